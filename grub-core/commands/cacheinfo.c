@@ -30,19 +30,22 @@ grub_rescue_cmd_info (struct grub_command *cmd __attribute__ ((unused)),
     int argc __attribute__ ((unused)),
     char *argv[] __attribute__ ((unused)))
 {
-  unsigned long hits, misses;
+  struct grub_disk_cache_stats stats;
 
-  grub_disk_cache_get_performance (&hits, &misses);
-  if (hits + misses)
+  grub_disk_cache_get_performance (&stats);
+  grub_printf_ (N_("Disk cache: %lu KiB, %u sets of %u blocks\n"),
+		(unsigned long) (stats.size >> 10), stats.sets, stats.ways);
+  if (stats.hits + stats.misses)
     {
-      unsigned long ratio = hits * 10000 / (hits + misses);
-      grub_printf ("(%lu.%lu%%)\n", ratio / 100, ratio % 100);
+      unsigned long ratio = stats.hits * 10000 / (stats.hits + stats.misses);
       grub_printf_ (N_("Disk cache statistics: hits = %lu (%lu.%02lu%%),"
-		     " misses = %lu\n"), ratio / 100, ratio % 100,
-		    hits, misses);
+		     " misses = %lu, evictions = %lu\n"),
+		    stats.hits, ratio / 100, ratio % 100,
+		    stats.misses, stats.evictions);
+      grub_printf_ (N_("Readahead: %lu blocks\n"), stats.readahead);
     }
   else
-    grub_printf ("%s\n", _("No disk cache statistics available\n"));    
+    grub_printf ("%s\n", _("No disk cache statistics available"));
 
  return 0;
 }
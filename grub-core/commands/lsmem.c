@@ -0,0 +1,75 @@
+/* lsmem.c - show heap usage.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2020  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/dl.h>
+#include <grub/misc.h>
+#include <grub/command.h>
+#include <grub/i18n.h>
+#include <grub/mm.h>
+#include <grub/mm_private.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+static grub_err_t
+grub_cmd_lsmem (grub_command_t cmd __attribute__ ((unused)),
+		int argc __attribute__ ((unused)),
+		char **args __attribute__ ((unused)))
+
+{
+#ifndef GRUB_MACHINE_EMU
+  struct grub_mm_stats stats;
+  grub_mm_region_t r;
+  unsigned i;
+
+  for (r = grub_mm_base; r; r = r->next)
+    grub_printf_ (N_("region %p, size 0x%llx\n"), r,
+		  (unsigned long long) r->size);
+
+  grub_mm_get_stats (&stats);
+
+  grub_printf_ (N_("total 0x%llx, free 0x%llx, binned 0x%llx\n"),
+		(unsigned long long) stats.total,
+		(unsigned long long) stats.free,
+		(unsigned long long) stats.binned);
+  grub_printf_ (N_("allocations %lu (%lu from bins, %lu large or aligned), frees %lu,"
+		   " failures %lu\n"),
+		stats.allocs, stats.bin_hits, stats.large_allocs,
+		stats.frees, stats.failures);
+
+  for (i = 0; i <= GRUB_MM_BINS; i++)
+    if (stats.bin_count[i])
+      grub_printf_ (N_("bin %u bytes: %u blocks\n"),
+		    i << GRUB_MM_ALIGN_LOG2, stats.bin_count[i]);
+#endif
+
+  return 0;
+}
+
+static grub_command_t cmd;
+
+GRUB_MOD_INIT(lsmem)
+{
+  cmd = grub_register_command ("lsmem", grub_cmd_lsmem,
+			       0, N_("Show heap usage."));
+}
+
+GRUB_MOD_FINI(lsmem)
+{
+  grub_unregister_command (cmd);
+}
@@ -55,6 +55,10 @@ loop_file_open (const char *name, int mem, int bl)
   grub_size_t size = 0;
   enum grub_file_type type = GRUB_FILE_TYPE_LOOPBACK;
 
+  /* Filesystems on the image read it randomly, unless it is copied to
+     memory in one go.  */
+  if (!mem)
+    type |= GRUB_FILE_TYPE_NO_READAHEAD;
   file = grub_file_open (name, type);
   if (!file)
     return NULL;
@@ -35,7 +35,7 @@
 #include <grub/lib/crc.h>
 #include <grub/deflate.h>
 #include <minilzo.h>
-#include <zstd.h>
+#include <grub/lib/zstd.h>
 #include <grub/i18n.h>
 #include <grub/btrfs.h>
 #include <grub/command.h>
@@ -110,6 +110,23 @@ struct grub_btrfs_device_desc
   grub_uint64_t id;
 };
 
+/* A chunk of the chunk tree with the devices of its stripes.  */
+struct grub_btrfs_chunk_desc
+{
+  grub_uint64_t laddr;
+  grub_uint64_t size;
+  struct grub_btrfs_chunk_item *chunk;
+  grub_device_t *devs;
+};
+
+enum
+  {
+    GRUB_BTRFS_CHUNK_MAP_NONE,
+    GRUB_BTRFS_CHUNK_MAP_LOADING,
+    GRUB_BTRFS_CHUNK_MAP_READY,
+    GRUB_BTRFS_CHUNK_MAP_FAILED
+  };
+
 struct grub_btrfs_data
 {
   struct grub_btrfs_superblock sblock;
@@ -120,6 +137,11 @@ struct grub_btrfs_data
   unsigned n_devices_attached;
   unsigned n_devices_allocated;
 
+  /* Chunk tree sorted by logical address, loaded on first use.  */
+  int chunk_map_state;
+  struct grub_btrfs_chunk_desc *chunk_map;
+  grub_size_t n_chunks;
+
   /* Cached extent data.  */
   grub_uint64_t extstart;
   grub_uint64_t extend;
@@ -684,19 +706,22 @@ find_device (struct grub_btrfs_data *data, grub_uint64_t id)
 static grub_err_t
 btrfs_read_from_chunk (struct grub_btrfs_data *data,
 		       struct grub_btrfs_chunk_item *chunk,
+		       grub_device_t *devs,
 		       grub_uint64_t stripen, grub_uint64_t stripe_offset,
 		       int redundancy, grub_uint64_t csize,
 		       void *buf)
 {
     struct grub_btrfs_chunk_stripe *stripe;
     grub_disk_addr_t paddr;
-    grub_device_t dev;
+    grub_device_t dev = NULL;
+    grub_uint64_t idx;
     grub_err_t err;
 
     stripe = (struct grub_btrfs_chunk_stripe *) (chunk + 1);
     /* Right now the redundancy handling is easy.
        With RAID5-like it will be more difficult.  */
-    stripe += stripen + redundancy;
+    idx = stripen + redundancy;
+    stripe += idx;
 
     paddr = grub_le_to_cpu64 (stripe->offset) + stripe_offset;
 
@@ -705,7 +730,15 @@ btrfs_read_from_chunk (struct grub_btrfs_data *data,
 		  "reading paddr 0x%" PRIxGRUB_UINT64_T "\n",
 		  stripen, stripe->offset, paddr);
 
-    dev = find_device (data, stripe->device_id);
+    /* Chunks from the chunk map remember the devices of their stripes.  */
+    if (devs && idx < grub_le_to_cpu16 (chunk->nstripes))
+      {
+	dev = devs[idx];
+	if (!dev)
+	  dev = devs[idx] = find_device (data, stripe->device_id);
+      }
+    else
+      dev = find_device (data, stripe->device_id);
     if (!dev)
       {
 	grub_dprintf ("btrfs",
@@ -886,6 +919,149 @@ raid56_read_retry (struct grub_btrfs_data *data,
   return ret;
 }
 
+static void
+free_chunk_map (struct grub_btrfs_data *data)
+{
+  grub_size_t i;
+
+  for (i = 0; i < data->n_chunks; i++)
+    {
+      grub_free (data->chunk_map[i].chunk);
+      grub_free (data->chunk_map[i].devs);
+    }
+  grub_free (data->chunk_map);
+  data->chunk_map = NULL;
+  data->n_chunks = 0;
+}
+
+/* Read the whole chunk tree into DATA->chunk_map.  On failure the map is
+   left unused and lookups go through the chunk tree as before.  */
+static void
+load_chunk_map (struct grub_btrfs_data *data)
+{
+  struct grub_btrfs_leaf_descriptor desc;
+  struct grub_btrfs_key key_in, key_out;
+  grub_disk_addr_t elemaddr;
+  grub_size_t elemsize, allocated = 0;
+  grub_err_t err;
+  int r = 1;
+
+  data->chunk_map_state = GRUB_BTRFS_CHUNK_MAP_LOADING;
+
+  key_in.object_id = grub_cpu_to_le64_compile_time (GRUB_BTRFS_OBJECT_ID_CHUNK);
+  key_in.type = GRUB_BTRFS_ITEM_TYPE_CHUNK;
+  key_in.offset = 0;
+  err = lower_bound (data, &key_in, &key_out, data->sblock.chunk_tree,
+		     &elemaddr, &elemsize, &desc, 0);
+  if (err)
+    goto fail_iter;
+
+  for (; r > 0; r = next (data, &desc, &elemaddr, &elemsize, &key_out))
+    {
+      struct grub_btrfs_chunk_desc *cd;
+      struct grub_btrfs_chunk_item *chunk;
+      grub_uint16_t nstripes;
+
+      if (key_out.object_id != key_in.object_id
+	  || key_out.type != GRUB_BTRFS_ITEM_TYPE_CHUNK)
+	{
+	  if (data->n_chunks)
+	    break;
+	  continue;
+	}
+
+      if (elemsize < sizeof (*chunk))
+	goto fail_iter;
+      chunk = grub_malloc (elemsize);
+      if (!chunk)
+	goto fail_iter;
+      if (grub_btrfs_read_logical (data, elemaddr, chunk, elemsize, 0))
+	{
+	  grub_free (chunk);
+	  goto fail_iter;
+	}
+      nstripes = grub_le_to_cpu16 (chunk->nstripes);
+      if (elemsize < sizeof (*chunk) + nstripes * sizeof (struct grub_btrfs_chunk_stripe)
+	  || (data->n_chunks
+	      && (data->chunk_map[data->n_chunks - 1].laddr
+		  + data->chunk_map[data->n_chunks - 1].size
+		  > grub_le_to_cpu64 (key_out.offset))))
+	{
+	  grub_free (chunk);
+	  goto fail_iter;
+	}
+
+      if (data->n_chunks == allocated)
+	{
+	  struct grub_btrfs_chunk_desc *tmp;
+	  grub_size_t sz;
+
+	  if (grub_mul (allocated ? : 8, 2, &allocated)
+	      || grub_mul (allocated, sizeof (data->chunk_map[0]), &sz))
+	    {
+	      grub_free (chunk);
+	      goto fail_iter;
+	    }
+	  tmp = grub_realloc (data->chunk_map, sz);
+	  if (!tmp)
+	    {
+	      grub_free (chunk);
+	      goto fail_iter;
+	    }
+	  data->chunk_map = tmp;
+	}
+
+      cd = &data->chunk_map[data->n_chunks];
+      cd->laddr = grub_le_to_cpu64 (key_out.offset);
+      cd->size = grub_le_to_cpu64 (chunk->size);
+      cd->chunk = chunk;
+      cd->devs = grub_calloc (nstripes ? : 1, sizeof (cd->devs[0]));
+      if (!cd->devs)
+	{
+	  grub_free (chunk);
+	  goto fail_iter;
+	}
+      data->n_chunks++;
+    }
+  free_iterator (&desc);
+
+  if (r < 0 || data->n_chunks == 0)
+    goto fail;
+
+  grub_dprintf ("btrfs", "loaded %" PRIuGRUB_SIZE " chunks\n", data->n_chunks);
+  data->chunk_map_state = GRUB_BTRFS_CHUNK_MAP_READY;
+  return;
+
+ fail_iter:
+  free_iterator (&desc);
+ fail:
+  free_chunk_map (data);
+  data->chunk_map_state = GRUB_BTRFS_CHUNK_MAP_FAILED;
+  grub_errno = GRUB_ERR_NONE;
+}
+
+/* Find the chunk of the chunk map holding ADDR.  */
+static struct grub_btrfs_chunk_desc *
+find_chunk_desc (struct grub_btrfs_data *data, grub_uint64_t addr)
+{
+  grub_size_t lo = 0, hi = data->n_chunks;
+
+  while (lo < hi)
+    {
+      grub_size_t mid = lo + (hi - lo) / 2;
+
+      if (data->chunk_map[mid].laddr > addr)
+	hi = mid;
+      else
+	lo = mid + 1;
+    }
+
+  if (lo == 0 || addr - data->chunk_map[lo - 1].laddr
+      >= data->chunk_map[lo - 1].size)
+    return NULL;
+  return &data->chunk_map[lo - 1];
+}
+
 static grub_err_t
 grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 			 void *buf, grub_size_t size, int recursion_depth)
@@ -902,9 +1078,27 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
       struct grub_btrfs_key key_in;
       grub_size_t chsize;
       grub_disk_addr_t chaddr;
+      grub_device_t *devs = NULL;
 
       grub_dprintf ("btrfs", "searching for laddr %" PRIxGRUB_UINT64_T "\n",
 		    addr);
+
+      if (data->chunk_map_state == GRUB_BTRFS_CHUNK_MAP_NONE)
+	load_chunk_map (data);
+      if (data->chunk_map_state == GRUB_BTRFS_CHUNK_MAP_READY)
+	{
+	  struct grub_btrfs_chunk_desc *cd = find_chunk_desc (data, addr);
+
+	  if (cd)
+	    {
+	      key_in.offset = grub_cpu_to_le64 (cd->laddr);
+	      key = &key_in;
+	      chunk = cd->chunk;
+	      devs = cd->devs;
+	      goto chunk_found;
+	    }
+	}
+
       for (ptr = data->sblock.bootstrap_mapping;
 	   ptr < data->sblock.bootstrap_mapping
 	   + sizeof (data->sblock.bootstrap_mapping)
@@ -1164,7 +1358,7 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 
 	    if (is_raid56)
 	      {
-		err = btrfs_read_from_chunk (data, chunk, stripen,
+		err = btrfs_read_from_chunk (data, chunk, devs, stripen,
 					     stripe_offset,
 					     0,     /* no mirror */
 					     csize, buf);
@@ -1176,7 +1370,7 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 	    else
 	      for (i = 0; i < redundancy; i++)
 		{
-		  err = btrfs_read_from_chunk (data, chunk, stripen,
+		  err = btrfs_read_from_chunk (data, chunk, devs, stripen,
 					       stripe_offset,
 					       i,     /* redundancy */
 					       csize, buf);
@@ -1360,6 +1554,7 @@ grub_btrfs_unmount (struct grub_btrfs_data *data)
     if (data->devices_attached[i].dev)
         grub_device_close (data->devices_attached[i].dev);
   grub_free (data->devices_attached);
+  free_chunk_map (data);
   grub_free (data->extent);
   grub_free (data);
 }
@@ -1389,27 +1584,6 @@ grub_btrfs_read_inode (struct grub_btrfs_data *data,
   return grub_btrfs_read_logical (data, elemaddr, inode, sizeof (*inode), 0);
 }
 
-static void *grub_zstd_malloc (void *state __attribute__((unused)), size_t size)
-{
-  return grub_malloc (size);
-}
-
-static void grub_zstd_free (void *state __attribute__((unused)), void *address)
-{
-  return grub_free (address);
-}
-
-static ZSTD_customMem grub_zstd_allocator (void)
-{
-  ZSTD_customMem allocator;
-
-  allocator.customAlloc = &grub_zstd_malloc;
-  allocator.customFree = &grub_zstd_free;
-  allocator.opaque = NULL;
-
-  return allocator;
-}
-
 static grub_ssize_t
 grub_btrfs_zstd_decompress (char *ibuf, grub_size_t isize, grub_off_t off,
 			    char *obuf, grub_size_t osize)
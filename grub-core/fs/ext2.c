@@ -26,6 +26,7 @@
 #include <grub/types.h>
 #include <grub/fshelp.h>
 #include <grub/ext2.h>
+#include <grub/env.h>
 #include <grub/safemath.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
@@ -482,6 +483,64 @@ grub_ext2_read_symlink (grub_fshelp_node_t node)
   return symlink;
 }
 
+/* Create the node for the directory entry DIRENT of DIRO and determine
+   its type.  Return NULL on error.  */
+static struct grub_fshelp_node *
+grub_ext2_dirent_node (struct grub_fshelp_node *diro,
+		       const struct ext2_dirent *dirent,
+		       enum grub_fshelp_filetype *type)
+{
+  struct grub_fshelp_node *fdiro;
+
+  *type = GRUB_FSHELP_UNKNOWN;
+
+  fdiro = grub_malloc (sizeof (struct grub_fshelp_node));
+  if (! fdiro)
+    return 0;
+
+  fdiro->data = diro->data;
+  fdiro->ino = grub_le_to_cpu32 (dirent->inode);
+
+  if (dirent->filetype != FILETYPE_UNKNOWN)
+    {
+      fdiro->inode_read = 0;
+
+      if (dirent->filetype == FILETYPE_DIRECTORY)
+	*type = GRUB_FSHELP_DIR;
+      else if (dirent->filetype == FILETYPE_SYMLINK)
+	*type = GRUB_FSHELP_SYMLINK;
+      else if (dirent->filetype == FILETYPE_REG)
+	*type = GRUB_FSHELP_REG;
+    }
+  else
+    {
+      /* The filetype can not be read from the dirent, read
+	 the inode to get more information.  */
+      grub_ext2_read_inode (diro->data,
+			    grub_le_to_cpu32 (dirent->inode),
+			    &fdiro->inode);
+      if (grub_errno)
+	{
+	  grub_free (fdiro);
+	  return 0;
+	}
+
+      fdiro->inode_read = 1;
+
+      if ((grub_le_to_cpu16 (fdiro->inode.mode)
+	   & FILETYPE_INO_MASK) == FILETYPE_INO_DIRECTORY)
+	*type = GRUB_FSHELP_DIR;
+      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
+		& FILETYPE_INO_MASK) == FILETYPE_INO_SYMLINK)
+	*type = GRUB_FSHELP_SYMLINK;
+      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
+		& FILETYPE_INO_MASK) == FILETYPE_INO_REG)
+	*type = GRUB_FSHELP_REG;
+    }
+
+  return fdiro;
+}
+
 static int
 grub_ext2_iterate_dir (grub_fshelp_node_t dir,
 		       grub_fshelp_iterate_dir_hook_t hook, void *hook_data)
@@ -519,58 +578,18 @@ grub_ext2_iterate_dir (grub_fshelp_node_t dir,
 	{
 	  char filename[MAX_NAMELEN + 1];
 	  struct grub_fshelp_node *fdiro;
-	  enum grub_fshelp_filetype type = GRUB_FSHELP_UNKNOWN;
+	  enum grub_fshelp_filetype type;
 
 	  grub_ext2_read_file (diro, 0, 0, 0, fpos + sizeof (struct ext2_dirent),
 			       dirent.namelen, filename);
 	  if (grub_errno)
 	    return 0;
 
-	  fdiro = grub_malloc (sizeof (struct grub_fshelp_node));
-	  if (! fdiro)
-	    return 0;
-
-	  fdiro->data = diro->data;
-	  fdiro->ino = grub_le_to_cpu32 (dirent.inode);
-
 	  filename[dirent.namelen] = '\0';
 
-	  if (dirent.filetype != FILETYPE_UNKNOWN)
-	    {
-	      fdiro->inode_read = 0;
-
-	      if (dirent.filetype == FILETYPE_DIRECTORY)
-		type = GRUB_FSHELP_DIR;
-	      else if (dirent.filetype == FILETYPE_SYMLINK)
-		type = GRUB_FSHELP_SYMLINK;
-	      else if (dirent.filetype == FILETYPE_REG)
-		type = GRUB_FSHELP_REG;
-	    }
-	  else
-	    {
-	      /* The filetype can not be read from the dirent, read
-		 the inode to get more information.  */
-	      grub_ext2_read_inode (diro->data,
-                                    grub_le_to_cpu32 (dirent.inode),
-				    &fdiro->inode);
-	      if (grub_errno)
-		{
-		  grub_free (fdiro);
-		  return 0;
-		}
-
-	      fdiro->inode_read = 1;
-
-	      if ((grub_le_to_cpu16 (fdiro->inode.mode)
-		   & FILETYPE_INO_MASK) == FILETYPE_INO_DIRECTORY)
-		type = GRUB_FSHELP_DIR;
-	      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
-			& FILETYPE_INO_MASK) == FILETYPE_INO_SYMLINK)
-		type = GRUB_FSHELP_SYMLINK;
-	      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
-			& FILETYPE_INO_MASK) == FILETYPE_INO_REG)
-		type = GRUB_FSHELP_REG;
-	    }
+	  fdiro = grub_ext2_dirent_node (diro, &dirent, &type);
+	  if (! fdiro)
+	    return 0;
 
 	  if (hook (filename, type, fdiro, hook_data))
 	    return 1;
@@ -582,6 +601,529 @@ grub_ext2_iterate_dir (grub_fshelp_node_t dir,
   return 0;
 }
 
+/* Directory index (htree) support.  The hash functions follow the
+   definitions used by the Linux ext4 driver.  */
+
+#define EXT2_DX_ROL(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+#define EXT2_DX_TEA_DELTA	0x9E3779B9
+#define EXT2_DX_MD4_F(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+#define EXT2_DX_MD4_G(x, y, z)	(((x) & (y)) + (((x) ^ (y)) & (z)))
+#define EXT2_DX_MD4_H(x, y, z)	((x) ^ (y) ^ (z))
+#define EXT2_DX_MD4_ROUND(f, a, b, c, d, x, s)	\
+  (a += f (b, c, d) + (x), a = EXT2_DX_ROL (a, s))
+#define EXT2_DX_MD4_K2		013240474631U
+#define EXT2_DX_MD4_K3		015666365641U
+/* The hash reserved for the end of the directory.  */
+#define EXT2_DX_HASH_EOF	0x7fffffff
+
+enum
+  {
+    GRUB_EXT2_LOOKUP_FOUND,
+    GRUB_EXT2_LOOKUP_MISSING,
+    GRUB_EXT2_LOOKUP_SCAN
+  };
+
+struct grub_ext2_dx_frame
+{
+  grub_uint8_t *buf;
+  struct grub_ext2_dx_entry *entries;
+  unsigned int count;
+  unsigned int at;
+};
+
+static void
+grub_ext2_dx_tea (grub_uint32_t buf[4], const grub_uint32_t in[4])
+{
+  grub_uint32_t sum = 0;
+  grub_uint32_t b0 = buf[0], b1 = buf[1];
+  int n;
+
+  for (n = 0; n < 16; n++)
+    {
+      sum += EXT2_DX_TEA_DELTA;
+      b0 += ((b1 << 4) + in[0]) ^ (b1 + sum) ^ ((b1 >> 5) + in[1]);
+      b1 += ((b0 << 4) + in[2]) ^ (b0 + sum) ^ ((b0 >> 5) + in[3]);
+    }
+
+  buf[0] += b0;
+  buf[1] += b1;
+}
+
+static void
+grub_ext2_dx_half_md4 (grub_uint32_t buf[4], const grub_uint32_t in[8])
+{
+  grub_uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+  EXT2_DX_MD4_ROUND (EXT2_DX_MD4_F, a, b, c, d, in[0], 3);
+  EXT2_DX_MD4_ROUND (EXT2_DX_MD4_F, d, a, b, c, in[1], 7);
+  EXT2_DX_MD4_ROUND (EXT2_DX_MD4_F, c, d, a, b, in[2], 11);
+  EXT2_DX_MD4_ROUND (EXT2_DX_MD4_F, b, c, d, a, in[3], 19);
+  EXT2_DX_MD4_ROUND (EXT2_DX_MD4_F, a, b, c, d, in[4], 3);
+  EXT2_DX_MD4_ROUND (EXT2_DX_MD4_F, d, a, b, c, in[5], 7);
+  EXT2_DX_MD4_ROUND (EXT2_DX_MD4_F, c, d, a, b, in[6], 11);
+  EXT2_DX_MD4_ROUND (EXT2_DX_MD4_F, b, c, d, a, in[7], 19);
+
+  EXT2_DX_MD4_ROUND (EXT2_DX_MD4_G, a, b, c, d, in[1] + EXT2_DX_MD4_K2, 3);
+  EXT2_DX_MD4_ROUND (EXT2_DX_MD4_G, d, a, b, c, in[3] + EXT2_DX_MD4_K2, 5);
+  EXT2_DX_MD4_ROUND (EXT2_DX_MD4_G, c, d, a, b, in[5] + EXT2_DX_MD4_K2, 9);
+  EXT2_DX_MD4_ROUND (EXT2_DX_MD4_G, b, c, d, a, in[7] + EXT2_DX_MD4_K2, 13);
+  EXT2_DX_MD4_ROUND (EXT2_DX_MD4_G, a, b, c, d, in[0] + EXT2_DX_MD4_K2, 3);
+  EXT2_DX_MD4_ROUND (EXT2_DX_MD4_G, d, a, b, c, in[2] + EXT2_DX_MD4_K2, 5);
+  EXT2_DX_MD4_ROUND (EXT2_DX_MD4_G, c, d, a, b, in[4] + EXT2_DX_MD4_K2, 9);
+  EXT2_DX_MD4_ROUND (EXT2_DX_MD4_G, b, c, d, a, in[6] + EXT2_DX_MD4_K2, 13);
+
+  EXT2_DX_MD4_ROUND (EXT2_DX_MD4_H, a, b, c, d, in[3] + EXT2_DX_MD4_K3, 3);
+  EXT2_DX_MD4_ROUND (EXT2_DX_MD4_H, d, a, b, c, in[7] + EXT2_DX_MD4_K3, 9);
+  EXT2_DX_MD4_ROUND (EXT2_DX_MD4_H, c, d, a, b, in[2] + EXT2_DX_MD4_K3, 11);
+  EXT2_DX_MD4_ROUND (EXT2_DX_MD4_H, b, c, d, a, in[6] + EXT2_DX_MD4_K3, 15);
+  EXT2_DX_MD4_ROUND (EXT2_DX_MD4_H, a, b, c, d, in[1] + EXT2_DX_MD4_K3, 3);
+  EXT2_DX_MD4_ROUND (EXT2_DX_MD4_H, d, a, b, c, in[5] + EXT2_DX_MD4_K3, 9);
+  EXT2_DX_MD4_ROUND (EXT2_DX_MD4_H, c, d, a, b, in[0] + EXT2_DX_MD4_K3, 11);
+  EXT2_DX_MD4_ROUND (EXT2_DX_MD4_H, b, c, d, a, in[4] + EXT2_DX_MD4_K3, 15);
+
+  buf[0] += a;
+  buf[1] += b;
+  buf[2] += c;
+  buf[3] += d;
+}
+
+/* Character value as seen by the signed or unsigned hash variants.  */
+static inline int
+grub_ext2_dx_char (const char *name, int i, int is_unsigned)
+{
+  if (is_unsigned)
+    return ((const grub_uint8_t *) name)[i];
+  return ((const grub_int8_t *) name)[i];
+}
+
+static grub_uint32_t
+grub_ext2_dx_legacy (const char *name, int len, int is_unsigned)
+{
+  grub_uint32_t hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+  int i;
+
+  for (i = 0; i < len; i++)
+    {
+      hash = hash1 + (hash0 ^ (grub_ext2_dx_char (name, i, is_unsigned)
+			       * 7152373));
+      if (hash & 0x80000000)
+	hash -= 0x7fffffff;
+      hash1 = hash0;
+      hash0 = hash;
+    }
+
+  return hash0 << 1;
+}
+
+/* Pack up to NUM words of NAME into BUF, padding with the length.  */
+static void
+grub_ext2_dx_str2hashbuf (const char *name, int len, grub_uint32_t *buf,
+			  int num, int is_unsigned)
+{
+  grub_uint32_t pad, val;
+  int i;
+
+  pad = (grub_uint32_t) len | ((grub_uint32_t) len << 8);
+  pad |= pad << 16;
+
+  val = pad;
+  if (len > num * 4)
+    len = num * 4;
+  for (i = 0; i < len; i++)
+    {
+      val = grub_ext2_dx_char (name, i, is_unsigned) + (val << 8);
+      if ((i % 4) == 3)
+	{
+	  *buf++ = val;
+	  val = pad;
+	  num--;
+	}
+    }
+  if (--num >= 0)
+    *buf++ = val;
+  while (--num >= 0)
+    *buf++ = pad;
+}
+
+/* Compute the major hash of NAME, or return 0 if VERSION is unknown.  */
+static int
+grub_ext2_dx_hash (struct grub_ext2_data *data, int version,
+		   const char *name, int len, grub_uint32_t *hash)
+{
+  grub_uint32_t buf[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+  grub_uint32_t in[8];
+  int i, is_unsigned = 0;
+
+  for (i = 0; i < 4; i++)
+    if (data->sblock.hash_seed[i])
+      break;
+  if (i < 4)
+    for (i = 0; i < 4; i++)
+      buf[i] = grub_le_to_cpu32 (data->sblock.hash_seed[i]);
+
+  switch (version)
+    {
+    case EXT2_DX_HASH_LEGACY_UNSIGNED:
+      is_unsigned = 1;
+      /* Fallthrough.  */
+    case EXT2_DX_HASH_LEGACY:
+      *hash = grub_ext2_dx_legacy (name, len, is_unsigned);
+      break;
+
+    case EXT2_DX_HASH_HALF_MD4_UNSIGNED:
+      is_unsigned = 1;
+      /* Fallthrough.  */
+    case EXT2_DX_HASH_HALF_MD4:
+      for (; len > 0; len -= 32, name += 32)
+	{
+	  grub_ext2_dx_str2hashbuf (name, len, in, 8, is_unsigned);
+	  grub_ext2_dx_half_md4 (buf, in);
+	}
+      *hash = buf[1];
+      break;
+
+    case EXT2_DX_HASH_TEA_UNSIGNED:
+      is_unsigned = 1;
+      /* Fallthrough.  */
+    case EXT2_DX_HASH_TEA:
+      for (; len > 0; len -= 16, name += 16)
+	{
+	  grub_ext2_dx_str2hashbuf (name, len, in, 4, is_unsigned);
+	  grub_ext2_dx_tea (buf, in);
+	}
+      *hash = buf[0];
+      break;
+
+    default:
+      return 0;
+    }
+
+  *hash &= ~1;
+  if (*hash == (EXT2_DX_HASH_EOF << 1))
+    *hash = (EXT2_DX_HASH_EOF - 1) << 1;
+  return 1;
+}
+
+/* Read directory block BLOCK of DIRO into BUF.  */
+static grub_err_t
+grub_ext2_dx_read_block (struct grub_fshelp_node *diro, grub_uint32_t block,
+			 grub_uint8_t *buf)
+{
+  struct grub_ext2_data *data = diro->data;
+
+  grub_ext2_read_file (diro, 0, 0, 0,
+		       (grub_off_t) block << LOG2_BLOCK_SIZE (data),
+		       EXT2_BLOCK_SIZE (data), (char *) buf);
+  return grub_errno;
+}
+
+/* Point FRAME at the index entries stored at OFFSET of its block and check
+   that their count and limit fit in the block.  */
+static int
+grub_ext2_dx_frame_init (struct grub_ext2_dx_frame *frame,
+			 grub_uint32_t offset, grub_uint32_t blocksize)
+{
+  struct grub_ext2_dx_countlimit *cl;
+  unsigned int limit;
+
+  cl = (struct grub_ext2_dx_countlimit *) (frame->buf + offset);
+  limit = grub_le_to_cpu16 (cl->limit);
+  frame->count = grub_le_to_cpu16 (cl->count);
+  if (frame->count == 0 || frame->count > limit
+      || limit > (blocksize - offset) / sizeof (struct grub_ext2_dx_entry))
+    return 0;
+
+  frame->entries = (struct grub_ext2_dx_entry *) (frame->buf + offset);
+  frame->at = 0;
+  return 1;
+}
+
+/* Select the last entry of FRAME whose hash is not above HASH.  The first
+   entry covers everything below the second one.  */
+static void
+grub_ext2_dx_search (struct grub_ext2_dx_frame *frame, grub_uint32_t hash)
+{
+  unsigned int lo = 1, hi = frame->count;
+
+  while (lo < hi)
+    {
+      unsigned int mid = lo + (hi - lo) / 2;
+
+      if (grub_le_to_cpu32 (frame->entries[mid].hash) > hash)
+	hi = mid;
+      else
+	lo = mid + 1;
+    }
+
+  frame->at = lo - 1;
+}
+
+/* Load into FRAME the index node referenced by the current entry of
+   PARENT.  */
+static int
+grub_ext2_dx_load_node (struct grub_fshelp_node *diro,
+			struct grub_ext2_dx_frame *parent,
+			struct grub_ext2_dx_frame *frame,
+			grub_uint32_t nblocks)
+{
+  grub_uint32_t blocksize = EXT2_BLOCK_SIZE (diro->data);
+  grub_uint32_t block;
+  struct ext2_dirent fake;
+
+  block = grub_le_to_cpu32 (parent->entries[parent->at].block) & 0x0fffffff;
+  if (block == 0 || block >= nblocks)
+    return 0;
+
+  if (! frame->buf)
+    {
+      frame->buf = grub_malloc (blocksize);
+      if (! frame->buf)
+	return 0;
+    }
+  if (grub_ext2_dx_read_block (diro, block, frame->buf))
+    return 0;
+
+  /* An index node is hidden behind an empty entry spanning the block.  */
+  grub_memcpy (&fake, frame->buf, sizeof (fake));
+  if (fake.inode != 0 || fake.namelen != 0)
+    return 0;
+
+  return grub_ext2_dx_frame_init (frame, sizeof (fake), blocksize);
+}
+
+/* Look for an entry called exactly NAME in the leaf block LEAF.  */
+static int
+grub_ext2_dx_scan_leaf (struct grub_fshelp_node *diro, const grub_uint8_t *leaf,
+			const char *name, grub_size_t len,
+			grub_fshelp_node_t *foundnode,
+			enum grub_fshelp_filetype *foundtype)
+{
+  grub_uint32_t blocksize = EXT2_BLOCK_SIZE (diro->data);
+  grub_uint32_t off = 0, reclen;
+  struct ext2_dirent dirent;
+
+  while (off + sizeof (dirent) <= blocksize)
+    {
+      grub_memcpy (&dirent, leaf + off, sizeof (dirent));
+      reclen = grub_le_to_cpu16 (dirent.direntlen);
+      if (reclen < sizeof (dirent) || reclen > blocksize - off
+	  || dirent.namelen > reclen - sizeof (dirent))
+	return GRUB_EXT2_LOOKUP_SCAN;
+
+      if (dirent.inode != 0 && dirent.namelen == len
+	  && grub_memcmp (leaf + off + sizeof (dirent), name, len) == 0)
+	{
+	  *foundnode = grub_ext2_dirent_node (diro, &dirent, foundtype);
+	  if (! *foundnode)
+	    return GRUB_EXT2_LOOKUP_SCAN;
+	  return GRUB_EXT2_LOOKUP_FOUND;
+	}
+
+      off += reclen;
+    }
+
+  return GRUB_EXT2_LOOKUP_MISSING;
+}
+
+/* Find NAME through the hash tree of the indexed directory DIRO.  */
+static int
+grub_ext2_dx_lookup (struct grub_fshelp_node *diro, const char *name,
+		     grub_fshelp_node_t *foundnode,
+		     enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_ext2_data *data = diro->data;
+  struct grub_ext2_dx_frame frames[EXT2_DX_MAX_LEVELS + 1];
+  struct grub_ext2_dx_root_info info;
+  struct ext2_dirent dot, dotdot;
+  grub_uint32_t blocksize = EXT2_BLOCK_SIZE (data);
+  grub_uint32_t nblocks, hash;
+  grub_uint8_t *leaf = NULL;
+  grub_size_t len = grub_strlen (name);
+  int version, levels, level, ret = GRUB_EXT2_LOOKUP_SCAN;
+
+  if (len == 0 || len > MAX_NAMELEN)
+    return GRUB_EXT2_LOOKUP_SCAN;
+
+  nblocks = grub_le_to_cpu32 (diro->inode.size) >> LOG2_BLOCK_SIZE (data);
+  if (nblocks == 0)
+    return GRUB_EXT2_LOOKUP_SCAN;
+
+  grub_memset (frames, 0, sizeof (frames));
+  frames[0].buf = grub_malloc (blocksize);
+  if (! frames[0].buf || grub_ext2_dx_read_block (diro, 0, frames[0].buf))
+    goto done;
+
+  /* The root block starts with "." and "..", the latter spanning the
+     rest of the block, followed by the index information.  */
+  grub_memcpy (&dot, frames[0].buf, sizeof (dot));
+  grub_memcpy (&dotdot, frames[0].buf + 12, sizeof (dotdot));
+  grub_memcpy (&info, frames[0].buf + 24, sizeof (info));
+  if (dot.namelen != 1 || frames[0].buf[sizeof (dot)] != '.'
+      || grub_le_to_cpu16 (dot.direntlen) != 12
+      || dotdot.namelen != 2
+      || grub_le_to_cpu16 (dotdot.direntlen) != blocksize - 12
+      || info.reserved_zero != 0
+      || info.info_length != sizeof (info)
+      || info.indirect_levels >= EXT2_DX_MAX_LEVELS)
+    goto done;
+
+  version = info.hash_version;
+  if (version <= EXT2_DX_HASH_TEA
+      && (data->sblock.flags
+	  & grub_cpu_to_le32_compile_time (EXT2_FLAGS_UNSIGNED_HASH)))
+    version += EXT2_DX_HASH_LEGACY_UNSIGNED;
+  if (! grub_ext2_dx_hash (data, version, name, len, &hash))
+    goto done;
+
+  if (! grub_ext2_dx_frame_init (&frames[0], 24 + sizeof (info), blocksize))
+    goto done;
+
+  levels = info.indirect_levels;
+  for (level = 0; ; level++)
+    {
+      grub_ext2_dx_search (&frames[level], hash);
+      if (level == levels)
+	break;
+      if (! grub_ext2_dx_load_node (diro, &frames[level], &frames[level + 1],
+				    nblocks))
+	goto done;
+    }
+
+  leaf = grub_malloc (blocksize);
+  if (! leaf)
+    goto done;
+
+  while (1)
+    {
+      struct grub_ext2_dx_frame *frame = &frames[levels];
+      grub_uint32_t block;
+
+      block = grub_le_to_cpu32 (frame->entries[frame->at].block) & 0x0fffffff;
+      if (block >= nblocks || grub_ext2_dx_read_block (diro, block, leaf))
+	goto done;
+
+      ret = grub_ext2_dx_scan_leaf (diro, leaf, name, len,
+				    foundnode, foundtype);
+      if (ret != GRUB_EXT2_LOOKUP_MISSING)
+	goto done;
+
+      /* Names with the same hash may continue in the next leaf, which is
+	 then flagged by the low bit of its starting hash.  */
+      for (level = levels; level >= 0; level--)
+	if (++frames[level].at < frames[level].count)
+	  break;
+      if (level < 0
+	  || ((grub_le_to_cpu32 (frames[level].entries[frames[level].at].hash)
+	       & ~1) != hash))
+	goto done;
+
+      for (; level < levels; level++)
+	if (! grub_ext2_dx_load_node (diro, &frames[level],
+				      &frames[level + 1], nblocks))
+	  {
+	    ret = GRUB_EXT2_LOOKUP_SCAN;
+	    goto done;
+	  }
+    }
+
+ done:
+  grub_free (leaf);
+  for (level = 0; level <= EXT2_DX_MAX_LEVELS; level++)
+    grub_free (frames[level].buf);
+  if (ret == GRUB_EXT2_LOOKUP_SCAN)
+    grub_errno = GRUB_ERR_NONE;
+  return ret;
+}
+
+/* Context for grub_ext2_lookup_file.  */
+struct grub_ext2_lookup_ctx
+{
+  const char *name;
+  int case_sensitive;
+  grub_fshelp_node_t *foundnode;
+  enum grub_fshelp_filetype *foundtype;
+};
+
+/* Helper for grub_ext2_lookup_file, matching like grub_fshelp_find_file.  */
+static int
+grub_ext2_scan_iter (const char *filename, enum grub_fshelp_filetype filetype,
+		     grub_fshelp_node_t node, void *data)
+{
+  struct grub_ext2_lookup_ctx *ctx = data;
+
+  if (filetype == GRUB_FSHELP_UNKNOWN
+      || (ctx->case_sensitive
+	  ? grub_strcmp (ctx->name, filename)
+	  : grub_strcasecmp (ctx->name, filename)))
+    {
+      grub_free (node);
+      return 0;
+    }
+
+  *ctx->foundnode = node;
+  *ctx->foundtype = filetype;
+  return 1;
+}
+
+static grub_err_t
+grub_ext2_lookup_file (grub_fshelp_node_t dir, const char *name,
+		       grub_fshelp_node_t *foundnode,
+		       enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_ext2_lookup_ctx ctx = {
+    .name = name,
+    .foundnode = foundnode,
+    .foundtype = foundtype
+  };
+  const char *case_sensitive;
+  int ret = GRUB_EXT2_LOOKUP_SCAN;
+
+  if (! dir->inode_read)
+    {
+      if (grub_ext2_read_inode (dir->data, dir->ino, &dir->inode))
+	return grub_errno;
+      dir->inode_read = 1;
+    }
+
+  if ((dir->inode.flags & grub_cpu_to_le32_compile_time (EXT2_INDEX_FLAG))
+      && ! (dir->inode.flags & grub_cpu_to_le32_compile_time (EXT4_ENCRYPT_FLAG))
+      && (dir->data->sblock.feature_compatibility
+	  & grub_cpu_to_le32_compile_time (EXT2_FEATURE_COMPAT_DIR_INDEX)))
+    ret = grub_ext2_dx_lookup (dir, name, foundnode, foundtype);
+  if (ret == GRUB_EXT2_LOOKUP_FOUND)
+    return GRUB_ERR_NONE;
+
+  /* The index only answers exact matches, so a miss is final only when
+     names are compared case-sensitively.  */
+  case_sensitive = grub_env_get ("grub_fs_case_sensitive");
+  ctx.case_sensitive = (case_sensitive && case_sensitive[0] == '1');
+  if (ret == GRUB_EXT2_LOOKUP_MISSING && ctx.case_sensitive)
+    return GRUB_ERR_NONE;
+
+  if (! grub_ext2_iterate_dir (dir, grub_ext2_scan_iter, &ctx) && grub_errno)
+    return grub_errno;
+  return GRUB_ERR_NONE;
+}
+
+static grub_uint64_t
+grub_ext2_node_key (grub_fshelp_node_t node)
+{
+  return node->ino;
+}
+
+static void
+grub_ext2_bind_node (grub_fshelp_node_t node, grub_fshelp_node_t dir)
+{
+  node->data = dir->data;
+}
+
+static const struct grub_fshelp_cache_desc grub_ext2_cache_desc =
+  {
+    .node_size = sizeof (struct grub_fshelp_node),
+    .node_key = grub_ext2_node_key,
+    .bind_node = grub_ext2_bind_node
+  };
+
 /* Open a file named NAME and initialize FILE.  */
 static grub_err_t
 grub_ext2_open (struct grub_file *file, const char *name)
@@ -599,9 +1141,10 @@ grub_ext2_open (struct grub_file *file, const char *name)
       goto fail;
     }
 
-  err = grub_fshelp_find_file (name, &data->diropen, &fdiro,
-			       grub_ext2_iterate_dir,
-			       grub_ext2_read_symlink, GRUB_FSHELP_REG);
+  err = grub_fshelp_find_file_cached (name, &data->diropen, &fdiro, NULL,
+				      grub_ext2_lookup_file,
+				      grub_ext2_read_symlink, GRUB_FSHELP_REG,
+				      file->device->disk, &grub_ext2_cache_desc);
   if (err)
     goto fail;
 
@@ -711,9 +1254,10 @@ grub_ext2_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
   if (! ctx.data)
     goto fail;
 
-  grub_fshelp_find_file (path, &ctx.data->diropen, &fdiro,
-			 grub_ext2_iterate_dir, grub_ext2_read_symlink,
-			 GRUB_FSHELP_DIR);
+  grub_fshelp_find_file_cached (path, &ctx.data->diropen, &fdiro, NULL,
+				grub_ext2_lookup_file, grub_ext2_read_symlink,
+				GRUB_FSHELP_DIR, device->disk,
+				&grub_ext2_cache_desc);
   if (grub_errno)
     goto fail;
 
@@ -834,4 +1378,5 @@ GRUB_MOD_INIT(ext2)
 GRUB_MOD_FINI(ext2)
 {
   grub_fs_unregister (&grub_ext2_fs);
+  grub_fshelp_cache_forget (&grub_ext2_cache_desc);
 }
@@ -185,6 +185,26 @@ struct grub_fat_data
   grub_uint32_t uuid;
 };
 
+/* A run of consecutive clusters of a file.  */
+struct grub_fat_extent
+{
+  grub_uint32_t logical;
+  grub_uint32_t cluster;
+  grub_uint32_t count;
+};
+
+/* Files needing more extents than this are read by walking the chain.  */
+#define GRUB_FAT_MAX_EXTENTS 4096
+
+enum
+  {
+    /* Never build an extent map (directories and lookup nodes).  */
+    GRUB_FAT_MAP_NONE,
+    GRUB_FAT_MAP_PENDING,
+    GRUB_FAT_MAP_READY,
+    GRUB_FAT_MAP_FAILED
+  };
+
 struct grub_fshelp_node {
   grub_disk_t disk;
   struct grub_fat_data *data;
@@ -202,6 +222,10 @@ struct grub_fshelp_node {
 #ifdef MODE_EXFAT
   int is_contiguous;
 #endif
+
+  int map_state;
+  grub_uint32_t num_extents;
+  struct grub_fat_extent *extents;
 };
 
 static grub_dl_t my_mod;
@@ -449,6 +473,189 @@ grub_fat_mount (grub_disk_t disk)
   return 0;
 }
 
+/* Look up the cluster following CLUSTER in the FAT.  Values at or above
+   cluster_eof_mark are returned as is.  */
+static grub_err_t
+grub_fat_next_cluster (grub_disk_t disk, struct grub_fat_data *data,
+		       grub_uint32_t cluster, grub_uint32_t *next)
+{
+  grub_uint32_t next_cluster;
+  grub_uint32_t fat_offset;
+
+  switch (data->fat_size)
+    {
+    case 32:
+      fat_offset = cluster << 2;
+      break;
+    case 16:
+      fat_offset = cluster << 1;
+      break;
+    default:
+      /* case 12: */
+      fat_offset = cluster + (cluster >> 1);
+      break;
+    }
+
+  /* Read the FAT.  */
+  if (grub_disk_read (disk, data->fat_sector, fat_offset,
+		      (data->fat_size + 7) >> 3,
+		      (char *) &next_cluster))
+    return grub_errno;
+
+  next_cluster = grub_le_to_cpu32 (next_cluster);
+  switch (data->fat_size)
+    {
+    case 16:
+      next_cluster &= 0xFFFF;
+      break;
+    case 12:
+      if (cluster & 1)
+	next_cluster >>= 4;
+
+      next_cluster &= 0x0FFF;
+      break;
+    }
+
+  grub_dprintf ("fat", "fat_size=%d, next_cluster=%u\n",
+		data->fat_size, next_cluster);
+
+  if (next_cluster < data->cluster_eof_mark
+      && (next_cluster < 2 || next_cluster >= data->num_clusters))
+    return grub_error (GRUB_ERR_BAD_FS, "invalid cluster %u", next_cluster);
+
+  *next = next_cluster;
+  return GRUB_ERR_NONE;
+}
+
+/* Compress the cluster chain of NODE into a list of extents.  On any
+   failure the map is abandoned and reads fall back to walking the chain,
+   which reports errors itself.  */
+static void
+grub_fat_build_map (grub_disk_t disk, grub_fshelp_node_t node)
+{
+  struct grub_fat_extent *extents = NULL, *e = NULL;
+  grub_uint32_t num = 0, alloc = 0;
+  grub_uint32_t cluster = node->file_cluster;
+  grub_uint32_t logical = 0, max_logical;
+  grub_uint32_t next;
+  unsigned cluster_size_bits = (node->data->cluster_bits
+				+ GRUB_DISK_SECTOR_BITS);
+
+  node->map_state = GRUB_FAT_MAP_FAILED;
+  if (cluster < 2 || cluster >= node->data->num_clusters)
+    return;
+
+  max_logical = (node->file_size + (1ULL << cluster_size_bits) - 1)
+    >> cluster_size_bits;
+
+  while (1)
+    {
+      if (e && e->cluster + e->count == cluster)
+	e->count++;
+      else
+	{
+	  if (num == GRUB_FAT_MAX_EXTENTS)
+	    goto fail;
+	  if (num == alloc)
+	    {
+	      struct grub_fat_extent *tmp;
+
+	      alloc = alloc ? 2 * alloc : 16;
+	      if (alloc > GRUB_FAT_MAX_EXTENTS)
+		alloc = GRUB_FAT_MAX_EXTENTS;
+	      tmp = grub_realloc (extents, alloc * sizeof (extents[0]));
+	      if (!tmp)
+		goto fail;
+	      extents = tmp;
+	    }
+	  e = &extents[num++];
+	  e->logical = logical;
+	  e->cluster = cluster;
+	  e->count = 1;
+	}
+      logical++;
+      if (logical >= max_logical)
+	break;
+
+      if (grub_fat_next_cluster (disk, node->data, cluster, &next))
+	goto fail;
+      if (next >= node->data->cluster_eof_mark)
+	break;
+      cluster = next;
+    }
+
+  grub_dprintf ("fat", "%u clusters in %u extents\n", logical, num);
+  node->extents = extents;
+  node->num_extents = num;
+  node->map_state = GRUB_FAT_MAP_READY;
+  return;
+
+ fail:
+  grub_free (extents);
+  grub_errno = GRUB_ERR_NONE;
+}
+
+/* Read through the extent map.  */
+static grub_ssize_t
+grub_fat_read_map (grub_disk_t disk, grub_fshelp_node_t node,
+		   grub_disk_read_hook_t read_hook, void *read_hook_data,
+		   int blocklist, grub_off_t offset, grub_size_t len, char *buf)
+{
+  unsigned logical_cluster_bits = (node->data->cluster_bits
+				   + GRUB_DISK_SECTOR_BITS);
+  grub_ssize_t ret = 0;
+
+  while (len)
+    {
+      struct grub_fat_extent *e;
+      grub_uint32_t logical = offset >> logical_cluster_bits;
+      grub_uint32_t lo = 0, hi = node->num_extents, mid;
+      grub_off_t ext_offset;
+      grub_disk_addr_t sector;
+      grub_size_t size;
+
+      /* Find the last extent starting at or before LOGICAL.  */
+      while (lo < hi)
+	{
+	  mid = (lo + hi) / 2;
+	  if (node->extents[mid].logical <= logical)
+	    lo = mid + 1;
+	  else
+	    hi = mid;
+	}
+      if (lo == 0)
+	break;
+      e = &node->extents[lo - 1];
+      if (logical >= e->logical + e->count)
+	break;
+
+      ext_offset = offset - ((grub_off_t) e->logical << logical_cluster_bits);
+      size = ((grub_off_t) e->count << logical_cluster_bits) - ext_offset;
+      if (size > len)
+	size = len;
+      sector = (node->data->cluster_sector
+		+ ((grub_disk_addr_t) (e->cluster - 2)
+		   << node->data->cluster_bits));
+
+      disk->read_hook = read_hook;
+      disk->read_hook_data = read_hook_data;
+      grub_disk_read_ex (disk, sector + (ext_offset >> GRUB_DISK_SECTOR_BITS),
+			 ext_offset & (GRUB_DISK_SECTOR_SIZE - 1),
+			 size, buf, blocklist);
+      disk->read_hook = 0;
+      if (grub_errno)
+	return -1;
+
+      len -= size;
+      if (buf)
+	buf += size;
+      ret += size;
+      offset += size;
+    }
+
+  return ret;
+}
+
 static grub_ssize_t
 grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
 		    grub_disk_read_hook_t read_hook, void *read_hook_data, int blocklist,
@@ -497,6 +704,12 @@ grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
     }
 #endif
 
+  if (node->map_state == GRUB_FAT_MAP_PENDING)
+    grub_fat_build_map (disk, node);
+  if (node->map_state == GRUB_FAT_MAP_READY)
+    return grub_fat_read_map (disk, node, read_hook, read_hook_data,
+			      blocklist, offset, len, buf);
+
   /* Calculate the logical cluster number and offset.  */
   logical_cluster_bits = (node->data->cluster_bits
 			  + GRUB_DISK_SECTOR_BITS);
@@ -515,56 +728,15 @@ grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
 	{
 	  /* Find next cluster.  */
 	  grub_uint32_t next_cluster;
-	  grub_uint32_t fat_offset;
-
-	  switch (node->data->fat_size)
-	    {
-	    case 32:
-	      fat_offset = node->cur_cluster << 2;
-	      break;
-	    case 16:
-	      fat_offset = node->cur_cluster << 1;
-	      break;
-	    default:
-	      /* case 12: */
-	      fat_offset = node->cur_cluster + (node->cur_cluster >> 1);
-	      break;
-	    }
 
-	  /* Read the FAT.  */
-	  if (grub_disk_read (disk, node->data->fat_sector, fat_offset,
-			      (node->data->fat_size + 7) >> 3,
-			      (char *) &next_cluster))
+	  if (grub_fat_next_cluster (disk, node->data, node->cur_cluster,
+				     &next_cluster))
 	    return -1;
 
-	  next_cluster = grub_le_to_cpu32 (next_cluster);
-	  switch (node->data->fat_size)
-	    {
-	    case 16:
-	      next_cluster &= 0xFFFF;
-	      break;
-	    case 12:
-	      if (node->cur_cluster & 1)
-		next_cluster >>= 4;
-
-	      next_cluster &= 0x0FFF;
-	      break;
-	    }
-
-	  grub_dprintf ("fat", "fat_size=%d, next_cluster=%u\n",
-			node->data->fat_size, next_cluster);
-
 	  /* Check the end.  */
 	  if (next_cluster >= node->data->cluster_eof_mark)
 	    return ret;
 
-	  if (next_cluster < 2 || next_cluster >= node->data->num_clusters)
-	    {
-	      grub_error (GRUB_ERR_BAD_FS, "invalid cluster %u",
-			  next_cluster);
-	      return -1;
-	    }
-
 	  node->cur_cluster = next_cluster;
 	  node->cur_cluster_num++;
 	}
@@ -954,6 +1126,9 @@ static grub_err_t lookup_file (grub_fshelp_node_t node,
 	    (*foundnode)->file_cluster = node->data->root_cluster;
 #endif
 	  (*foundnode)->cur_cluster_num = ~0U;
+	  (*foundnode)->map_state = GRUB_FAT_MAP_NONE;
+	  (*foundnode)->num_extents = 0;
+	  (*foundnode)->extents = NULL;
 	  (*foundnode)->data = node->data;
 	  (*foundnode)->disk = node->disk;
 
@@ -972,6 +1147,28 @@ static grub_err_t lookup_file (grub_fshelp_node_t node,
 
 }
 
+/* Lookup nodes carry no extent map, so they can be cached by value.  A
+   directory is identified by its first cluster.  */
+static grub_uint64_t
+grub_fat_node_key (grub_fshelp_node_t node)
+{
+  return node->file_cluster;
+}
+
+static void
+grub_fat_bind_node (grub_fshelp_node_t node, grub_fshelp_node_t dir)
+{
+  node->data = dir->data;
+  node->disk = dir->disk;
+}
+
+static const struct grub_fshelp_cache_desc grub_fat_cache_desc =
+  {
+    .node_size = sizeof (struct grub_fshelp_node),
+    .node_key = grub_fat_node_key,
+    .bind_node = grub_fat_bind_node
+  };
+
 static grub_err_t
 grub_fat_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
 	      void *hook_data)
@@ -1001,7 +1198,9 @@ grub_fat_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
 #endif
   };
 
-  err = grub_fshelp_find_file_lookup (path, &root, &found, lookup_file, NULL, GRUB_FSHELP_DIR);
+  err = grub_fshelp_find_file_cached (path, &root, &found, NULL, lookup_file,
+				      NULL, GRUB_FSHELP_DIR, disk,
+				      &grub_fat_cache_desc);
   if (err)
     goto fail;
 
@@ -1075,12 +1274,16 @@ grub_fat_open (grub_file_t file, const char *name)
 #endif
   };
 
-  err = grub_fshelp_find_file_lookup (name, &root, &found, lookup_file, NULL, GRUB_FSHELP_REG);
+  err = grub_fshelp_find_file_cached (name, &root, &found, NULL, lookup_file,
+				      NULL, GRUB_FSHELP_REG, disk,
+				      &grub_fat_cache_desc);
   if (err)
     goto fail;
 
   file->data = found;
   file->size = found->file_size;
+  if (found != &root)
+    found->map_state = GRUB_FAT_MAP_PENDING;
 
   return GRUB_ERR_NONE;
 
@@ -1109,6 +1312,7 @@ grub_fat_close (grub_file_t file)
 {
   grub_fshelp_node_t node = file->data;
 
+  grub_free (node->extents);
   grub_free (node->data);
   grub_free (node);
 
@@ -1325,5 +1529,6 @@ GRUB_MOD_FINI(fat)
 #endif
 {
   grub_fs_unregister (&grub_fat_fs);
+  grub_fshelp_cache_forget (&grub_fat_cache_desc);
 }
 
@@ -25,6 +25,7 @@
 #include <grub/dl.h>
 #include <grub/i18n.h>
 #include <grub/env.h>
+#include <grub/partition.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -49,6 +50,8 @@ struct grub_fshelp_find_file_ctx
   /* Inputs.  */
   const char *path;
   grub_fshelp_node_t rootnode;
+  grub_disk_t disk;
+  const struct grub_fshelp_cache_desc *cache;
 
   /* Global options. */
   int symlinknest;
@@ -163,6 +166,198 @@ directory_find_file (grub_fshelp_node_t node, const char *name, grub_fshelp_node
   return GRUB_ERR_NONE;
 }
 
+/* Lookup cache.  Entries map a name in a directory of a given disk to a
+   copy of the node found there, or to nothing for names known to be
+   missing.  */
+#define GRUB_FSHELP_CACHE_HASH	64
+#define GRUB_FSHELP_CACHE_MAX	1024
+
+struct grub_fshelp_cache_ent
+{
+  struct grub_fshelp_cache_ent *next;
+  const struct grub_fshelp_cache_desc *desc;
+  enum grub_disk_dev_id dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  grub_uint64_t dir;
+  int case_sensitive;
+  unsigned long stamp;
+  enum grub_fshelp_filetype type;
+  grub_fshelp_node_t node;
+  char name[0];
+};
+
+static struct grub_fshelp_cache_ent *fshelp_cache[GRUB_FSHELP_CACHE_HASH];
+static unsigned fshelp_cache_count;
+static unsigned long fshelp_cache_stamp;
+static grub_uint32_t fshelp_cache_generation;
+
+static void
+cache_free (struct grub_fshelp_cache_ent *ent)
+{
+  grub_free (ent->node);
+  grub_free (ent);
+}
+
+static void
+cache_drop (const struct grub_fshelp_cache_desc *desc)
+{
+  struct grub_fshelp_cache_ent **p, *ent;
+  unsigned i;
+
+  for (i = 0; i < GRUB_FSHELP_CACHE_HASH; i++)
+    for (p = &fshelp_cache[i]; *p; )
+      {
+	ent = *p;
+	if (desc && ent->desc != desc)
+	  {
+	    p = &ent->next;
+	    continue;
+	  }
+	*p = ent->next;
+	cache_free (ent);
+	fshelp_cache_count--;
+      }
+}
+
+void
+grub_fshelp_cache_forget (const struct grub_fshelp_cache_desc *cache)
+{
+  cache_drop (cache);
+}
+
+static unsigned
+cache_hash (grub_uint64_t dir, const char *name)
+{
+  grub_uint32_t h = (grub_uint32_t) dir ^ (grub_uint32_t) (dir >> 32);
+
+  for (; *name; name++)
+    h = h * 31 + grub_tolower (*name);
+  return h % GRUB_FSHELP_CACHE_HASH;
+}
+
+static int
+cache_case_sensitive (void)
+{
+  const char *case_sensitive = grub_env_get ("grub_fs_case_sensitive");
+
+  return case_sensitive && case_sensitive[0] == '1';
+}
+
+/* Look NAME up in DIR through the cache of CTX.  Return 1 and fill in
+   FOUNDNODE and FOUNDTYPE on a hit.  */
+static int
+cache_lookup (struct grub_fshelp_find_file_ctx *ctx, grub_fshelp_node_t dir,
+	      const char *name, grub_fshelp_node_t *foundnode,
+	      enum grub_fshelp_filetype *foundtype)
+{
+  const struct grub_fshelp_cache_desc *desc = ctx->cache;
+  grub_disk_t disk = ctx->disk;
+  grub_disk_addr_t part_start = grub_partition_get_start (disk->partition);
+  grub_uint64_t key = desc->node_key (dir);
+  int case_sensitive = cache_case_sensitive ();
+  struct grub_fshelp_cache_ent *ent;
+
+  if (fshelp_cache_generation != grub_disk_cache_generation)
+    {
+      cache_drop (NULL);
+      fshelp_cache_generation = grub_disk_cache_generation;
+      return 0;
+    }
+
+  for (ent = fshelp_cache[cache_hash (key, name)]; ent; ent = ent->next)
+    if (ent->desc == desc && ent->dir == key
+	&& ent->dev_id == disk->dev->id && ent->disk_id == disk->id
+	&& ent->part_start == part_start
+	&& ent->case_sensitive == case_sensitive
+	&& grub_strcmp (ent->name, name) == 0)
+      break;
+  if (!ent)
+    return 0;
+
+  ent->stamp = ++fshelp_cache_stamp;
+  *foundnode = NULL;
+  *foundtype = ent->type;
+  if (ent->node)
+    {
+      *foundnode = grub_malloc (desc->node_size);
+      if (!*foundnode)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return 0;
+	}
+      grub_memcpy (*foundnode, ent->node, desc->node_size);
+      desc->bind_node (*foundnode, dir);
+    }
+  return 1;
+}
+
+/* Remember that NAME in DIR resolved to NODE of TYPE, NODE being NULL for
+   a missing name.  Failures only mean the result is not cached.  */
+static void
+cache_store (struct grub_fshelp_find_file_ctx *ctx, grub_fshelp_node_t dir,
+	     const char *name, grub_fshelp_node_t node,
+	     enum grub_fshelp_filetype type)
+{
+  const struct grub_fshelp_cache_desc *desc = ctx->cache;
+  grub_disk_t disk = ctx->disk;
+  struct grub_fshelp_cache_ent *ent;
+  grub_uint64_t key = desc->node_key (dir);
+  grub_size_t len = grub_strlen (name);
+  unsigned idx = cache_hash (key, name);
+
+  /* The disk changed under a lookup in progress.  */
+  if (fshelp_cache_generation != grub_disk_cache_generation)
+    return;
+
+  if (fshelp_cache_count >= GRUB_FSHELP_CACHE_MAX)
+    {
+      struct grub_fshelp_cache_ent **p, **victim = NULL;
+      unsigned i;
+
+      for (i = 0; i < GRUB_FSHELP_CACHE_HASH; i++)
+	for (p = &fshelp_cache[i]; *p; p = &(*p)->next)
+	  if (!victim || (*p)->stamp < (*victim)->stamp)
+	    victim = p;
+      ent = *victim;
+      *victim = ent->next;
+      cache_free (ent);
+      fshelp_cache_count--;
+    }
+
+  ent = grub_zalloc (sizeof (*ent) + len + 1);
+  if (!ent)
+    goto fail;
+  if (node)
+    {
+      ent->node = grub_malloc (desc->node_size);
+      if (!ent->node)
+	{
+	  grub_free (ent);
+	  goto fail;
+	}
+      grub_memcpy (ent->node, node, desc->node_size);
+    }
+
+  ent->desc = desc;
+  ent->dev_id = disk->dev->id;
+  ent->disk_id = disk->id;
+  ent->part_start = grub_partition_get_start (disk->partition);
+  ent->dir = key;
+  ent->case_sensitive = cache_case_sensitive ();
+  ent->stamp = ++fshelp_cache_stamp;
+  ent->type = type;
+  grub_memcpy (ent->name, name, len + 1);
+
+  ent->next = fshelp_cache[idx];
+  fshelp_cache[idx] = ent;
+  fshelp_cache_count++;
+  return;
+
+ fail:
+  grub_errno = GRUB_ERR_NONE;
+}
+
 static grub_err_t
 find_file (char *currpath,
 	   iterate_dir_func iterate_dir, lookup_file_func lookup_file,
@@ -207,10 +402,19 @@ find_file (char *currpath,
       /* Iterate over the directory.  */
       c = *next;
       *next = '\0';
-      if (lookup_file)
-	err = lookup_file (ctx->currnode->node, name, &foundnode, &foundtype);
+      if (ctx->cache
+	  && cache_lookup (ctx, ctx->currnode->node, name,
+			   &foundnode, &foundtype))
+	err = GRUB_ERR_NONE;
       else
-	err = directory_find_file (ctx->currnode->node, name, &foundnode, &foundtype, iterate_dir);
+	{
+	  if (lookup_file)
+	    err = lookup_file (ctx->currnode->node, name, &foundnode, &foundtype);
+	  else
+	    err = directory_find_file (ctx->currnode->node, name, &foundnode, &foundtype, iterate_dir);
+	  if (!err && ctx->cache)
+	    cache_store (ctx, ctx->currnode->node, name, foundnode, foundtype);
+	}
       *next = c;
 
       if (err)
@@ -269,11 +473,15 @@ grub_fshelp_find_file_real (const char *path, grub_fshelp_node_t rootnode,
 			    iterate_dir_func iterate_dir,
 			    lookup_file_func lookup_file,
 			    read_symlink_func read_symlink,
-			    enum grub_fshelp_filetype expecttype)
+			    enum grub_fshelp_filetype expecttype,
+			    grub_disk_t disk,
+			    const struct grub_fshelp_cache_desc *cache)
 {
   struct grub_fshelp_find_file_ctx ctx = {
     .path = path,
     .rootnode = rootnode,
+    .disk = disk,
+    .cache = disk ? cache : NULL,
     .symlinknest = 0,
     .currnode = 0
   };
@@ -332,7 +540,7 @@ grub_fshelp_find_file (const char *path, grub_fshelp_node_t rootnode,
 {
   return grub_fshelp_find_file_real (path, rootnode, foundnode,
 				     iterate_dir, NULL, 
-				     read_symlink, expecttype);
+				     read_symlink, expecttype, NULL, NULL);
 
 }
 
@@ -345,10 +553,26 @@ grub_fshelp_find_file_lookup (const char *path, grub_fshelp_node_t rootnode,
 {
   return grub_fshelp_find_file_real (path, rootnode, foundnode,
 				     NULL, lookup_file, 
-				     read_symlink, expecttype);
+				     read_symlink, expecttype, NULL, NULL);
 
 }
 
+grub_err_t
+grub_fshelp_find_file_cached (const char *path, grub_fshelp_node_t rootnode,
+			      grub_fshelp_node_t *foundnode,
+			      iterate_dir_func iterate_dir,
+			      lookup_file_func lookup_file,
+			      read_symlink_func read_symlink,
+			      enum grub_fshelp_filetype expecttype,
+			      grub_disk_t disk,
+			      const struct grub_fshelp_cache_desc *cache)
+{
+  return grub_fshelp_find_file_real (path, rootnode, foundnode,
+				     iterate_dir,
+				     iterate_dir ? NULL : lookup_file,
+				     read_symlink, expecttype, disk, cache);
+}
+
 /* Read LEN bytes from the file NODE on disk DISK into the buffer BUF,
    beginning with the block POS.  READ_HOOK should be set before
    reading a block from the file.  READ_HOOK_DATA is passed through as
@@ -27,11 +27,23 @@
 #include <grub/fshelp.h>
 #include <grub/ntfs.h>
 #include <grub/charset.h>
+#include <grub/env.h>
+#include <grub/partition.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
 static grub_dl_t my_mod;
 
+/* $UpCase table of the volume used most recently, which defines the
+   collation order of directory indexes.  */
+#define GRUB_NTFS_UPCASE_LEN	0x10000
+
+static grub_uint16_t *upcase_table;
+static enum grub_disk_dev_id upcase_dev_id;
+static unsigned long upcase_disk_id;
+static grub_disk_addr_t upcase_part_start;
+static grub_uint64_t upcase_uuid;
+
 #define grub_fshelp_node grub_ntfs_file 
 
 static inline grub_uint16_t
@@ -108,6 +120,9 @@ init_attr (struct grub_ntfs_attr *at, struct grub_ntfs_file *mft)
   at->flags = (mft == &mft->data->mmft) ? GRUB_NTFS_AF_MMFT : 0;
   at->attr_nxt = mft->buf + u16at (mft->buf, 0x14);
   at->attr_end = at->emft_buf = at->edat_buf = at->sbuf = NULL;
+  at->runs_type = 0;
+  at->num_runs = 0;
+  at->runs = NULL;
 }
 
 static void
@@ -116,6 +131,9 @@ free_attr (struct grub_ntfs_attr *at)
   grub_free (at->emft_buf);
   grub_free (at->edat_buf);
   grub_free (at->sbuf);
+  grub_free (at->runs);
+  at->runs = NULL;
+  at->runs_type = 0;
 }
 
 static grub_uint8_t *
@@ -449,6 +467,116 @@ read_data (struct grub_ntfs_attr *at, grub_uint8_t *pa, grub_uint8_t *dest,
   return grub_errno;
 }
 
+/* Decode the whole run list of the attribute starting at PA, which must
+   be its first record, into AT->runs.  */
+static void
+build_runs (struct grub_ntfs_attr *at, grub_uint8_t *pa)
+{
+  struct grub_ntfs_rlst cc;
+  struct grub_ntfs_run *runs = NULL;
+  grub_size_t num = 0, alloc = 0;
+  grub_disk_addr_t total;
+
+  grub_memset (&cc, 0, sizeof (cc));
+  cc.attr = at;
+  cc.comp.log_spc = at->mft->data->log_spc;
+  cc.comp.disk = at->mft->data->disk;
+  cc.cur_run = pa + u16at (pa, 0x20);
+  cc.next_vcn = u32at (pa, 0x10);
+  cc.curr_lcn = 0;
+
+  total = u64at (pa, 0x28) >> (GRUB_NTFS_BLK_SHR + cc.comp.log_spc);
+  while (cc.next_vcn < total)
+    {
+      if (grub_ntfs_read_run_list (&cc))
+	goto fail;
+      if (num == alloc)
+	{
+	  struct grub_ntfs_run *tmp;
+
+	  if (alloc == GRUB_NTFS_MAX_RUNS)
+	    goto fail;
+	  alloc = alloc ? 2 * alloc : 16;
+	  tmp = grub_realloc (runs, alloc * sizeof (runs[0]));
+	  if (!tmp)
+	    goto fail;
+	  runs = tmp;
+	}
+      runs[num].vcn = cc.curr_vcn;
+      runs[num].lcn = (cc.flags & GRUB_NTFS_RF_BLNK) ? 0 : cc.curr_lcn;
+      num++;
+    }
+
+  at->runs = runs;
+  at->num_runs = num;
+  at->runs_end = cc.next_vcn;
+  return;
+
+ fail:
+  grub_free (runs);
+  grub_errno = GRUB_ERR_NONE;
+}
+
+static grub_disk_addr_t
+grub_ntfs_read_run_block (grub_fshelp_node_t node, grub_disk_addr_t block)
+{
+  struct grub_ntfs_attr *at = (struct grub_ntfs_attr *) node;
+  grub_size_t lo = 0, hi = at->num_runs, mid;
+  struct grub_ntfs_run *r;
+
+  if (block >= at->runs_end)
+    {
+      grub_error (GRUB_ERR_BAD_FS, "read out of range");
+      return -1;
+    }
+
+  while (lo < hi)
+    {
+      mid = (lo + hi) / 2;
+      if (at->runs[mid].vcn <= block)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  if (lo == 0)
+    {
+      grub_error (GRUB_ERR_BAD_FS, "read out of range");
+      return -1;
+    }
+  r = &at->runs[lo - 1];
+  return r->lcn ? block - r->vcn + r->lcn : 0;
+}
+
+/* Map the run list of attribute ATTR of AT on first use, if it is a plain
+   non-resident attribute.  */
+static void
+map_runs (struct grub_ntfs_attr *at, grub_uint8_t attr)
+{
+  grub_uint8_t *pa;
+
+  /* The MFT is read with GPOS set while it is being located; map it
+     later.  */
+  if (at->runs_type == attr || (at->flags & GRUB_NTFS_AF_GPOS))
+    return;
+  grub_free (at->runs);
+  at->runs = NULL;
+  at->runs_type = attr;
+
+  /* Start from the record holding VCN 0.  */
+  at->attr_nxt = at->attr_cur;
+  pa = find_attr (at, attr);
+  if (!pa)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  if (pa[8] == 0 || u64at (pa, 0x10) != 0
+      || (pa[0xC] & GRUB_NTFS_FLAG_COMPRESSED))
+    return;
+
+  build_runs (at, pa);
+}
+
 static grub_err_t
 read_attr (struct grub_ntfs_attr *at, grub_uint8_t *dest, grub_disk_addr_t ofs,
 	   grub_size_t len, int cached,
@@ -460,8 +588,22 @@ read_attr (struct grub_ntfs_attr *at, grub_uint8_t *dest, grub_disk_addr_t ofs,
   grub_err_t ret;
 
   save_cur = at->attr_cur;
+  attr = *at->attr_cur;
+
+  map_runs (at, attr);
+  at->attr_cur = save_cur;
+  if (at->runs)
+    {
+      if (len == 0)
+	return 0;
+      grub_fshelp_read_file (at->mft->data->disk, (grub_fshelp_node_t) at,
+			     read_hook, read_hook_data, blocklist, ofs, len,
+			     (char *) dest, grub_ntfs_read_run_block,
+			     ofs + len, at->mft->data->log_spc, 0);
+      return grub_errno;
+    }
+
   at->attr_nxt = at->attr_cur;
-  attr = *at->attr_nxt;
   if (at->flags & GRUB_NTFS_AF_ALST)
     {
       grub_uint8_t *pa;
@@ -890,6 +1032,347 @@ done:
   return ret;
 }
 
+static const grub_uint16_t *
+get_upcase (struct grub_ntfs_data *data)
+{
+  struct grub_ntfs_file upcase;
+  grub_disk_t disk = data->disk;
+  grub_disk_addr_t part_start = grub_partition_get_start (disk->partition);
+  grub_size_t len = GRUB_NTFS_UPCASE_LEN * sizeof (grub_uint16_t);
+  grub_uint16_t *tab;
+  grub_size_t i;
+
+  if (upcase_table && upcase_dev_id == disk->dev->id
+      && upcase_disk_id == disk->id && upcase_part_start == part_start
+      && upcase_uuid == data->uuid)
+    return upcase_table;
+
+  grub_memset (&upcase, 0, sizeof (upcase));
+  upcase.data = data;
+  tab = grub_malloc (len);
+  if (!tab
+      || init_file (&upcase, GRUB_NTFS_FILE_UPCASE)
+      || upcase.size < len
+      || read_attr (&upcase.attr, (grub_uint8_t *) tab, 0, len, 0, 0, 0, 0))
+    {
+      free_file (&upcase);
+      grub_free (tab);
+      grub_errno = GRUB_ERR_NONE;
+      return NULL;
+    }
+  free_file (&upcase);
+
+  for (i = 0; i < GRUB_NTFS_UPCASE_LEN; i++)
+    tab[i] = grub_le_to_cpu16 (tab[i]);
+
+  grub_free (upcase_table);
+  upcase_table = tab;
+  upcase_dev_id = disk->dev->id;
+  upcase_disk_id = disk->id;
+  upcase_part_start = part_start;
+  upcase_uuid = data->uuid;
+  return tab;
+}
+
+enum
+  {
+    GRUB_NTFS_LOOKUP_FOUND,
+    GRUB_NTFS_LOOKUP_MISSING,
+    GRUB_NTFS_LOOKUP_DESCEND,
+    /* The index can't be searched reliably, scan the whole directory.  */
+    GRUB_NTFS_LOOKUP_SCAN
+  };
+
+struct grub_ntfs_lookup_ctx
+{
+  struct grub_ntfs_file *dir;
+  const grub_uint16_t *upcase;
+  /* Name looked for, as is and upcased.  */
+  grub_uint16_t *name;
+  grub_uint16_t *uname;
+  grub_size_t len;
+  const char *utf8_name;
+  int case_sensitive;
+  grub_fshelp_node_t *foundnode;
+  enum grub_fshelp_filetype *foundtype;
+};
+
+/* Compare a name from an index entry with the name looked for, in NTFS
+   collation order.  */
+static int
+lookup_collate (struct grub_ntfs_lookup_ctx *ctx, grub_uint8_t *np,
+		grub_size_t ns, int *exact)
+{
+  grub_size_t i;
+  grub_uint16_t c, uc;
+
+  *exact = (ns == ctx->len);
+  for (i = 0; i < ns && i < ctx->len; i++)
+    {
+      c = grub_le_to_cpu16 (grub_get_unaligned16 (np + 2 * i));
+      if (c != ctx->name[i])
+	*exact = 0;
+      uc = ctx->upcase[c];
+      if (uc != ctx->uname[i])
+	return (uc < ctx->uname[i]) ? -1 : 1;
+    }
+  if (ns != ctx->len)
+    return (ns < ctx->len) ? -1 : 1;
+  return 0;
+}
+
+/* Search one index node, whose entries lie between POS and END.  */
+static int
+lookup_node (struct grub_ntfs_lookup_ctx *ctx, grub_uint8_t *pos,
+	     grub_uint8_t *end, grub_disk_addr_t *subnode)
+{
+  while (1)
+    {
+      grub_uint16_t elen;
+      grub_uint8_t *np;
+      grub_size_t ns;
+      grub_uint8_t namespace;
+      int cmp, exact;
+
+      if (pos + 0x10 > end)
+	return GRUB_NTFS_LOOKUP_SCAN;
+      elen = u16at (pos, 8);
+      if (elen < 0x10 || pos + elen > end)
+	return GRUB_NTFS_LOOKUP_SCAN;
+
+      if (pos[0xC] & 2)		/* end signature */
+	break;
+
+      if (elen < 0x52)
+	return GRUB_NTFS_LOOKUP_SCAN;
+      np = pos + 0x50;
+      ns = *(np++);
+      namespace = *(np++);
+      if (0x52 + 2 * ns > elen)
+	return GRUB_NTFS_LOOKUP_SCAN;
+
+      cmp = lookup_collate (ctx, np, ns, &exact);
+      if (cmp > 0)
+	break;
+      if (cmp == 0)
+	{
+	  enum grub_fshelp_filetype type;
+	  struct grub_ntfs_file *fdiro;
+	  grub_uint32_t attr;
+
+	  /* DOS names are never matched, and a case sensitive match may
+	     be stored next to other names that differ only in case.  */
+	  if (namespace == 2 || (!exact && !namespace && ctx->case_sensitive))
+	    return GRUB_NTFS_LOOKUP_SCAN;
+
+	  attr = u32at (pos, 0x48);
+	  if (attr & GRUB_NTFS_ATTR_REPARSE)
+	    type = GRUB_FSHELP_SYMLINK;
+	  else if (attr & GRUB_NTFS_ATTR_DIRECTORY)
+	    type = GRUB_FSHELP_DIR;
+	  else
+	    type = GRUB_FSHELP_REG;
+
+	  fdiro = grub_zalloc (sizeof (struct grub_ntfs_file));
+	  if (!fdiro)
+	    return GRUB_NTFS_LOOKUP_SCAN;
+	  fdiro->data = ctx->dir->data;
+	  fdiro->ino = u64at (pos, 0) & 0xffffffffffffULL;
+	  fdiro->mtime = u64at (pos, 0x20);
+
+	  *ctx->foundnode = fdiro;
+	  *ctx->foundtype = type;
+	  return GRUB_NTFS_LOOKUP_FOUND;
+	}
+      pos += elen;
+    }
+
+  /* Entries in the subnode sort before the current one.  */
+  if (!(pos[0xC] & 1))
+    return GRUB_NTFS_LOOKUP_MISSING;
+  *subnode = u64at (pos, u16at (pos, 8) - 8);
+  return GRUB_NTFS_LOOKUP_DESCEND;
+}
+
+/* Descend the $I30 B+tree of CTX->dir.  */
+static int
+lookup_index (struct grub_ntfs_lookup_ctx *ctx)
+{
+  struct grub_ntfs_file *mft = ctx->dir;
+  struct grub_ntfs_attr attr, *at = &attr;
+  grub_uint8_t *cur_pos, *indx = NULL;
+  grub_disk_addr_t vcn;
+  grub_size_t idx_bytes;
+  int vcn_bits, depth, ret;
+
+  init_attr (at, mft);
+  while (1)
+    {
+      cur_pos = find_attr (at, GRUB_NTFS_AT_INDEX_ROOT);
+      if (cur_pos == NULL)
+	{
+	  ret = GRUB_NTFS_LOOKUP_SCAN;
+	  goto done;
+	}
+
+      /* Resident, Namelen=4, Offset=0x18, Flags=0x00, Name="$I30" */
+      if ((u32at (cur_pos, 8) != 0x180400) ||
+	  (u32at (cur_pos, 0x18) != 0x490024) ||
+	  (u32at (cur_pos, 0x1C) != 0x300033))
+	continue;
+      cur_pos += u16at (cur_pos, 0x14);
+      if (*cur_pos != 0x30)	/* Not filename index */
+	continue;
+      break;
+    }
+
+  /* Only the filename collation rule is understood.  */
+  if (u32at (cur_pos, 4) != 1)
+    {
+      ret = GRUB_NTFS_LOOKUP_SCAN;
+      goto done;
+    }
+
+  cur_pos += 0x10;		/* Skip index root */
+  ret = lookup_node (ctx, cur_pos + u32at (cur_pos, 0),
+		     cur_pos + u32at (cur_pos, 4), &vcn);
+  if (ret != GRUB_NTFS_LOOKUP_DESCEND)
+    goto done;
+
+  free_attr (at);
+  cur_pos = locate_attr (at, mft, GRUB_NTFS_AT_INDEX_ALLOCATION);
+  while (cur_pos != NULL)
+    {
+      /* Non-resident, Namelen=4, Offset=0x40, Flags=0, Name="$I30" */
+      if ((u32at (cur_pos, 8) == 0x400401) &&
+	  (u32at (cur_pos, 0x40) == 0x490024) &&
+	  (u32at (cur_pos, 0x44) == 0x300033))
+	break;
+      cur_pos = find_attr (at, GRUB_NTFS_AT_INDEX_ALLOCATION);
+    }
+  if (!cur_pos)
+    {
+      ret = GRUB_NTFS_LOOKUP_SCAN;
+      goto done;
+    }
+
+  idx_bytes = mft->data->idx_size << GRUB_NTFS_BLK_SHR;
+  if (mft->data->idx_size >= (1U << mft->data->log_spc))
+    vcn_bits = mft->data->log_spc + GRUB_NTFS_BLK_SHR;
+  else
+    vcn_bits = GRUB_NTFS_BLK_SHR;
+
+  indx = grub_malloc (idx_bytes);
+  if (indx == NULL)
+    {
+      ret = GRUB_NTFS_LOOKUP_SCAN;
+      goto done;
+    }
+
+  for (depth = 0; ret == GRUB_NTFS_LOOKUP_DESCEND; depth++)
+    {
+      if (depth == 32
+	  || read_attr (at, indx, vcn << vcn_bits, idx_bytes, 0, 0, 0, 0)
+	  || fixup (indx, mft->data->idx_size, (const grub_uint8_t *) "INDX")
+	  || u64at (indx, 0x10) != vcn)
+	{
+	  ret = GRUB_NTFS_LOOKUP_SCAN;
+	  break;
+	}
+      cur_pos = indx + 0x18;
+      if (u32at (cur_pos, 4) > idx_bytes - 0x18)
+	{
+	  ret = GRUB_NTFS_LOOKUP_SCAN;
+	  break;
+	}
+      ret = lookup_node (ctx, cur_pos + u32at (cur_pos, 0),
+			 cur_pos + u32at (cur_pos, 4), &vcn);
+    }
+
+done:
+  free_attr (at);
+  grub_free (indx);
+  grub_errno = GRUB_ERR_NONE;
+  return ret;
+}
+
+/* Helper for grub_ntfs_lookup_file, matching like grub_fshelp_find_file.  */
+static int
+grub_ntfs_scan_iter (const char *filename, enum grub_fshelp_filetype filetype,
+		     grub_fshelp_node_t node, void *data)
+{
+  struct grub_ntfs_lookup_ctx *ctx = data;
+  const char *name = ctx->utf8_name;
+
+  if (!ctx->case_sensitive)
+    filetype |= GRUB_FSHELP_CASE_INSENSITIVE;
+
+  if (filetype == GRUB_FSHELP_UNKNOWN ||
+      ((filetype & GRUB_FSHELP_CASE_INSENSITIVE)
+       ? grub_strcasecmp (name, filename)
+       : grub_strcmp (name, filename)))
+    {
+      grub_free (node);
+      return 0;
+    }
+
+  *ctx->foundnode = node;
+  *ctx->foundtype = filetype & ~GRUB_FSHELP_CASE_INSENSITIVE;
+  return 1;
+}
+
+static grub_err_t
+grub_ntfs_lookup_file (grub_fshelp_node_t dir, const char *name,
+		       grub_fshelp_node_t *foundnode,
+		       enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_ntfs_lookup_ctx ctx;
+  struct grub_ntfs_file *mft = (struct grub_ntfs_file *) dir;
+  const char *case_sensitive;
+  grub_size_t len = grub_strlen (name);
+  grub_size_t i;
+  int ret = GRUB_NTFS_LOOKUP_SCAN;
+
+  if (!mft->inode_read)
+    {
+      if (init_file (mft, mft->ino))
+	return grub_errno;
+    }
+
+  grub_memset (&ctx, 0, sizeof (ctx));
+  ctx.dir = mft;
+  ctx.utf8_name = name;
+  ctx.foundnode = foundnode;
+  ctx.foundtype = foundtype;
+  case_sensitive = grub_env_get ("grub_fs_case_sensitive");
+  ctx.case_sensitive = (case_sensitive && case_sensitive[0] == '1');
+
+  ctx.upcase = get_upcase (mft->data);
+  if (ctx.upcase)
+    {
+      ctx.name = grub_calloc (len + 1, sizeof (ctx.name[0]));
+      ctx.uname = grub_calloc (len + 1, sizeof (ctx.uname[0]));
+      if (ctx.name && ctx.uname)
+	{
+	  ctx.len = grub_utf8_to_utf16 (ctx.name, len, (const grub_uint8_t *) name,
+					len, NULL);
+	  for (i = 0; i < ctx.len; i++)
+	    ctx.uname[i] = ctx.upcase[ctx.name[i]];
+	  ret = lookup_index (&ctx);
+	}
+      grub_free (ctx.name);
+      grub_free (ctx.uname);
+      grub_errno = GRUB_ERR_NONE;
+    }
+
+  if (ret != GRUB_NTFS_LOOKUP_SCAN)
+    return GRUB_ERR_NONE;
+
+  if (!grub_ntfs_iterate_dir (dir, grub_ntfs_scan_iter, &ctx) && grub_errno)
+    return grub_errno;
+  return GRUB_ERR_NONE;
+}
+
 static struct grub_ntfs_data *
 grub_ntfs_mount (grub_disk_t disk)
 {
@@ -1020,8 +1503,9 @@ grub_ntfs_dir (grub_device_t device, const char *path,
   if (!data)
     goto fail;
 
-  grub_fshelp_find_file (path, &data->cmft, &fdiro, grub_ntfs_iterate_dir,
-			 grub_ntfs_read_symlink, GRUB_FSHELP_DIR);
+  grub_fshelp_find_file_lookup (path, &data->cmft, &fdiro,
+				grub_ntfs_lookup_file, grub_ntfs_read_symlink,
+				GRUB_FSHELP_DIR);
 
   if (grub_errno)
     goto fail;
@@ -1058,8 +1542,9 @@ grub_ntfs_open (grub_file_t file, const char *name)
   if (!data)
     goto fail;
 
-  grub_fshelp_find_file (name, &data->cmft, &mft, grub_ntfs_iterate_dir,
-			 grub_ntfs_read_symlink, GRUB_FSHELP_REG);
+  grub_fshelp_find_file_lookup (name, &data->cmft, &mft,
+				grub_ntfs_lookup_file, grub_ntfs_read_symlink,
+				GRUB_FSHELP_REG);
 
   if (grub_errno)
     goto fail;
@@ -1242,4 +1727,6 @@ GRUB_MOD_INIT (ntfs)
 GRUB_MOD_FINI (ntfs)
 {
   grub_fs_unregister (&grub_ntfs_fs);
+  grub_free (upcase_table);
+  upcase_table = NULL;
 }
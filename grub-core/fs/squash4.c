@@ -27,7 +27,10 @@
 #include <grub/fshelp.h>
 #include <grub/deflate.h>
 #include <grub/safemath.h>
+#include <grub/env.h>
+#include <grub/partition.h>
 #include <minilzo.h>
+#include <grub/lib/zstd.h>
 
 #include "xz.h"
 #include "xz_stream.h"
@@ -60,8 +63,11 @@ struct grub_squash_super
   grub_uint32_t block_size;
   grub_uint32_t dummy2;
   grub_uint16_t compression;
-  grub_uint16_t dummy3;
-  grub_uint64_t dummy4;
+  grub_uint16_t block_log;
+  grub_uint16_t flags;
+  grub_uint16_t no_ids;
+  grub_uint16_t s_major;
+  grub_uint16_t s_minor;
   grub_uint16_t root_ino_offset;
   grub_uint32_t root_ino_chunk;
   grub_uint16_t dummy5;
@@ -74,6 +80,8 @@ struct grub_squash_super
   grub_uint64_t unk2offset;
 } GRUB_PACKED;
 
+#define OFFSET_OF(TYPE, MEMBER) ((grub_size_t) &((TYPE *)0)->MEMBER)
+
 /* Chunk-based */
 struct grub_squash_inode
 {
@@ -184,12 +192,68 @@ enum
     COMPRESSION_ZLIB = 1,
     COMPRESSION_LZO = 3,
     COMPRESSION_XZ = 4,
+    COMPRESSION_LZ4 = 5,
+    COMPRESSION_ZSTD = 6,
   };
 
+enum
+  {
+    SQUASH_FLAG_COMP_OPTS = 0x400
+  };
+
+/* Compressor options, stored as a metadata chunk right after the superblock
+   when SQUASH_FLAG_COMP_OPTS is set.  */
+union grub_squash_comp_opts
+{
+  struct
+  {
+    grub_uint32_t version;
+    grub_uint32_t flags;
+  } GRUB_PACKED lz4;
+  struct
+  {
+    grub_uint32_t level;
+  } GRUB_PACKED zstd;
+};
+
+#define SQUASH_LZ4_LEGACY 1
+
 
 #define SQUASH_CHUNK_SIZE 0x2000
 #define XZBUFSIZ 0x2000
 
+/* Default limit of the decompressed block cache in KiB, overridden by the
+   squash_cache_size variable.  */
+#define SQUASH_CACHE_DEFAULT_SIZE 8192
+#define SQUASH_CACHE_HASH 64
+
+/* A decompressed metadata, data or fragment block.  Blocks are identified
+   by the position of their compressed form on the disk and kept across
+   mounts, so that files opened one after the other share them.  Besides
+   their hash chain, cached blocks are on a list ordered from the most to
+   the least recently used.  */
+struct grub_squash_cache_ent
+{
+  struct grub_squash_cache_ent *next;
+  struct grub_squash_cache_ent **prevp;
+  struct grub_squash_cache_ent *lru_next;
+  struct grub_squash_cache_ent *lru_prev;
+  enum grub_disk_dev_id dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  grub_uint32_t creation_time;
+  grub_uint64_t total_size;
+  grub_uint64_t start;
+  grub_size_t size;
+  int cached;
+  char *buf;
+};
+
+static struct grub_squash_cache_ent *squash_cache[SQUASH_CACHE_HASH];
+static struct grub_squash_cache_ent *squash_cache_mru, *squash_cache_lru;
+static grub_size_t squash_cache_used;
+static grub_size_t squash_cache_limit = SQUASH_CACHE_DEFAULT_SIZE << 10;
+
 struct grub_squash_data
 {
   grub_disk_t disk;
@@ -203,6 +267,7 @@ struct grub_squash_data
 			      struct grub_squash_data *data);
   struct xz_dec *xzdec;
   char *xzbuf;
+  ZSTD_DCtx *zstdctx;
 };
 
 struct grub_fshelp_node
@@ -217,6 +282,178 @@ struct grub_fshelp_node
   } stack[1];
 };
 
+static inline unsigned int
+squash_cache_index (grub_uint64_t start)
+{
+  return (start >> 9) % SQUASH_CACHE_HASH;
+}
+
+static void
+squash_cache_free (struct grub_squash_cache_ent *ent)
+{
+  grub_free (ent->buf);
+  grub_free (ent);
+}
+
+static void
+squash_cache_lru_unlink (struct grub_squash_cache_ent *ent)
+{
+  if (ent->lru_prev)
+    ent->lru_prev->lru_next = ent->lru_next;
+  else
+    squash_cache_mru = ent->lru_next;
+  if (ent->lru_next)
+    ent->lru_next->lru_prev = ent->lru_prev;
+  else
+    squash_cache_lru = ent->lru_prev;
+}
+
+static void
+squash_cache_lru_push (struct grub_squash_cache_ent *ent)
+{
+  ent->lru_prev = NULL;
+  ent->lru_next = squash_cache_mru;
+  if (squash_cache_mru)
+    squash_cache_mru->lru_prev = ent;
+  else
+    squash_cache_lru = ent;
+  squash_cache_mru = ent;
+}
+
+/* Drop least recently used blocks until SIZE more bytes fit.  */
+static void
+squash_cache_shrink (grub_size_t size)
+{
+  struct grub_squash_cache_ent *ent;
+
+  while (squash_cache_used + size > squash_cache_limit && squash_cache_lru)
+    {
+      ent = squash_cache_lru;
+      squash_cache_lru_unlink (ent);
+      *ent->prevp = ent->next;
+      if (ent->next)
+	ent->next->prevp = ent->prevp;
+      squash_cache_used -= ent->size;
+      squash_cache_free (ent);
+    }
+}
+
+static void
+squash_cache_flush (void)
+{
+  struct grub_squash_cache_ent *ent;
+
+  while (squash_cache_mru)
+    {
+      ent = squash_cache_mru;
+      squash_cache_mru = ent->lru_next;
+      squash_cache_free (ent);
+    }
+  squash_cache_lru = NULL;
+  grub_memset (squash_cache, 0, sizeof (squash_cache));
+  squash_cache_used = 0;
+}
+
+/* Return the block of CSIZE compressed bytes at START decompressed, MAXSIZE
+   being an upper bound of its size.  The block must be handed back with
+   squash_cache_put before the next call.  */
+static struct grub_squash_cache_ent *
+squash_cache_get (struct grub_squash_data *data, grub_uint64_t start,
+		  grub_size_t csize, grub_size_t maxsize)
+{
+  grub_disk_t disk = data->disk;
+  grub_disk_addr_t part_start = grub_partition_get_start (disk->partition);
+  struct grub_squash_cache_ent *ent;
+  unsigned int idx = squash_cache_index (start);
+  grub_ssize_t size;
+  char *tmp;
+
+  for (ent = squash_cache[idx]; ent; ent = ent->next)
+    if (ent->start == start && ent->dev_id == disk->dev->id
+	&& ent->disk_id == disk->id && ent->part_start == part_start
+	&& ent->creation_time == data->sb.creation_time
+	&& ent->total_size == data->sb.total_size)
+      {
+	if (ent != squash_cache_mru)
+	  {
+	    squash_cache_lru_unlink (ent);
+	    squash_cache_lru_push (ent);
+	  }
+	return ent;
+      }
+
+  ent = grub_zalloc (sizeof (*ent));
+  if (!ent)
+    return NULL;
+  ent->buf = grub_malloc (maxsize);
+  tmp = grub_malloc (csize);
+  if (!ent->buf || !tmp)
+    goto fail;
+
+  if (grub_disk_read (disk, start >> GRUB_DISK_SECTOR_BITS,
+		      start & (GRUB_DISK_SECTOR_SIZE - 1), csize, tmp))
+    goto fail;
+  size = data->decompress (tmp, csize, 0, ent->buf, maxsize, data);
+  if (size < 0)
+    goto fail;
+  grub_free (tmp);
+
+  ent->dev_id = disk->dev->id;
+  ent->disk_id = disk->id;
+  ent->part_start = part_start;
+  ent->creation_time = data->sb.creation_time;
+  ent->total_size = data->sb.total_size;
+  ent->start = start;
+  ent->size = size;
+
+  if (ent->size <= squash_cache_limit)
+    {
+      squash_cache_shrink (ent->size);
+      ent->next = squash_cache[idx];
+      if (ent->next)
+	ent->next->prevp = &ent->next;
+      ent->prevp = &squash_cache[idx];
+      squash_cache[idx] = ent;
+      squash_cache_lru_push (ent);
+      squash_cache_used += ent->size;
+      ent->cached = 1;
+    }
+  return ent;
+
+ fail:
+  grub_free (tmp);
+  squash_cache_free (ent);
+  return NULL;
+}
+
+static void
+squash_cache_put (struct grub_squash_cache_ent *ent)
+{
+  if (!ent->cached)
+    squash_cache_free (ent);
+}
+
+/* Copy LEN bytes at OFF of the decompressed block at START to BUF.  */
+static grub_err_t
+squash_read_block (struct grub_squash_data *data, grub_uint64_t start,
+		   grub_size_t csize, grub_size_t maxsize,
+		   grub_off_t off, void *buf, grub_size_t len)
+{
+  struct grub_squash_cache_ent *ent;
+
+  ent = squash_cache_get (data, start, csize, maxsize);
+  if (!ent)
+    return grub_errno;
+  if (off > ent->size || len > ent->size - off)
+    {
+      squash_cache_put (ent);
+      return grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
+    }
+  grub_memcpy (buf, ent->buf + off, len);
+  squash_cache_put (ent);
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 read_chunk (struct grub_squash_data *data, void *buf, grub_size_t len,
 	    grub_uint64_t chunk_start, grub_off_t offset)
@@ -255,29 +492,12 @@ read_chunk (struct grub_squash_data *data, void *buf, grub_size_t len,
 	}
       else
 	{
-	  char *tmp;
 	  grub_size_t bsize = grub_le_to_cpu16 (d) & ~SQUASH_CHUNK_FLAGS; 
-	  grub_disk_addr_t a = chunk_start + 2;
-	  tmp = grub_malloc (bsize);
-	  if (!tmp)
-	    return grub_errno;
-	  /* FIXME: buffer uncompressed data.  */
-	  err = grub_disk_read (data->disk, (a >> GRUB_DISK_SECTOR_BITS),
-				a & (GRUB_DISK_SECTOR_SIZE - 1),
-				bsize, tmp);
-	  if (err)
-	    {
-	      grub_free (tmp);
-	      return err;
-	    }
 
-	  if (data->decompress (tmp, bsize, offset,
-				buf, csize, data) < 0)
-	    {
-	      grub_free (tmp);
-	      return grub_errno;
-	    }
-	  grub_free (tmp);
+	  err = squash_read_block (data, chunk_start + 2, bsize,
+				   SQUASH_CHUNK_SIZE, offset, buf, csize);
+	  if (err)
+	    return err;
 	}
       len -= csize;
       offset += csize;
@@ -286,6 +506,13 @@ read_chunk (struct grub_squash_data *data, void *buf, grub_size_t len,
   return GRUB_ERR_NONE;
 }
 
+/* Largest decompressed size of a metadata or data block.  */
+static inline grub_size_t
+squash_max_block (struct grub_squash_data *data)
+{
+  return data->blksz < SQUASH_CHUNK_SIZE ? SQUASH_CHUNK_SIZE : data->blksz;
+}
+
 static grub_ssize_t
 zlib_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
 		 char *outbuf, grub_size_t outsize,
@@ -298,23 +525,33 @@ static grub_ssize_t
 lzo_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
 		char *outbuf, grub_size_t len, struct grub_squash_data *data)
 {
-  lzo_uint usize = data->blksz;
-  grub_uint8_t *udata;
-
-  if (usize < 8192)
-    usize = 8192;
+  lzo_uint usize = len;
+  grub_uint8_t *udata = (grub_uint8_t *) outbuf;
 
-  udata = grub_malloc (usize);
-  if (!udata)
-    return -1;
+  /* Decode straight into OUTBUF, which is sized for the kind of block being
+     read, unless the block does not start there.  */
+  if (off)
+    {
+      usize = squash_max_block (data);
+      udata = grub_malloc (usize);
+      if (!udata)
+	return -1;
+    }
 
   if (lzo1x_decompress_safe ((grub_uint8_t *) inbuf,
 			     insize, udata, &usize, NULL) != LZO_E_OK)
     {
       grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
-      grub_free (udata);
+      if (udata != (grub_uint8_t *) outbuf)
+	grub_free (udata);
       return -1;
     }
+  if (udata == (grub_uint8_t *) outbuf)
+    return usize;
+  if (off > usize)
+    off = usize;
+  if (len > usize - off)
+    len = usize - off;
   grub_memcpy (outbuf, udata + off, len);
   grub_free (udata);
   return len;
@@ -378,6 +615,201 @@ xz_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
   return ret;
 }
 
+/* Decode a raw LZ4 block of INSIZE bytes into at most OUTSIZE bytes of
+   OUT.  Return the decoded size or -1 if the block is invalid.  */
+static grub_ssize_t
+lz4_decode_block (const grub_uint8_t *ip, grub_size_t insize,
+		  grub_uint8_t *out, grub_size_t outsize)
+{
+  const grub_uint8_t *iend = ip + insize;
+  grub_uint8_t *op = out, *oend = out + outsize;
+
+  while (ip < iend)
+    {
+      grub_uint8_t token = *ip++, b;
+      grub_size_t lit, mlen, offset;
+      const grub_uint8_t *ref;
+
+      lit = token >> 4;
+      if (lit == 15)
+	do
+	  {
+	    if (ip >= iend)
+	      return -1;
+	    b = *ip++;
+	    lit += b;
+	  }
+	while (b == 255);
+      if (lit > (grub_size_t) (iend - ip) || lit > (grub_size_t) (oend - op))
+	return -1;
+      grub_memcpy (op, ip, lit);
+      op += lit;
+      ip += lit;
+
+      /* The last sequence has no match.  */
+      if (ip == iend)
+	break;
+
+      if (iend - ip < 2)
+	return -1;
+      offset = ip[0] | (ip[1] << 8);
+      ip += 2;
+      if (offset == 0 || offset > (grub_size_t) (op - out))
+	return -1;
+
+      mlen = token & 15;
+      if (mlen == 15)
+	do
+	  {
+	    if (ip >= iend)
+	      return -1;
+	    b = *ip++;
+	    mlen += b;
+	  }
+	while (b == 255);
+      mlen += 4;
+      if (mlen > (grub_size_t) (oend - op))
+	return -1;
+
+      /* A match may overlap the bytes it produces.  */
+      ref = op - offset;
+      if (offset >= mlen)
+	{
+	  grub_memcpy (op, ref, mlen);
+	  op += mlen;
+	}
+      else
+	while (mlen--)
+	  *op++ = *ref++;
+    }
+
+  return op - out;
+}
+
+static grub_ssize_t
+lz4_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
+		char *outbuf, grub_size_t len, struct grub_squash_data *data)
+{
+  grub_size_t usize = len;
+  grub_uint8_t *udata = (grub_uint8_t *) outbuf;
+  grub_ssize_t ret;
+
+  /* Blocks are only decoded whole, into OUTBUF if they start there.  */
+  if (off)
+    {
+      usize = squash_max_block (data);
+      udata = grub_malloc (usize);
+      if (!udata)
+	return -1;
+    }
+
+  ret = lz4_decode_block ((grub_uint8_t *) inbuf, insize, udata, usize);
+  if (ret < 0)
+    grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "invalid lz4 chunk");
+  else if (udata != (grub_uint8_t *) outbuf)
+    {
+      if (off > (grub_size_t) ret)
+	off = ret;
+      if (len > ret - off)
+	len = ret - off;
+      grub_memcpy (outbuf, udata + off, len);
+      ret = len;
+    }
+
+  if (udata != (grub_uint8_t *) outbuf)
+    grub_free (udata);
+  return ret;
+}
+
+static grub_ssize_t
+zstd_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
+		 char *outbuf, grub_size_t len, struct grub_squash_data *data)
+{
+  grub_size_t usize = len;
+  char *udata = outbuf;
+  grub_size_t zret;
+  grub_ssize_t ret = -1;
+
+  /* zstd fails unless the whole frame fits in the output, so a block that
+     does not start at OUTBUF goes through a buffer of the largest size.  */
+  if (off)
+    {
+      usize = squash_max_block (data);
+      udata = grub_malloc (usize);
+      if (!udata)
+	return -1;
+    }
+
+  zret = ZSTD_decompressDCtx (data->zstdctx, udata, usize, inbuf, insize);
+  if (ZSTD_isError (zret))
+    grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "invalid zstd chunk");
+  else if (udata != outbuf)
+    {
+      if (off > zret)
+	off = zret;
+      if (len > zret - off)
+	len = zret - off;
+      grub_memcpy (outbuf, udata + off, len);
+      ret = len;
+    }
+  else
+    ret = zret;
+
+  if (udata != outbuf)
+    grub_free (udata);
+  return ret;
+}
+
+/* Read the compressor options and check they are understood.  */
+static grub_err_t
+squash_check_comp_opts (struct grub_squash_data *data)
+{
+  union grub_squash_comp_opts opts;
+  grub_size_t size;
+
+  if (!(data->sb.flags & grub_cpu_to_le16_compile_time (SQUASH_FLAG_COMP_OPTS)))
+    return GRUB_ERR_NONE;
+
+  switch (data->sb.compression)
+    {
+    case grub_cpu_to_le16_compile_time (COMPRESSION_LZ4):
+      size = sizeof (opts.lz4);
+      break;
+    case grub_cpu_to_le16_compile_time (COMPRESSION_ZSTD):
+      size = sizeof (opts.zstd);
+      break;
+    default:
+      /* Nothing in the other options affects decompression.  */
+      return GRUB_ERR_NONE;
+    }
+
+  if (read_chunk (data, &opts, size, sizeof (data->sb), 0))
+    return grub_errno;
+
+  switch (data->sb.compression)
+    {
+    case grub_cpu_to_le16_compile_time (COMPRESSION_LZ4):
+      if (opts.lz4.version != grub_cpu_to_le32_compile_time (SQUASH_LZ4_LEGACY))
+	return grub_error (GRUB_ERR_BAD_FS, "unsupported lz4 version %d",
+			   grub_le_to_cpu32 (opts.lz4.version));
+      break;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+static void
+squash_unmount (struct grub_squash_data *data)
+{
+  if (data->xzdec)
+    xz_dec_end (data->xzdec);
+  ZSTD_freeDCtx (data->zstdctx);
+  grub_free (data->xzbuf);
+  grub_free (data->ino.cumulated_block_sizes);
+  grub_free (data->ino.block_sizes);
+  grub_free (data);
+}
+
 static struct grub_squash_data *
 squash_mount (grub_disk_t disk)
 {
@@ -440,6 +872,21 @@ squash_mount (grub_disk_t disk)
 	  return NULL;
 	}
       break;
+    case grub_cpu_to_le16_compile_time (COMPRESSION_LZ4):
+      data->decompress = lz4_decompress;
+      break;
+    case grub_cpu_to_le16_compile_time (COMPRESSION_ZSTD):
+      {
+	data->decompress = zstd_decompress;
+	data->zstdctx = ZSTD_createDCtx_advanced (grub_zstd_allocator ());
+	if (!data->zstdctx)
+	  {
+	    grub_free (data);
+	    grub_error (GRUB_ERR_OUT_OF_MEMORY, "failed to create a zstd context");
+	    return NULL;
+	  }
+      }
+      break;
     default:
       grub_free (data);
       grub_error (GRUB_ERR_BAD_FS, "unsupported compression %d",
@@ -452,6 +899,12 @@ squash_mount (grub_disk_t disk)
        (1U << data->log2_blksz) < data->blksz;
        data->log2_blksz++);
 
+  if (squash_check_comp_opts (data))
+    {
+      squash_unmount (data);
+      return NULL;
+    }
+
   return data;
 }
 
@@ -648,16 +1101,6 @@ make_root_node (struct grub_squash_data *data, struct grub_fshelp_node *root)
 		    root->stack[0].ino_offset);
 }
 
-static void
-squash_unmount (struct grub_squash_data *data)
-{
-  if (data->xzdec)
-    xz_dec_end (data->xzdec);
-  grub_free (data->xzbuf);
-  grub_free (data->ino.cumulated_block_sizes);
-  grub_free (data->ino.block_sizes);
-  grub_free (data);
-}
 
 
 /* Context for grub_squash_dir.  */
@@ -854,32 +1297,10 @@ direct_read (struct grub_squash_data *data,
       else if (!(ino->block_sizes[i]
 	    & grub_cpu_to_le32_compile_time (SQUASH_BLOCK_UNCOMPRESSED)))
 	{
-	  char *block;
 	  grub_size_t csize;
 	  csize = grub_le_to_cpu32 (ino->block_sizes[i]) & ~SQUASH_BLOCK_FLAGS;
-	  block = grub_malloc (csize);
-	  if (!block)
-	    return -1;
-	  err = grub_disk_read (data->disk,
-				(ino->cumulated_block_sizes[i] + a)
-				>> GRUB_DISK_SECTOR_BITS,
-				(ino->cumulated_block_sizes[i] + a)
-				& (GRUB_DISK_SECTOR_SIZE - 1),
-				csize, block);
-	  if (err)
-	    {
-	      grub_free (block);
-	      return -1;
-	    }
-	  if (data->decompress (block, csize, boff, buf, curread, data)
-	      != (grub_ssize_t) curread)
-	    {
-	      grub_free (block);
-	      if (!grub_errno)
-		grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
-	      return -1;
-	    }
-	  grub_free (block);
+	  err = squash_read_block (data, ino->cumulated_block_sizes[i] + a,
+				   csize, data->blksz, boff, buf, curread);
 	}
       else
 	err = grub_disk_read (data->disk, 
@@ -958,32 +1379,12 @@ grub_squash_read (grub_file_t file, char *buf, grub_size_t len)
   else
     b = grub_le_to_cpu32 (ino->ino.file.offset) + off;
   
-  /* FIXME: cache uncompressed chunks.  */
   if (compressed)
     {
-      char *block;
-      block = grub_malloc (grub_le_to_cpu32 (frag.size));
-      if (!block)
-	return -1;
-      err = grub_disk_read (data->disk,
-			    a >> GRUB_DISK_SECTOR_BITS,
-			    a & (GRUB_DISK_SECTOR_SIZE - 1),
-			    grub_le_to_cpu32 (frag.size), block);
+      err = squash_read_block (data, a, grub_le_to_cpu32 (frag.size),
+			       data->blksz, b, buf, len);
       if (err)
-	{
-	  grub_free (block);
-	  return -1;
-	}
-      if (data->decompress (block, grub_le_to_cpu32 (frag.size),
-			    b, buf, len, data)
-	  != (grub_ssize_t) len)
-	{
-	  grub_free (block);
-	  if (!grub_errno)
-	    grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
-	  return -1;
-	}
-      grub_free (block);
+	return -1;
     }
   else
     {
@@ -1030,13 +1431,37 @@ static struct grub_fs grub_squash_fs =
     .next = 0
   };
 
+static char *
+squash_cache_size_write (struct grub_env_var *var __attribute__ ((unused)),
+			 const char *val)
+{
+  grub_size_t size;
+
+  if (grub_env_parse_size (val, &size))
+    return NULL;
+
+  squash_cache_limit = size;
+  squash_cache_shrink (0);
+  return grub_strdup (val);
+}
+
 GRUB_MOD_INIT(squash4)
 {
+  COMPILE_TIME_ASSERT (OFFSET_OF (struct grub_squash_super, block_log) == 22);
+  COMPILE_TIME_ASSERT (OFFSET_OF (struct grub_squash_super, flags) == 24);
+  COMPILE_TIME_ASSERT (OFFSET_OF (struct grub_squash_super, no_ids) == 26);
+  COMPILE_TIME_ASSERT (OFFSET_OF (struct grub_squash_super, s_major) == 28);
+  COMPILE_TIME_ASSERT (OFFSET_OF (struct grub_squash_super, s_minor) == 30);
+  COMPILE_TIME_ASSERT (sizeof (struct grub_squash_super) == 96);
   grub_fs_register (&grub_squash_fs);
+  grub_register_variable_hook ("squash_cache_size", 0,
+			       squash_cache_size_write);
 }
 
 GRUB_MOD_FINI(squash4)
 {
+  grub_register_variable_hook ("squash_cache_size", 0, 0);
   grub_fs_unregister (&grub_squash_fs);
+  squash_cache_flush ();
 }
 
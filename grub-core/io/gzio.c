@@ -44,6 +44,9 @@
 #include <grub/deflate.h>
 #include <grub/i18n.h>
 #include <grub/crypto.h>
+#include <grub/env.h>
+#include <grub/extcmd.h>
+#include <grub/list.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -58,6 +61,68 @@ GRUB_MOD_LICENSE ("GPLv3+");
 
 #define INBUFSIZ  0x2000
 
+/* Default spacing of access points and default memory budget for them.  */
+#define GZIO_INDEX_INTERVAL	(1 << 20)
+#define GZIO_INDEX_BUDGET	(4 << 20)
+
+#define GZIO_INDEX_MAGIC	"GRUBGZIX"
+#define GZIO_INDEX_VERSION	2
+
+/* Access point: the decompressor state at a deflate block boundary, from
+   which decompression can be resumed without starting over.  */
+struct grub_gzio_point
+{
+  /* Offset in the uncompressed data.  */
+  grub_off_t out;
+  /* Offset of the next unread byte in the underlying file.  */
+  grub_off_t in;
+  /* Bit buffer and number of bits in it.  */
+  grub_uint64_t bb;
+  grub_uint32_t bk;
+  /* Position in the slide.  */
+  grub_uint32_t wp;
+  grub_uint8_t slide[WSIZE];
+};
+
+/* Layout of an index file as written by the gzindex command. The header
+   is followed by COUNT entries, each followed by the 32K slide. SIZE,
+   COMPRESSED_SIZE, CRC32 and MTIME identify the gzip file the index was
+   made from; an index is only used for a file that matches all of them.  */
+struct grub_gzio_index_header
+{
+  char magic[8];
+  grub_uint32_t version;
+  grub_uint32_t count;
+  grub_uint64_t interval;
+  grub_uint64_t size;
+  grub_uint64_t compressed_size;
+  grub_uint32_t crc32;
+  grub_uint32_t mtime_set;
+  grub_int64_t mtime;
+} GRUB_PACKED;
+
+struct grub_gzio_index_entry
+{
+  grub_uint64_t out;
+  grub_uint64_t in;
+  grub_uint64_t bb;
+  grub_uint32_t bk;
+  grub_uint32_t wp;
+} GRUB_PACKED;
+
+/* An index loaded by gzindex --load. Gzip files whose fingerprint
+   matches HDR start with a copy of its access points.  */
+struct grub_gzio_loaded_index
+{
+  struct grub_gzio_loaded_index *next;
+  struct grub_gzio_loaded_index **prev;
+  struct grub_gzio_index_header hdr;
+  unsigned count;
+  struct grub_gzio_point *points;
+};
+
+static struct grub_gzio_loaded_index *loaded_indexes;
+
 /* The state stored in filesystem-specific data.  */
 struct grub_gzio
 {
@@ -83,6 +148,8 @@ struct grub_gzio
   /* The input buffer.  */
   grub_uint8_t inbuf[INBUFSIZ];
   int inbuf_d;
+  /* The offset of INBUF in the underlying file.  */
+  grub_off_t inbuf_pos;
   /* The bit buffer.  */
   unsigned long bb;
   /* The bits in the bit buffer.  */
@@ -109,6 +176,14 @@ struct grub_gzio
   int bd;
   /* The original offset value.  */
   grub_off_t saved_offset;
+  /* Set after resuming from an access point, the checksum can't be
+     verified then.  */
+  int skip_checksum;
+  /* Access points sorted by offset, and their minimal spacing.  */
+  struct grub_gzio_point **points;
+  unsigned num_points;
+  unsigned max_points;
+  grub_off_t point_interval;
 };
 typedef struct grub_gzio *grub_gzio_t;
 
@@ -393,6 +468,7 @@ get_byte (grub_gzio_t gzio)
 		     || gzio->inbuf_d == INBUFSIZ))
     {
       gzio->inbuf_d = 0;
+      gzio->inbuf_pos = grub_file_tell (gzio->file);
       grub_file_read (gzio->file, gzio->inbuf, INBUFSIZ);
     }
 
@@ -1043,12 +1119,93 @@ get_new_block (grub_gzio_t gzio)
 }
 
 
+/* Remember the current state as an access point if it is far enough
+   from the last one. When the budget is exhausted, every other point is
+   dropped and the spacing doubled.  */
 static void
-inflate_window (grub_gzio_t gzio)
+gzio_add_point (grub_gzio_t gzio)
 {
-  /* initialize window */
-  gzio->wp = 0;
+  struct grub_gzio_point *p;
+  grub_off_t out, last;
+  unsigned i;
+
+  if (! gzio->max_points)
+    return;
 
+  out = gzio->saved_offset + gzio->wp;
+  last = gzio->num_points ? gzio->points[gzio->num_points - 1]->out : 0;
+  if (out < last + gzio->point_interval)
+    return;
+
+  if (gzio->num_points == gzio->max_points)
+    {
+      for (i = 0; i < gzio->num_points; i++)
+	if (i & 1)
+	  grub_free (gzio->points[i]);
+	else
+	  gzio->points[i / 2] = gzio->points[i];
+      gzio->num_points = (gzio->num_points + 1) / 2;
+      gzio->point_interval *= 2;
+      last = gzio->points[gzio->num_points - 1]->out;
+      if (out < last + gzio->point_interval)
+	return;
+    }
+
+  p = grub_malloc (sizeof (*p));
+  if (! p)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  p->out = out;
+  p->in = gzio->inbuf_pos + gzio->inbuf_d;
+  p->bb = gzio->bb;
+  p->bk = gzio->bk;
+  p->wp = gzio->wp;
+  grub_memcpy (p->slide, gzio->slide, WSIZE);
+  gzio->points[gzio->num_points++] = p;
+}
+
+/* Return the last access point at or before OFFSET.  */
+static struct grub_gzio_point *
+gzio_find_point (grub_gzio_t gzio, grub_off_t offset)
+{
+  unsigned lo = 0, hi = gzio->num_points;
+
+  if (! hi || gzio->points[0]->out > offset)
+    return NULL;
+
+  while (hi - lo > 1)
+    {
+      unsigned mid = (lo + hi) / 2;
+
+      if (gzio->points[mid]->out <= offset)
+	lo = mid;
+      else
+	hi = mid;
+    }
+
+  return gzio->points[lo];
+}
+
+static void
+gzio_free_points (grub_gzio_t gzio)
+{
+  unsigned i;
+
+  for (i = 0; i < gzio->num_points; i++)
+    grub_free (gzio->points[i]);
+  grub_free (gzio->points);
+  gzio->points = NULL;
+  gzio->num_points = 0;
+  gzio->max_points = 0;
+}
+
+/* Continue filling the window from the current position.  */
+static void
+inflate_window_fill (grub_gzio_t gzio)
+{
   /*
    *  Main decompression loop.
    */
@@ -1060,6 +1217,7 @@ inflate_window (grub_gzio_t gzio)
 	  if (gzio->last_block)
 	    break;
 
+	  gzio_add_point (gzio);
 	  get_new_block (gzio);
 	}
 
@@ -1107,7 +1265,7 @@ inflate_window (grub_gzio_t gzio)
 
   gzio->saved_offset += gzio->wp;
 
-  if (gzio->hcontext)
+  if (gzio->hcontext && ! gzio->skip_checksum)
     {
       gzio->hdesc->write (gzio->hcontext, gzio->slide, gzio->wp);
 
@@ -1127,10 +1285,46 @@ inflate_window (grub_gzio_t gzio)
 }
 
 
+static void
+inflate_window (grub_gzio_t gzio)
+{
+  /* initialize window */
+  gzio->wp = 0;
+
+  inflate_window_fill (gzio);
+}
+
+
+/* Resume decompression at access point P.  */
+static void
+gzio_restore_point (grub_gzio_t gzio, struct grub_gzio_point *p)
+{
+  gzio->saved_offset = p->out - p->wp;
+  gzio->wp = p->wp;
+  grub_memcpy (gzio->slide, p->slide, WSIZE);
+  gzio->bb = p->bb;
+  gzio->bk = p->bk;
+  gzio->last_block = 0;
+  gzio->block_len = 0;
+
+  huft_free (gzio->tl);
+  huft_free (gzio->td);
+  gzio->tl = NULL;
+  gzio->td = NULL;
+
+  gzio_seek (gzio, p->in);
+  gzio->inbuf_d = INBUFSIZ;
+  gzio->skip_checksum = 1;
+
+  inflate_window_fill (gzio);
+}
+
+
 static void
 initialize_tables (grub_gzio_t gzio)
 {
   gzio->saved_offset = 0;
+  gzio->skip_checksum = 0;
   gzio_seek (gzio, gzio->data_offset);
 
   /* Initialize the bit buffer.  */
@@ -1152,6 +1346,175 @@ initialize_tables (grub_gzio_t gzio)
 }
 
 
+/* Memory budget for the access points of one file, set in KiB by the
+   gzio_index_size variable.  */
+static grub_size_t
+gzio_index_budget (void)
+{
+  grub_size_t budget = GZIO_INDEX_BUDGET;
+  const char *val;
+
+  val = grub_env_get ("gzio_index_size");
+  if (val && *val && grub_env_parse_size (val, &budget))
+    grub_errno = GRUB_ERR_NONE;
+
+  return budget;
+}
+
+/* Start recording access points within the budget (0 disables).  */
+static void
+gzio_init_index (grub_gzio_t gzio)
+{
+  grub_size_t budget = gzio_index_budget ();
+
+  if (budget < 2 * sizeof (struct grub_gzio_point))
+    return;
+
+  gzio->max_points = budget / sizeof (struct grub_gzio_point);
+  gzio->points = grub_calloc (gzio->max_points, sizeof (gzio->points[0]));
+  if (! gzio->points)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      gzio->max_points = 0;
+      return;
+    }
+  gzio->point_interval = GZIO_INDEX_INTERVAL;
+}
+
+/* Context for gzio_get_mtime.  */
+struct gzio_mtime_ctx
+{
+  const char *basename;
+  int found;
+  grub_int32_t mtime;
+};
+
+/* Helper for gzio_get_mtime.  */
+static int
+gzio_get_mtime_iter (const char *filename,
+		     const struct grub_dirhook_info *info, void *data)
+{
+  struct gzio_mtime_ctx *ctx = data;
+
+  if ((info->case_insensitive ? grub_strcasecmp (filename, ctx->basename)
+       : grub_strcmp (filename, ctx->basename)) != 0)
+    return 0;
+
+  ctx->found = info->mtimeset;
+  ctx->mtime = info->mtime;
+  return 1;
+}
+
+/* Store the modification time of the file NAME in MTIME. Return 0 if it
+   isn't known.  */
+static int
+gzio_get_mtime (const char *name, grub_int32_t *mtime)
+{
+  struct gzio_mtime_ctx ctx = { .found = 0, .mtime = 0 };
+  const char *path;
+  char *device_name, *dir;
+  grub_device_t dev;
+  grub_fs_t fs;
+
+  *mtime = 0;
+  path = (name[0] == '(') ? grub_strchr (name, ')') : NULL;
+  path = path ? path + 1 : name;
+  ctx.basename = grub_strrchr (path, '/');
+  if (! ctx.basename || ! ctx.basename[1])
+    return 0;
+  ctx.basename++;
+
+  device_name = grub_file_get_device_name (name);
+  if (grub_errno)
+    goto out;
+  dev = grub_device_open (device_name);
+  grub_free (device_name);
+  if (! dev)
+    goto out;
+
+  fs = grub_fs_probe (dev);
+  dir = grub_strndup (path, ctx.basename - path);
+  if (fs && fs->fs_dir && dir)
+    fs->fs_dir (dev, dir, gzio_get_mtime_iter, &ctx);
+  grub_free (dir);
+  grub_device_close (dev);
+
+ out:
+  grub_errno = GRUB_ERR_NONE;
+  *mtime = ctx.mtime;
+  return ctx.found;
+}
+
+/* Fill in the fields of HDR that identify the gzip file FILE.  */
+static void
+gzio_fingerprint (grub_file_t file, struct grub_gzio_index_header *hdr)
+{
+  grub_gzio_t gzio = file->data;
+  grub_int32_t mtime;
+  int mtime_set;
+
+  mtime_set = gzio_get_mtime (gzio->file->name, &mtime);
+  hdr->size = grub_cpu_to_le64 (file->size);
+  hdr->compressed_size = grub_cpu_to_le64 (grub_file_size (gzio->file));
+  hdr->crc32 = grub_cpu_to_le32 (gzio->orig_checksum);
+  hdr->mtime_set = grub_cpu_to_le32 (mtime_set);
+  hdr->mtime = grub_cpu_to_le64 (mtime);
+}
+
+static int
+gzio_fingerprint_equal (const struct grub_gzio_index_header *a,
+			const struct grub_gzio_index_header *b)
+{
+  return (a->size == b->size && a->compressed_size == b->compressed_size
+	  && a->crc32 == b->crc32 && a->mtime_set == b->mtime_set
+	  && a->mtime == b->mtime);
+}
+
+/* Seed the access points of FILE from an index loaded by gzindex --load
+   for the same gzip file. Only the cheap parts of the fingerprint are
+   compared before looking up the modification time, so files without a
+   loaded index don't pay for it.  */
+static void
+gzio_apply_loaded_index (grub_file_t file)
+{
+  grub_gzio_t gzio = file->data;
+  struct grub_gzio_loaded_index *li;
+  struct grub_gzio_index_header hdr;
+  unsigned i;
+
+  FOR_LIST_ELEMENTS (li, loaded_indexes)
+    if (grub_le_to_cpu64 (li->hdr.size) == file->size
+	&& grub_le_to_cpu64 (li->hdr.compressed_size)
+	   == grub_file_size (gzio->file)
+	&& grub_le_to_cpu32 (li->hdr.crc32) == gzio->orig_checksum)
+      break;
+  if (! li)
+    return;
+
+  gzio_fingerprint (file, &hdr);
+  if (! gzio_fingerprint_equal (&hdr, &li->hdr))
+    return;
+
+  gzio_init_index (gzio);
+  if (! gzio->max_points)
+    return;
+
+  gzio->point_interval = grub_le_to_cpu64 (li->hdr.interval);
+  for (i = 0; i < li->count && gzio->num_points < gzio->max_points; i++)
+    {
+      struct grub_gzio_point *p;
+
+      p = grub_malloc (sizeof (*p));
+      if (! p)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  break;
+	}
+      grub_memcpy (p, &li->points[i], sizeof (*p));
+      gzio->points[gzio->num_points++] = p;
+    }
+}
+
 /* Open a new decompressing object on the top of IO. If TRANSPARENT is true,
    even if IO does not contain data compressed by gzip, return a valid file
    object. Note that this function won't close IO, even if an error occurs.  */
@@ -1196,6 +1559,9 @@ grub_gzio_open (grub_file_t io, enum grub_file_type type)
       return io;
     }
 
+  if (loaded_indexes && file->size > GZIO_INDEX_INTERVAL)
+    gzio_apply_loaded_index (file);
+
   return file;
 }
 
@@ -1256,10 +1622,29 @@ grub_gzio_read_real (grub_gzio_t gzio, grub_off_t offset,
 		     char *buf, grub_size_t len)
 {
   grub_ssize_t ret = 0;
+  struct grub_gzio_point *p;
 
-  /* Do we reset decompression to the beginning of the file?  */
+  /* Resume from the nearest access point if going backwards or if it
+     saves decompressing the data in between, otherwise reset
+     decompression to the beginning of the file.  */
+  p = gzio_find_point (gzio, offset);
   if (gzio->saved_offset > offset + WSIZE)
-    initialize_tables (gzio);
+    {
+      if (p)
+	gzio_restore_point (gzio, p);
+      else
+	{
+	  /* The file isn't read sequentially, record access points from
+	     now on so that the next such read doesn't start over.  Reads
+	     from the start never resume from a point and keep verifying
+	     the checksum.  */
+	  if (gzio->file && ! gzio->points)
+	    gzio_init_index (gzio);
+	  initialize_tables (gzio);
+	}
+    }
+  else if (p && p->out > gzio->saved_offset)
+    gzio_restore_point (gzio, p);
 
   /*
    *  This loop operates upon uncompressed data only.  The only
@@ -1325,6 +1710,7 @@ grub_gzio_close (grub_file_t file)
   grub_file_close (gzio->file);
   huft_free (gzio->tl);
   huft_free (gzio->td);
+  gzio_free_points (gzio);
   grub_free (gzio->hcontext);
   grub_free (gzio);
 
@@ -1386,6 +1772,225 @@ grub_deflate_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
 
 
 
+static grub_err_t
+gzio_write_index (grub_file_t out, grub_off_t *pos, const void *buf,
+		  grub_size_t len)
+{
+  grub_file_seek (out, *pos);
+  if (grub_blocklist_write (out, buf, len) < 0 && ! grub_errno)
+    grub_error (GRUB_ERR_WRITE_ERROR, N_("cannot write to `%s'"), out->name);
+  *pos += len;
+  return grub_errno;
+}
+
+/* Load the index NAME made for FILE and keep it for later opens of
+   FILE.  */
+static grub_err_t
+gzio_load_index (grub_file_t file, const char *name)
+{
+  struct grub_gzio_loaded_index *li, *old;
+  struct grub_gzio_index_header hdr, want;
+  struct grub_gzio_index_entry ent;
+  grub_file_t idx;
+  grub_size_t count;
+  unsigned i;
+
+  idx = grub_file_open (name, GRUB_FILE_TYPE_LOOPBACK
+			| GRUB_FILE_TYPE_NO_DECOMPRESS);
+  if (! idx)
+    return grub_errno;
+
+  if (grub_file_read (idx, &hdr, sizeof (hdr)) != sizeof (hdr)
+      || grub_memcmp (hdr.magic, GZIO_INDEX_MAGIC, sizeof (hdr.magic)) != 0
+      || grub_le_to_cpu32 (hdr.version) != GZIO_INDEX_VERSION
+      || ! hdr.interval)
+    {
+      grub_file_close (idx);
+      return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			 N_("`%s' is not a gzip index"), name);
+    }
+
+  gzio_fingerprint (file, &want);
+  if (! gzio_fingerprint_equal (&hdr, &want))
+    {
+      grub_file_close (idx);
+      return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			 N_("`%s' was not made from `%s'"), name, file->name);
+    }
+
+  count = gzio_index_budget () / sizeof (struct grub_gzio_point);
+  if (count > grub_le_to_cpu32 (hdr.count))
+    count = grub_le_to_cpu32 (hdr.count);
+
+  li = grub_zalloc (sizeof (*li));
+  if (! li)
+    goto fail;
+  li->hdr = hdr;
+  li->points = grub_calloc (count, sizeof (li->points[0]));
+  if (count && ! li->points)
+    goto fail;
+
+  for (i = 0; i < count; i++)
+    {
+      struct grub_gzio_point *p = &li->points[i];
+
+      if (grub_file_read (idx, &ent, sizeof (ent)) != sizeof (ent))
+	break;
+      p->out = grub_le_to_cpu64 (ent.out);
+      p->in = grub_le_to_cpu64 (ent.in);
+      p->bb = grub_le_to_cpu64 (ent.bb);
+      p->bk = grub_le_to_cpu32 (ent.bk);
+      p->wp = grub_le_to_cpu32 (ent.wp);
+      if (grub_file_read (idx, p->slide, WSIZE) != WSIZE
+	  || p->wp > WSIZE || p->bk > 64 || p->out < p->wp
+	  || p->out > file->size
+	  || p->in >= grub_file_size (((grub_gzio_t) file->data)->file)
+	  || (i && p->out <= li->points[i - 1].out))
+	break;
+    }
+  if (i < count)
+    {
+      if (! grub_errno)
+	grub_error (GRUB_ERR_BAD_FILE_TYPE, N_("`%s' is corrupted"), name);
+      goto fail;
+    }
+  li->count = count;
+  grub_file_close (idx);
+
+  /* Replace an index loaded earlier for the same file.  */
+  FOR_LIST_ELEMENTS (old, loaded_indexes)
+    if (gzio_fingerprint_equal (&old->hdr, &li->hdr))
+      {
+	grub_list_remove (GRUB_AS_LIST (old));
+	grub_free (old->points);
+	grub_free (old);
+	break;
+      }
+  grub_list_push (GRUB_AS_LIST_P (&loaded_indexes), GRUB_AS_LIST (li));
+  return GRUB_ERR_NONE;
+
+ fail:
+  if (li)
+    grub_free (li->points);
+  grub_free (li);
+  grub_file_close (idx);
+  return grub_errno;
+}
+
+static const struct grub_arg_option options[] =
+  {
+    {"load", 'l', 0, N_("Load INDEX_FILE for later reads of FILE instead"
+			" of saving it."), 0, 0},
+    {0, 0, 0, 0, 0, 0}
+  };
+
+static grub_err_t
+grub_cmd_gzindex (grub_extcmd_context_t ctxt, int argc, char **args)
+{
+  grub_file_t file, out = 0;
+  grub_gzio_t gzio;
+  struct grub_gzio_index_header hdr;
+  struct grub_gzio_index_entry ent;
+  grub_off_t pos = 0;
+  char *name = 0;
+  char *buf = 0;
+  unsigned i;
+
+  if (argc < 1)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("filename expected"));
+
+  file = grub_file_open (args[0], GRUB_FILE_TYPE_LOOPBACK);
+  if (! file)
+    return grub_errno;
+
+  if (file->fs != &grub_gzio_fs)
+    {
+      grub_error (GRUB_ERR_BAD_FILE_TYPE, N_("`%s' is not gzip compressed"),
+		  args[0]);
+      goto fail;
+    }
+  gzio = file->data;
+
+  name = (argc > 1) ? grub_strdup (args[1])
+    : grub_xasprintf ("%s.gzi", args[0]);
+  if (! name)
+    goto fail;
+
+  if (ctxt->state[0].set)
+    {
+      gzio_load_index (file, name);
+      goto fail;
+    }
+
+  if (! gzio->points)
+    gzio_init_index (gzio);
+  if (! gzio->max_points)
+    {
+      grub_error (GRUB_ERR_BAD_ARGUMENT, N_("gzip index is disabled"));
+      goto fail;
+    }
+
+  /* Decompress the whole file to record the access points.  */
+  buf = grub_malloc (WSIZE);
+  if (! buf)
+    goto fail;
+  while (file->offset < file->size)
+    if (grub_file_read (file, buf, WSIZE) <= 0)
+      goto fail;
+
+  out = grub_file_open (name, GRUB_FILE_TYPE_LOOPBACK
+			| GRUB_FILE_TYPE_NO_DECOMPRESS);
+  if (! out)
+    goto fail;
+  if (grub_file_size (out) < sizeof (hdr) + (grub_off_t) gzio->num_points
+      * (sizeof (ent) + WSIZE))
+    {
+      grub_error (GRUB_ERR_OUT_OF_RANGE,
+		  N_("`%s' is too small, %llu bytes needed"), name,
+		  (unsigned long long) (sizeof (hdr) + (grub_off_t)
+					gzio->num_points
+					* (sizeof (ent) + WSIZE)));
+      goto fail;
+    }
+  if (! grub_blocklist_convert (out))
+    {
+      grub_error (GRUB_ERR_BAD_DEVICE, N_("cannot write to `%s'"), name);
+      goto fail;
+    }
+
+  grub_memcpy (hdr.magic, GZIO_INDEX_MAGIC, sizeof (hdr.magic));
+  hdr.version = grub_cpu_to_le32_compile_time (GZIO_INDEX_VERSION);
+  hdr.count = grub_cpu_to_le32 (gzio->num_points);
+  hdr.interval = grub_cpu_to_le64 (gzio->point_interval);
+  gzio_fingerprint (file, &hdr);
+  if (gzio_write_index (out, &pos, &hdr, sizeof (hdr)))
+    goto fail;
+
+  for (i = 0; i < gzio->num_points; i++)
+    {
+      struct grub_gzio_point *p = gzio->points[i];
+
+      ent.out = grub_cpu_to_le64 (p->out);
+      ent.in = grub_cpu_to_le64 (p->in);
+      ent.bb = grub_cpu_to_le64 (p->bb);
+      ent.bk = grub_cpu_to_le32 (p->bk);
+      ent.wp = grub_cpu_to_le32 (p->wp);
+      if (gzio_write_index (out, &pos, &ent, sizeof (ent))
+	  || gzio_write_index (out, &pos, p->slide, WSIZE))
+	goto fail;
+    }
+
+ fail:
+  grub_free (buf);
+  grub_free (name);
+  if (out)
+    grub_file_close (out);
+  grub_file_close (file);
+  return grub_errno;
+}
+
+static grub_extcmd_t cmd_gzindex;
+
 static struct grub_fs grub_gzio_fs =
   {
     .name = "gzio",
@@ -1400,9 +2005,22 @@ static struct grub_fs grub_gzio_fs =
 GRUB_MOD_INIT(gzio)
 {
   grub_file_filter_register (GRUB_FILE_FILTER_GZIO, grub_gzio_open);
+  cmd_gzindex = grub_register_extcmd ("gzindex", grub_cmd_gzindex, 0,
+				      N_("[--load] FILE [INDEX_FILE]"),
+				      N_("Save or load the random access index"
+					 " of a gzip file."), options);
 }
 
 GRUB_MOD_FINI(gzio)
 {
+  struct grub_gzio_loaded_index *li, *next;
+
   grub_file_filter_unregister (GRUB_FILE_FILTER_GZIO);
+  grub_unregister_extcmd (cmd_gzindex);
+  FOR_LIST_ELEMENTS_SAFE (li, next, loaded_indexes)
+    {
+      grub_free (li->points);
+      grub_free (li);
+    }
+  loaded_indexes = NULL;
 }
@@ -237,14 +237,58 @@ grub_lzmaio_open (grub_file_t io, enum grub_file_type type __attribute__ ((unuse
 }
 
 
+/* The decoder keeps the last dicBufSize bytes of output in its dictionary.
+   Copy what is wanted from there if OFFSET is still covered, which makes
+   short backward seeks free.  Returns the number of bytes copied.  */
+static grub_size_t
+grub_lzmaio_read_dic (grub_lzmaio_p lzmaio, grub_off_t offset,
+                      char *buf, grub_size_t len)
+{
+   grub_size_t back, pos, n, ret = 0;
+
+   if (offset >= lzmaio->saved_offset
+       || lzmaio->saved_offset - offset > lzmaio->state.dicBufSize)
+      return 0;
+
+   back = lzmaio->saved_offset - offset;
+   if (len > back)
+      len = back;
+
+   /* The dictionary is circular, the newest byte is just before dicPos.  */
+   if (back > lzmaio->state.dicPos)
+      pos = lzmaio->state.dicBufSize - (back - lzmaio->state.dicPos);
+   else
+      pos = lzmaio->state.dicPos - back;
+
+   while (ret < len)
+   {
+      n = lzmaio->state.dicBufSize - pos;
+      if (n > len - ret)
+         n = len - ret;
+      grub_memcpy (buf + ret, lzmaio->state.dic + pos, n);
+      ret += n;
+      pos = 0;
+   }
+
+   return ret;
+}
+
 static grub_ssize_t
 grub_lzmaio_read(struct grub_file *file, char *buf, grub_size_t len)
 {
    grub_lzmaio_p lzmaio = file->data;
    SRes res;
    grub_ssize_t ret = 0;
+   grub_size_t from_dic;
+
+   /* .lzma files have no block structure to jump into, but data decoded
+      recently can be taken from the dictionary.  */
+   from_dic = grub_lzmaio_read_dic (lzmaio, file->offset, buf, len);
+   if (from_dic == len)
+      return len;
+   ret = from_dic;
 
-   if (grub_lzmaio_seek (file) != GRUB_ERR_NONE)
+   if (! from_dic && grub_lzmaio_seek (file) != GRUB_ERR_NONE)
    {
       grub_dprintf("lzmaio", "seek failed\n");
       return -1;
@@ -270,7 +314,7 @@ grub_lzmaio_read(struct grub_file *file, char *buf, grub_size_t len)
       }
       if (status == LZMA_STATUS_FINISHED_WITH_MARK || (grub_size_t)ret == len)
       {
-         lzmaio->saved_offset += ret;
+         lzmaio->saved_offset += ret - from_dic;
          return ret;
       }
       if (status == LZMA_STATUS_NEEDS_MORE_INPUT)
@@ -33,6 +33,29 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define VLI_MAX_DIGITS 9
 #define XZ_STREAM_FOOTER_SIZE 12
 
+/* Number of decoded blocks kept around and the largest block which is
+   cached.  */
+#define XZIO_CACHE_SLOTS 4
+#define XZIO_CACHE_BLOCK_MAX (2 << 20)
+
+/* Block of the stream, as listed in the stream index.  */
+struct grub_xzio_block
+{
+  /* Offset of the block header in the compressed file.  */
+  grub_off_t in;
+  /* Offset of the block data in the uncompressed file.  */
+  grub_off_t out;
+  grub_uint64_t size;
+};
+
+/* Decoded block.  */
+struct grub_xzio_cache
+{
+  struct grub_xzio_block *block;
+  grub_uint8_t *data;
+  grub_uint32_t stamp;
+};
+
 struct grub_xzio
 {
   grub_file_t file;
@@ -41,6 +64,15 @@ struct grub_xzio
   grub_uint8_t inbuf[XZBUFSIZ];
   grub_uint8_t outbuf[XZBUFSIZ];
   grub_off_t saved_offset;
+  /* Stream header, replayed to the decoder before jumping to a block.  */
+  grub_uint8_t header[STREAM_HEADER_SIZE];
+  /* Set after jumping to a block, the stream index can't be verified
+     then.  */
+  int jumped;
+  struct grub_xzio_block *blocks;
+  grub_size_t num_blocks;
+  struct grub_xzio_cache cache[XZIO_CACHE_SLOTS];
+  grub_uint32_t cache_clock;
 };
 
 typedef struct grub_xzio *grub_xzio_t;
@@ -100,6 +132,8 @@ test_header (grub_file_t file)
   if (xzio->buf.in_size != STREAM_HEADER_SIZE)
     return 0;
 
+  grub_memcpy (xzio->header, xzio->inbuf, STREAM_HEADER_SIZE);
+
   ret = xz_dec_run (xzio->dec, &xzio->buf);
 
   if (ret == XZ_FORMAT_ERROR)
@@ -121,8 +155,11 @@ test_footer (grub_file_t file)
   grub_uint32_t backsize;
   grub_uint8_t imarker;
   grub_uint64_t uncompressed_size_total = 0;
+  grub_uint64_t compressed_size_total = STREAM_HEADER_SIZE;
+  grub_uint64_t unpadded_size;
   grub_uint64_t uncompressed_size;
   grub_uint64_t records;
+  grub_size_t i;
 
   grub_file_seek (xzio->file, xzio->file->size - FOOTER_MAGIC_SIZE);
   if (grub_file_read (xzio->file, footer, FOOTER_MAGIC_SIZE)
@@ -150,21 +187,39 @@ test_footer (grub_file_t file)
   if (read_vli (xzio->file, &records) <= 0)
     goto ERROR;
 
-  for (; records != 0; records--)
+  /* Remember where the blocks are, unless there is just one.  */
+  if (records > 1)
+    xzio->blocks = grub_calloc (records, sizeof (xzio->blocks[0]));
+  grub_errno = GRUB_ERR_NONE;
+
+  for (i = 0; i < records; i++)
     {
-      if (read_vli (xzio->file, &uncompressed_size) <= 0)	/* Ignore unpadded.  */
+      if (read_vli (xzio->file, &unpadded_size) <= 0)	/* Unpadded.  */
 	goto ERROR;
       if (read_vli (xzio->file, &uncompressed_size) <= 0)	/* Uncompressed.  */
 	goto ERROR;
 
+      if (xzio->blocks)
+	{
+	  xzio->blocks[i].in = compressed_size_total;
+	  xzio->blocks[i].out = uncompressed_size_total;
+	  xzio->blocks[i].size = uncompressed_size;
+	}
+
+      compressed_size_total += ALIGN_UP (unpadded_size, 4);
       uncompressed_size_total += uncompressed_size;
     }
 
+  if (xzio->blocks)
+    xzio->num_blocks = records;
+
   file->size = uncompressed_size_total;
   grub_file_seek (xzio->file, STREAM_HEADER_SIZE);
   return 1;
 
 ERROR:
+  grub_free (xzio->blocks);
+  xzio->blocks = 0;
   return 0;
 }
 
@@ -219,6 +274,7 @@ grub_xzio_open (grub_file_t io, enum grub_file_type type)
       grub_errno = GRUB_ERR_NONE;
       grub_file_seek (io, 0);
       xz_dec_end (xzio->dec);
+      grub_free (xzio->blocks);
       grub_free (xzio);
       grub_free (file);
 
@@ -228,8 +284,11 @@ grub_xzio_open (grub_file_t io, enum grub_file_type type)
   return file;
 }
 
+/* Decode LEN bytes at OFFSET, which must not be before the current
+   position of the decoder.  */
 static grub_ssize_t
-grub_xzio_read (grub_file_t file, char *buf, grub_size_t len)
+xzio_stream_read (grub_file_t file, grub_off_t offset, char *buf,
+		  grub_size_t len)
 {
   grub_ssize_t ret = 0;
   grub_ssize_t readret;
@@ -237,23 +296,11 @@ grub_xzio_read (grub_file_t file, char *buf, grub_size_t len)
   grub_xzio_t xzio = file->data;
   grub_off_t current_offset;
 
-  /* If seek backward need to reset decoder and start from beginning of file.
-     TODO Possible improvement by jumping blocks.  */
-  if (file->offset < xzio->saved_offset)
-    {
-      xz_dec_reset (xzio->dec);
-      xzio->saved_offset = 0;
-      xzio->buf.out_pos = 0;
-      xzio->buf.in_pos = 0;
-      xzio->buf.in_size = 0;
-      grub_file_seek (xzio->file, 0);
-    }
-
   current_offset = xzio->saved_offset;
 
   while (len > 0)
     {
-      xzio->buf.out_size = file->offset + ret + len - current_offset;
+      xzio->buf.out_size = offset + ret + len - current_offset;
       if (xzio->buf.out_size > XZBUFSIZ)
 	xzio->buf.out_size = XZBUFSIZ;
       /* Feed input.  */
@@ -269,10 +316,19 @@ grub_xzio_read (grub_file_t file, char *buf, grub_size_t len)
       xzret = xz_dec_run (xzio->dec, &xzio->buf);
       switch (xzret)
 	{
+	case XZ_DATA_ERROR:
+	  /* After a jump the decoder hasn't seen all blocks, so the index
+	     check at the end fails even though all data is there.  */
+	  if (xzio->jumped
+	      && current_offset + xzio->buf.out_pos >= file->size)
+	    {
+	      xzret = XZ_STREAM_END;
+	      break;
+	    }
+	  /* Fallthrough.  */
 	case XZ_MEMLIMIT_ERROR:
 	case XZ_FORMAT_ERROR:
 	case XZ_OPTIONS_ERROR:
-	case XZ_DATA_ERROR:
 	case XZ_BUF_ERROR:
 	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
 		      N_("xz file corrupted or unsupported block options"));
@@ -284,10 +340,10 @@ grub_xzio_read (grub_file_t file, char *buf, grub_size_t len)
       {
 	grub_off_t new_offset = current_offset + xzio->buf.out_pos;
 	
-	if (file->offset <= new_offset)
+	if (offset <= new_offset)
 	  /* Store first chunk of data in buffer.  */
 	  {
-	    grub_size_t delta = new_offset - (file->offset + ret);
+	    grub_size_t delta = new_offset - (offset + ret);
 	    grub_memmove (buf, xzio->buf.out + (xzio->buf.out_pos - delta),
 			  delta);
 	    len -= delta;
@@ -303,7 +359,183 @@ grub_xzio_read (grub_file_t file, char *buf, grub_size_t len)
     }
 
   if (ret >= 0)
-    xzio->saved_offset = file->offset + ret;
+    xzio->saved_offset = offset + ret;
+
+  return ret;
+}
+
+/* Restart the decoder at the beginning of BLOCK, or of the file if BLOCK
+   is NULL.  */
+static grub_err_t
+xzio_restart (grub_file_t file, struct grub_xzio_block *block)
+{
+  grub_xzio_t xzio = file->data;
+
+  xz_dec_reset (xzio->dec);
+  xzio->saved_offset = 0;
+  xzio->jumped = 0;
+  xzio->buf.out_pos = 0;
+  xzio->buf.in_pos = 0;
+  xzio->buf.in_size = 0;
+  grub_file_seek (xzio->file, 0);
+
+  if (! block)
+    return GRUB_ERR_NONE;
+
+  /* Let the decoder parse the stream header, then continue with the block
+     header.  */
+  grub_memcpy (xzio->inbuf, xzio->header, STREAM_HEADER_SIZE);
+  xzio->buf.in_size = STREAM_HEADER_SIZE;
+  xzio->buf.out_size = XZBUFSIZ;
+  if (xz_dec_run (xzio->dec, &xzio->buf) != XZ_OK)
+    return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		       N_("xz file corrupted or unsupported block options"));
+
+  xzio->buf.in_pos = 0;
+  xzio->buf.in_size = 0;
+  xzio->buf.out_pos = 0;
+  grub_file_seek (xzio->file, block->in);
+  xzio->saved_offset = block->out;
+  xzio->jumped = 1;
+
+  return grub_errno;
+}
+
+/* Return the block containing OFFSET, or NULL if there is no index.  */
+static struct grub_xzio_block *
+xzio_find_block (grub_xzio_t xzio, grub_off_t offset)
+{
+  grub_size_t lo = 0, hi = xzio->num_blocks;
+
+  if (! hi)
+    return 0;
+
+  while (hi - lo > 1)
+    {
+      grub_size_t mid = lo + (hi - lo) / 2;
+
+      if (xzio->blocks[mid].out <= offset)
+	lo = mid;
+      else
+	hi = mid;
+    }
+
+  return xzio->blocks + lo;
+}
+
+static struct grub_xzio_cache *
+xzio_cache_find (grub_xzio_t xzio, grub_off_t offset)
+{
+  unsigned i;
+
+  for (i = 0; i < XZIO_CACHE_SLOTS; i++)
+    {
+      struct grub_xzio_cache *c = xzio->cache + i;
+
+      if (c->block && c->block->out <= offset
+	  && offset < c->block->out + c->block->size)
+	{
+	  c->stamp = ++xzio->cache_clock;
+	  return c;
+	}
+    }
+
+  return 0;
+}
+
+/* Decode BLOCK into the least recently used cache slot.  */
+static struct grub_xzio_cache *
+xzio_cache_fill (grub_file_t file, struct grub_xzio_block *block)
+{
+  grub_xzio_t xzio = file->data;
+  struct grub_xzio_cache *c = xzio->cache;
+  unsigned i;
+
+  for (i = 1; i < XZIO_CACHE_SLOTS; i++)
+    if (xzio->cache[i].stamp < c->stamp)
+      c = xzio->cache + i;
+
+  c->block = 0;
+  grub_free (c->data);
+  c->data = grub_malloc (block->size);
+  if (! c->data)
+    return 0;
+
+  if (xzio_restart (file, block)
+      || xzio_stream_read (file, block->out, (char *) c->data, block->size)
+	 != (grub_ssize_t) block->size)
+    {
+      grub_free (c->data);
+      c->data = 0;
+      if (! grub_errno)
+	grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, N_("premature end of file"));
+      /* The decoder stopped somewhere inside the block.  */
+      grub_error_push ();
+      xzio_restart (file, 0);
+      grub_error_pop ();
+      return 0;
+    }
+
+  c->block = block;
+  c->stamp = ++xzio->cache_clock;
+  return c;
+}
+
+static grub_ssize_t
+grub_xzio_read (grub_file_t file, char *buf, grub_size_t len)
+{
+  grub_xzio_t xzio = file->data;
+  grub_off_t offset = file->offset;
+  grub_ssize_t ret = 0;
+
+  while (len > 0)
+    {
+      struct grub_xzio_cache *c;
+      struct grub_xzio_block *block;
+      grub_ssize_t n;
+
+      c = xzio_cache_find (xzio, offset);
+      if (! c)
+	{
+	  /* Seeking backward, or forward beyond the next block, is done by
+	     jumping to the block containing OFFSET. Small blocks are
+	     decoded as a whole and cached for later random reads.  */
+	  block = xzio_find_block (xzio, offset);
+	  if (offset < xzio->saved_offset
+	      || (block && block->out > xzio->saved_offset))
+	    {
+	      if (block && block->size <= XZIO_CACHE_BLOCK_MAX)
+		{
+		  c = xzio_cache_fill (file, block);
+		  if (! c)
+		    return -1;
+		}
+	      else if (xzio_restart (file, block))
+		return -1;
+	    }
+	}
+
+      if (c)
+	{
+	  n = c->block->out + c->block->size - offset;
+	  if ((grub_size_t) n > len)
+	    n = len;
+	  grub_memcpy (buf, c->data + (offset - c->block->out), n);
+	}
+      else
+	{
+	  n = xzio_stream_read (file, offset, buf, len);
+	  if (n < 0)
+	    return -1;
+	  if (n == 0)
+	    break;
+	}
+
+      buf += n;
+      len -= n;
+      ret += n;
+      offset += n;
+    }
 
   return ret;
 }
@@ -313,9 +545,13 @@ static grub_err_t
 grub_xzio_close (grub_file_t file)
 {
   grub_xzio_t xzio = file->data;
+  unsigned i;
 
   xz_dec_end (xzio->dec);
 
+  for (i = 0; i < XZIO_CACHE_SLOTS; i++)
+    grub_free (xzio->cache[i].data);
+  grub_free (xzio->blocks);
   grub_file_close (xzio->file);
   grub_free (xzio);
 
@@ -25,28 +25,49 @@
 #include <grub/time.h>
 #include <grub/file.h>
 #include <grub/i18n.h>
+#include <grub/env.h>
 
 #define	GRUB_CACHE_TIMEOUT	2
 
 /* The last time the disk was used.  */
 static grub_uint64_t grub_last_time = 0;
 
-struct grub_disk_cache grub_disk_cache_table[GRUB_DISK_CACHE_NUM];
+/* The disk cache is set-associative: a block is hashed into one of
+   GRUB_DISK_CACHE_WAYS-way sets and the least recently used unlocked
+   block of that set is replaced.  Each set owns one slab buffer which
+   is allocated on first use and only freed under memory pressure.  */
+static struct grub_disk_cache_set *grub_disk_cache_sets;
+static unsigned grub_disk_cache_num_sets;
+static grub_size_t grub_disk_cache_size = GRUB_DISK_CACHE_DEFAULT_SIZE;
+static grub_uint32_t grub_disk_cache_clock;
+
+static unsigned long grub_disk_cache_hits;
+static unsigned long grub_disk_cache_misses;
+static unsigned long grub_disk_cache_evictions;
+static unsigned long grub_disk_cache_readahead;
+
+#define GRUB_DISK_CACHE_BLOCK_SIZE \
+  (GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS)
 
 void (*grub_disk_firmware_fini) (void);
 int grub_disk_firmware_is_tainted;
 
-#if DISK_CACHE_STATS
-static unsigned long grub_disk_cache_hits;
-static unsigned long grub_disk_cache_misses;
+/* Bumped whenever cached disk contents may have become stale, so that
+   caches built on top of the disk cache can follow it.  */
+grub_uint32_t grub_disk_cache_generation;
 
 void
-grub_disk_cache_get_performance (unsigned long *hits, unsigned long *misses)
+grub_disk_cache_get_performance (struct grub_disk_cache_stats *stats)
 {
-  *hits = grub_disk_cache_hits;
-  *misses = grub_disk_cache_misses;
+  stats->hits = grub_disk_cache_hits;
+  stats->misses = grub_disk_cache_misses;
+  stats->evictions = grub_disk_cache_evictions;
+  stats->readahead = grub_disk_cache_readahead;
+  stats->size = grub_disk_cache_size;
+  stats->sets = grub_disk_cache_size / (GRUB_DISK_CACHE_BLOCK_SIZE
+					* GRUB_DISK_CACHE_WAYS);
+  stats->ways = GRUB_DISK_CACHE_WAYS;
 }
-#endif
 
 grub_err_t (*grub_disk_write_weak) (grub_disk_t disk,
 				    grub_disk_addr_t sector,
@@ -55,46 +76,143 @@ grub_err_t (*grub_disk_write_weak) (grub_disk_t disk,
 				    const void *buf);
 #include "disk_common.c"
 
-void
-grub_disk_cache_invalidate_all (void)
+static struct grub_disk_cache_set *
+grub_disk_cache_get_set (unsigned long dev_id, unsigned long disk_id,
+			 grub_disk_addr_t sector)
+{
+  unsigned index;
+
+  index = ((dev_id * 524287UL + disk_id * 2606459UL
+	    + ((unsigned) (sector >> GRUB_DISK_CACHE_BITS)))
+	   % grub_disk_cache_num_sets);
+  return grub_disk_cache_sets + index;
+}
+
+static struct grub_disk_cache *
+grub_disk_cache_lookup (unsigned long dev_id, unsigned long disk_id,
+			grub_disk_addr_t sector)
 {
+  struct grub_disk_cache_set *set;
   unsigned i;
 
-  for (i = 0; i < GRUB_DISK_CACHE_NUM; i++)
+  if (! grub_disk_cache_sets)
+    return 0;
+
+  set = grub_disk_cache_get_set (dev_id, disk_id, sector);
+  for (i = 0; i < GRUB_DISK_CACHE_WAYS; i++)
     {
-      struct grub_disk_cache *cache = grub_disk_cache_table + i;
+      struct grub_disk_cache *cache = set->ways + i;
+
+      if (cache->valid && cache->dev_id == dev_id
+	  && cache->disk_id == disk_id && cache->sector == sector)
+	return cache;
+    }
 
-      if (cache->data && ! cache->lock)
+  return 0;
+}
+
+/* Drop all unlocked blocks. If RELEASE is set, also give the slabs of
+   sets without locked blocks back to the heap.  */
+static void
+grub_disk_cache_flush (int release)
+{
+  unsigned i, j;
+
+  grub_disk_cache_generation++;
+
+  if (! grub_disk_cache_sets)
+    return;
+
+  for (i = 0; i < grub_disk_cache_num_sets; i++)
+    {
+      struct grub_disk_cache_set *set = grub_disk_cache_sets + i;
+      int locked = 0;
+
+      for (j = 0; j < GRUB_DISK_CACHE_WAYS; j++)
 	{
-	  grub_free (cache->data);
-	  cache->data = 0;
+	  if (set->ways[j].lock)
+	    locked = 1;
+	  else
+	    set->ways[j].valid = 0;
+	}
+
+      if (release && ! locked && set->slab)
+	{
+	  grub_free (set->slab);
+	  set->slab = 0;
+	  for (j = 0; j < GRUB_DISK_CACHE_WAYS; j++)
+	    set->ways[j].data = 0;
 	}
     }
 }
 
+void
+grub_disk_cache_invalidate_all (void)
+{
+  grub_disk_cache_flush (1);
+}
+
+void
+grub_disk_cache_invalidate (unsigned long dev_id, unsigned long disk_id,
+			    grub_disk_addr_t sector)
+{
+  struct grub_disk_cache *cache;
+
+  grub_disk_cache_generation++;
+
+  sector &= ~((grub_disk_addr_t) GRUB_DISK_CACHE_SIZE - 1);
+  cache = grub_disk_cache_lookup (dev_id, disk_id, sector);
+  if (cache && ! cache->lock)
+    cache->valid = 0;
+}
+
+grub_err_t
+grub_disk_cache_set_size (grub_size_t size)
+{
+  unsigned i, j;
+
+  if (size && size < GRUB_DISK_CACHE_BLOCK_SIZE * GRUB_DISK_CACHE_WAYS)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT,
+		       N_("disk cache must be at least %u KiB"),
+		       (GRUB_DISK_CACHE_BLOCK_SIZE * GRUB_DISK_CACHE_WAYS)
+		       >> 10);
+
+  if (grub_disk_cache_sets)
+    {
+      for (i = 0; i < grub_disk_cache_num_sets; i++)
+	for (j = 0; j < GRUB_DISK_CACHE_WAYS; j++)
+	  if (grub_disk_cache_sets[i].ways[j].lock)
+	    return grub_error (GRUB_ERR_BAD_ARGUMENT,
+			       N_("disk cache is in use"));
+
+      for (i = 0; i < grub_disk_cache_num_sets; i++)
+	grub_free (grub_disk_cache_sets[i].slab);
+      grub_free (grub_disk_cache_sets);
+      grub_disk_cache_sets = 0;
+      grub_disk_cache_num_sets = 0;
+    }
+
+  /* The sets are allocated again on the next store.  */
+  grub_disk_cache_size = size;
+  return GRUB_ERR_NONE;
+}
+
 static char *
 grub_disk_cache_fetch (unsigned long dev_id, unsigned long disk_id,
 		       grub_disk_addr_t sector)
 {
   struct grub_disk_cache *cache;
-  unsigned cache_index;
 
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
-
-  if (cache->dev_id == dev_id && cache->disk_id == disk_id
-      && cache->sector == sector)
+  cache = grub_disk_cache_lookup (dev_id, disk_id, sector);
+  if (cache)
     {
       cache->lock = 1;
-#if DISK_CACHE_STATS
+      cache->stamp = ++grub_disk_cache_clock;
       grub_disk_cache_hits++;
-#endif
       return cache->data;
     }
 
-#if DISK_CACHE_STATS
   grub_disk_cache_misses++;
-#endif
 
   return 0;
 }
@@ -104,45 +222,142 @@ grub_disk_cache_unlock (unsigned long dev_id, unsigned long disk_id,
 			grub_disk_addr_t sector)
 {
   struct grub_disk_cache *cache;
-  unsigned cache_index;
-
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
 
-  if (cache->dev_id == dev_id && cache->disk_id == disk_id
-      && cache->sector == sector)
+  cache = grub_disk_cache_lookup (dev_id, disk_id, sector);
+  if (cache)
     cache->lock = 0;
 }
 
-static grub_err_t
+/* Pick a block for SECTOR and lock it, without marking it valid. The
+   caller fills CACHE->data and calls grub_disk_cache_commit, or releases
+   it with grub_disk_cache_cancel. Returns NULL if nothing can be cached;
+   no error is raised in that case.  */
+static struct grub_disk_cache *
+grub_disk_cache_reserve (unsigned long dev_id, unsigned long disk_id,
+			 grub_disk_addr_t sector)
+{
+  struct grub_disk_cache_set *set;
+  struct grub_disk_cache *victim = 0;
+  unsigned i;
+
+  if (! grub_disk_cache_size)
+    return 0;
+
+  if (! grub_disk_cache_sets)
+    {
+      unsigned num;
+
+      num = grub_disk_cache_size / (GRUB_DISK_CACHE_BLOCK_SIZE
+				    * GRUB_DISK_CACHE_WAYS);
+      grub_disk_cache_sets = grub_calloc (num, sizeof (*grub_disk_cache_sets));
+      if (! grub_disk_cache_sets)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return 0;
+	}
+      grub_disk_cache_num_sets = num;
+    }
+
+  set = grub_disk_cache_get_set (dev_id, disk_id, sector);
+  if (! set->slab)
+    {
+      set->slab = grub_malloc (GRUB_DISK_CACHE_BLOCK_SIZE
+			       * GRUB_DISK_CACHE_WAYS);
+      if (! set->slab)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return 0;
+	}
+      for (i = 0; i < GRUB_DISK_CACHE_WAYS; i++)
+	set->ways[i].data = set->slab + i * GRUB_DISK_CACHE_BLOCK_SIZE;
+    }
+
+  for (i = 0; i < GRUB_DISK_CACHE_WAYS; i++)
+    {
+      struct grub_disk_cache *cache = set->ways + i;
+
+      if (cache->lock)
+	continue;
+      if (! cache->valid
+	  || (cache->dev_id == dev_id && cache->disk_id == disk_id
+	      && cache->sector == sector))
+	{
+	  victim = cache;
+	  break;
+	}
+      if (! victim || (grub_uint32_t) (grub_disk_cache_clock - cache->stamp)
+	  > (grub_uint32_t) (grub_disk_cache_clock - victim->stamp))
+	victim = cache;
+    }
+
+  if (! victim)
+    return 0;
+
+  if (victim->valid)
+    {
+      if (victim->dev_id != dev_id || victim->disk_id != disk_id
+	  || victim->sector != sector)
+	grub_disk_cache_evictions++;
+      victim->valid = 0;
+    }
+
+  victim->dev_id = dev_id;
+  victim->disk_id = disk_id;
+  victim->sector = sector;
+  victim->lock = 1;
+
+  return victim;
+}
+
+static void
+grub_disk_cache_commit (struct grub_disk_cache *cache)
+{
+  cache->valid = 1;
+  cache->lock = 0;
+  cache->stamp = ++grub_disk_cache_clock;
+}
+
+static void
+grub_disk_cache_cancel (struct grub_disk_cache *cache)
+{
+  cache->lock = 0;
+}
+
+static void
 grub_disk_cache_store (unsigned long dev_id, unsigned long disk_id,
 		       grub_disk_addr_t sector, const char *data)
 {
-  unsigned cache_index;
   struct grub_disk_cache *cache;
 
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
+  cache = grub_disk_cache_reserve (dev_id, disk_id, sector);
+  if (! cache)
+    return;
 
-  cache->lock = 1;
-  grub_free (cache->data);
-  cache->data = 0;
-  cache->lock = 0;
+  grub_memcpy (cache->data, data, GRUB_DISK_CACHE_BLOCK_SIZE);
+  grub_disk_cache_commit (cache);
+}
 
-  cache->data = grub_malloc (GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
-  if (! cache->data)
-    return grub_errno;
+static char *
+grub_env_write_disk_cache_size (struct grub_env_var *var
+				__attribute__ ((unused)),
+				const char *val)
+{
+  grub_size_t size;
 
-  grub_memcpy (cache->data, data,
-	       GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
-  cache->dev_id = dev_id;
-  cache->disk_id = disk_id;
-  cache->sector = sector;
+  if (grub_env_parse_size (val, &size)
+      || grub_disk_cache_set_size (size))
+    return NULL;
 
-  return GRUB_ERR_NONE;
+  return grub_strdup (val);
+}
+
+void
+grub_disk_cache_init (void)
+{
+  grub_register_variable_hook ("disk_cache_size", 0,
+			       grub_env_write_disk_cache_size);
 }
 
-
 
 grub_disk_dev_t grub_disk_dev_list;
 
@@ -280,7 +495,7 @@ grub_disk_open (const char *name)
 
   if (current_time > (grub_last_time
 		      + GRUB_CACHE_TIMEOUT * 1000))
-    grub_disk_cache_invalidate_all ();
+    grub_disk_cache_flush (0);
 
   grub_last_time = current_time;
 
@@ -314,6 +529,8 @@ grub_disk_close (grub_disk_t disk)
   /* Reset the timer.  */
   grub_last_time = grub_get_time_ms ();
 
+  grub_free (disk->ra_buf);
+
   while (disk->partition)
     {
       part = disk->partition->parent;
@@ -333,6 +550,7 @@ grub_disk_read_small_real (grub_disk_t disk, grub_disk_addr_t sector,
 {
   char *data;
   char *tmp_buf;
+  struct grub_disk_cache *cache;
 
   /* Fetch the cache.  */
   data = grub_disk_cache_fetch (disk->dev->id, disk->id, sector);
@@ -345,10 +563,17 @@ grub_disk_read_small_real (grub_disk_t disk, grub_disk_addr_t sector,
       return GRUB_ERR_NONE;
     }
 
-  /* Allocate a temporary buffer.  */
-  tmp_buf = grub_malloc (GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
-  if (! tmp_buf)
-    return grub_errno;
+  /* Read straight into a cache block if possible, otherwise allocate
+     a temporary buffer.  */
+  cache = grub_disk_cache_reserve (disk->dev->id, disk->id, sector);
+  if (cache)
+    tmp_buf = cache->data;
+  else
+    {
+      tmp_buf = grub_malloc (GRUB_DISK_CACHE_BLOCK_SIZE);
+      if (! tmp_buf)
+	return grub_errno;
+    }
 
   /* Otherwise read data from the disk actually.  */
   if (disk->total_sectors == GRUB_DISK_SIZE_UNKNOWN
@@ -362,17 +587,21 @@ grub_disk_read_small_real (grub_disk_t disk, grub_disk_addr_t sector,
 					   - disk->log_sector_size), tmp_buf);
       if (!err)
 	{
-	  /* Copy it and store it in the disk cache.  */
+	  /* Copy it and keep it in the disk cache.  */
       if (buf)
         grub_memcpy (buf, tmp_buf + offset, size);
-	  grub_disk_cache_store (disk->dev->id, disk->id,
-				 sector, tmp_buf);
-	  grub_free (tmp_buf);
+	  if (cache)
+	    grub_disk_cache_commit (cache);
+	  else
+	    grub_free (tmp_buf);
 	  return GRUB_ERR_NONE;
 	}
     }
 
-  grub_free (tmp_buf);
+  if (cache)
+    grub_disk_cache_cancel (cache);
+  else
+    grub_free (tmp_buf);
   grub_errno = GRUB_ERR_NONE;
 
   {
@@ -425,11 +654,120 @@ grub_disk_read_small (grub_disk_t disk, grub_disk_addr_t sector,
   return GRUB_ERR_NONE;
 }
 
+/* Track sequential streams on DISK and prefetch the blocks following
+   the request just served at SECTOR/OFFSET/SIZE into the disk cache.
+   The window doubles on every sequential read up to max_agglomerate
+   (at most GRUB_DISK_READAHEAD_MAX) and is dropped on a seek.  */
+static void
+grub_disk_readahead (grub_disk_t disk, grub_disk_addr_t sector,
+		     grub_off_t offset, grub_size_t size)
+{
+  grub_uint64_t start, end;
+  grub_disk_addr_t base, from, to, total;
+  grub_size_t n;
+  unsigned max;
+
+  if (disk->readahead_disabled || ! grub_disk_cache_size
+      || ! disk->max_agglomerate
+      || disk->dev->id == GRUB_DISK_DEVICE_MEM_ID
+      || disk->total_sectors == GRUB_DISK_SIZE_UNKNOWN)
+    return;
+
+  max = disk->max_agglomerate;
+  if (max > GRUB_DISK_READAHEAD_MAX)
+    max = GRUB_DISK_READAHEAD_MAX;
+
+  start = (sector << GRUB_DISK_SECTOR_BITS) + offset;
+  end = start + size;
+
+  if (start != disk->ra_next)
+    {
+      /* Small reads outside of the stream are mostly filesystem
+	 metadata; let the stream continue after them.  */
+      if (disk->ra_window && size <= GRUB_DISK_CACHE_BLOCK_SIZE)
+	return;
+      disk->ra_next = end;
+      disk->ra_window = 0;
+      disk->ra_end = 0;
+      return;
+    }
+
+  disk->ra_next = end;
+  if (disk->ra_window)
+    disk->ra_window *= 2;
+  else
+    disk->ra_window = GRUB_DISK_READAHEAD_MIN;
+  if (disk->ra_window > max)
+    disk->ra_window = max;
+
+  base = ALIGN_UP (end, GRUB_DISK_CACHE_BLOCK_SIZE) >> GRUB_DISK_SECTOR_BITS;
+  to = base + ((grub_disk_addr_t) disk->ra_window << GRUB_DISK_CACHE_BITS);
+  from = (disk->ra_end > base) ? disk->ra_end : base;
+
+  /* Refill only once half of the window is consumed.  */
+  if (from >= to || (to - from) < ((grub_disk_addr_t) disk->ra_window
+				   << (GRUB_DISK_CACHE_BITS - 1)))
+    return;
+
+  total = disk->total_sectors << (disk->log_sector_size
+				  - GRUB_DISK_SECTOR_BITS);
+  if (total <= GRUB_DISK_CACHE_SIZE)
+    return;
+  total = (total - 1) & ~((grub_disk_addr_t) GRUB_DISK_CACHE_SIZE - 1);
+  if (to > total)
+    to = total;
+
+  while (from < to && grub_disk_cache_lookup (disk->dev->id, disk->id, from))
+    from += GRUB_DISK_CACHE_SIZE;
+
+  for (n = 0; from + (n << GRUB_DISK_CACHE_BITS) < to; n++)
+    if (grub_disk_cache_lookup (disk->dev->id, disk->id,
+				from + (n << GRUB_DISK_CACHE_BITS)))
+      break;
+
+  if (! n)
+    return;
+
+  if (! disk->ra_buf)
+    {
+      disk->ra_buf = grub_malloc ((grub_size_t) max
+				  * GRUB_DISK_CACHE_BLOCK_SIZE);
+      if (! disk->ra_buf)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return;
+	}
+    }
+
+  if ((disk->dev->disk_read) (disk, transform_sector (disk, from),
+			      n << (GRUB_DISK_CACHE_BITS
+				    + GRUB_DISK_SECTOR_BITS
+				    - disk->log_sector_size),
+			      disk->ra_buf) != GRUB_ERR_NONE)
+    {
+      /* Readahead is only a hint, let the real read report errors.  */
+      grub_errno = GRUB_ERR_NONE;
+      disk->ra_window = 0;
+      return;
+    }
+
+  disk->ra_end = from + (n << GRUB_DISK_CACHE_BITS);
+  grub_disk_cache_readahead += n;
+  while (n--)
+    grub_disk_cache_store (disk->dev->id, disk->id,
+			   from + (n << GRUB_DISK_CACHE_BITS),
+			   disk->ra_buf + n * GRUB_DISK_CACHE_BLOCK_SIZE);
+}
+
 /* Read data from the disk.  */
 grub_err_t
 grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
 		grub_off_t offset, grub_size_t size, void *buf)
 {
+  grub_disk_addr_t ra_sector;
+  grub_off_t ra_offset;
+  grub_size_t ra_size;
+
   /* First of all, check if the region is within the disk.  */
   if (grub_disk_adjust_range (disk, &sector, &offset, size) != GRUB_ERR_NONE)
     {
@@ -440,6 +778,10 @@ grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
       return grub_errno;
     }
 
+  ra_sector = sector;
+  ra_offset = offset;
+  ra_size = size;
+
   /* First read until first cache boundary.   */
   if (offset || (sector & (GRUB_DISK_CACHE_SIZE - 1)))
     {
@@ -551,6 +893,9 @@ grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
 	return err;
     }
 
+  if (buf)
+    grub_disk_readahead (disk, ra_sector, ra_offset, ra_size);
+
   return grub_errno;
 }
 
@@ -54,12 +54,3 @@ transform_sector (grub_disk_t disk, grub_disk_addr_t sector)
 {
   return sector >> (disk->log_sector_size - GRUB_DISK_SECTOR_BITS);
 }
-
-static unsigned
-grub_disk_cache_get_index (unsigned long dev_id, unsigned long disk_id,
-			   grub_disk_addr_t sector)
-{
-  return ((dev_id * 524287UL + disk_id * 2606459UL
-	   + ((unsigned) (sector >> GRUB_DISK_CACHE_BITS)))
-	  % GRUB_DISK_CACHE_NUM);
-}
@@ -21,6 +21,7 @@
 #include <grub/env_private.h>
 #include <grub/misc.h>
 #include <grub/mm.h>
+#include <grub/i18n.h>
 
 /* The initial context.  */
 static struct grub_env_context initial_context;
@@ -32,23 +33,26 @@ struct grub_env_context *grub_current_context = &initial_context;
 static unsigned int
 grub_env_hashval (const char *s)
 {
-  unsigned int i = 0;
+  grub_uint32_t h = 2166136261U;
 
-  /* XXX: This can be done much more efficiently.  */
   while (*s)
-    i += 5 * *(s++);
+    h = (h ^ (grub_uint8_t) *(s++)) * 16777619U;
 
-  return i % HASHSZ;
+  return h;
 }
 
 static struct grub_env_var *
 grub_env_find (const char *name)
 {
   struct grub_env_var *var;
-  int idx = grub_env_hashval (name);
+
+  if (! grub_current_context->vars)
+    return 0;
 
   /* Look for the variable in the current context.  */
-  for (var = grub_current_context->vars[idx]; var; var = var->next)
+  for (var = grub_current_context->vars[grub_env_hashval (name)
+					 & (grub_current_context->hashsz - 1)];
+       var; var = var->next)
     if (grub_strcmp (var->name, name) == 0)
       return var;
 
@@ -56,12 +60,11 @@ grub_env_find (const char *name)
 }
 
 static void
-grub_env_insert (struct grub_env_context *context,
-		 struct grub_env_var *var)
+grub_env_link (struct grub_env_context *context,
+	       struct grub_env_var *var)
 {
-  int idx = grub_env_hashval (var->name);
+  unsigned idx = grub_env_hashval (var->name) & (context->hashsz - 1);
 
-  /* Insert the variable into the hashtable.  */
   var->prevp = &context->vars[idx];
   var->next = context->vars[idx];
   if (var->next)
@@ -69,6 +72,51 @@ grub_env_insert (struct grub_env_context *context,
   context->vars[idx] = var;
 }
 
+/* Double the number of buckets of CONTEXT.  Failing to do so only makes
+   lookups slower.  */
+static void
+grub_env_grow (struct grub_env_context *context)
+{
+  struct grub_env_var **old = context->vars, *var, *next;
+  unsigned oldsz = context->hashsz, i;
+
+  context->vars = grub_calloc (oldsz * 2, sizeof (context->vars[0]));
+  if (! context->vars)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      context->vars = old;
+      return;
+    }
+  context->hashsz = oldsz * 2;
+
+  for (i = 0; i < oldsz; i++)
+    for (var = old[i]; var; var = next)
+      {
+	next = var->next;
+	grub_env_link (context, var);
+      }
+
+  if (old != context->initial_vars)
+    grub_free (old);
+}
+
+static void
+grub_env_insert (struct grub_env_context *context,
+		 struct grub_env_var *var)
+{
+  if (! context->vars)
+    {
+      context->vars = context->initial_vars;
+      context->hashsz = HASHSZ;
+    }
+  else if (context->count >= context->hashsz)
+    grub_env_grow (context);
+
+  /* Insert the variable into the hashtable.  */
+  grub_env_link (context, var);
+  context->count++;
+}
+
 static void
 grub_env_remove (struct grub_env_var *var)
 {
@@ -76,6 +124,7 @@ grub_env_remove (struct grub_env_var *var)
   *var->prevp = var->next;
   if (var->next)
     var->next->prevp = var->prevp;
+  grub_current_context->count--;
 }
 
 grub_err_t
@@ -170,10 +219,10 @@ struct grub_env_var *
 grub_env_update_get_sorted (void)
 {
   struct grub_env_var *sorted_list = 0;
-  int i;
+  unsigned i;
 
   /* Add variables associated with this context into a sorted list.  */
-  for (i = 0; i < HASHSZ; i++)
+  for (i = 0; i < grub_current_context->hashsz; i++)
     {
       struct grub_env_var *var;
 
@@ -236,3 +285,65 @@ grub_env_export (const char *name)
 
   return GRUB_ERR_NONE;
 }
+
+/* Parse VAL, the value of a variable holding a number no larger than MAX,
+   into *VALUE.  */
+grub_err_t
+grub_env_parse_number (const char *val, unsigned long max,
+		       unsigned long *value)
+{
+  const char *end;
+  unsigned long num;
+
+  num = grub_strtoul (val, &end, 0);
+  if (grub_errno)
+    return grub_errno;
+  if (*end)
+    return grub_error (GRUB_ERR_BAD_NUMBER, N_("unrecognized number"));
+  if (num > max)
+    return grub_error (GRUB_ERR_OUT_OF_RANGE, N_("value is too large"));
+
+  *value = num;
+  return GRUB_ERR_NONE;
+}
+
+/* Parse VAL, the value of a variable holding a size in KiB unless it is
+   followed by K, M or G, into *SIZE in bytes.  */
+grub_err_t
+grub_env_parse_size (const char *val, grub_size_t *size)
+{
+  const char *end;
+  grub_uint64_t num;
+  unsigned shift;
+
+  num = grub_strtoull (val, &end, 0);
+  if (grub_errno)
+    return grub_errno;
+
+  switch (*end)
+    {
+    case 'g':
+    case 'G':
+      shift = 30;
+      break;
+    case 'm':
+    case 'M':
+      shift = 20;
+      break;
+    case 'k':
+    case 'K':
+    case '\0':
+      shift = 10;
+      break;
+    default:
+      return grub_error (GRUB_ERR_BAD_NUMBER, N_("unrecognized number"));
+    }
+
+  if (*end && end[1])
+    return grub_error (GRUB_ERR_BAD_NUMBER, N_("unrecognized number"));
+  if (num > (GRUB_SIZE_MAX >> shift))
+    return grub_error (GRUB_ERR_OUT_OF_RANGE, N_("value is too large"));
+
+  *size = (grub_size_t) num << shift;
+  return GRUB_ERR_NONE;
+}
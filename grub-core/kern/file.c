@@ -123,6 +123,9 @@ grub_file_open (const char *name, enum grub_file_type type)
 
   file->device = device;
 
+  if (device->disk && (type & GRUB_FILE_TYPE_NO_READAHEAD))
+    grub_disk_set_readahead (device->disk, 0);
+
   /* In case of relative pathnames and non-Unix systems (like Windows)
    * name of host files may not start with `/'. Blocklists for host files
    * are meaningless as well (for a start, host disk does not allow any direct
@@ -152,6 +152,68 @@ strtosector (const char * str, const char ** const end)
   return ret;
 }
 
+/* Fill in the file offsets of the NUM extents in BLOCKS, terminate the
+   list and attach it to FILE.  BLOCKS must have room for NUM + 1
+   entries.  */
+static void
+grub_fs_blocklist_index (grub_file_t file, struct grub_fs_block *blocks,
+			 grub_size_t num)
+{
+  grub_off_t pos = 0;
+  grub_size_t i;
+
+  for (i = 0; i < num; i++)
+    {
+      blocks[i].file_offset = pos;
+      pos += blocks[i].length;
+    }
+
+  blocks[num].offset = 0;
+  blocks[num].length = 0;
+  blocks[num].file_offset = pos;
+
+  file->data = blocks;
+  file->blocklist_num = num;
+  file->blocklist_cur = 0;
+}
+
+/* Return the extent containing OFFSET, which must be below the file
+   size.  */
+static struct grub_fs_block *
+grub_fs_blocklist_find (grub_file_t file, grub_off_t offset)
+{
+  struct grub_fs_block *blocks = file->data;
+  grub_size_t lo, hi, cur = file->blocklist_cur;
+
+  /* Sequential reads stay in the current extent or enter the next one.  */
+  if (cur < file->blocklist_num && blocks[cur].file_offset <= offset)
+    {
+      if (offset < blocks[cur].file_offset + blocks[cur].length)
+	return blocks + cur;
+      if (cur + 1 < file->blocklist_num
+	  && offset < blocks[cur + 1].file_offset + blocks[cur + 1].length)
+	{
+	  file->blocklist_cur = cur + 1;
+	  return blocks + cur + 1;
+	}
+    }
+
+  lo = 0;
+  hi = file->blocklist_num;
+  while (hi - lo > 1)
+    {
+      grub_size_t mid = lo + (hi - lo) / 2;
+
+      if (blocks[mid].file_offset <= offset)
+	lo = mid;
+      else
+	hi = mid;
+    }
+
+  file->blocklist_cur = lo;
+  return blocks + lo;
+}
+
 static grub_err_t
 grub_fs_blocklist_open (grub_file_t file, const char *name)
 {
@@ -217,7 +279,7 @@ grub_fs_blocklist_open (grub_file_t file, const char *name)
     p++;
   }
 
-  file->data = blocks;
+  grub_fs_blocklist_index (file, blocks, num);
 
   return GRUB_ERR_NONE;
 
@@ -236,32 +298,31 @@ grub_fs_blocklist_rw (int write, grub_file_t file, char *buf, grub_size_t len)
   if (len > file->size - file->offset)
     len = file->size - file->offset;
 
-  offset = file->offset;
-  for (p = file->data; p->length && len > 0; p++)
+  if (! len)
+    return 0;
+
+  p = grub_fs_blocklist_find (file, file->offset);
+  offset = file->offset - p->file_offset;
+  for (; p->length && len > 0; p++, offset = 0)
   {
-    if (offset < p->length)
-    {
-      grub_size_t size;
-
-      size = len;
-      if (offset + size > p->length)
-        size = p->length - offset;
-
-      if ((write) ?
-           grub_disk_write_weak (file->device->disk, 0, p->offset + offset,
-              size, buf) :
-           grub_disk_read_ex (file->device->disk, 0, p->offset + offset,
-              size, buf, file->blocklist) != GRUB_ERR_NONE)
-        return -1;
-
-      ret += size;
-      len -= size;
-      if (buf)
-        buf += size;
-      offset += size;
-    }
-    else
-      offset -= p->length;
+    grub_size_t size;
+
+    size = len;
+    if (offset + size > p->length)
+      size = p->length - offset;
+
+    if ((write) ?
+         grub_disk_write_weak (file->device->disk, 0, p->offset + offset,
+            size, buf) :
+         grub_disk_read_ex (file->device->disk, 0, p->offset + offset,
+            size, buf, file->blocklist) != GRUB_ERR_NONE)
+      return -1;
+
+    file->blocklist_cur = p - (struct grub_fs_block *) file->data;
+    ret += size;
+    len -= size;
+    if (buf)
+      buf += size;
   }
 
   return ret;
@@ -319,7 +380,8 @@ read_blocklist (grub_disk_addr_t sector, unsigned offset,
 
   if ((c->num & (BLOCKLIST_INC_STEP - 1)) == 0)
   {
-    c->blocks = grub_realloc (c->blocks, (c->num + BLOCKLIST_INC_STEP) *
+    /* Keep room for the terminating entry.  */
+    c->blocks = grub_realloc (c->blocks, (c->num + BLOCKLIST_INC_STEP + 1) *
                   sizeof (struct grub_fs_block));
     if (! c->blocks)
       return;
@@ -363,7 +425,7 @@ grub_blocklist_convert (grub_file_t file)
     if (file->fs->fs_close)
       (file->fs->fs_close) (file);
     file->fs = &grub_fs_blocklist;
-    file->data = c.blocks;
+    grub_fs_blocklist_index (file, c.blocks, c.num);
   }
 
   file->offset = 0;
@@ -24,6 +24,7 @@
 #include <grub/term.h>
 #include <grub/file.h>
 #include <grub/device.h>
+#include <grub/disk.h>
 #include <grub/env.h>
 #include <grub/mm.h>
 #include <grub/command.h>
@@ -331,6 +332,8 @@ grub_main (void)
 
   grub_register_core_commands ();
 
+  grub_disk_cache_init ();
+
   grub_boot_time ("Before execution of embedded config.");
 
   if (load_config)
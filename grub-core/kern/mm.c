@@ -53,6 +53,20 @@
   a typical optimization against defragmentation, and makes the
   implementation a bit easier.
 
+  Small blocks are not returned to the ring right away. Freeing a block
+  of at most GRUB_MM_BINS cells pushes it onto the bin for its exact size,
+  and allocations of that size pop it again, so that the many short-lived
+  small objects neither walk nor fragment the ring. Binned blocks still
+  look allocated to the regions; they are given back when the bins grow
+  past GRUB_MM_BIN_LIMIT or when memory runs out.
+
+  Allocations of GRUB_MM_LARGE cells and more, and those with an
+  alignment above GRUB_MM_ALIGN, take a separate path: they are carved
+  from the top of the highest free block that fits in the largest
+  region that can hold them. They collect at the top of the heap instead
+  of splitting the free blocks small allocations are served from, and
+  their alignment padding stays in one place.
+
   For safety, both allocated blocks and free ones are marked by magic
   numbers. Whenever anything unexpected is detected, GRUB aborts the
   operation.
@@ -82,6 +96,19 @@
 
 grub_mm_region_t grub_mm_base;
 
+/* Lists of freed small blocks, indexed by size in cells.  */
+static grub_mm_header_t mm_bins[GRUB_MM_BINS + 1];
+static grub_size_t mm_binned;
+
+static struct
+{
+  unsigned long allocs;
+  unsigned long frees;
+  unsigned long bin_hits;
+  unsigned long large_allocs;
+  unsigned long failures;
+} mm_stats;
+
 /* Get a header from the pointer PTR, and set *P and *R to a pointer
    to the header and a pointer to its region, respectively. PTR must
    be allocated.  */
@@ -100,13 +127,15 @@ get_header_from_pointer (void *ptr, grub_mm_header_t *p, grub_mm_region_t *r)
     grub_fatal ("out of range pointer %p", ptr);
 
   *p = (grub_mm_header_t) ptr - 1;
-  if ((*p)->magic == GRUB_MM_FREE_MAGIC)
+  if ((*p)->magic == GRUB_MM_FREE_MAGIC || (*p)->magic == GRUB_MM_BIN_MAGIC)
     grub_fatal ("double free at %p", *p);
   if ((*p)->magic != GRUB_MM_ALLOC_MAGIC)
     grub_fatal ("alloc magic is broken at %p: %lx", *p,
 		(unsigned long) (*p)->magic);
 }
 
+static void free_to_region (grub_mm_header_t p, grub_mm_region_t r);
+
 /* Initialize a region starting from ADDR and whose size is SIZE,
    to use it as free space.  */
 void
@@ -143,7 +172,7 @@ grub_mm_init_region (void *addr, grub_size_t size)
 	    r->size += h->size << GRUB_MM_ALIGN_LOG2;
 	    r->pre_size &= (GRUB_MM_ALIGN - 1);
 	    *p = r;
-	    grub_free (h + 1);
+	    free_to_region (h, r);
 	  }
 	*p = r;
 	return;
@@ -316,6 +345,112 @@ grub_real_malloc (grub_mm_header_t *first, grub_size_t n, grub_size_t align)
   return 0;
 }
 
+/* Return where a block of N units aligned to ALIGN starts when carved
+   from the top of the free block P, or NULL if it doesn't fit.  */
+static grub_mm_header_t
+top_fit (grub_mm_header_t p, grub_size_t n, grub_size_t align)
+{
+  grub_mm_header_t a;
+  grub_size_t skew;
+
+  if (p->size < n)
+    return NULL;
+
+  a = p + p->size - n;
+  skew = ((grub_addr_t) (a + 1) >> GRUB_MM_ALIGN_LOG2) & (align - 1);
+  if (p->size - n < skew)
+    return NULL;
+  return a - skew;
+}
+
+/* Allocate the number of units N with the alignment ALIGN for the large
+   and aligned path.  Both are in units of GRUB_MM_ALIGN.  Return a
+   non-NULL if successful, otherwise return NULL.  */
+static void *
+grub_real_malloc_top (grub_size_t n, grub_size_t align)
+{
+  grub_mm_region_t r, best_r = NULL;
+  grub_mm_header_t p, q, a, t = NULL, best = NULL, best_q = NULL;
+  grub_size_t tail;
+
+  /* Find the highest fitting free block of the largest region with one.
+     The free ring is kept in decreasing address order.  */
+  for (r = grub_mm_base; r; r = r->next)
+    {
+      if ((r->size >> GRUB_MM_ALIGN_LOG2) < n
+	  || r->first->magic == GRUB_MM_ALLOC_MAGIC
+	  || (best_r && r->size < best_r->size))
+	continue;
+
+      for (q = r->first, p = q->next; ; q = p, p = p->next)
+	{
+	  if (p->magic != GRUB_MM_FREE_MAGIC)
+	    grub_fatal ("free magic is broken at %p: 0x%x", p, p->magic);
+
+	  if (top_fit (p, n, align) && (best_r != r || p > best))
+	    {
+	      best_r = r;
+	      best = p;
+	      best_q = q;
+	    }
+
+	  if (p == r->first)
+	    break;
+	}
+    }
+
+  if (! best)
+    return 0;
+
+  r = best_r;
+  p = best;
+  q = best_q;
+  a = top_fit (p, n, align);
+  tail = (p + p->size) - (a + n);
+  if (tail)
+    {
+      t = a + n;
+      t->magic = GRUB_MM_FREE_MAGIC;
+      t->size = tail;
+    }
+
+  if (a == p)
+    {
+      /* The whole block goes; what alignment leaves above the allocated
+	 area takes its place in the ring.  */
+      if (tail)
+	{
+	  t->next = (p->next == p) ? t : p->next;
+	  if (q == p)
+	    q = t;
+	  q->next = t;
+	  if (r->first == p)
+	    r->first = t;
+	}
+      else
+	{
+	  /* If P was the only free block, R->FIRST is left pointing to an
+	     allocated block, which marks the region as full.  */
+	  q->next = p->next;
+	  if (r->first == p)
+	    r->first = q;
+	}
+    }
+  else
+    {
+      p->size = a - p;
+      if (tail)
+	{
+	  q->next = t;
+	  t->next = p;
+	}
+    }
+
+  a->magic = GRUB_MM_ALLOC_MAGIC;
+  a->size = n;
+  return a + 1;
+}
+
 /* Allocate SIZE bytes with the alignment ALIGN and return the pointer.  */
 void *
 grub_memalign (grub_size_t align, grub_size_t size)
@@ -340,22 +475,52 @@ grub_memalign (grub_size_t align, grub_size_t size)
   if (align == 0)
     align = 1;
 
+  mm_stats.allocs++;
+
+  /* Every block is aligned to a cell, so any binned block will do.  */
+  if (align == 1 && n <= GRUB_MM_BINS && mm_bins[n])
+    {
+      grub_mm_header_t p = mm_bins[n];
+
+      if (p->magic != GRUB_MM_BIN_MAGIC)
+	grub_fatal ("bin magic is broken at %p: 0x%x", p, p->magic);
+
+      mm_bins[n] = p->next;
+      mm_binned -= n << GRUB_MM_ALIGN_LOG2;
+      p->magic = GRUB_MM_ALLOC_MAGIC;
+      mm_stats.bin_hits++;
+      return p + 1;
+    }
+
+  if (n >= GRUB_MM_LARGE || align > 1)
+    mm_stats.large_allocs++;
+
  again:
 
-  for (r = grub_mm_base; r; r = r->next)
+  if (n >= GRUB_MM_LARGE || align > 1)
     {
       void *p;
 
-      p = grub_real_malloc (&(r->first), n, align);
+      p = grub_real_malloc_top (n, align);
       if (p)
 	return p;
     }
+  else
+    for (r = grub_mm_base; r; r = r->next)
+      {
+	void *p;
+
+	p = grub_real_malloc (&(r->first), n, align);
+	if (p)
+	  return p;
+      }
 
   /* If failed, increase free memory somehow.  */
   switch (count)
     {
     case 0:
-      /* Invalidate disk caches.  */
+      /* Return binned blocks and invalidate disk caches.  */
+      grub_mm_flush_bins ();
       grub_disk_cache_invalidate_all ();
       count++;
       goto again;
@@ -373,6 +538,7 @@ grub_memalign (grub_size_t align, grub_size_t size)
     }
 
  fail:
+  mm_stats.failures++;
   grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
   return 0;
 }
@@ -421,18 +587,11 @@ grub_zalloc (grub_size_t size)
   return ret;
 }
 
-/* Deallocate the pointer PTR.  */
-void
-grub_free (void *ptr)
+/* Give the allocated block P back to its region R, merging it with its
+   free neighbours.  */
+static void
+free_to_region (grub_mm_header_t p, grub_mm_region_t r)
 {
-  grub_mm_header_t p;
-  grub_mm_region_t r;
-
-  if (! ptr)
-    return;
-
-  get_header_from_pointer (ptr, &p, &r);
-
   if (r->first->magic == GRUB_MM_ALLOC_MAGIC)
     {
       p->magic = GRUB_MM_FREE_MAGIC;
@@ -491,6 +650,90 @@ grub_free (void *ptr)
     }
 }
 
+/* Give all binned blocks back to their regions.  */
+void
+grub_mm_flush_bins (void)
+{
+  unsigned i;
+
+  for (i = 0; i <= GRUB_MM_BINS; i++)
+    while (mm_bins[i])
+      {
+	grub_mm_header_t p = mm_bins[i];
+	grub_mm_region_t r;
+
+	mm_bins[i] = p->next;
+	p->magic = GRUB_MM_ALLOC_MAGIC;
+	get_header_from_pointer (p + 1, &p, &r);
+	free_to_region (p, r);
+      }
+  mm_binned = 0;
+}
+
+/* Deallocate the pointer PTR.  */
+void
+grub_free (void *ptr)
+{
+  grub_mm_header_t p;
+  grub_mm_region_t r;
+
+  if (! ptr)
+    return;
+
+  get_header_from_pointer (ptr, &p, &r);
+  mm_stats.frees++;
+
+  if (p->size <= GRUB_MM_BINS
+      && mm_binned + (p->size << GRUB_MM_ALIGN_LOG2) <= GRUB_MM_BIN_LIMIT)
+    {
+      p->magic = GRUB_MM_BIN_MAGIC;
+      p->next = mm_bins[p->size];
+      mm_bins[p->size] = p;
+      mm_binned += p->size << GRUB_MM_ALIGN_LOG2;
+      return;
+    }
+
+  free_to_region (p, r);
+}
+
+/* Fill in STATS with the current state of the heap.  */
+void
+grub_mm_get_stats (struct grub_mm_stats *stats)
+{
+  grub_mm_region_t r;
+  grub_mm_header_t p;
+  unsigned i;
+
+  grub_memset (stats, 0, sizeof (*stats));
+
+  for (r = grub_mm_base; r; r = r->next)
+    {
+      stats->total += r->size;
+      if (r->first->magic == GRUB_MM_ALLOC_MAGIC)
+	continue;
+      p = r->first;
+      do
+	{
+	  if (p->magic != GRUB_MM_FREE_MAGIC)
+	    grub_fatal ("free magic is broken at %p: 0x%x", p, p->magic);
+	  stats->free += p->size << GRUB_MM_ALIGN_LOG2;
+	  p = p->next;
+	}
+      while (p != r->first);
+    }
+
+  for (i = 0; i <= GRUB_MM_BINS; i++)
+    for (p = mm_bins[i]; p; p = p->next)
+      stats->bin_count[i]++;
+
+  stats->binned = mm_binned;
+  stats->allocs = mm_stats.allocs;
+  stats->frees = mm_stats.frees;
+  stats->bin_hits = mm_stats.bin_hits;
+  stats->large_allocs = mm_stats.large_allocs;
+  stats->failures = mm_stats.failures;
+}
+
 /* Reallocate SIZE bytes and return the pointer. The contents will be
    the same as that of PTR.  */
 void *
@@ -580,6 +823,9 @@ grub_mm_dump (unsigned lineno)
 	    case GRUB_MM_ALLOC_MAGIC:
 	      grub_printf ("A:%p:%u\n", p, (unsigned int) p->size << GRUB_MM_ALIGN_LOG2);
 	      break;
+	    case GRUB_MM_BIN_MAGIC:
+	      grub_printf ("B:%p:%u\n", p, (unsigned int) p->size << GRUB_MM_ALIGN_LOG2);
+	      break;
 	    }
 	}
     }
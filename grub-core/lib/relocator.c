@@ -439,6 +439,9 @@ malloc_in_range (struct grub_relocator *rel,
   if (end < start + size)
     return 0;
 
+  /* Binned blocks look allocated; let the free space below cover them.  */
+  grub_mm_flush_bins ();
+
   /* We have to avoid any allocations when filling scanline events. 
      Hence 2-stages.
    */
@@ -17,5 +17,31 @@
  */
 
 #include <grub/dl.h>
+#include <grub/mm.h>
+#include <grub/lib/zstd.h>
 
 GRUB_MOD_LICENSE ("GPLv3");
+
+static void *
+grub_zstd_malloc (void *state __attribute__ ((unused)), size_t size)
+{
+  return grub_malloc (size);
+}
+
+static void
+grub_zstd_free (void *state __attribute__ ((unused)), void *address)
+{
+  grub_free (address);
+}
+
+ZSTD_customMem
+grub_zstd_allocator (void)
+{
+  ZSTD_customMem allocator;
+
+  allocator.customAlloc = &grub_zstd_malloc;
+  allocator.customFree = &grub_zstd_free;
+  allocator.opaque = NULL;
+
+  return allocator;
+}
@@ -20,6 +20,9 @@
 #include <grub/efi/api.h>
 #include <grub/efi/efi.h>
 #include <grub/efi/disk.h>
+#include <grub/file.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
 
 #include <vfat.h>
 #include <misc.h>
@@ -27,6 +30,294 @@
 
 #define VDISK_BLOCKIO_TO_PARENT(a) CR(a, grub_efivdisk_t, block_io)
 
+/* Each cache line holds 64 KiB of the backing file.  */
+#define VDISK_CACHE_LINE_BITS 16
+#define VDISK_CACHE_LINE_SIZE (1 << VDISK_CACHE_LINE_BITS)
+#define VDISK_CACHE_LINE_MASK (VDISK_CACHE_LINE_SIZE - 1)
+
+/* Number of lines fetched with a single file read once reads are
+   found to be sequential.  */
+#define VDISK_CACHE_READAHEAD 8
+
+/* Requests at least this large are read straight from the file.  */
+#define VDISK_CACHE_BYPASS (VDISK_CACHE_READAHEAD * VDISK_CACHE_LINE_SIZE)
+
+/* Marks an unused cache line.  */
+#define VDISK_CACHE_INVALID ((grub_off_t) -1)
+
+struct grub_efivdisk_cache_line
+{
+  /* Offset of the line within the file.  */
+  grub_off_t offset;
+  /* Last use, for LRU eviction.  */
+  grub_uint64_t stamp;
+  grub_uint8_t *data;
+  struct grub_efivdisk_cache_line *next;
+};
+
+struct grub_efivdisk_cache
+{
+  grub_file_t file;
+  grub_uint64_t stamp;
+  /* Offset following the most recently fetched line.  */
+  grub_off_t next_offset;
+  unsigned int count;
+  struct grub_efivdisk_cache_line *lines;
+  struct grub_efivdisk_cache_line **hash;
+  grub_uint8_t *readahead;
+};
+
+static inline unsigned int
+vdisk_cache_hash (struct grub_efivdisk_cache *cache, grub_off_t offset)
+{
+  return (unsigned int) ((offset >> VDISK_CACHE_LINE_BITS) % cache->count);
+}
+
+struct grub_efivdisk_cache *
+grub_efivdisk_cache_new (grub_file_t file, grub_size_t size)
+{
+  struct grub_efivdisk_cache *cache;
+  grub_uint8_t *data;
+  unsigned int i;
+
+  cache = grub_zalloc (sizeof (*cache));
+  if (!cache)
+    return NULL;
+  cache->file = file;
+  cache->next_offset = VDISK_CACHE_INVALID;
+  cache->count = size >> VDISK_CACHE_LINE_BITS;
+  if (cache->count < VDISK_CACHE_READAHEAD)
+    cache->count = VDISK_CACHE_READAHEAD;
+  cache->lines = grub_calloc (cache->count, sizeof (cache->lines[0]));
+  cache->hash = grub_calloc (cache->count, sizeof (cache->hash[0]));
+  cache->readahead = grub_malloc (VDISK_CACHE_BYPASS);
+  data = grub_malloc ((grub_size_t) cache->count << VDISK_CACHE_LINE_BITS);
+  if (!cache->lines || !cache->hash || !cache->readahead || !data)
+  {
+    grub_free (data);
+    grub_free (cache->readahead);
+    grub_free (cache->hash);
+    grub_free (cache->lines);
+    grub_free (cache);
+    return NULL;
+  }
+  for (i = 0; i < cache->count; i++)
+  {
+    cache->lines[i].offset = VDISK_CACHE_INVALID;
+    cache->lines[i].data = data + ((grub_size_t) i << VDISK_CACHE_LINE_BITS);
+  }
+  return cache;
+}
+
+static struct grub_efivdisk_cache_line *
+vdisk_cache_find (struct grub_efivdisk_cache *cache, grub_off_t offset)
+{
+  struct grub_efivdisk_cache_line *line;
+
+  for (line = cache->hash[vdisk_cache_hash (cache, offset)];
+       line; line = line->next)
+  {
+    if (line->offset == offset)
+      return line;
+  }
+  return NULL;
+}
+
+static void
+vdisk_cache_unlink (struct grub_efivdisk_cache *cache,
+                    struct grub_efivdisk_cache_line *line)
+{
+  struct grub_efivdisk_cache_line **p;
+
+  if (line->offset == VDISK_CACHE_INVALID)
+    return;
+  for (p = &cache->hash[vdisk_cache_hash (cache, line->offset)];
+       *p; p = &(*p)->next)
+  {
+    if (*p == line)
+    {
+      *p = line->next;
+      break;
+    }
+  }
+  line->offset = VDISK_CACHE_INVALID;
+  line->next = NULL;
+}
+
+/* Take the least recently used line and assign it to OFFSET.  */
+static struct grub_efivdisk_cache_line *
+vdisk_cache_evict (struct grub_efivdisk_cache *cache, grub_off_t offset)
+{
+  struct grub_efivdisk_cache_line *line;
+  struct grub_efivdisk_cache_line *victim = &cache->lines[0];
+  unsigned int i;
+
+  for (i = 0; i < cache->count; i++)
+  {
+    line = &cache->lines[i];
+    if (line->offset == VDISK_CACHE_INVALID)
+    {
+      victim = line;
+      break;
+    }
+    if (line->stamp < victim->stamp)
+      victim = line;
+  }
+  vdisk_cache_unlink (cache, victim);
+  victim->offset = offset;
+  victim->next = cache->hash[vdisk_cache_hash (cache, offset)];
+  cache->hash[vdisk_cache_hash (cache, offset)] = victim;
+  return victim;
+}
+
+/* Read LEN bytes at OFFSET from the file, zero-filling past its end.  */
+static grub_err_t
+vdisk_file_read (grub_file_t file, void *buf, grub_size_t len,
+                 grub_off_t offset)
+{
+  grub_size_t avail = 0;
+  grub_ssize_t actual;
+
+  if (offset < file->size)
+    avail = (file->size - offset < len) ? file->size - offset : len;
+  if (avail)
+  {
+    actual = file_read (file, buf, avail, offset);
+    if (actual < 0 || (grub_size_t) actual != avail)
+    {
+      if (!grub_errno)
+        grub_error (GRUB_ERR_FILE_READ_ERROR,
+                    N_("premature end of file %s"), file->name);
+      return grub_errno;
+    }
+  }
+  grub_memset ((grub_uint8_t *) buf + avail, 0, len - avail);
+  return GRUB_ERR_NONE;
+}
+
+/* Fetch the line at OFFSET, reading ahead if the previous fetch ended
+   where this one starts.  */
+static struct grub_efivdisk_cache_line *
+vdisk_cache_fetch (struct grub_efivdisk_cache *cache, grub_off_t offset)
+{
+  struct grub_efivdisk_cache_line *line;
+  unsigned int n = 1;
+  unsigned int i;
+
+  if (offset == cache->next_offset)
+  {
+    while (n < VDISK_CACHE_READAHEAD &&
+           offset + ((grub_off_t) n << VDISK_CACHE_LINE_BITS)
+             < cache->file->size &&
+           !vdisk_cache_find (cache, offset +
+                              ((grub_off_t) n << VDISK_CACHE_LINE_BITS)))
+      n++;
+  }
+
+  if (vdisk_file_read (cache->file, cache->readahead,
+                       (grub_size_t) n << VDISK_CACHE_LINE_BITS, offset))
+  {
+    cache->next_offset = VDISK_CACHE_INVALID;
+    return NULL;
+  }
+  cache->next_offset = offset + ((grub_off_t) n << VDISK_CACHE_LINE_BITS);
+
+  /* Fill the readahead lines first so that the requested line is the
+     most recently used.  */
+  for (i = n; i > 0; i--)
+  {
+    line = vdisk_cache_evict (cache, offset +
+                              ((grub_off_t) (i - 1) << VDISK_CACHE_LINE_BITS));
+    grub_memcpy (line->data, cache->readahead +
+                 ((grub_size_t) (i - 1) << VDISK_CACHE_LINE_BITS),
+                 VDISK_CACHE_LINE_SIZE);
+    line->stamp = ++cache->stamp;
+  }
+  return line;
+}
+
+grub_err_t
+grub_efivdisk_cache_read (grub_efivdisk_t *vdisk, void *buf,
+                          grub_size_t len, grub_off_t offset)
+{
+  struct grub_efivdisk_cache *cache = vdisk->cache;
+  struct grub_efivdisk_cache_line *line;
+  grub_uint8_t *dst = buf;
+  grub_off_t base;
+  grub_size_t skip;
+  grub_size_t frag;
+
+  if (!cache || len >= VDISK_CACHE_BYPASS)
+    return vdisk_file_read (vdisk->file, buf, len, offset);
+
+  while (len)
+  {
+    base = offset & ~(grub_off_t) VDISK_CACHE_LINE_MASK;
+    skip = offset - base;
+    frag = VDISK_CACHE_LINE_SIZE - skip;
+    if (frag > len)
+      frag = len;
+    line = vdisk_cache_find (cache, base);
+    if (line)
+      line->stamp = ++cache->stamp;
+    else
+      line = vdisk_cache_fetch (cache, base);
+    if (!line)
+      return grub_errno;
+    grub_memcpy (dst, line->data + skip, frag);
+    dst += frag;
+    offset += frag;
+    len -= frag;
+  }
+  return GRUB_ERR_NONE;
+}
+
+void
+grub_efivdisk_cache_drop (grub_efivdisk_t *vdisk,
+                          grub_size_t len, grub_off_t offset)
+{
+  struct grub_efivdisk_cache *cache = vdisk->cache;
+  struct grub_efivdisk_cache_line *line;
+  grub_off_t end = offset + len;
+  unsigned int i;
+
+  if (!cache || !len)
+    return;
+  for (i = 0; i < cache->count; i++)
+  {
+    line = &cache->lines[i];
+    if (line->offset != VDISK_CACHE_INVALID &&
+        line->offset < end &&
+        line->offset + VDISK_CACHE_LINE_SIZE > offset)
+      vdisk_cache_unlink (cache, line);
+  }
+  cache->next_offset = VDISK_CACHE_INVALID;
+}
+
+static grub_efi_status_t
+vdisk_status (grub_err_t err)
+{
+  grub_efi_status_t status;
+
+  switch (err)
+  {
+    case GRUB_ERR_NONE:
+      return GRUB_EFI_SUCCESS;
+    case GRUB_ERR_OUT_OF_MEMORY:
+      status = GRUB_EFI_OUT_OF_RESOURCES;
+      break;
+    case GRUB_ERR_OUT_OF_RANGE:
+      status = GRUB_EFI_INVALID_PARAMETER;
+      break;
+    default:
+      status = GRUB_EFI_DEVICE_ERROR;
+      break;
+  }
+  grub_dprintf ("map", "vdisk I/O error: %s\n", grub_errmsg);
+  grub_errno = GRUB_ERR_NONE;
+  return status;
+}
+
 static grub_efi_status_t EFIAPI
 blockio_reset (block_io_protocol_t *this __unused,
                grub_efi_boolean_t extended __unused)
@@ -70,9 +361,8 @@ blockio_read (block_io_protocol_t *this, grub_efi_uint32_t media_id,
   if ((lba + block_num - 1) > data->media.last_block)
     return GRUB_EFI_INVALID_PARAMETER;
 
-  file_read (data->file, buf, len, data->addr + lba * data->media.block_size);
-
-  return GRUB_EFI_SUCCESS;
+  return vdisk_status (grub_efivdisk_cache_read (data, buf, len,
+                          data->addr + lba * data->media.block_size));
 }
 
 static grub_efi_status_t EFIAPI
@@ -110,9 +400,12 @@ blockio_write (block_io_protocol_t *this,
   if ((lba + block_num - 1) > data->media.last_block)
     return GRUB_EFI_INVALID_PARAMETER;
 
+  grub_efivdisk_cache_drop (data, len,
+                            data->addr + lba * data->media.block_size);
+  grub_errno = GRUB_ERR_NONE;
   file_write (data->file, buf, len, data->addr + lba * data->media.block_size);
 
-  return GRUB_EFI_SUCCESS;
+  return vdisk_status (grub_errno);
 }
 
 static grub_efi_status_t EFIAPI
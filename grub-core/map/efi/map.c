@@ -191,6 +191,9 @@ grub_efivdisk_write (grub_disk_t disk, grub_disk_addr_t sector,
 {
   grub_file_t file = ((struct grub_efivdisk_data *) disk->data)->vdisk.file;
   grub_off_t start = ((struct grub_efivdisk_data *) disk->data)->vdisk.addr;
+  grub_efivdisk_cache_drop (&((struct grub_efivdisk_data *) disk->data)->vdisk,
+                            size << GRUB_DISK_SECTOR_BITS,
+                            (sector << GRUB_DISK_SECTOR_BITS) + start);
   file_write (file, buf, size << GRUB_DISK_SECTOR_BITS,
               (sector << GRUB_DISK_SECTOR_BITS) + start);
   return 0;
@@ -286,6 +289,8 @@ static const struct grub_arg_option options_map[] =
   {"nb", 'n', 0, N_("Don't boot virtual disk."), 0, 0},
   {"unmap", 'x', 0, N_("Unmap devices."), N_("disk"), ARG_TYPE_STRING},
   {"first", 'f', 0, N_("Set as the first drive."), 0, 0},
+  {"cache", 'c', 0, N_("Set size of read cache in KiB (0 to disable)."),
+    N_("n"), ARG_TYPE_INT},
   {0, 0, 0, 0, 0, 0}
 };
 
@@ -332,6 +337,16 @@ grub_cmd_map (grub_extcmd_context_t ctxt, int argc, char **args)
   disk->vdisk.file = file;
   disk->vdisk.size = file->size;
   disk->vpart.file = file;
+  if (!grub_ismemfile (file->name))
+  {
+    grub_size_t cache_size = VDISK_CACHE_DEFAULT_SIZE;
+    if (state[MAP_CACHE].set)
+      cache_size = grub_strtoul (state[MAP_CACHE].arg, NULL, 0);
+    if (cache_size)
+      disk->vdisk.cache = grub_efivdisk_cache_new (file, cache_size << 10);
+    disk->vpart.cache = disk->vdisk.cache;
+    grub_errno = GRUB_ERR_NONE;
+  }
   if (argc < 2)
     grub_snprintf (disk->devname, 20, "vd%u", last_id);
   else
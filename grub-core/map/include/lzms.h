@@ -0,0 +1,205 @@
+#ifndef _LZMS_H
+#define _LZMS_H
+
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * LZMS decompression
+ *
+ */
+
+#include <stdint.h>
+#include <huffman.h>
+
+/** Number of LZ repeat offsets */
+#define LZMS_NUM_LZ_REPS 3
+
+/** Number of delta repeat offsets */
+#define LZMS_NUM_DELTA_REPS 3
+
+/** Number of main probability states */
+#define LZMS_NUM_MAIN_PROBS 16
+
+/** Number of match probability states */
+#define LZMS_NUM_MATCH_PROBS 32
+
+/** Number of LZ and delta probability states */
+#define LZMS_NUM_LZ_PROBS 64
+
+/** Number of bits of precision used for probabilities */
+#define LZMS_PROBABILITY_BITS 6
+
+/** Probability denominator */
+#define LZMS_PROBABILITY_DENOMINATOR ( 1 << LZMS_PROBABILITY_BITS )
+
+/** Initial number of zero bits in a probability entry's history */
+#define LZMS_INITIAL_PROBABILITY 48
+
+/** Initial probability entry history */
+#define LZMS_INITIAL_RECENT_BITS 0x0000000055555555ULL
+
+/** Number of literal symbols */
+#define LZMS_NUM_LITERAL_SYMS 256
+
+/** Number of length symbols */
+#define LZMS_NUM_LENGTH_SYMS 54
+
+/** Number of delta power symbols */
+#define LZMS_NUM_DELTA_POWER_SYMS 8
+
+/** Maximum number of offset symbols */
+#define LZMS_MAX_NUM_OFFSET_SYMS 799
+
+/** Maximum length of a Huffman codeword */
+#define LZMS_MAX_CODEWORD_LEN 15
+
+/** Literal code rebuild interval (in symbols) */
+#define LZMS_LITERAL_CODE_REBUILD_FREQ 1024
+
+/** LZ offset code rebuild interval (in symbols) */
+#define LZMS_LZ_OFFSET_CODE_REBUILD_FREQ 1024
+
+/** Length code rebuild interval (in symbols) */
+#define LZMS_LENGTH_CODE_REBUILD_FREQ 512
+
+/** Delta offset code rebuild interval (in symbols) */
+#define LZMS_DELTA_OFFSET_CODE_REBUILD_FREQ 1024
+
+/** Delta power code rebuild interval (in symbols) */
+#define LZMS_DELTA_POWER_CODE_REBUILD_FREQ 512
+
+/** Maximum distance from a recent target for an x86 translation */
+#define LZMS_X86_MAX_TRANSLATION_OFFSET 1023
+
+/** x86 target identification window */
+#define LZMS_X86_ID_WINDOW_SIZE 65535
+
+/** Number of x86 target usage slots */
+#define LZMS_X86_TARGETS 65536
+
+/** An LZMS range decoder */
+struct lzms_range_decoder {
+	/** Current range */
+	uint32_t range;
+	/** Current code */
+	uint32_t code;
+	/** Next input word */
+	const uint16_t *next;
+	/** End of input */
+	const uint16_t *end;
+};
+
+/** An LZMS backwards bitstream */
+struct lzms_bitstream {
+	/** Bit buffer (most significant bits first) */
+	uint64_t bitbuf;
+	/** Number of valid bits in bit buffer */
+	unsigned int bits;
+	/** Next input word (moving backwards) */
+	const uint16_t *next;
+	/** Start of input */
+	const uint16_t *begin;
+};
+
+/** An LZMS adaptive probability entry */
+struct lzms_probability {
+	/** Number of zero bits in recent history */
+	uint32_t zeros;
+	/** Recent history (most recent bit in least significant bit) */
+	uint64_t recent;
+};
+
+/** An LZMS adaptive Huffman code */
+struct lzms_huffman {
+	/** Number of symbols */
+	unsigned int count;
+	/** Symbols remaining until next rebuild */
+	unsigned int remaining;
+	/** Rebuild interval */
+	unsigned int rebuild;
+	/** Symbol frequencies */
+	uint32_t *freqs;
+	/** Symbol code lengths */
+	uint8_t *lengths;
+	/** Huffman alphabet (followed by raw symbol storage) */
+	struct huffman_alphabet *alphabet;
+};
+
+/** Declare storage for an LZMS adaptive Huffman code */
+#define LZMS_HUFFMAN_STORAGE( name, syms )				\
+	struct {							\
+		struct huffman_alphabet alphabet;			\
+		huffman_raw_symbol_t raw[syms];				\
+	} name ## _alphabet;						\
+	uint32_t name ## _freqs[syms];					\
+	uint8_t name ## _lengths[syms]
+
+/** LZMS decompressor */
+struct lzms {
+	/** Range decoder */
+	struct lzms_range_decoder rd;
+	/** Bitstream */
+	struct lzms_bitstream is;
+
+	/** Main probabilities */
+	struct lzms_probability main[LZMS_NUM_MAIN_PROBS];
+	/** Match probabilities */
+	struct lzms_probability match[LZMS_NUM_MATCH_PROBS];
+	/** LZ probabilities */
+	struct lzms_probability lz[LZMS_NUM_LZ_PROBS];
+	/** LZ repeat probabilities */
+	struct lzms_probability
+		lz_rep[ LZMS_NUM_LZ_REPS - 1 ][LZMS_NUM_LZ_PROBS];
+	/** Delta probabilities */
+	struct lzms_probability delta[LZMS_NUM_LZ_PROBS];
+	/** Delta repeat probabilities */
+	struct lzms_probability
+		delta_rep[ LZMS_NUM_DELTA_REPS - 1 ][LZMS_NUM_LZ_PROBS];
+
+	/** Literal code */
+	struct lzms_huffman literal;
+	/** LZ offset code */
+	struct lzms_huffman lz_offset;
+	/** Length code */
+	struct lzms_huffman length;
+	/** Delta offset code */
+	struct lzms_huffman delta_offset;
+	/** Delta power code */
+	struct lzms_huffman delta_power;
+
+	/** Storage for the adaptive Huffman codes */
+	LZMS_HUFFMAN_STORAGE ( literal, LZMS_NUM_LITERAL_SYMS );
+	LZMS_HUFFMAN_STORAGE ( lz_offset, LZMS_MAX_NUM_OFFSET_SYMS );
+	LZMS_HUFFMAN_STORAGE ( length, LZMS_NUM_LENGTH_SYMS );
+	LZMS_HUFFMAN_STORAGE ( delta_offset, LZMS_MAX_NUM_OFFSET_SYMS );
+	LZMS_HUFFMAN_STORAGE ( delta_power, LZMS_NUM_DELTA_POWER_SYMS );
+
+	/** Code construction workspace */
+	uint32_t sort[LZMS_MAX_NUM_OFFSET_SYMS];
+
+	/** Most recent usage of each x86 call target */
+	int32_t x86_targets[LZMS_X86_TARGETS];
+};
+
+extern ssize_t lzms_decompress ( const void *data, size_t len, void *buf,
+				 size_t buf_len );
+
+#endif /* _LZMS_H */
@@ -90,6 +90,8 @@ struct lzx_input_stream {
 struct lzx_output_stream {
 	/** Data, or NULL */
 	uint8_t *data;
+	/** Length of data buffer */
+	size_t len;
 	/** Offset within stream */
 	size_t offset;
 	/** End of current block within stream */
@@ -175,6 +177,7 @@ static inline unsigned int lzx_footer_bits ( unsigned int position_slot ) {
 	}
 }
 
-extern ssize_t lzx_decompress ( const void *data, size_t len, void *buf );
+extern ssize_t lzx_decompress ( const void *data, size_t len, void *buf,
+			       size_t buf_len );
 
 #endif /* _LZX_H */
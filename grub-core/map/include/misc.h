@@ -61,8 +61,12 @@ enum options_map
   MAP_NB,
   MAP_UNMAP,
   MAP_FIRST,
+  MAP_CACHE,
 };
 
+/* Default size of the read cache of a file-backed vdisk (in KiB).  */
+#define VDISK_CACHE_DEFAULT_SIZE 4096
+
 enum grub_efivdisk_type
 grub_vdisk_check_type (const char *name, grub_file_t file,
                        enum grub_efivdisk_type type);
@@ -75,6 +79,17 @@ grub_err_t
 grub_efivpart_install (struct grub_efivdisk_data *disk,
                        struct grub_arg_list *state);
 
+struct grub_efivdisk_cache *
+grub_efivdisk_cache_new (grub_file_t file, grub_size_t size);
+
+grub_err_t
+grub_efivdisk_cache_read (grub_efivdisk_t *vdisk, void *buf,
+                          grub_size_t len, grub_off_t offset);
+
+void
+grub_efivdisk_cache_drop (grub_efivdisk_t *vdisk,
+                          grub_size_t len, grub_off_t offset);
+
 static inline void
 grub_efi_dprintf_dp (grub_efi_device_path_t *dp)
 {
@@ -98,7 +113,8 @@ void grub_pause_fatal (const char *fmt, ...);
 
 grub_file_t file_open (const char *name, int mem, int bl, int rt);
 
-void file_read (grub_file_t file, void *buf, grub_size_t len, grub_off_t offset);
+grub_ssize_t
+file_read (grub_file_t file, void *buf, grub_size_t len, grub_off_t offset);
 
 void
 file_write (grub_file_t file, const void *buf, grub_size_t len, grub_off_t offset);
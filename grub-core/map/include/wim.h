@@ -127,6 +127,47 @@ struct wim_lookup_entry {
 /** WIM chunk length */
 #define WIM_CHUNK_LEN 32768
 
+/** Compression formats */
+enum wim_format {
+	/** Uncompressed */
+	WIM_FORMAT_NONE = 0,
+	/** Xpress compression */
+	WIM_FORMAT_XPRESS = 1,
+	/** LZX compression */
+	WIM_FORMAT_LZX = 2,
+	/** LZMS compression */
+	WIM_FORMAT_LZMS = 3,
+};
+
+/** Solid resource header
+ *
+ * This precedes the chunk table of a solid resource, which holds
+ * the compressed length of every chunk as a 32-bit value.
+ */
+struct wim_solid_header {
+	/** Uncompressed length */
+	uint64_t len;
+	/** Chunk length */
+	uint32_t chunk_len;
+	/** Compression format */
+	uint32_t format;
+} __attribute__ (( packed ));
+
+/** Uncompressed length recorded in a solid resource's lookup entry */
+#define WIM_SOLID_MAGIC_LEN 0x100000000ULL
+
+/** Maximum solid resource chunk length */
+#define WIM_SOLID_MAX_CHUNK_LEN ( 1U << 30 )
+
+/** Number of recently located solid resource streams to remember */
+#define WIM_SOLID_STREAMS 8
+
+/** Number of lookup table entries to read at once */
+#define WIM_LOOKUP_BATCH 32
+
+/** Default size of decompressed chunk cache */
+#define WIM_CHUNK_CACHE_DEFAULT_SIZE ( 2 * 1024 * 1024 )
+
 /** A WIM chunk buffer */
 struct wim_chunk_buffer {
 	/** Data */
@@ -185,6 +226,7 @@ extern int wim_count ( struct vfat_file *file, struct wim_header *header,
 		       unsigned int *count );
 extern int wim_metadata ( struct vfat_file *file, struct wim_header *header,
 			  unsigned int index, struct wim_resource_header *meta);
+extern void wim_set_chunk_cache_size ( size_t size );
 extern int wim_read ( struct vfat_file *file, struct wim_header *header,
 		      struct wim_resource_header *resource, void *data,
 		      size_t offset, size_t len );
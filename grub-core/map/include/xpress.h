@@ -83,6 +83,7 @@ static inline unsigned int xca_huf_len ( const struct xca_huf_len *lengths,
 /** XCA block size */
 #define XCA_BLOCK_SIZE ( 64 * 1024 )
 
-extern ssize_t xca_decompress ( const void *data, size_t len, void *buf );
+extern ssize_t xca_decompress ( const void *data, size_t len, void *buf,
+			       size_t buf_len );
 
 #endif /* _XCA_H */
@@ -0,0 +1,845 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * LZMS decompression
+ *
+ * The LZMS format is undocumented.  This decoder follows the format
+ * as implemented by the file lzms_decompress.c in the wimlib source
+ * code.  LZMS is used for LZMS-compressed WIM files and for solid
+ * (ESD) resources.
+ *
+ * Each compressed chunk is an independent block consisting of a
+ * range-coded stream of item types read forwards from the start of
+ * the buffer, and a stream of adaptively Huffman-coded values read
+ * backwards from the end of the buffer.  The decompressed data is
+ * finally passed through an x86 address translation filter.
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <huffman.h>
+#include <lzms.h>
+
+#pragma GCC diagnostic ignored "-Wcast-align"
+
+/** Offset slot delta run lengths */
+static const uint8_t lzms_offset_slot_runs[] = {
+  9, 0, 9, 7, 10, 15, 15, 20, 20, 30, 33, 40, 42, 45, 60, 73,
+  80, 85, 95, 105, 6,
+};
+
+/** Length slot delta run lengths */
+static const uint8_t lzms_length_slot_runs[] = {
+  27, 4, 6, 4, 5, 2, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 1,
+};
+
+/** Offset slot base values */
+static uint32_t lzms_offset_base[ LZMS_MAX_NUM_OFFSET_SYMS + 1 ];
+
+/** Offset slot extra bits */
+static uint8_t lzms_offset_bits[LZMS_MAX_NUM_OFFSET_SYMS];
+
+/** Length slot base values */
+static uint32_t lzms_length_base[ LZMS_NUM_LENGTH_SYMS + 1 ];
+
+/** Length slot extra bits */
+static uint8_t lzms_length_bits[LZMS_NUM_LENGTH_SYMS];
+
+/** Decompressor state */
+static struct lzms *lzms_state;
+
+/**
+ * Calculate index of most significant set bit
+ *
+ * @v value    Non-zero value
+ * @ret bit    Bit index
+ */
+static unsigned int lzms_fls ( uint32_t value ) {
+
+  return ( 31 - __builtin_clz ( value ) );
+}
+
+/**
+ * Construct slot tables from delta run lengths
+ *
+ * @v base    Slot base values to fill in
+ * @v bits    Slot extra bits to fill in
+ * @v runs    Delta run lengths
+ * @v num_runs    Number of delta run lengths
+ * @v final    Base value following the final slot
+ */
+static void lzms_init_slots ( uint32_t *base, uint8_t *bits,
+            const uint8_t *runs, unsigned int num_runs,
+            uint32_t final ) {
+  uint32_t value = 0;
+  unsigned int slot = 0;
+  unsigned int order;
+  unsigned int len;
+
+  for ( order = 0 ; order < num_runs ; order++ ) {
+    for ( len = runs[order] ; len ; len-- ) {
+      value += ( 1U << order );
+      if ( slot )
+        bits[ slot - 1 ] = order;
+      base[slot++] = value;
+    }
+  }
+  base[slot] = final;
+  bits[ slot - 1 ] = lzms_fls ( base[slot] - base[ slot - 1 ] );
+}
+
+/**
+ * Get number of offset slots required for an output length
+ *
+ * @v len    Output length
+ * @ret count    Number of offset slots
+ */
+static unsigned int lzms_offset_slots ( size_t len ) {
+  unsigned int slot;
+
+  if ( len < 2 )
+    return 0;
+  for ( slot = 0 ; ( slot < ( LZMS_MAX_NUM_OFFSET_SYMS - 1 ) ) &&
+          ( lzms_offset_base[ slot + 1 ] <= ( len - 1 ) ) ; slot++ ) {}
+  return ( slot + 1 );
+}
+
+/**
+ * Initialise range decoder
+ *
+ * @v rd    Range decoder
+ * @v data    Compressed data
+ * @v words    Length of compressed data (in 16-bit words)
+ */
+static void lzms_rd_init ( struct lzms_range_decoder *rd,
+         const uint16_t *data, size_t words ) {
+
+  rd->range = 0xffffffffUL;
+  rd->code = ( ( ( ( uint32_t ) data[0] ) << 16 ) | data[1] );
+  rd->next = ( data + 2 );
+  rd->end = ( data + words );
+}
+
+/**
+ * Decode a range-coded bit
+ *
+ * @v rd    Range decoder
+ * @v state    Probability state (will be updated)
+ * @v num_states    Number of probability states
+ * @v probs    Probability entries
+ * @ret bit    Decoded bit
+ */
+static int lzms_rd_bit ( struct lzms_range_decoder *rd, unsigned int *state,
+       unsigned int num_states,
+       struct lzms_probability *probs ) {
+  struct lzms_probability *prob = &probs[*state];
+  uint32_t zeros;
+  uint32_t bound;
+  int bit;
+
+  /* Get probability of a zero bit, excluding 0% and 100% */
+  zeros = prob->zeros;
+  if ( ! zeros )
+    zeros = 1;
+  if ( zeros == LZMS_PROBABILITY_DENOMINATOR )
+    zeros--;
+
+  /* Normalise range */
+  if ( ! ( rd->range & 0xffff0000UL ) ) {
+    rd->range <<= 16;
+    rd->code <<= 16;
+    if ( rd->next != rd->end )
+      rd->code |= *(rd->next++);
+  }
+
+  /* Decode bit */
+  bound = ( ( rd->range >> LZMS_PROBABILITY_BITS ) * zeros );
+  if ( rd->code < bound ) {
+    rd->range = bound;
+    bit = 0;
+  } else {
+    rd->range -= bound;
+    rd->code -= bound;
+    bit = 1;
+  }
+
+  /* Update probability and state */
+  prob->zeros += ( ( prob->recent >> 63 ) - bit );
+  prob->recent = ( ( prob->recent << 1 ) | bit );
+  *state = ( ( ( *state << 1 ) | bit ) & ( num_states - 1 ) );
+
+  return bit;
+}
+
+/**
+ * Initialise backwards bitstream
+ *
+ * @v is    Bitstream
+ * @v data    Compressed data
+ * @v words    Length of compressed data (in 16-bit words)
+ */
+static void lzms_is_init ( struct lzms_bitstream *is, const uint16_t *data,
+         size_t words ) {
+
+  is->bitbuf = 0;
+  is->bits = 0;
+  is->begin = data;
+  is->next = ( data + words );
+}
+
+/**
+ * Ensure that bits are available in backwards bitstream
+ *
+ * @v is    Bitstream
+ * @v bits    Number of bits required (at most 48)
+ *
+ * Reading past the start of the input yields zero bits.
+ */
+static void lzms_is_ensure ( struct lzms_bitstream *is, unsigned int bits ) {
+
+  while ( is->bits < bits ) {
+    if ( is->next != is->begin ) {
+      is->bitbuf |= ( ( ( uint64_t ) *(--is->next) ) <<
+          ( 48 - is->bits ) );
+    }
+    is->bits += 16;
+  }
+}
+
+/**
+ * Read bits from backwards bitstream
+ *
+ * @v is    Bitstream
+ * @v bits    Number of bits to read (at most 32)
+ * @ret value    Value
+ */
+static uint32_t lzms_is_read ( struct lzms_bitstream *is,
+             unsigned int bits ) {
+  uint32_t value;
+
+  if ( ! bits )
+    return 0;
+  lzms_is_ensure ( is, bits );
+  value = ( is->bitbuf >> ( 64 - bits ) );
+  is->bitbuf <<= bits;
+  is->bits -= bits;
+  return value;
+}
+
+/**
+ * Sort code construction workspace
+ *
+ * @v keys    Keys (frequency and symbol)
+ * @v count    Number of keys
+ */
+static void lzms_heap_sort ( uint32_t *keys, unsigned int count ) {
+  unsigned int start;
+  unsigned int end;
+  unsigned int root;
+  unsigned int child;
+  uint32_t tmp;
+
+  if ( count < 2 )
+    return;
+  for ( end = count, start = ( count / 2 ) ; ; ) {
+    if ( start ) {
+      start--;
+    } else {
+      end--;
+      tmp = keys[end];
+      keys[end] = keys[0];
+      keys[0] = tmp;
+      if ( end == 1 )
+        break;
+    }
+    for ( root = start ; ( child = ( 2 * root + 1 ) ) < end ;
+          root = child ) {
+      if ( ( ( child + 1 ) < end ) && ( keys[ child + 1 ] > keys[child] ) )
+        child++;
+      if ( keys[root] >= keys[child] )
+        break;
+      tmp = keys[root];
+      keys[root] = keys[child];
+      keys[child] = tmp;
+    }
+  }
+}
+
+/** Number of low bits holding the symbol in a code construction key */
+#define LZMS_SYM_BITS 10
+
+/** Symbol mask for a code construction key */
+#define LZMS_SYM_MASK ( ( 1U << LZMS_SYM_BITS ) - 1 )
+
+/**
+ * Rebuild an adaptive Huffman code
+ *
+ * @v lzms    Decompressor
+ * @v huf    Adaptive Huffman code
+ * @ret rc    Return status code
+ *
+ * The code lengths must match those generated by the compressor
+ * exactly, so this mirrors the length-limited Huffman construction
+ * used by wimlib: symbols are sorted by frequency then by value, a
+ * Huffman tree is built in place, and overlong codewords are
+ * shortened by borrowing from the next shorter available length.
+ */
+static int lzms_rebuild ( struct lzms *lzms, struct lzms_huffman *huf ) {
+  uint32_t *A = lzms->sort;
+  unsigned int counts[ LZMS_MAX_CODEWORD_LEN + 1 ];
+  unsigned int num = huf->count;
+  unsigned int i, b, e, m, n;
+  unsigned int len;
+  unsigned int depth;
+  uint32_t freq;
+  int node;
+
+  /* Sort symbols by frequency then by value */
+  for ( i = 0 ; i < num ; i++ )
+    A[i] = ( ( huf->freqs[i] << LZMS_SYM_BITS ) | i );
+  lzms_heap_sort ( A, num );
+
+  /* Build tree, leaving parent indices in the non-leaf nodes */
+  i = b = e = 0;
+  do {
+    if ( ( i != num ) && ( ( b == e ) ||
+         ( ( A[i] >> LZMS_SYM_BITS ) <= ( A[b] >> LZMS_SYM_BITS ) ) ) ) {
+      m = i++;
+    } else {
+      m = b++;
+    }
+    if ( ( i != num ) && ( ( b == e ) ||
+         ( ( A[i] >> LZMS_SYM_BITS ) <= ( A[b] >> LZMS_SYM_BITS ) ) ) ) {
+      n = i++;
+    } else {
+      n = b++;
+    }
+    freq = ( ( A[m] & ~LZMS_SYM_MASK ) + ( A[n] & ~LZMS_SYM_MASK ) );
+    A[m] = ( ( A[m] & LZMS_SYM_MASK ) | ( e << LZMS_SYM_BITS ) );
+    A[n] = ( ( A[n] & LZMS_SYM_MASK ) | ( e << LZMS_SYM_BITS ) );
+    A[e] = ( ( A[e] & LZMS_SYM_MASK ) | freq );
+    e++;
+  } while ( ( num - e ) > 1 );
+
+  /* Compute length counts, limiting the codeword length */
+  memset ( counts, 0, sizeof ( counts ) );
+  counts[1] = 2;
+  A[ num - 2 ] &= LZMS_SYM_MASK;
+  for ( node = ( num - 3 ) ; node >= 0 ; node-- ) {
+    depth = ( ( A[ A[node] >> LZMS_SYM_BITS ] >> LZMS_SYM_BITS ) + 1 );
+    A[node] = ( ( A[node] & LZMS_SYM_MASK ) | ( depth << LZMS_SYM_BITS ) );
+    len = depth;
+    if ( len >= LZMS_MAX_CODEWORD_LEN ) {
+      len = LZMS_MAX_CODEWORD_LEN;
+      do {
+        len--;
+      } while ( ! counts[len] );
+    }
+    counts[len]--;
+    counts[ len + 1 ] += 2;
+  }
+
+  /* Assign lengths, longest first, in sorted symbol order */
+  for ( i = 0, len = LZMS_MAX_CODEWORD_LEN ; len ; len-- ) {
+    for ( n = counts[len] ; n ; n-- )
+      huf->lengths[ A[i++] & LZMS_SYM_MASK ] = len;
+  }
+
+  /* Dilute frequencies for the next rebuild */
+  for ( i = 0 ; i < num ; i++ )
+    huf->freqs[i] = ( ( huf->freqs[i] >> 1 ) + 1 );
+  huf->remaining = huf->rebuild;
+
+  return huffman_alphabet ( huf->alphabet, huf->lengths, num );
+}
+
+/**
+ * Initialise an adaptive Huffman code
+ *
+ * @v lzms    Decompressor
+ * @v huf    Adaptive Huffman code
+ * @v alphabet    Huffman alphabet storage
+ * @v freqs    Frequency storage
+ * @v lengths    Code length storage
+ * @v count    Number of symbols
+ * @v rebuild    Rebuild interval
+ * @ret rc    Return status code
+ */
+static int lzms_huffman_init ( struct lzms *lzms, struct lzms_huffman *huf,
+             struct huffman_alphabet *alphabet,
+             uint32_t *freqs, uint8_t *lengths,
+             unsigned int count, unsigned int rebuild ) {
+  unsigned int i;
+
+  /* A code must have at least two symbols; any unused extra
+   * symbol can never be decoded from a valid stream.
+   */
+  if ( count < 2 )
+    count = 2;
+  huf->count = count;
+  huf->rebuild = rebuild;
+  huf->freqs = freqs;
+  huf->lengths = lengths;
+  huf->alphabet = alphabet;
+  for ( i = 0 ; i < count ; i++ )
+    freqs[i] = 1;
+  return lzms_rebuild ( lzms, huf );
+}
+
+/**
+ * Decode an adaptive Huffman-coded symbol
+ *
+ * @v lzms    Decompressor
+ * @v huf    Adaptive Huffman code
+ * @ret sym    Symbol, or negative error
+ */
+static int lzms_huffman_sym ( struct lzms *lzms, struct lzms_huffman *huf ) {
+  struct lzms_bitstream *is = &lzms->is;
+  struct huffman_symbols *sym;
+  unsigned int value;
+  unsigned int raw;
+  int rc;
+
+  /* Decode symbol */
+  lzms_is_ensure ( is, HUFFMAN_BITS );
+  value = ( is->bitbuf >> ( 64 - HUFFMAN_BITS ) );
+  sym = huffman_sym ( huf->alphabet, value );
+  raw = huffman_raw ( sym, value );
+  is->bitbuf <<= huffman_len ( sym );
+  is->bits -= huffman_len ( sym );
+
+  /* Update frequencies and rebuild code if required */
+  huf->freqs[raw]++;
+  if ( ! --huf->remaining ) {
+    if ( ( rc = lzms_rebuild ( lzms, huf ) ) != 0 )
+      return rc;
+  }
+
+  return raw;
+}
+
+/**
+ * Decode an offset
+ *
+ * @v lzms    Decompressor
+ * @v huf    Offset code
+ * @v offset    Offset to fill in
+ * @ret rc    Return status code
+ */
+static int lzms_offset ( struct lzms *lzms, struct lzms_huffman *huf,
+       uint32_t *offset ) {
+  int slot;
+
+  slot = lzms_huffman_sym ( lzms, huf );
+  if ( slot < 0 )
+    return slot;
+  *offset = ( lzms_offset_base[slot] +
+        lzms_is_read ( &lzms->is, lzms_offset_bits[slot] ) );
+  return 0;
+}
+
+/**
+ * Decode a match length
+ *
+ * @v lzms    Decompressor
+ * @v length    Length to fill in
+ * @ret rc    Return status code
+ */
+static int lzms_length ( struct lzms *lzms, uint32_t *length ) {
+  int slot;
+
+  slot = lzms_huffman_sym ( lzms, &lzms->length );
+  if ( slot < 0 )
+    return slot;
+  *length = ( lzms_length_base[slot] +
+        lzms_is_read ( &lzms->is, lzms_length_bits[slot] ) );
+  return 0;
+}
+
+/**
+ * Initialise probability entries
+ *
+ * @v probs    Probability entries
+ * @v count    Number of probability entries
+ */
+static void lzms_probs_init ( struct lzms_probability *probs,
+            unsigned int count ) {
+  unsigned int i;
+
+  for ( i = 0 ; i < count ; i++ ) {
+    probs[i].zeros = LZMS_INITIAL_PROBABILITY;
+    probs[i].recent = LZMS_INITIAL_RECENT_BITS;
+  }
+}
+
+/**
+ * Initialise decompressor
+ *
+ * @v lzms    Decompressor
+ * @v data    Compressed data
+ * @v words    Length of compressed data (in 16-bit words)
+ * @v out_len    Length of decompressed data
+ * @ret rc    Return status code
+ */
+static int lzms_init ( struct lzms *lzms, const uint16_t *data,
+           size_t words, size_t out_len ) {
+  unsigned int num_offsets;
+  unsigned int i;
+  int rc;
+
+  /* Initialise input streams */
+  lzms_rd_init ( &lzms->rd, data, words );
+  lzms_is_init ( &lzms->is, data, words );
+
+  /* Initialise probabilities */
+  lzms_probs_init ( lzms->main, LZMS_NUM_MAIN_PROBS );
+  lzms_probs_init ( lzms->match, LZMS_NUM_MATCH_PROBS );
+  lzms_probs_init ( lzms->lz, LZMS_NUM_LZ_PROBS );
+  for ( i = 0 ; i < ( LZMS_NUM_LZ_REPS - 1 ) ; i++ )
+    lzms_probs_init ( lzms->lz_rep[i], LZMS_NUM_LZ_PROBS );
+  lzms_probs_init ( lzms->delta, LZMS_NUM_LZ_PROBS );
+  for ( i = 0 ; i < ( LZMS_NUM_DELTA_REPS - 1 ) ; i++ )
+    lzms_probs_init ( lzms->delta_rep[i], LZMS_NUM_LZ_PROBS );
+
+  /* Initialise Huffman codes */
+  num_offsets = lzms_offset_slots ( out_len );
+  if ( ( ( rc = lzms_huffman_init ( lzms, &lzms->literal,
+            &lzms->literal_alphabet.alphabet,
+            lzms->literal_freqs,
+            lzms->literal_lengths,
+            LZMS_NUM_LITERAL_SYMS,
+            LZMS_LITERAL_CODE_REBUILD_FREQ ) ) != 0 ) ||
+       ( ( rc = lzms_huffman_init ( lzms, &lzms->lz_offset,
+            &lzms->lz_offset_alphabet.alphabet,
+            lzms->lz_offset_freqs,
+            lzms->lz_offset_lengths, num_offsets,
+            LZMS_LZ_OFFSET_CODE_REBUILD_FREQ ) ) != 0 ) ||
+       ( ( rc = lzms_huffman_init ( lzms, &lzms->length,
+            &lzms->length_alphabet.alphabet,
+            lzms->length_freqs,
+            lzms->length_lengths,
+            LZMS_NUM_LENGTH_SYMS,
+            LZMS_LENGTH_CODE_REBUILD_FREQ ) ) != 0 ) ||
+       ( ( rc = lzms_huffman_init ( lzms, &lzms->delta_offset,
+            &lzms->delta_offset_alphabet.alphabet,
+            lzms->delta_offset_freqs,
+            lzms->delta_offset_lengths, num_offsets,
+            LZMS_DELTA_OFFSET_CODE_REBUILD_FREQ ) ) != 0 ) ||
+       ( ( rc = lzms_huffman_init ( lzms, &lzms->delta_power,
+            &lzms->delta_power_alphabet.alphabet,
+            lzms->delta_power_freqs,
+            lzms->delta_power_lengths,
+            LZMS_NUM_DELTA_POWER_SYMS,
+            LZMS_DELTA_POWER_CODE_REBUILD_FREQ ) ) != 0 ) )
+    return rc;
+
+  return 0;
+}
+
+/**
+ * Decode items
+ *
+ * @v lzms    Decompressor
+ * @v out    Output buffer
+ * @v out_len    Length of output
+ * @ret rc    Return status code
+ *
+ * Updates to the recent offset queues are delayed by one item.
+ * Rather than delaying the update, the queues hold one extra entry
+ * and a repeat match immediately following a match of the same type
+ * selects from one slot further along.
+ */
+static int lzms_items ( struct lzms *lzms, uint8_t *out, size_t out_len ) {
+  struct lzms_range_decoder *rd = &lzms->rd;
+  uint32_t lz_offsets[ LZMS_NUM_LZ_REPS + 1 ];
+  uint64_t delta_pairs[ LZMS_NUM_DELTA_REPS + 1 ];
+  unsigned int lz_rep_states[ LZMS_NUM_LZ_REPS - 1 ];
+  unsigned int delta_rep_states[ LZMS_NUM_DELTA_REPS - 1 ];
+  unsigned int main_state = 0;
+  unsigned int match_state = 0;
+  unsigned int lz_state = 0;
+  unsigned int delta_state = 0;
+  unsigned int prev_type = 0;
+  unsigned int rep;
+  unsigned int i;
+  size_t pos = 0;
+  uint32_t offset;
+  uint32_t length;
+  uint32_t power;
+  uint32_t raw_offset;
+  uint32_t span;
+  uint64_t pair;
+  int sym;
+  int rc;
+
+  for ( i = 0 ; i < ( LZMS_NUM_LZ_REPS + 1 ) ; i++ )
+    lz_offsets[i] = ( i + 1 );
+  for ( i = 0 ; i < ( LZMS_NUM_DELTA_REPS + 1 ) ; i++ )
+    delta_pairs[i] = ( i + 1 );
+  memset ( lz_rep_states, 0, sizeof ( lz_rep_states ) );
+  memset ( delta_rep_states, 0, sizeof ( delta_rep_states ) );
+
+  while ( pos < out_len ) {
+
+    if ( ! lzms_rd_bit ( rd, &main_state, LZMS_NUM_MAIN_PROBS,
+             lzms->main ) ) {
+
+      /* Literal */
+      sym = lzms_huffman_sym ( lzms, &lzms->literal );
+      if ( sym < 0 )
+        return sym;
+      out[pos++] = sym;
+      prev_type = 0;
+
+    } else if ( ! lzms_rd_bit ( rd, &match_state, LZMS_NUM_MATCH_PROBS,
+              lzms->match ) ) {
+
+      /* LZ match */
+      if ( ! lzms_rd_bit ( rd, &lz_state, LZMS_NUM_LZ_PROBS,
+               lzms->lz ) ) {
+        if ( ( rc = lzms_offset ( lzms, &lzms->lz_offset,
+                &offset ) ) != 0 )
+          return rc;
+        for ( i = LZMS_NUM_LZ_REPS ; i > 0 ; i-- )
+          lz_offsets[i] = lz_offsets[ i - 1 ];
+      } else {
+        for ( rep = 0 ; rep < ( LZMS_NUM_LZ_REPS - 1 ) ; rep++ ) {
+          if ( ! lzms_rd_bit ( rd, &lz_rep_states[rep],
+                   LZMS_NUM_LZ_PROBS,
+                   lzms->lz_rep[rep] ) )
+            break;
+        }
+        offset = lz_offsets[ rep + ( prev_type & 1 ) ];
+        lz_offsets[ rep + ( prev_type & 1 ) ] = lz_offsets[rep];
+        for ( i = rep ; i > 0 ; i-- )
+          lz_offsets[i] = lz_offsets[ i - 1 ];
+      }
+      lz_offsets[0] = offset;
+      prev_type = 1;
+
+      if ( ( rc = lzms_length ( lzms, &length ) ) != 0 )
+        return rc;
+      if ( ( length > ( out_len - pos ) ) || ( offset > pos ) ) {
+        printf ( "LZMS match out of range\n" );
+        return -1;
+      }
+      for ( ; length ; length--, pos++ )
+        out[pos] = out[ pos - offset ];
+
+    } else {
+
+      /* Delta match */
+      if ( ! lzms_rd_bit ( rd, &delta_state, LZMS_NUM_LZ_PROBS,
+               lzms->delta ) ) {
+        sym = lzms_huffman_sym ( lzms, &lzms->delta_power );
+        if ( sym < 0 )
+          return sym;
+        power = sym;
+        if ( ( rc = lzms_offset ( lzms, &lzms->delta_offset,
+                &raw_offset ) ) != 0 )
+          return rc;
+        for ( i = LZMS_NUM_DELTA_REPS ; i > 0 ; i-- )
+          delta_pairs[i] = delta_pairs[ i - 1 ];
+      } else {
+        for ( rep = 0 ; rep < ( LZMS_NUM_DELTA_REPS - 1 ) ; rep++ ) {
+          if ( ! lzms_rd_bit ( rd, &delta_rep_states[rep],
+                   LZMS_NUM_LZ_PROBS,
+                   lzms->delta_rep[rep] ) )
+            break;
+        }
+        pair = delta_pairs[ rep + ( prev_type >> 1 ) ];
+        delta_pairs[ rep + ( prev_type >> 1 ) ] = delta_pairs[rep];
+        for ( i = rep ; i > 0 ; i-- )
+          delta_pairs[i] = delta_pairs[ i - 1 ];
+        power = ( pair >> 32 );
+        raw_offset = ( ( uint32_t ) pair );
+      }
+      delta_pairs[0] = ( ( ( ( uint64_t ) power ) << 32 ) | raw_offset );
+      prev_type = 2;
+
+      if ( ( rc = lzms_length ( lzms, &length ) ) != 0 )
+        return rc;
+      span = ( 1U << power );
+      offset = ( raw_offset << power );
+      if ( ( ( offset >> power ) != raw_offset ) ||
+           ( ( offset + span ) < offset ) ||
+           ( ( offset + span ) > pos ) ||
+           ( length > ( out_len - pos ) ) ) {
+        printf ( "LZMS delta match out of range\n" );
+        return -1;
+      }
+      for ( ; length ; length--, pos++ ) {
+        out[pos] = ( out[ pos - offset ] + out[ pos - span ] -
+               out[ pos - offset - span ] );
+      }
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Undo x86 address translation
+ *
+ * @v lzms    Decompressor
+ * @v data    Decompressed data
+ * @v len    Length of data
+ */
+static void lzms_x86_filter ( struct lzms *lzms, uint8_t *data,
+            size_t len ) {
+  int32_t *targets = lzms->x86_targets;
+  int32_t closest = ( - LZMS_X86_MAX_TRANSLATION_OFFSET - 1 );
+  int32_t max_offset;
+  int32_t i;
+  int32_t end;
+  unsigned int op_len;
+  uint16_t target;
+  uint32_t value;
+
+  for ( i = 0 ; i < LZMS_X86_TARGETS ; i++ )
+    targets[i] = ( - LZMS_X86_ID_WINDOW_SIZE - 1 );
+  if ( len <= 17 )
+    return;
+
+  /* The final 16 bytes are never translated */
+  end = ( len - 16 );
+  for ( i = 1 ; i < end ; i++ ) {
+
+    /* Identify instructions with relative addresses */
+    max_offset = LZMS_X86_MAX_TRANSLATION_OFFSET;
+    op_len = 0;
+    switch ( data[i] ) {
+    case 0x48:
+      if ( ( data[ i + 1 ] == 0x8b ) &&
+           ( ( data[ i + 2 ] == 0x05 ) || ( data[ i + 2 ] == 0x0d ) ) ) {
+        /* Load relative (x86_64) */
+        op_len = 3;
+      } else if ( ( data[ i + 1 ] == 0x8d ) &&
+            ( ( data[ i + 2 ] & 0x07 ) == 0x05 ) ) {
+        /* Load effective address relative (x86_64) */
+        op_len = 3;
+      }
+      break;
+    case 0x4c:
+      if ( ( data[ i + 1 ] == 0x8d ) &&
+           ( ( data[ i + 2 ] & 0x07 ) == 0x05 ) ) {
+        /* Load effective address relative (x86_64) */
+        op_len = 3;
+      }
+      break;
+    case 0xe8:
+      /* Call relative; require more confidence */
+      op_len = 1;
+      max_offset /= 2;
+      break;
+    case 0xe9:
+      /* Jump relative; skipped but never translated */
+      i += 4;
+      break;
+    case 0xf0:
+      if ( ( data[ i + 1 ] == 0x83 ) && ( data[ i + 2 ] == 0x05 ) ) {
+        /* Lock add relative */
+        op_len = 3;
+      }
+      break;
+    case 0xff:
+      if ( data[ i + 1 ] == 0x15 ) {
+        /* Call indirect relative */
+        op_len = 2;
+      }
+      break;
+    }
+    if ( ! op_len )
+      continue;
+
+    /* Undo translation if close to a recently used target */
+    if ( ( i - closest ) <= max_offset ) {
+      memcpy ( &value, &data[ i + op_len ], sizeof ( value ) );
+      value -= i;
+      memcpy ( &data[ i + op_len ], &value, sizeof ( value ) );
+    }
+    memcpy ( &target, &data[ i + op_len ], sizeof ( target ) );
+    target += i;
+
+    /* Track target usage */
+    i += ( op_len + sizeof ( value ) - 1 );
+    if ( ( i - targets[target] ) <= LZMS_X86_ID_WINDOW_SIZE )
+      closest = i;
+    targets[target] = i;
+  }
+}
+
+/**
+ * Decompress LZMS-compressed data
+ *
+ * @v data    Compressed data
+ * @v len    Length of compressed data
+ * @v buf    Decompression buffer
+ * @v buf_len    Length of decompressed data
+ * @ret out_len    Length of decompressed data, or negative error
+ *
+ * Unlike the LZX and XPRESS decompressors, the exact length of the
+ * decompressed data must be known in advance.
+ */
+ssize_t lzms_decompress ( const void *data, size_t len, void *buf,
+                          size_t buf_len ) {
+  struct lzms *lzms;
+  int rc;
+
+  /* Sanity checks */
+  if ( ( len < 4 ) || ( len % 2 ) ) {
+    printf ( "LZMS cannot handle odd-length or short input data\n" );
+    return -1;
+  }
+  if ( ( ! buf ) || ( buf_len > 0x7fffffffUL ) )
+    return -1;
+
+  /* Initialise global state, if required */
+  if ( ! lzms_offset_base[0] ) {
+    lzms_init_slots ( lzms_offset_base, lzms_offset_bits,
+          lzms_offset_slot_runs,
+          sizeof ( lzms_offset_slot_runs ),
+          0x7fffffffUL );
+    lzms_init_slots ( lzms_length_base, lzms_length_bits,
+          lzms_length_slot_runs,
+          sizeof ( lzms_length_slot_runs ),
+          0x400108abUL );
+  }
+  if ( ! lzms_state ) {
+    lzms_state = malloc ( sizeof ( *lzms_state ) );
+    if ( ! lzms_state )
+      return -1;
+  }
+  lzms = lzms_state;
+
+  /* Decompress */
+  if ( ( rc = lzms_init ( lzms, data, ( len / 2 ), buf_len ) ) != 0 )
+    return rc;
+  if ( ( rc = lzms_items ( lzms, buf, buf_len ) ) != 0 )
+    return rc;
+  lzms_x86_filter ( lzms, buf, buf_len );
+
+  return buf_len;
+}
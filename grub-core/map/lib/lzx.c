@@ -408,6 +408,10 @@ static int lzx_block_header ( struct lzx *lzx ) {
     block_len = ( ( len_high << 8 ) | len_low );
   }
   lzx->output.threshold = ( lzx->output.offset + block_len );
+  if ( lzx->output.data && ( lzx->output.threshold > lzx->output.len ) ) {
+    printf ( "LZX block overruns output buffer\n" );
+    return -1;
+  }
 
   /* Handle block type */
   switch ( block_type ) {
@@ -555,6 +559,8 @@ static int lzx_token ( struct lzx *lzx ) {
     return -1;
   }
   if ( lzx->output.data ) {
+    if ( ( lzx->output.offset + match_length ) > lzx->output.len )
+      return -1;
     copy = &lzx->output.data[lzx->output.offset];
     for ( i = 0 ; i < match_length ; i++ )
       copy[i] = copy[ i - match_offset ];
@@ -603,9 +609,11 @@ static void lzx_translate_jumps ( struct lzx *lzx ) {
  * @v data    Compressed data
  * @v len    Length of compressed data
  * @v buf    Decompression buffer, or NULL
+ * @v buf_len    Length of decompression buffer
  * @ret out_len    Length of decompressed data, or negative error
  */
-ssize_t lzx_decompress ( const void *data, size_t len, void *buf ) {
+ssize_t lzx_decompress ( const void *data, size_t len, void *buf,
+                         size_t buf_len ) {
   struct lzx lzx;
   unsigned int i;
   int rc;
@@ -630,6 +638,7 @@ ssize_t lzx_decompress ( const void *data, size_t len, void *buf ) {
   lzx.input.data = data;
   lzx.input.len = len;
   lzx.output.data = buf;
+  lzx.output.len = buf_len;
   for ( i = 0 ; i < LZX_REPEATED_OFFSETS ; i++ )
     lzx.repeated_offset[i] = 1;
 
@@ -123,6 +123,10 @@ file_open (const char *name, int mem, int bl, int rt)
   grub_size_t size = 0;
   enum grub_file_type type = GRUB_FILE_TYPE_LOOPBACK;
 
+  /* Mapped images are read randomly by the OS, unless they are copied to
+     memory in one go.  */
+  if (!mem)
+    type |= GRUB_FILE_TYPE_NO_READAHEAD;
   file = grub_file_open (name, type);
   if (!file)
     return NULL;
@@ -162,11 +166,12 @@ file_open (const char *name, int mem, int bl, int rt)
   return file;
 }
 
-void
+grub_ssize_t
 file_read (grub_file_t file, void *buf, grub_size_t len, grub_off_t offset)
 {
-  grub_file_seek (file, offset);
-  grub_file_read (file, buf, len);
+  if (grub_file_seek (file, offset) == (grub_off_t) -1)
+    return -1;
+  return grub_file_read (file, buf, len);
 }
 
 void
@@ -20,6 +20,7 @@
 #include <stddef.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <vfat.h>
 #include <misc.h>
@@ -32,6 +33,12 @@
 /** Virtual files */
 struct vfat_file vfat_files[VDISK_MAX_FILES];
 
+/** FAT end-of-file marker clusters, in increasing order */
+static uint32_t vfat_fat_ends[VDISK_MAX_FILES];
+
+/** Number of FAT end-of-file marker clusters */
+static unsigned int vfat_fat_ends_count;
+
 /**
  * Read from virtual Master Boot Record
  *
@@ -140,19 +147,13 @@ static void vfat_fat (uint64_t lba, unsigned int count, void *data)
   }
 
   /* Add end-of-file markers, if applicable */
-  for (i = 0; i < VDISK_MAX_FILES; i++)
+  for (i = 0; i < vfat_fat_ends_count; i++)
   {
-    if (vfat_files[i].read)
-    {
-      file_end_marker = (VDISK_FILE_CLUSTER (i) +
-              ((vfat_files[i].xlen - 1) /
-                VDISK_CLUSTER_SIZE));
-      if ((file_end_marker >= start) &&
-           (file_end_marker < end))
-      {
-        next[file_end_marker] = VDISK_FAT_END_MARKER;
-      }
-    }
+    file_end_marker = vfat_fat_ends[i];
+    if (file_end_marker >= end)
+      break;
+    if (file_end_marker >= start)
+      next[file_end_marker] = VDISK_FAT_END_MARKER;
   }
 }
 
@@ -437,15 +438,17 @@ vfat_dir_files (uint64_t lba, unsigned int count, void *data)
 }
 
 /**
- * Read from virtual file (or empty space)
+ * Read from virtual file
  *
- * @v lba    Starting LBA
+ * @v file    Virtual file
+ * @v sector    Starting sector within file
  * @v count    Number of blocks to read
  * @v data    Data buffer
  */
-static void vfat_file (uint64_t lba, unsigned int count, void *data)
+static void
+vfat_file (struct vfat_file *file, uint64_t sector, unsigned int count,
+           void *data)
 {
-  struct vfat_file *file;
   size_t offset;
   size_t len;
   size_t copy_len;
@@ -453,8 +456,7 @@ static void vfat_file (uint64_t lba, unsigned int count, void *data)
   size_t patch_len;
 
   /* Construct file portion */
-  file = &vfat_files[VDISK_FILE_IDX (lba)];
-  offset = VDISK_FILE_OFFSET (lba);
+  offset = (sector * VDISK_SECTOR_SIZE);
   len = (count * VDISK_SECTOR_SIZE);
 
   /* Copy any initialised-data portion */
@@ -540,6 +542,184 @@ static struct vfat_region vfat_regions[] =
          VDISK_MICROSOFT_LBA),
 };
 
+/** A compiled virtual disk extent */
+struct vfat_extent
+{
+  /** Starting LBA */
+  uint64_t lba;
+  /** Number of blocks */
+  uint64_t count;
+  /** Region, if this extent holds generated data */
+  struct vfat_region *region;
+  /** Virtual file, if this extent holds file data */
+  struct vfat_file *file;
+  /** Cached generated data, if any */
+  void *cache;
+};
+
+/** Maximum number of compiled extents */
+#define VFAT_MAX_EXTENTS \
+  ((sizeof (vfat_regions) / sizeof (vfat_regions[0])) + VDISK_MAX_FILES)
+
+/** Maximum size of a region whose generated data is cached (in blocks) */
+#define VFAT_CACHE_MAX_COUNT VDISK_CLUSTER_COUNT
+
+/** Compiled virtual disk extents, sorted by starting LBA */
+static struct vfat_extent vfat_extents[VFAT_MAX_EXTENTS];
+
+/** Number of compiled extents */
+static unsigned int vfat_extents_count;
+
+/** Compiled extents are valid */
+static int vfat_extents_valid;
+
+/**
+ * Discard compiled virtual disk layout
+ *
+ * This must be called whenever the set of files or their lengths
+ * changes, since the FAT and directory contents depend on them.
+ */
+static void
+vfat_invalidate (void)
+{
+  unsigned int i;
+
+  for (i = 0; i < vfat_extents_count; i++)
+    free (vfat_extents[i].cache);
+  memset (vfat_extents, 0, sizeof (vfat_extents));
+  vfat_extents_count = 0;
+  vfat_extents_valid = 0;
+}
+
+/**
+ * Add compiled extent
+ *
+ * @v lba    Starting LBA
+ * @v count    Number of blocks
+ * @v region    Region, or NULL
+ * @v file    Virtual file, or NULL
+ */
+static void
+vfat_add_extent (uint64_t lba, uint64_t count, struct vfat_region *region,
+                 struct vfat_file *file)
+{
+  struct vfat_extent *extent;
+  unsigned int i;
+
+  /* Insert in order of starting LBA */
+  assert (vfat_extents_count < VFAT_MAX_EXTENTS);
+  for (i = vfat_extents_count; i && (vfat_extents[i - 1].lba > lba); i--)
+    vfat_extents[i] = vfat_extents[i - 1];
+  extent = &vfat_extents[i];
+  extent->lba = lba;
+  extent->count = count;
+  extent->region = region;
+  extent->file = file;
+  extent->cache = NULL;
+  vfat_extents_count++;
+}
+
+/**
+ * Compile virtual disk layout
+ */
+static void
+vfat_compile (void)
+{
+  struct vfat_file *file;
+  unsigned int i;
+
+  vfat_invalidate ();
+
+  /* Add generated regions */
+  for (i = 0; i < (sizeof (vfat_regions) / sizeof (vfat_regions[0])); i++)
+  {
+    vfat_add_extent (vfat_regions[i].lba, vfat_regions[i].count,
+                     &vfat_regions[i], NULL);
+  }
+
+  /* Add files and record their FAT end-of-file markers */
+  vfat_fat_ends_count = 0;
+  for (i = 0; i < VDISK_MAX_FILES; i++)
+  {
+    file = &vfat_files[i];
+    if (! file->read)
+      continue;
+    vfat_add_extent (VDISK_FILE_LBA (i), VDISK_FILE_COUNT, NULL, file);
+    vfat_fat_ends[vfat_fat_ends_count++] =
+      (VDISK_FILE_CLUSTER (i) + ((file->xlen - 1) / VDISK_CLUSTER_SIZE));
+  }
+
+  vfat_extents_valid = 1;
+}
+
+/**
+ * Find compiled extent
+ *
+ * @v lba    LBA
+ * @ret index    Index of last extent starting at or before LBA, or -1
+ */
+static int
+vfat_find_extent (uint64_t lba)
+{
+  unsigned int low = 0;
+  unsigned int high = vfat_extents_count;
+  unsigned int mid;
+
+  while (low < high)
+  {
+    mid = ((low + high) / 2);
+    if (vfat_extents[mid].lba <= lba)
+      low = (mid + 1);
+    else
+      high = mid;
+  }
+  return ((int) low - 1);
+}
+
+/**
+ * Read from compiled extent
+ *
+ * @v extent    Extent
+ * @v lba    Starting LBA
+ * @v count    Number of blocks to read
+ * @v data    Data buffer
+ */
+static void
+vfat_read_extent (struct vfat_extent *extent, uint64_t lba,
+                  unsigned int count, void *data)
+{
+  struct vfat_region *region = extent->region;
+
+  /* Read file data */
+  if (extent->file)
+  {
+    vfat_file (extent->file, (lba - extent->lba), count, data);
+    return;
+  }
+
+  /* Generate large regions (i.e. the FAT) on demand */
+  if (extent->count > VFAT_CACHE_MAX_COUNT)
+  {
+    region->build (lba, count, data);
+    return;
+  }
+
+  /* Generate small regions once and cache the result */
+  if (! extent->cache)
+  {
+    extent->cache = malloc (extent->count * VDISK_SECTOR_SIZE);
+    if (! extent->cache)
+    {
+      region->build (lba, count, data);
+      return;
+    }
+    region->build (extent->lba, extent->count, extent->cache);
+  }
+  memcpy (data, ((char *) extent->cache +
+                 ((lba - extent->lba) * VDISK_SECTOR_SIZE)),
+          (count * VDISK_SECTOR_SIZE));
+}
+
 /**
  * Read from virtual disk
  *
@@ -549,88 +729,48 @@ static struct vfat_region vfat_regions[] =
  */
 void vfat_read (uint64_t lba, unsigned int count, void *data)
 {
-  struct vfat_region *region;
-  void (* build) (uint64_t lba, unsigned int count, void *data);
-  //const char *name;
-  uint64_t start = lba;
+  struct vfat_extent *extent;
   uint64_t end = (lba + count);
-  uint64_t frag_start = start;
+  uint64_t frag_start = lba;
   uint64_t frag_end;
-  int file_idx;
-  uint64_t file_end;
-  uint64_t region_start;
-  uint64_t region_end;
   unsigned int frag_count;
-  unsigned int i;
+  int idx;
+
+  /* Compile layout, if required */
+  if (! vfat_extents_valid)
+    vfat_compile ();
 
-  do
+  while (frag_start != end)
   {
     /* Initialise fragment to fill remaining space */
     frag_end = end;
-    //name = NULL;
-    build = NULL;
 
-    /* Truncate fragment and generate data */
-    file_idx = VDISK_FILE_IDX (frag_start);
-    if (file_idx >= 0)
-    {
-      /* Truncate fragment to end of file */
-      file_end = VDISK_FILE_LBA (file_idx + 1);
-      if (frag_end > file_end)
-        frag_end = file_end;
-
-      /* Generate data from file */
-      if (file_idx < VDISK_MAX_FILES)
-      {
-        //name = vfat_files[file_idx].name;
-        build = vfat_file;
-      }
-    }
-    else
-    {
-      /* Truncate fragment to region boundaries */
-      for (i = 0; i < (sizeof (vfat_regions) /
-              sizeof (vfat_regions[0])); i++)
-      {
-        region = &vfat_regions[i];
-        region_start = region->lba;
-        region_end = (region_start + region->count);
-        /* Avoid crossing start of any region */
-        if ((frag_start < region_start) &&
-             (frag_end > region_start))
-        {
-          frag_end = region_start;
-        }
-        /* Ignore unless we overlap with this region */
-        if ((frag_start >= region_end) ||
-             (frag_end <= region_start))
-        {
-          continue;
-        }
-        /* Avoid crossing end of region */
-        if (frag_end > region_end)
-          frag_end = region_end;
-        /* Found a suitable region */
-        //name = region->name;
-        build = region->build;
-        break;
-      }
-    }
-    /* Generate data from this region */
-    frag_count = (frag_end - frag_start);
-    if (build)
+    /* Find extent containing (or preceding) the fragment start */
+    idx = vfat_find_extent (frag_start);
+    extent = ((idx >= 0) ? &vfat_extents[idx] : NULL);
+
+    if (extent && (frag_start < (extent->lba + extent->count)))
     {
-      build (frag_start, frag_count, data);
+      /* Truncate fragment to end of extent and generate data */
+      if (frag_end > (extent->lba + extent->count))
+        frag_end = (extent->lba + extent->count);
+      frag_count = (frag_end - frag_start);
+      vfat_read_extent (extent, frag_start, frag_count, data);
     }
     else
     {
+      /* Truncate fragment to start of next extent and zero-fill */
+      if (((unsigned int) (idx + 1) < vfat_extents_count) &&
+          (frag_end > vfat_extents[idx + 1].lba))
+        frag_end = vfat_extents[idx + 1].lba;
+      frag_count = (frag_end - frag_start);
       memset (data, 0, (frag_count * VDISK_SECTOR_SIZE));
     }
-    /* Move to next fragment */ 
+
+    /* Move to next fragment */
     frag_start += frag_count;
     data = (char *)data + (frag_count * VDISK_SECTOR_SIZE);
   }
-  while (frag_start != end);
 }
 
 /**
@@ -659,6 +799,7 @@ vfat_add_file (const char *name, void *opaque, size_t len,
   file->len = len;
   file->xlen = len;
   file->read = read;
+  vfat_invalidate ();
   printf ("Using %s via %p len 0x%lx\n", file->name, file->opaque,
         file->len);
   return file;
@@ -679,6 +820,7 @@ vfat_patch_file (struct vfat_file *file,
   file->patch = patch;
   /* Allow patch method to update file length */
   patch (file, NULL, 0, 0);
+  vfat_invalidate ();
 }
 
 #if __GNUC__ >= 9
@@ -31,16 +31,89 @@
 #include <vfat.h>
 #include <lzx.h>
 #include <xpress.h>
+#include <lzms.h>
 #include <wim.h>
 
-/**
- * WIM chunk buffer
- *
- * We place this in the .stack section to avoid crossing the Forbidden
- * Threshold at 0x30000.  (See comments in script.lds.)
- */
-static struct wim_chunk_buffer wim_chunk_buffer
-  __attribute__ (( section ( ".stack" ) ));
+/** A cached decompressed chunk */
+struct wim_chunk_cache_entry {
+  /** Virtual file */
+  struct vfat_file *file;
+  /** Offset of compressed resource within file */
+  uint64_t resource_offset;
+  /** Chunk number */
+  unsigned int chunk;
+  /** Time of last use */
+  unsigned long stamp;
+  /** Decompressed data, or NULL if entry is unused */
+  uint8_t *data;
+  /** Length of decompressed data buffer */
+  size_t len;
+};
+
+/** Chunk cache entries */
+static struct wim_chunk_cache_entry *wim_chunk_cache;
+
+/** Number of chunk cache entries */
+static unsigned int wim_chunk_cache_count;
+
+/** Chunk cache size, in bytes */
+static size_t wim_chunk_cache_size = WIM_CHUNK_CACHE_DEFAULT_SIZE;
+
+/** Total length of chunk cache buffers */
+static size_t wim_chunk_cache_used;
+
+/** Chunk cache use counter */
+static unsigned long wim_chunk_cache_stamp;
+
+/** Most recent chunk larger than the whole cache, kept outside of it */
+static struct wim_chunk_cache_entry wim_chunk_oversized;
+
+/** Compressed chunk buffer */
+static uint8_t *wim_zbuf;
+
+/** Length of compressed chunk buffer */
+static size_t wim_zbuf_len;
+
+/** A solid resource */
+struct wim_solid {
+  /** Virtual file */
+  struct vfat_file *file;
+  /** Offset of resource within file */
+  uint64_t offset;
+  /** Uncompressed length */
+  uint64_t len;
+  /** Chunk length */
+  size_t chunk_len;
+  /** Compression format */
+  unsigned int format;
+  /** Number of chunks */
+  unsigned int chunks;
+  /** Chunk data offsets within resource (one per chunk, plus end) */
+  uint64_t *offsets;
+};
+
+/** Most recently used solid resource */
+static struct wim_solid wim_solid;
+
+/** A stream within a solid resource */
+struct wim_solid_stream {
+  /** Virtual file */
+  struct vfat_file *file;
+  /** Stream resource header */
+  struct wim_resource_header resource;
+  /** Offset of solid resource within file */
+  uint64_t solid_offset;
+  /** Compressed length of solid resource */
+  uint64_t solid_zlen;
+  /** Offset of stream within uncompressed solid resource */
+  uint64_t offset;
+};
+
+/** Recently located solid resource streams */
+static struct wim_solid_stream wim_solid_streams[WIM_SOLID_STREAMS];
+
+/** Next solid resource stream slot to replace */
+static unsigned int wim_solid_stream_next;
 
 /**
  * Get WIM header
@@ -63,18 +136,48 @@ int wim_header ( struct vfat_file *file, struct wim_header *header ) {
   return 0;
 }
 
+/**
+ * Get chunk length
+ *
+ * @v header    WIM header
+ * @ret chunk_len    Chunk length
+ */
+static size_t wim_chunk_len ( struct wim_header *header ) {
+
+  return ( header->chunk_len ? header->chunk_len : WIM_CHUNK_LEN );
+}
+
+/**
+ * Get compression format
+ *
+ * @v header    WIM header
+ * @ret format    Compression format
+ */
+static unsigned int wim_format ( struct wim_header *header ) {
+
+  if ( header->flags & WIM_HDR_LZX )
+    return WIM_FORMAT_LZX;
+  if ( header->flags & WIM_HDR_XPRESS )
+    return WIM_FORMAT_XPRESS;
+  if ( header->flags & WIM_HDR_LZMS )
+    return WIM_FORMAT_LZMS;
+  return WIM_FORMAT_NONE;
+}
+
 /**
  * Get compressed chunk offset
  *
  * @v file    Virtual file
  * @v resource    Resource
+ * @v chunk_len    Chunk length
  * @v chunk    Chunk number
  * @v offset    Offset to fill in
  * @ret rc    Return status code
  */
 static int wim_chunk_offset ( struct vfat_file *file,
             struct wim_resource_header *resource,
-            unsigned int chunk, size_t *offset ) {
+            size_t chunk_len, unsigned int chunk,
+            size_t *offset ) {
   size_t zlen = ( resource->zlen__flags & WIM_RESHDR_ZLEN_MASK );
   unsigned int chunks;
   size_t offset_offset;
@@ -92,7 +195,7 @@ static int wim_chunk_offset ( struct vfat_file *file,
   }
 
   /* Calculate chunk parameters */
-  chunks = ( ( resource->len + WIM_CHUNK_LEN - 1 ) / WIM_CHUNK_LEN );
+  chunks = ( ( resource->len + chunk_len - 1 ) / chunk_len );
   offset_len = ( ( resource->len > 0xffffffffULL ) ?
            sizeof ( u.offset_64 ) : sizeof ( u.offset_32 ) );
   chunks_len = ( ( chunks - 1 ) * offset_len );
@@ -131,6 +234,77 @@ static int wim_chunk_offset ( struct vfat_file *file,
   return 0;
 }
 
+/**
+ * Read and decompress a chunk
+ *
+ * @v file    Virtual file
+ * @v format    Compression format
+ * @v offset    Offset of compressed chunk within file
+ * @v len    Length of compressed chunk
+ * @v buf    Chunk buffer
+ * @v out_len    Uncompressed length of chunk
+ * @ret rc    Return status code
+ */
+static int wim_decompress ( struct vfat_file *file, unsigned int format,
+          uint64_t offset, size_t len, void *buf,
+          size_t out_len ) {
+  ssize_t ( * decompress ) ( const void *data, size_t len, void *buf,
+                             size_t buf_len );
+  ssize_t decompressed_len;
+
+  /* Chunk did not compress; read raw data */
+  if ( len == out_len ) {
+    file->read ( file, buf, offset, len );
+    return 0;
+  }
+
+  /* Sanity check */
+  if ( len > out_len ) {
+    printf ( "Compressed chunk too long (0x%lx bytes)\n",
+          (unsigned long)len );
+    return -1;
+  }
+
+  /* Identify decompressor */
+  switch ( format ) {
+  case WIM_FORMAT_LZX :
+    decompress = lzx_decompress;
+    break;
+  case WIM_FORMAT_XPRESS :
+    decompress = xca_decompress;
+    break;
+  case WIM_FORMAT_LZMS :
+    decompress = lzms_decompress;
+    break;
+  default :
+    printf ( "Unsupported compression format %d\n", format );
+    return -1;
+  }
+
+  /* Read compressed data into the compressed chunk buffer */
+  if ( len > wim_zbuf_len ) {
+    free ( wim_zbuf );
+    wim_zbuf_len = 0;
+    wim_zbuf = malloc ( out_len );
+    if ( ! wim_zbuf )
+      return -1;
+    wim_zbuf_len = out_len;
+  }
+  file->read ( file, wim_zbuf, offset, len );
+
+  /* Decompress data directly into the chunk buffer */
+  decompressed_len = decompress ( wim_zbuf, len, buf, out_len );
+  if ( decompressed_len < 0 )
+    return decompressed_len;
+  if ( ( ( size_t ) decompressed_len ) != out_len ) {
+    printf ( "Unexpected output length 0x%lx (expected 0x%lx)\n",
+          decompressed_len, (unsigned long)out_len );
+    return -1;
+  }
+
+  return 0;
+}
+
 /**
  * Read chunk from a compressed resource
  *
@@ -139,72 +313,451 @@ static int wim_chunk_offset ( struct vfat_file *file,
  * @v resource    Resource
  * @v chunk    Chunk number
  * @v buf    Chunk buffer
+ * @v out_len    Uncompressed length of chunk
  * @ret rc    Return status code
  */
 static int wim_chunk ( struct vfat_file *file, struct wim_header *header,
            struct wim_resource_header *resource,
-           unsigned int chunk, struct wim_chunk_buffer *buf ) {
-  ssize_t ( * decompress ) ( const void *data, size_t len, void *buf );
-  unsigned int chunks;
+           unsigned int chunk, void *buf, size_t out_len ) {
+  size_t chunk_len = wim_chunk_len ( header );
   size_t offset;
   size_t next_offset;
-  size_t len;
-  size_t expected_out_len;
-  ssize_t out_len;
   int rc;
 
   /* Get chunk compressed data offset and length */
-  if ( ( rc = wim_chunk_offset ( file, resource, chunk,
+  if ( ( rc = wim_chunk_offset ( file, resource, chunk_len, chunk,
                &offset ) ) != 0 )
     return rc;
-  if ( ( rc = wim_chunk_offset ( file, resource, ( chunk + 1 ),
+  if ( ( rc = wim_chunk_offset ( file, resource, chunk_len, ( chunk + 1 ),
                &next_offset ) ) != 0 )
     return rc;
-  len = ( next_offset - offset );
+  if ( next_offset < offset ) {
+    printf ( "Chunk %d has negative length\n", chunk );
+    return -1;
+  }
 
-  /* Calculate uncompressed length */
-  chunks = ( ( resource->len + WIM_CHUNK_LEN - 1 ) / WIM_CHUNK_LEN );
-  expected_out_len = ( ( chunk >= ( chunks - 1 ) ) ?
-           ( resource->len % WIM_CHUNK_LEN ) : WIM_CHUNK_LEN);
+  return wim_decompress ( file, wim_format ( header ),
+        ( resource->offset + offset ), ( next_offset - offset ),
+        buf, out_len );
+}
 
-  /* Read possibly-compressed data */
-  if ( len == expected_out_len ) {
+/**
+ * Open solid resource
+ *
+ * @v file    Virtual file
+ * @v offset    Offset of resource within file
+ * @v zlen    Compressed length of resource
+ * @ret solid    Solid resource, or NULL on error
+ */
+static struct wim_solid * wim_solid_open ( struct vfat_file *file,
+             uint64_t offset, uint64_t zlen ) {
+  struct wim_solid *solid = &wim_solid;
+  struct wim_solid_header hdr;
+  uint64_t *offsets;
+  uint32_t *sizes;
+  uint64_t table_len;
+  unsigned int chunks;
+  unsigned int i;
 
-    /* Chunk did not compress; read raw data */
-    file->read ( file, buf->data, ( resource->offset + offset ),
-           len );
+  /* Use cached resource, if applicable */
+  if ( solid->offsets && ( solid->file == file ) &&
+       ( solid->offset == offset ) )
+    return solid;
 
-  } else {
-    uint8_t zbuf[len];
-
-    /* Read compressed data into a temporary buffer */
-    file->read ( file, zbuf, ( resource->offset + offset ), len );
-
-    /* Identify decompressor */
-    if ( header->flags & WIM_HDR_LZX ) {
-      decompress = lzx_decompress;
-    } else if ( header->flags & WIM_HDR_XPRESS ) {
-      decompress = xca_decompress;
-    } else if ( header->flags & WIM_HDR_LZMS ) {
-      printf ( "LZMS compression is not supported.\n" );
-      return -1;
-    } else {
-      return -1;
-    }
+  /* Read solid resource header */
+  if ( ( sizeof ( hdr ) > zlen ) || ( ( offset + zlen ) > file->len ) ) {
+    printf ( "Solid resource exceeds length of file\n" );
+    return NULL;
+  }
+  file->read ( file, &hdr, offset, sizeof ( hdr ) );
+  if ( ( ! hdr.chunk_len ) || ( hdr.chunk_len > WIM_SOLID_MAX_CHUNK_LEN ) ) {
+    printf ( "Unsupported solid chunk length 0x%x\n", hdr.chunk_len );
+    return NULL;
+  }
+  chunks = ( ( hdr.len + hdr.chunk_len - 1 ) / hdr.chunk_len );
+  table_len = ( ( ( uint64_t ) chunks ) * sizeof ( sizes[0] ) );
+  if ( ( sizeof ( hdr ) + table_len ) > zlen ) {
+    printf ( "Solid resource too short for %d chunks\n", chunks );
+    return NULL;
+  }
 
-    /* Decompress data */
-    out_len = decompress ( zbuf, len, NULL );
-    if ( out_len < 0 )
-      return out_len;
-    if ( ( ( size_t ) out_len ) != expected_out_len ) {
-      printf ( "Unexpected output length 0x%lx (expected 0x%lx)\n",
-            out_len, (unsigned long)expected_out_len );
-      return -1;
+  /* Read chunk sizes and convert to offsets */
+  offsets = malloc ( ( chunks + 1 ) * sizeof ( offsets[0] ) );
+  sizes = malloc ( table_len );
+  if ( ! ( offsets && sizes ) ) {
+    free ( offsets );
+    free ( sizes );
+    return NULL;
+  }
+  file->read ( file, sizes, ( offset + sizeof ( hdr ) ), table_len );
+  offsets[0] = ( sizeof ( hdr ) + table_len );
+  for ( i = 0 ; i < chunks ; i++ )
+    offsets[ i + 1 ] = ( offsets[i] + sizes[i] );
+  free ( sizes );
+  if ( offsets[chunks] > zlen ) {
+    printf ( "Solid resource chunks lie outside resource\n" );
+    free ( offsets );
+    return NULL;
+  }
+
+  /* Replace cached resource */
+  free ( solid->offsets );
+  solid->file = file;
+  solid->offset = offset;
+  solid->len = hdr.len;
+  solid->chunk_len = hdr.chunk_len;
+  solid->format = hdr.format;
+  solid->chunks = chunks;
+  solid->offsets = offsets;
+
+  return solid;
+}
+
+/**
+ * Read chunk from a solid resource
+ *
+ * @v solid    Solid resource
+ * @v chunk    Chunk number
+ * @v buf    Chunk buffer
+ * @v out_len    Uncompressed length of chunk
+ * @ret rc    Return status code
+ */
+static int wim_solid_chunk ( struct wim_solid *solid, unsigned int chunk,
+           void *buf, size_t out_len ) {
+
+  if ( chunk >= solid->chunks )
+    return -1;
+  return wim_decompress ( solid->file, solid->format,
+        ( solid->offset + solid->offsets[chunk] ),
+        ( solid->offsets[ chunk + 1 ] - solid->offsets[chunk] ),
+        buf, out_len );
+}
+
+/**
+ * Locate a stream within a solid resource
+ *
+ * @v file    Virtual file
+ * @v header    WIM header
+ * @v resource    Stream resource
+ * @v solid    Solid resource to fill in
+ * @v offset    Offset of stream within solid resource to fill in
+ * @ret rc    Return status code
+ *
+ * A stream's offset is relative to the concatenated uncompressed
+ * contents of the run of solid resource entries most recently
+ * preceding the stream's own entry in the lookup table.
+ */
+static int wim_solid_find ( struct vfat_file *file, struct wim_header *header,
+          struct wim_resource_header *resource,
+          struct wim_solid **solid, uint64_t *offset ) {
+  struct wim_lookup_entry entries[WIM_LOOKUP_BATCH];
+  struct wim_solid_stream *stream;
+  struct wim_solid_header hdr;
+  struct wim_resource_header *run = NULL;
+  struct wim_resource_header *tmp;
+  uint64_t *run_lens = NULL;
+  uint64_t *tmp_lens;
+  unsigned int run_count = 0;
+  unsigned int run_max = 0;
+  unsigned int count;
+  unsigned int i;
+  unsigned int j;
+  uint64_t base;
+  uint64_t zlen;
+  size_t pos;
+  int prev_solid = 0;
+  int rc;
+
+  /* Check recently located streams */
+  for ( i = 0 ; i < WIM_SOLID_STREAMS ; i++ ) {
+    stream = &wim_solid_streams[i];
+    if ( ( stream->file == file ) &&
+         ( memcmp ( &stream->resource, resource,
+              sizeof ( *resource ) ) == 0 ) )
+      goto found;
+  }
+
+  /* Scan lookup table */
+  stream = NULL;
+  for ( pos = 0 ; ( pos + sizeof ( entries[0] ) ) <= header->lookup.len ;
+        pos += ( count * sizeof ( entries[0] ) ) ) {
+
+    /* Read a batch of entries */
+    count = ( ( header->lookup.len - pos ) / sizeof ( entries[0] ) );
+    if ( count > WIM_LOOKUP_BATCH )
+      count = WIM_LOOKUP_BATCH;
+    if ( ( rc = wim_read ( file, header, &header->lookup, entries, pos,
+               ( count * sizeof ( entries[0] ) ) ) ) != 0 )
+      goto err;
+
+    for ( i = 0 ; i < count ; i++ ) {
+      tmp = &entries[i].resource;
+
+      /* Ignore streams not in solid resources */
+      if ( ! ( tmp->zlen__flags & WIM_RESHDR_PACKED_STREAMS ) ) {
+        prev_solid = 0;
+        continue;
+      }
+
+      /* Record solid resources, starting a new run if needed */
+      if ( tmp->len == WIM_SOLID_MAGIC_LEN ) {
+        if ( ! prev_solid )
+          run_count = 0;
+        prev_solid = 1;
+        if ( run_count == run_max ) {
+          run_max = ( run_max ? ( run_max * 2 ) : 4 );
+          tmp = realloc ( run, ( run_max * sizeof ( run[0] ) ) );
+          if ( ! tmp ) {
+            rc = -1;
+            goto err;
+          }
+          run = tmp;
+          tmp_lens = realloc ( run_lens,
+                   ( run_max * sizeof ( run_lens[0] ) ) );
+          if ( ! tmp_lens ) {
+            rc = -1;
+            goto err;
+          }
+          run_lens = tmp_lens;
+          tmp = &entries[i].resource;
+        }
+        zlen = ( tmp->zlen__flags & WIM_RESHDR_ZLEN_MASK );
+        if ( ( sizeof ( hdr ) > zlen ) ||
+             ( ( tmp->offset + sizeof ( hdr ) ) > file->len ) ) {
+          printf ( "Solid resource exceeds length of file\n" );
+          rc = -1;
+          goto err;
+        }
+        file->read ( file, &hdr, tmp->offset, sizeof ( hdr ) );
+        memcpy ( &run[run_count], tmp, sizeof ( run[0] ) );
+        run_lens[run_count++] = hdr.len;
+        continue;
+      }
+      prev_solid = 0;
+
+      /* Check for our stream */
+      if ( memcmp ( tmp, resource, sizeof ( *resource ) ) != 0 )
+        continue;
+      for ( base = 0, j = 0 ; j < run_count ; base += run_lens[j++] ) {
+        if ( ( resource->offset >= base ) &&
+             ( ( resource->offset + resource->len ) <=
+               ( base + run_lens[j] ) ) ) {
+          stream = &wim_solid_streams[wim_solid_stream_next];
+          wim_solid_stream_next = ( ( wim_solid_stream_next + 1 ) %
+                  WIM_SOLID_STREAMS );
+          stream->file = file;
+          memcpy ( &stream->resource, resource,
+             sizeof ( stream->resource ) );
+          stream->solid_offset = run[j].offset;
+          stream->solid_zlen = ( run[j].zlen__flags &
+               WIM_RESHDR_ZLEN_MASK );
+          stream->offset = ( resource->offset - base );
+          break;
+        }
+      }
+      if ( ! stream ) {
+        printf ( "Solid stream does not lie within one resource\n" );
+        rc = -1;
+        goto err;
+      }
+      break;
     }
-    decompress ( zbuf, len, buf->data );
+    if ( stream )
+      break;
+  }
+  free ( run );
+  free ( run_lens );
+  if ( ! stream ) {
+    printf ( "Cannot find solid resource for stream\n" );
+    return -1;
   }
 
+ found:
+  *solid = wim_solid_open ( file, stream->solid_offset, stream->solid_zlen );
+  if ( ! *solid ) {
+    stream->file = NULL;
+    return -1;
+  }
+  *offset = stream->offset;
   return 0;
+
+ err:
+  free ( run );
+  free ( run_lens );
+  return rc;
+}
+
+/**
+ * Set size of decompressed chunk cache
+ *
+ * @v size    Cache size in bytes, or 0 to cache a single chunk
+ *
+ * Any cached chunks are discarded.  A chunk larger than the cache is
+ * held outside of it, see wim_cache_alloc_oversized().
+ */
+void wim_set_chunk_cache_size ( size_t size ) {
+  unsigned int i;
+
+  for ( i = 0 ; i < wim_chunk_cache_count ; i++ )
+    free ( wim_chunk_cache[i].data );
+  free ( wim_chunk_cache );
+  wim_chunk_cache = NULL;
+  wim_chunk_cache_count = 0;
+  wim_chunk_cache_used = 0;
+  wim_chunk_cache_size = size;
+  free ( wim_chunk_oversized.data );
+  memset ( &wim_chunk_oversized, 0, sizeof ( wim_chunk_oversized ) );
+}
+
+/**
+ * Find chunk in cache
+ *
+ * @v file    Virtual file
+ * @v resource_offset    Offset of compressed resource within file
+ * @v chunk    Chunk number
+ * @ret entry    Cache entry, or NULL if not cached
+ */
+static struct wim_chunk_cache_entry *
+wim_cache_find ( struct vfat_file *file, uint64_t resource_offset,
+     unsigned int chunk ) {
+  struct wim_chunk_cache_entry *entry;
+  unsigned int count;
+  unsigned int i;
+
+  /* Allocate cache, if required */
+  if ( ! wim_chunk_cache ) {
+    count = ( wim_chunk_cache_size / WIM_CHUNK_LEN );
+    if ( ! count )
+      count = 1;
+    wim_chunk_cache = calloc ( count, sizeof ( wim_chunk_cache[0] ) );
+    if ( ! wim_chunk_cache )
+      return NULL;
+    wim_chunk_cache_count = count;
+  }
+
+  for ( i = 0 ; i < wim_chunk_cache_count ; i++ ) {
+    entry = &wim_chunk_cache[i];
+    if ( entry->data && ( entry->file == file ) &&
+         ( entry->resource_offset == resource_offset ) &&
+         ( entry->chunk == chunk ) ) {
+      entry->stamp = ++wim_chunk_cache_stamp;
+      return entry;
+    }
+  }
+
+  entry = &wim_chunk_oversized;
+  if ( entry->data && ( entry->file == file ) &&
+       ( entry->resource_offset == resource_offset ) &&
+       ( entry->chunk == chunk ) )
+    return entry;
+  return NULL;
+}
+
+/**
+ * Free least recently used chunk cache entry
+ *
+ * @v keep    Entry to keep
+ * @ret freed    An entry was freed
+ */
+static int wim_cache_discard ( struct wim_chunk_cache_entry *keep ) {
+  struct wim_chunk_cache_entry *entry;
+  struct wim_chunk_cache_entry *victim = NULL;
+  unsigned int i;
+
+  for ( i = 0 ; i < wim_chunk_cache_count ; i++ ) {
+    entry = &wim_chunk_cache[i];
+    if ( ( entry != keep ) && entry->data &&
+         ( ( ! victim ) || ( entry->stamp < victim->stamp ) ) )
+      victim = entry;
+  }
+  if ( ! victim )
+    return 0;
+  free ( victim->data );
+  wim_chunk_cache_used -= victim->len;
+  victim->data = NULL;
+  victim->len = 0;
+  victim->file = NULL;
+  return 1;
+}
+
+/**
+ * Allocate chunk cache entry
+ *
+ * @v len    Length of decompressed data
+ * @ret entry    Cache entry, or NULL on error
+ *
+ * The least recently used entry is reused, and further entries are
+ * discarded until the cache fits within its size limit.  The
+ * returned entry is not yet associated with any chunk.
+ */
+static struct wim_chunk_cache_entry * wim_cache_alloc ( size_t len ) {
+  struct wim_chunk_cache_entry *entry;
+  struct wim_chunk_cache_entry *victim;
+  unsigned int i;
+
+  /* Choose an unused entry, or the least recently used entry */
+  victim = &wim_chunk_cache[0];
+  for ( i = 0 ; i < wim_chunk_cache_count ; i++ ) {
+    entry = &wim_chunk_cache[i];
+    if ( ! entry->data ) {
+      victim = entry;
+      break;
+    }
+    if ( entry->stamp < victim->stamp )
+      victim = entry;
+  }
+  victim->file = NULL;
+
+  /* Resize buffer if required */
+  if ( victim->data && ( victim->len != len ) ) {
+    free ( victim->data );
+    wim_chunk_cache_used -= victim->len;
+    victim->data = NULL;
+    victim->len = 0;
+  }
+  if ( ! victim->data ) {
+    while ( ( ( wim_chunk_cache_used + len ) > wim_chunk_cache_size ) &&
+            wim_cache_discard ( victim ) ) {}
+    victim->data = malloc ( len );
+    if ( ! victim->data )
+      return NULL;
+    victim->len = len;
+    wim_chunk_cache_used += len;
+  }
+
+  return victim;
+}
+
+/**
+ * Allocate buffer for a chunk larger than the cache
+ *
+ * @v len    Length of decompressed data
+ * @ret entry    Oversized chunk entry, or NULL on error
+ *
+ * Solid resources use chunks of typically 64 MiB and up to 1 GiB.
+ * Caching one would evict every other chunk and still exceed the
+ * cache size, so only the most recent such chunk is kept, in a buffer
+ * of its own.  The returned entry is not yet associated with any
+ * chunk.
+ */
+static struct wim_chunk_cache_entry *
+wim_cache_alloc_oversized ( size_t len ) {
+  struct wim_chunk_cache_entry *entry = &wim_chunk_oversized;
+
+  entry->file = NULL;
+  if ( entry->data && ( entry->len != len ) ) {
+    free ( entry->data );
+    entry->data = NULL;
+    entry->len = 0;
+  }
+  if ( ! entry->data ) {
+    entry->data = malloc ( len );
+    if ( ! entry->data )
+      return NULL;
+    entry->len = len;
+  }
+
+  return entry;
 }
 
 /**
@@ -221,10 +774,14 @@ static int wim_chunk ( struct vfat_file *file, struct wim_header *header,
 int wim_read ( struct vfat_file *file, struct wim_header *header,
          struct wim_resource_header *resource, void *data,
          size_t offset, size_t len ) {
-  static struct vfat_file *cached_file;
-  static size_t cached_resource_offset;
-  static unsigned int cached_chunk;
   size_t zlen = ( resource->zlen__flags & WIM_RESHDR_ZLEN_MASK );
+  struct wim_chunk_cache_entry *entry;
+  struct wim_solid *solid = NULL;
+  uint64_t resource_offset;
+  uint64_t total_len;
+  uint64_t pos;
+  size_t chunk_len;
+  size_t out_len;
   unsigned int chunk;
   size_t skip_len;
   size_t frag_len;
@@ -234,50 +791,77 @@ int wim_read ( struct vfat_file *file, struct wim_header *header,
   if ( ( offset + len ) > resource->len ) {
     return -1;
   }
-  if ( ( resource->offset + zlen ) > file->len ) {
-    printf ( "Resource exceeds length of file\n" );
-    return -1;
-  }
 
-  /* If resource is uncompressed, just read the raw data */
-  if ( ! ( resource->zlen__flags & ( WIM_RESHDR_COMPRESSED |
-             WIM_RESHDR_PACKED_STREAMS ) ) ) {
-    file->read ( file, data, ( resource->offset + offset ), len );
-    return 0;
+  /* Locate stream within solid resource, if applicable */
+  if ( resource->zlen__flags & WIM_RESHDR_PACKED_STREAMS ) {
+    if ( ( rc = wim_solid_find ( file, header, resource, &solid,
+               &pos ) ) != 0 )
+      return rc;
+    resource_offset = solid->offset;
+    total_len = solid->len;
+    chunk_len = solid->chunk_len;
+    pos += offset;
+  } else {
+    if ( ( resource->offset + zlen ) > file->len ) {
+      printf ( "Resource exceeds length of file\n" );
+      return -1;
+    }
+
+    /* If resource is uncompressed, just read the raw data */
+    if ( ! ( resource->zlen__flags & WIM_RESHDR_COMPRESSED ) ) {
+      file->read ( file, data, ( resource->offset + offset ), len );
+      return 0;
+    }
+    resource_offset = resource->offset;
+    total_len = resource->len;
+    chunk_len = wim_chunk_len ( header );
+    pos = offset;
   }
 
   /* Read from each chunk overlapping the target region */
   while ( len ) {
 
-    /* Calculate chunk number */
-    chunk = ( offset / WIM_CHUNK_LEN );
+    /* Calculate chunk number and length */
+    chunk = ( pos / chunk_len );
+    out_len = ( total_len - ( ( ( uint64_t ) chunk ) * chunk_len ) );
+    if ( out_len > chunk_len )
+      out_len = chunk_len;
 
     /* Read chunk, if not already cached */
-    if ( ( file != cached_file ) ||
-         ( resource->offset != cached_resource_offset ) ||
-         ( chunk != cached_chunk ) ) {
-
-      /* Read chunk */
-      if ( ( rc = wim_chunk ( file, header, resource, chunk,
-            &wim_chunk_buffer ) ) != 0 )
+    entry = wim_cache_find ( file, resource_offset, chunk );
+    if ( ! entry ) {
+      if ( ! wim_chunk_cache )
+        return -1;
+      if ( out_len > wim_chunk_cache_size )
+        entry = wim_cache_alloc_oversized ( out_len );
+      else
+        entry = wim_cache_alloc ( out_len );
+      if ( ! entry )
+        return -1;
+      if ( solid ) {
+        rc = wim_solid_chunk ( solid, chunk, entry->data, out_len );
+      } else {
+        rc = wim_chunk ( file, header, resource, chunk, entry->data,
+             out_len );
+      }
+      if ( rc != 0 )
         return rc;
-
-      /* Update cache */
-      cached_file = file;
-      cached_resource_offset = resource->offset;
-      cached_chunk = chunk;
+      entry->file = file;
+      entry->resource_offset = resource_offset;
+      entry->chunk = chunk;
+      entry->stamp = ++wim_chunk_cache_stamp;
     }
 
     /* Copy fragment from this chunk */
-    skip_len = ( offset % WIM_CHUNK_LEN );
-    frag_len = ( WIM_CHUNK_LEN - skip_len );
+    skip_len = ( pos % chunk_len );
+    frag_len = ( out_len - skip_len );
     if ( frag_len > len )
       frag_len = len;
-    memcpy ( data, ( wim_chunk_buffer.data + skip_len ), frag_len );
+    memcpy ( data, ( entry->data + skip_len ), frag_len );
 
     /* Move to next chunk */
     data = (char *)data + frag_len;
-    offset += frag_len;
+    pos += frag_len;
     len -= frag_len;
   }
 
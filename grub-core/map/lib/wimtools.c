@@ -139,7 +139,8 @@ grub_wim_chunk (grub_file_t file, struct wim_header *header,
                 struct wim_resource_header *resource,
                 unsigned int chunk, struct wim_chunk_buffer *buf)
 {
-  ssize_t (* decompress) (const void *data, size_t len, void *buf);
+  ssize_t (* decompress) (const void *data, size_t len, void *buf,
+                          size_t buf_len);
   unsigned int chunks;
   size_t offset;
   size_t next_offset;
@@ -183,13 +184,11 @@ grub_wim_chunk (grub_file_t file, struct wim_header *header,
       return -1;
 
     /* Decompress data */
-    out_len = decompress (zbuf, len, NULL);
+    out_len = decompress (zbuf, len, buf->data, sizeof (buf->data));
     if (out_len < 0)
       return out_len;
     if (((size_t) out_len) != expected_out_len)
       return -1;
-
-    decompress (zbuf, len, buf->data);
   }
   return 0;
 }
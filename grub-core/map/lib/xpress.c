@@ -39,9 +39,11 @@
  * @v data		Compressed data
  * @v len		Length of compressed data
  * @v buf		Decompression buffer, or NULL
+ * @v buf_len		Length of decompression buffer
  * @ret out_len		Length of decompressed data, or negative error
  */
-ssize_t xca_decompress ( const void *data, size_t len, void *buf ) {
+ssize_t xca_decompress ( const void *data, size_t len, void *buf,
+			 size_t buf_len ) {
 	const void *src = data;
 	const void *end = ( uint8_t * ) src + len;
 	uint8_t *out = buf;
@@ -107,8 +109,13 @@ ssize_t xca_decompress ( const void *data, size_t len, void *buf ) {
 		if ( raw < XCA_END_MARKER ) {
 
 			/* Literal symbol - add to output stream */
-			if ( buf )
+			if ( buf ) {
+				if ( out_len >= buf_len ) {
+					printf ( "XCA output overrun\n" );
+					return -1;
+				}
 				*(out++) = raw;
+			}
 			out_len++;
 
 		} else if ( ( raw == XCA_END_MARKER ) &&
@@ -147,8 +154,16 @@ ssize_t xca_decompress ( const void *data, size_t len, void *buf ) {
 			}
 
 			/* Copy data */
+			if ( match_offset > out_len ) {
+				printf ( "XCA match offset out of range\n" );
+				return -1;
+			}
 			out_len += match_len;
 			if ( buf ) {
+				if ( out_len > buf_len ) {
+					printf ( "XCA output overrun\n" );
+					return -1;
+				}
 				copy = ( out - match_offset );
 				while ( match_len-- )
 					*(out++) = *(copy++);
@@ -41,6 +41,7 @@
 #include <string.h>
 #include <bcd.h>
 #include <sdi.h>
+#include <wim.h>
 
 #ifdef GRUB_MACHINE_EFI
 #include <grub/efi/api.h>
@@ -73,6 +74,8 @@ static const struct grub_arg_option options_wimboot[] =
   {"loadoptions", 0, 0, N_("Set LoadOptionsString."), N_("STRING"), ARG_TYPE_STRING},
   {"winload", 0, 0, N_("Set path of winload."), N_("WIN32_PATH"), ARG_TYPE_STRING},
   {"sysroot", 0, 0, N_("Set system root."), N_("WIN32_PATH"), ARG_TYPE_STRING},
+  {"cachesize", 0, 0, N_("Set size of WIM chunk cache in KiB."),
+    N_("n"), ARG_TYPE_INT},
   {0, 0, 0, 0, 0, 0}
 };
 
@@ -98,6 +101,7 @@ enum options_wimboot
   WIMBOOT_CMDLINE,  // string
   WIMBOOT_WINLOAD,  // string
   WIMBOOT_SYSROOT,  // string
+  WIMBOOT_CACHESIZE,
 };
 
 static grub_err_t
@@ -122,6 +126,9 @@ grub_cmd_wimboot (grub_extcmd_context_t ctxt, int argc, char *argv[])
     wimboot_cmd.index = grub_strtoul (state[WIMBOOT_INDEX].arg, NULL, 0);
   if (state[WIMBOOT_INJECT].set)
     mbstowcs (wimboot_cmd.inject, state[WIMBOOT_INJECT].arg, 256);
+  if (state[WIMBOOT_CACHESIZE].set)
+    wim_set_chunk_cache_size
+        (grub_strtoul (state[WIMBOOT_CACHESIZE].arg, NULL, 0) << 10);
 
   set_wim_patch (&wimboot_cmd);
 
@@ -66,12 +66,12 @@ send_card_buffer (struct grub_net_card *dev __attribute__ ((unused)),
 }
 
 static struct grub_net_buff *
-get_card_packet (struct grub_net_card *dev __attribute__ ((unused)))
+get_card_packet (struct grub_net_card *dev)
 {
   grub_ssize_t actual;
   struct grub_net_buff *nb;
 
-  nb = grub_netbuff_alloc (emucard.mtu + 36 + 2);
+  nb = grub_net_card_alloc_rx (dev, emucard.mtu + 36 + 2);
   if (!nb)
     return NULL;
 
@@ -26,32 +26,164 @@
 #include <grub/dl.h>
 #include <grub/file.h>
 #include <grub/i18n.h>
+#include <grub/env.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
 enum
   {
     HTTP_PORT = 80,
-    HTTP_MAX_CHUNK_SIZE = 0x80000000
+    HTTP_MAX_CHUNK_SIZE = 0x80000000,
+    /* Length of the first Range request after an open or a seek.  Each
+       following request doubles it, up to HTTP_MAX_RANGE.  */
+    HTTP_MIN_RANGE = 0x10000,
+    HTTP_MAX_RANGE = 0x400000,
+    /* A seek may skip or drain this much data already on its way rather
+       than open another connection.  */
+    HTTP_DRAIN_MAX = 0x40000,
+    /* Requests in flight on one connection, discarded ones included.  */
+    HTTP_MAX_REQS = 4,
+    /* Requests whose data is still wanted; one is pipelined behind the
+       one being received.  */
+    HTTP_PIPELINE = 2,
+    /* Idle connections kept for later requests.  */
+    HTTP_MAX_IDLE = 4,
+    /* Files read through the block cache are fetched in blocks of this
+       size over up to HTTP_FETCHERS connections.  Sequential readers
+       get between HTTP_READAHEAD_MIN and HTTP_READAHEAD blocks requested
+       ahead of them.  The first
+       request of a file fetches exactly its first block.  */
+    HTTP_BLOCK_SHIFT = 16,
+    HTTP_BLOCK_SIZE = 1 << HTTP_BLOCK_SHIFT,
+    HTTP_FETCHERS = 4,
+    HTTP_READAHEAD_MIN = 2,
+    HTTP_READAHEAD = 16,
+    HTTP_CACHE_HASH = 64,
+    /* Times a block is requested again after its connection failed.  */
+    HTTP_BLOCK_TRIES = 3
   };
 
+/* Default size of the block cache in KiB, overridden by the
+   net_http_cache_size variable.  */
+#define HTTP_DEFAULT_CACHE_SIZE 16384
+
+/* A connection to a server.  Connections are kept open between requests
+   and files as long as the server allows it.  */
+struct http_conn
+{
+  struct http_conn *next;
+  char *server;
+  int port;
+  grub_net_tcp_socket_t sock;
+  /* Owner of the requests in flight, NULL while idle.  */
+  struct http_data *data;
+  /* The connection can't carry any more requests.  */
+  int dead;
+};
+
+/* A Range request in flight.  */
+struct http_req
+{
+  grub_off_t start;
+  grub_off_t end;
+  /* The reader seeked away; the response is dropped.  */
+  int discard;
+  /* Cache block the response fills, if any.  */
+  struct http_block *block;
+};
+
+/* A block of a file in the block cache.  */
+struct http_block
+{
+  /* Chain in the hash table of the file.  */
+  struct http_block *next;
+  /* Cache-wide LRU list, most recently used first.  */
+  struct http_block *lru_prev;
+  struct http_block *lru_next;
+  /* Queue of blocks waiting to be requested.  */
+  struct http_block *queue_next;
+  struct http_cache *cache;
+  grub_off_t start;
+  grub_size_t len;
+  grub_size_t filled;
+  int queued;
+  int tries;
+  /* Set once the block is filled or has failed.  */
+  int done;
+  int failed;
+  char *buf;
+};
+
+/* Block cache state of an open file.  Its blocks are freed when the file
+   is closed, so opening the file again starts with an empty cache; the
+   size limit is shared by all open files.  The file's own connection is
+   the first fetcher; the others are opened as read-ahead needs them.  */
+struct http_cache
+{
+  struct http_data *fetch[HTTP_FETCHERS];
+  struct http_block *hash[HTTP_CACHE_HASH];
+  unsigned nfetchers;
+  struct http_block *queue_first;
+  struct http_block *queue_last;
+  /* File offset where the last read ended and blocks read ahead of the
+     reader, see http_cache_readahead.  */
+  grub_off_t ra_next;
+  unsigned ra_window;
+};
 
 typedef struct http_data
 {
+  /* The response being received, for REQS[0].  */
   char *current_line;
   grub_size_t current_line_len;
   int headers_recv;
   int first_line_recv;
   int size_recv;
-  grub_net_tcp_socket_t sock;
-  char *filename;
+  grub_uint64_t body_rem;
+  int code;
+  int close;
+  int range_recv;
+  grub_off_t range_start;
+  int total_recv;
+  grub_uint64_t range_total;
   grub_err_t err;
   char *errmsg;
   int chunked;
   grub_size_t chunk_rem;
   int in_chunk_len;
+
+  grub_file_t file;
+  char *filename;
+  struct http_conn *conn;
+  struct http_req reqs[HTTP_MAX_REQS];
+  unsigned nreqs;
+  /* File offset of the next body byte of REQS[0].  */
+  grub_off_t recv_off;
+  /* File offset of the next byte to queue for the reader.  */
+  grub_off_t want_off;
+  /* End of the last range requested.  */
+  grub_off_t req_end;
+  grub_size_t range_size;
+  /* The server answered a Range request with partial content.  */
+  int ranges_ok;
+  /* The headers of the first response are in.  */
+  int opened;
+  /* Set when the file is read through the block cache.  */
+  struct http_cache *cache;
 } *http_data_t;
 
+static struct http_conn *idle_conns;
+
+static struct http_block *lru_first;
+static struct http_block *lru_last;
+static grub_size_t cache_used;
+static grub_size_t cache_size = HTTP_DEFAULT_CACHE_SIZE << 10;
+
+static grub_err_t
+http_receive (grub_net_tcp_socket_t sock, struct grub_net_buff *nb, void *c);
+static void
+http_err (grub_net_tcp_socket_t sock, void *c);
+
 static grub_off_t
 have_ahead (struct grub_file *file)
 {
@@ -63,6 +195,721 @@ have_ahead (struct grub_file *file)
   return ret;
 }
 
+static void
+http_conn_free (struct http_conn *conn)
+{
+  if (conn->sock)
+    grub_net_tcp_close (conn->sock, GRUB_NET_TCP_ABORT);
+  grub_free (conn->server);
+  grub_free (conn);
+}
+
+/* Get a connection to the server of FILE, preferring an idle one.  */
+static struct http_conn *
+http_conn_get (http_data_t data, int *reused)
+{
+  grub_net_t net = data->file->device->net;
+  struct http_conn **p, *conn;
+
+  for (p = &idle_conns; *p; )
+    {
+      conn = *p;
+      if (conn->dead)
+	{
+	  *p = conn->next;
+	  http_conn_free (conn);
+	  continue;
+	}
+      if (conn->port == net->port && grub_strcmp (conn->server, net->server) == 0)
+	{
+	  *p = conn->next;
+	  conn->data = data;
+	  *reused = 1;
+	  return conn;
+	}
+      p = &conn->next;
+    }
+
+  conn = grub_zalloc (sizeof (*conn));
+  if (!conn)
+    return NULL;
+  conn->server = grub_strdup (net->server);
+  if (!conn->server)
+    {
+      grub_free (conn);
+      return NULL;
+    }
+  conn->port = net->port;
+  conn->data = data;
+
+  grub_dprintf ("http", "connecting to host %s TCP port %d\n",
+		conn->server, conn->port ? conn->port : HTTP_PORT);
+  conn->sock = grub_net_tcp_open (conn->server,
+				  conn->port ? conn->port : HTTP_PORT,
+				  http_receive, http_err, http_err, conn);
+  if (!conn->sock)
+    {
+      http_conn_free (conn);
+      return NULL;
+    }
+  *reused = 0;
+  return conn;
+}
+
+static void
+http_reset_response (http_data_t data)
+{
+  grub_free (data->current_line);
+  grub_free (data->errmsg);
+  data->current_line = 0;
+  data->current_line_len = 0;
+  data->headers_recv = 0;
+  data->first_line_recv = 0;
+  data->size_recv = 0;
+  data->body_rem = 0;
+  data->code = 0;
+  data->close = 0;
+  data->range_recv = 0;
+  data->total_recv = 0;
+  data->err = GRUB_ERR_NONE;
+  data->errmsg = 0;
+  data->chunked = 0;
+  data->chunk_rem = 0;
+  data->in_chunk_len = 0;
+}
+
+/* Detach the connection of DATA, keeping it for later requests if
+   nothing more is due on it.  */
+static void
+http_conn_release (http_data_t data)
+{
+  struct http_conn *conn = data->conn, **p;
+  unsigned n = 0;
+
+  if (!conn)
+    return;
+  data->conn = 0;
+  if (conn->dead || data->nreqs || data->current_line)
+    {
+      http_conn_free (conn);
+      return;
+    }
+
+  conn->data = 0;
+  conn->next = idle_conns;
+  idle_conns = conn;
+  for (p = &idle_conns; *p; )
+    if (++n > HTTP_MAX_IDLE)
+      {
+	conn = *p;
+	*p = conn->next;
+	http_conn_free (conn);
+      }
+    else
+      p = &(*p)->next;
+}
+
+static void
+http_set_eof (grub_file_t file)
+{
+  file->device->net->eof = 1;
+  file->device->net->stall = 1;
+  if (file->size == GRUB_FILE_SIZE_UNKNOWN)
+    file->size = have_ahead (file);
+}
+
+/* Send a Range request for the data of FILE from START on.  */
+static grub_err_t
+http_send_request (http_data_t data, grub_off_t start)
+{
+  grub_file_t file = data->file;
+  grub_net_t net = file->device->net;
+  struct grub_net_buff *nb;
+  grub_off_t end = start + data->range_size;
+  char port[sizeof (":XXXXXXXXXX")] = "";
+  char *req;
+  grub_size_t len;
+  grub_err_t err;
+
+  if (file->size != GRUB_FILE_SIZE_UNKNOWN && end > file->size)
+    end = file->size;
+  if (net->port)
+    grub_snprintf (port, sizeof (port), ":%d", net->port);
+
+  req = grub_xasprintf ("GET %s HTTP/1.1\r\nHost: %s%s\r\n"
+			"User-Agent: " PACKAGE_STRING "\r\n"
+			"Connection: keep-alive\r\n"
+			"Range: bytes=%" PRIuGRUB_UINT64_T "-%"
+			PRIuGRUB_UINT64_T "\r\n\r\n",
+			data->filename, net->server, port,
+			(grub_uint64_t) start, (grub_uint64_t) end - 1);
+  if (!req)
+    return grub_errno;
+  len = grub_strlen (req);
+
+  nb = grub_netbuff_alloc (GRUB_NET_TCP_RESERVE_SIZE + len);
+  if (!nb)
+    {
+      grub_free (req);
+      return grub_errno;
+    }
+  grub_netbuff_reserve (nb, GRUB_NET_TCP_RESERVE_SIZE);
+  err = grub_netbuff_put (nb, len);
+  if (err)
+    {
+      grub_free (req);
+      grub_netbuff_free (nb);
+      return err;
+    }
+  grub_memcpy (nb->data, req, len);
+  grub_free (req);
+
+  grub_dprintf ("http", "requesting %s bytes %" PRIuGRUB_UINT64_T "-%"
+		PRIuGRUB_UINT64_T "\n", data->filename,
+		(grub_uint64_t) start, (grub_uint64_t) end - 1);
+  err = grub_net_send_tcp_packet (data->conn->sock, nb, 1);
+  if (err)
+    {
+      data->conn->dead = 1;
+      return err;
+    }
+
+  data->reqs[data->nreqs].start = start;
+  data->reqs[data->nreqs].end = end;
+  data->reqs[data->nreqs].discard = 0;
+  data->reqs[data->nreqs].block = 0;
+  data->nreqs++;
+  data->req_end = end;
+  return GRUB_ERR_NONE;
+}
+
+static void
+http_lru_unlink (struct http_block *block)
+{
+  if (block->lru_prev)
+    block->lru_prev->lru_next = block->lru_next;
+  else
+    lru_first = block->lru_next;
+  if (block->lru_next)
+    block->lru_next->lru_prev = block->lru_prev;
+  else
+    lru_last = block->lru_prev;
+}
+
+static void
+http_lru_link (struct http_block *block)
+{
+  block->lru_prev = 0;
+  block->lru_next = lru_first;
+  if (lru_first)
+    lru_first->lru_prev = block;
+  else
+    lru_last = block;
+  lru_first = block;
+}
+
+static struct http_block **
+http_block_head (struct http_cache *cache, grub_off_t start)
+{
+  return &cache->hash[(start >> HTTP_BLOCK_SHIFT) & (HTTP_CACHE_HASH - 1)];
+}
+
+static void
+http_block_free (struct http_block *block)
+{
+  struct http_block **p;
+
+  for (p = http_block_head (block->cache, block->start); *p != block;
+       p = &(*p)->next);
+  *p = block->next;
+  http_lru_unlink (block);
+  cache_used -= block->len;
+  grub_free (block->buf);
+  grub_free (block);
+}
+
+/* Evict blocks until another one fits in the cache.  Blocks still being
+   fetched stay.  */
+static int
+http_cache_make_room (void)
+{
+  struct http_block *block;
+
+  while (cache_used + HTTP_BLOCK_SIZE > cache_size)
+    {
+      for (block = lru_last; block && !block->done; block = block->lru_prev);
+      if (!block)
+	return 0;
+      http_block_free (block);
+    }
+  return 1;
+}
+
+static void
+http_block_queue (struct http_block *block, int front)
+{
+  struct http_cache *cache = block->cache;
+
+  block->queued = 1;
+  if (front)
+    {
+      block->queue_next = cache->queue_first;
+      cache->queue_first = block;
+      if (!cache->queue_last)
+	cache->queue_last = block;
+      return;
+    }
+  block->queue_next = 0;
+  if (cache->queue_last)
+    cache->queue_last->queue_next = block;
+  else
+    cache->queue_first = block;
+  cache->queue_last = block;
+}
+
+static void
+http_block_unqueue (struct http_block *block)
+{
+  struct http_cache *cache = block->cache;
+  struct http_block **p, *prev = 0;
+
+  for (p = &cache->queue_first; *p != block; p = &(*p)->queue_next)
+    prev = *p;
+  *p = block->queue_next;
+  if (cache->queue_last == block)
+    cache->queue_last = prev;
+  block->queued = 0;
+}
+
+/* Request BLOCK again after the response carrying it failed.  */
+static void
+http_block_retry (struct http_block *block)
+{
+  block->filled = 0;
+  if (++block->tries > HTTP_BLOCK_TRIES)
+    {
+      block->failed = 1;
+      block->done = 1;
+      return;
+    }
+  http_block_queue (block, 1);
+}
+
+/* Find the block of the file of DATA at START, queueing it for fetching
+   if it isn't cached.  A block the reader waits for (DEMAND) goes first
+   and may exceed the cache size; read-ahead doesn't.  */
+static struct http_block *
+http_cache_get (http_data_t data, grub_off_t start, int demand)
+{
+  struct http_cache *cache = data->cache;
+  grub_file_t file = data->file;
+  struct http_block *block, **head;
+
+  head = http_block_head (cache, start);
+  for (block = *head; block; block = block->next)
+    if (block->start == start)
+      {
+	http_lru_unlink (block);
+	http_lru_link (block);
+	if (demand && block->failed)
+	  {
+	    block->failed = 0;
+	    block->done = 0;
+	    block->tries = 0;
+	    http_block_queue (block, 1);
+	  }
+	else if (demand && block->queued && cache->queue_first != block)
+	  {
+	    http_block_unqueue (block);
+	    http_block_queue (block, 1);
+	  }
+	return block;
+      }
+
+  if (start >= file->size)
+    return 0;
+  if (!http_cache_make_room () && !demand)
+    return 0;
+
+  block = grub_zalloc (sizeof (*block));
+  if (!block)
+    return 0;
+  block->len = file->size - start < HTTP_BLOCK_SIZE
+    ? file->size - start : HTTP_BLOCK_SIZE;
+  block->buf = grub_malloc (block->len);
+  if (!block->buf)
+    {
+      grub_free (block);
+      return 0;
+    }
+  block->cache = cache;
+  block->start = start;
+  block->next = *head;
+  *head = block;
+  http_lru_link (block);
+  cache_used += block->len;
+  http_block_queue (block, demand);
+  return block;
+}
+
+static http_data_t
+http_fetcher_new (http_data_t owner)
+{
+  http_data_t data;
+
+  data = grub_zalloc (sizeof (*data));
+  if (!data)
+    return 0;
+  data->file = owner->file;
+  data->filename = owner->filename;
+  data->cache = owner->cache;
+  data->range_size = HTTP_BLOCK_SIZE;
+  data->ranges_ok = 1;
+  data->opened = 1;
+  return data;
+}
+
+/* Take back the blocks of a fetcher whose connection went away.  */
+static void
+http_fetcher_reset (http_data_t data, int can_connect)
+{
+  unsigned i;
+
+  for (i = data->nreqs; i > 0; i--)
+    if (data->reqs[i - 1].block && !data->reqs[i - 1].block->done)
+      http_block_retry (data->reqs[i - 1].block);
+  data->nreqs = 0;
+  http_reset_response (data);
+  if (can_connect)
+    {
+      http_conn_free (data->conn);
+      data->conn = 0;
+    }
+}
+
+/* Hand queued blocks to the fetchers, spreading them over the
+   connections.  Connections are only opened when CAN_CONNECT is set, as
+   opening one polls the network.  */
+static void
+http_cache_schedule (http_data_t data, int can_connect)
+{
+  struct http_cache *cache = data->cache;
+  struct http_block *block;
+  http_data_t f;
+  unsigned i, depth;
+  int reused;
+
+  for (i = 0; i < cache->nfetchers; i++)
+    {
+      f = cache->fetch[i];
+      if (f && f->conn && f->conn->dead)
+	http_fetcher_reset (f, can_connect);
+    }
+
+  for (depth = 1; depth <= HTTP_PIPELINE; depth++)
+    for (i = 0; i < cache->nfetchers && cache->queue_first; i++)
+      {
+	f = cache->fetch[i];
+	if (!f && can_connect)
+	  f = cache->fetch[i] = http_fetcher_new (data);
+	if (!f)
+	  continue;
+	if (!f->conn && can_connect)
+	  {
+	    f->conn = http_conn_get (f, &reused);
+	    /* The server may limit connections; make do with fewer.  */
+	    if (!f->conn && i)
+	      {
+		grub_free (f);
+		cache->fetch[i] = 0;
+		cache->nfetchers = i;
+		break;
+	      }
+	  }
+	if (!f->conn || f->conn->dead || f->nreqs >= depth)
+	  continue;
+
+	block = cache->queue_first;
+	http_block_unqueue (block);
+	f->range_size = block->len;
+	if (http_send_request (f, block->start))
+	  {
+	    http_block_queue (block, 1);
+	    continue;
+	  }
+	f->reqs[f->nreqs - 1].block = block;
+      }
+  grub_errno = GRUB_ERR_NONE;
+}
+
+/* Switch to the block cache once the first response shows that the
+   server serves ranges of a file of known size.  The first request asked
+   for exactly the first block.  */
+static void
+http_cache_enable (http_data_t data)
+{
+  grub_file_t file = data->file;
+  struct http_block *block;
+
+  if (cache_size < HTTP_READAHEAD * HTTP_BLOCK_SIZE
+      || data->reqs[0].start != 0 || data->chunked || !data->size_recv
+      || data->body_rem != (file->size < HTTP_BLOCK_SIZE
+			    ? file->size : HTTP_BLOCK_SIZE))
+    return;
+
+  data->cache = grub_zalloc (sizeof (*data->cache));
+  if (!data->cache)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  data->cache->fetch[0] = data;
+  data->cache->nfetchers = HTTP_FETCHERS;
+
+  block = http_cache_get (data, 0, 1);
+  if (!block)
+    {
+      grub_free (data->cache);
+      data->cache = 0;
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  http_block_unqueue (block);
+  data->reqs[0].block = block;
+  file->device->net->direct_read = 1;
+}
+
+static void
+http_cache_free (http_data_t data)
+{
+  struct http_cache *cache = data->cache;
+  unsigned i;
+
+  for (i = 1; i < HTTP_FETCHERS; i++)
+    if (cache->fetch[i])
+      {
+	http_conn_release (cache->fetch[i]);
+	http_reset_response (cache->fetch[i]);
+	grub_free (cache->fetch[i]);
+      }
+  for (i = 0; i < HTTP_CACHE_HASH; i++)
+    while (cache->hash[i])
+      http_block_free (cache->hash[i]);
+  grub_free (cache);
+  data->cache = 0;
+}
+
+/* Check that a response carries the block it was asked for.  */
+static void
+http_cache_headers (http_data_t data)
+{
+  struct http_req *req = &data->reqs[0];
+
+  if (data->err || data->code != 206 || data->chunked || !data->size_recv
+      || !req->block || (data->range_recv && data->range_start != req->start)
+      || data->body_rem != req->block->len)
+    {
+      /* The block is requested again on another connection.  */
+      data->conn->dead = 1;
+      return;
+    }
+  data->recv_off = req->start;
+}
+
+/* Ask for the data following the last request ahead of time, so that it
+   comes right after the current response.  */
+static void
+http_pipeline (grub_file_t file)
+{
+  http_data_t data = file->data;
+  unsigned i, live = 0;
+
+  if (!data->conn || data->conn->dead || data->close || data->cache
+      || file->size == GRUB_FILE_SIZE_UNKNOWN)
+    return;
+  if (data->nreqs && !data->ranges_ok)
+    return;
+
+  for (i = 0; i < data->nreqs; i++)
+    if (!data->reqs[i].discard)
+      live++;
+
+  while (live < HTTP_PIPELINE && data->nreqs < HTTP_MAX_REQS
+	 && data->req_end < file->size)
+    {
+      if (data->nreqs && data->range_size < HTTP_MAX_RANGE)
+	data->range_size *= 2;
+      if (http_send_request (data, data->req_end))
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return;
+	}
+      live++;
+    }
+}
+
+/* Drop the current request, its response being complete.  */
+static void
+http_response_done (grub_file_t file, http_data_t data)
+{
+  unsigned i;
+
+  struct http_block *block = data->reqs[0].block;
+
+  if (data->close && data->conn)
+    data->conn->dead = 1;
+  for (i = 1; i < data->nreqs; i++)
+    data->reqs[i - 1] = data->reqs[i];
+  data->nreqs--;
+  http_reset_response (data);
+
+  if (data->cache)
+    {
+      if (block && !block->done)
+	http_block_retry (block);
+      http_cache_schedule (data, 0);
+      return;
+    }
+
+  if (file->size != GRUB_FILE_SIZE_UNKNOWN && data->want_off >= file->size)
+    http_set_eof (file);
+  else
+    http_pipeline (file);
+}
+
+/* Count the body data queued for the reader against the TCP receive
+   window.  Return 1 if half of the buffer is waiting to be read, in
+   which case the cards aren't polled until the reader catches up.  */
+static int
+http_update_unread (grub_file_t file, http_data_t data)
+{
+  grub_net_t net = file->device->net;
+  grub_size_t unread = 0;
+
+  if (data->want_off > net->offset)
+    unread = data->want_off - net->offset;
+  if (data->conn && !data->conn->dead)
+    grub_net_tcp_set_unread (data->conn->sock, unread);
+  return unread >= grub_net_tcp_buffer_size () / 2;
+}
+
+/* Queue body data for the reader, dropping what it doesn't want.  */
+static void
+http_deliver (grub_file_t file, http_data_t data, struct grub_net_buff *nb)
+{
+  grub_net_t net = file->device->net;
+  grub_off_t off = data->recv_off;
+  struct http_block *block = data->reqs[0].block;
+
+  if (block)
+    {
+      grub_size_t len = nb->tail - nb->data;
+
+      data->recv_off += len;
+      if (off - block->start < block->len)
+	{
+	  if (len > block->len - (off - block->start))
+	    len = block->len - (off - block->start);
+	  grub_memcpy (block->buf + (off - block->start), nb->data, len);
+	  block->filled += len;
+	  if (block->filled == block->len)
+	    block->done = 1;
+	}
+      grub_netbuff_free (nb);
+      return;
+    }
+
+  if (data->reqs[0].discard)
+    {
+      grub_netbuff_free (nb);
+      return;
+    }
+
+  data->recv_off += nb->tail - nb->data;
+  if (data->recv_off <= data->want_off)
+    {
+      grub_netbuff_free (nb);
+      return;
+    }
+  if (off < data->want_off)
+    grub_netbuff_pull (nb, data->want_off - off);
+  data->want_off = data->recv_off;
+
+  grub_net_put_packet (&net->packs, nb);
+  if (http_update_unread (file, data))
+    net->stall = 1;
+
+  if (file->size != GRUB_FILE_SIZE_UNKNOWN && data->want_off >= file->size)
+    http_set_eof (file);
+}
+
+static grub_err_t
+http_headers_done (grub_file_t file, http_data_t data)
+{
+  struct http_req *req = &data->reqs[0];
+
+  if (data->chunked)
+    data->in_chunk_len = 2;
+  /* Without a length, the body ends with the connection.  */
+  if (data->chunked || !data->size_recv)
+    data->close = 1;
+
+  if (data->cache)
+    {
+      http_cache_headers (data);
+      return GRUB_ERR_NONE;
+    }
+
+  if (data->err)
+    {
+      if (!data->opened)
+	{
+	  data->opened = 1;
+	  return GRUB_ERR_NONE;
+	}
+      data->conn->dead = 1;
+      http_set_eof (file);
+      return GRUB_ERR_NONE;
+    }
+
+  if (data->code == 416)
+    {
+      /* Asked for data past the end of the file.  */
+      if (data->total_recv && file->size == GRUB_FILE_SIZE_UNKNOWN)
+	file->size = data->range_total;
+      req->discard = 1;
+      http_set_eof (file);
+    }
+  else if (data->code == 206)
+    {
+      data->ranges_ok = 1;
+      data->recv_off = data->range_recv ? data->range_start : req->start;
+      if (data->total_recv && file->size == GRUB_FILE_SIZE_UNKNOWN)
+	file->size = data->range_total;
+      if (!data->opened && data->recv_off == 0
+	  && file->size != GRUB_FILE_SIZE_UNKNOWN)
+	http_cache_enable (data);
+    }
+  else
+    {
+      /* The server ignored the range and sends the whole file.  */
+      data->ranges_ok = 0;
+      data->recv_off = 0;
+      if (data->size_recv && !data->chunked
+	  && file->size == GRUB_FILE_SIZE_UNKNOWN)
+	file->size = data->body_rem;
+      req->end = data->req_end = (file->size != GRUB_FILE_SIZE_UNKNOWN
+				  ? file->size : ~(grub_off_t) 0);
+    }
+  data->opened = 1;
+
+  if (data->size_recv && !data->chunked && !data->body_rem)
+    http_response_done (file, data);
+  else
+    http_pipeline (file);
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 parse_line (grub_file_t file, http_data_t data, char *ptr, grub_size_t len)
 {
@@ -84,10 +931,9 @@ parse_line (grub_file_t file, http_data_t data, char *ptr, grub_size_t len)
       grub_errno = GRUB_ERR_NONE;
       if (data->chunk_rem == 0)
 	{
-	  file->device->net->eof = 1;
-	  file->device->net->stall = 1;
-	  if (file->size == GRUB_FILE_SIZE_UNKNOWN)
-	    file->size = have_ahead (file);
+	  http_set_eof (file);
+	  http_response_done (file, data);
+	  return GRUB_ERR_NONE;
 	}
       data->in_chunk_len = 0;
       return GRUB_ERR_NONE;
@@ -95,28 +941,32 @@ parse_line (grub_file_t file, http_data_t data, char *ptr, grub_size_t len)
   if (ptr == end)
     {
       data->headers_recv = 1;
-      if (data->chunked)
-	data->in_chunk_len = 2;
-      return GRUB_ERR_NONE;
+      return http_headers_done (file, data);
     }
 
   if (!data->first_line_recv)
     {
       int code;
-      if (grub_memcmp (ptr, "HTTP/1.1 ", sizeof ("HTTP/1.1 ") - 1) != 0)
+
+      data->first_line_recv = 1;
+      if (grub_memcmp (ptr, "HTTP/1.0 ", sizeof ("HTTP/1.0 ") - 1) == 0)
+	data->close = 1;
+      else if (grub_memcmp (ptr, "HTTP/1.1 ", sizeof ("HTTP/1.1 ") - 1) != 0)
 	{
+	  data->err = GRUB_ERR_NET_UNKNOWN_ERROR;
 	  data->errmsg = grub_strdup (_("unsupported HTTP response"));
-	  data->first_line_recv = 1;
 	  return GRUB_ERR_NONE;
 	}
       ptr += sizeof ("HTTP/1.1 ") - 1;
       code = grub_strtoul (ptr, (const char **)&ptr, 10);
       if (grub_errno)
 	return grub_errno;
+      data->code = code;
       switch (code)
 	{
 	case 200:
 	case 206:
+	case 416:
 	  break;
 	case 404:
 	  data->err = GRUB_ERR_FILE_NOT_FOUND;
@@ -130,64 +980,107 @@ parse_line (grub_file_t file, http_data_t data, char *ptr, grub_size_t len)
 					 code, ptr);
 	  return GRUB_ERR_NONE;
 	}
-      data->first_line_recv = 1;
       return GRUB_ERR_NONE;
     }
-  if (grub_memcmp (ptr, "Content-Length: ", sizeof ("Content-Length: ") - 1)
-      == 0 && !data->size_recv)
+  if (grub_strncasecmp (ptr, "Content-Length: ",
+			sizeof ("Content-Length: ") - 1) == 0
+      && !data->size_recv)
     {
       ptr += sizeof ("Content-Length: ") - 1;
-      file->size = grub_strtoull (ptr, (const char **)&ptr, 10);
+      data->body_rem = grub_strtoull (ptr, (const char **)&ptr, 10);
       data->size_recv = 1;
       return GRUB_ERR_NONE;
     }
-  if (grub_memcmp (ptr, "Transfer-Encoding: chunked",
-		   sizeof ("Transfer-Encoding: chunked") - 1) == 0)
+  if (grub_strncasecmp (ptr, "Content-Range: bytes ",
+			sizeof ("Content-Range: bytes ") - 1) == 0)
+    {
+      ptr += sizeof ("Content-Range: bytes ") - 1;
+      if (*ptr != '*')
+	{
+	  data->range_start = grub_strtoull (ptr, (const char **)&ptr, 10);
+	  data->range_recv = 1;
+	}
+      ptr = grub_strchr (ptr, '/');
+      if (ptr && ptr[1] != '*')
+	{
+	  data->range_total = grub_strtoull (ptr + 1, 0, 10);
+	  data->total_recv = 1;
+	}
+      grub_errno = GRUB_ERR_NONE;
+      return GRUB_ERR_NONE;
+    }
+  if (grub_strncasecmp (ptr, "Transfer-Encoding: chunked",
+			sizeof ("Transfer-Encoding: chunked") - 1) == 0)
     {
       data->chunked = 1;
       return GRUB_ERR_NONE;
     }
+  if (grub_strncasecmp (ptr, "Connection: close",
+			sizeof ("Connection: close") - 1) == 0)
+    {
+      data->close = 1;
+      return GRUB_ERR_NONE;
+    }
 
   return GRUB_ERR_NONE;  
 }
 
+/* The connection was closed or reset.  */
 static void
 http_err (grub_net_tcp_socket_t sock __attribute__ ((unused)),
-	  void *f)
+	  void *c)
 {
-  grub_file_t file = f;
-  http_data_t data = file->data;
+  struct http_conn *conn = c;
+  http_data_t data = conn->data;
+  grub_file_t file;
 
-  if (data->sock)
-    grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
-  data->sock = 0;
-  if (data->current_line)
-    grub_free (data->current_line);
-  data->current_line = 0;
-  file->device->net->eof = 1;
-  file->device->net->stall = 1;
+  conn->dead = 1;
+  /* Cached files pick the requests up on another connection.  */
+  if (!data || data->cache)
+    return;
+  file = data->file;
+
+  /* A response without a length ends here.  */
+  if (data->nreqs && data->headers_recv && data->close
+      && !data->size_recv && !data->chunked)
+    http_response_done (file, data);
+
+  /* Without a size there's no telling what is missing; otherwise the
+     reader reconnects for the rest.  */
   if (file->size == GRUB_FILE_SIZE_UNKNOWN)
-    file->size = have_ahead (file);
+    http_set_eof (file);
+  file->device->net->stall = 1;
 }
 
 static grub_err_t
 http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 	      struct grub_net_buff *nb,
-	      void *f)
+	      void *c)
 {
-  grub_file_t file = f;
-  http_data_t data = file->data;
+  struct http_conn *conn = c;
+  http_data_t data = conn->data;
+  grub_file_t file;
   grub_err_t err;
 
-  if (!data->sock)
+  /* Nothing is expected on an idle connection.  */
+  if (!data || conn->dead)
     {
+      conn->dead = 1;
       grub_netbuff_free (nb);
       return GRUB_ERR_NONE;
     }
+  file = data->file;
 
   while (1)
     {
       char *ptr = (char *) nb->data;
+
+      if (!data->nreqs || conn->dead)
+	{
+	  grub_netbuff_free (nb);
+	  return GRUB_ERR_NONE;
+	}
+
       if ((!data->headers_recv || data->in_chunk_len) && data->current_line)
 	{
 	  int have_line = 1;
@@ -205,7 +1098,7 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 	  if (!t)
 	    {
 	      grub_netbuff_free (nb);
-	      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+	      conn->dead = 1;
 	      return grub_errno;
 	    }
 	      
@@ -218,21 +1111,21 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 	      grub_netbuff_free (nb);
 	      return GRUB_ERR_NONE;
 	    }
-	  err = parse_line (file, data, data->current_line,
-			    data->current_line_len);
-	  grub_free (data->current_line);
+	  t = data->current_line;
 	  data->current_line = 0;
+	  err = parse_line (file, data, t, data->current_line_len);
+	  grub_free (t);
 	  data->current_line_len = 0;
 	  if (err)
 	    {
-	      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+	      conn->dead = 1;
 	      grub_netbuff_free (nb);
 	      return err;
 	    }
 	}
 
-      while (ptr < (char *) nb->tail && (!data->headers_recv
-					 || data->in_chunk_len))
+      while (ptr < (char *) nb->tail && data->nreqs
+	     && (!data->headers_recv || data->in_chunk_len))
 	{
 	  char *ptr2;
 	  ptr2 = grub_memchr (ptr, '\n', (char *) nb->tail - ptr);
@@ -242,7 +1135,7 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 	      if (!data->current_line)
 		{
 		  grub_netbuff_free (nb);
-		  grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+		  conn->dead = 1;
 		  return grub_errno;
 		}
 	      data->current_line_len = (char *) nb->tail - ptr;
@@ -253,7 +1146,7 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 	  err = parse_line (file, data, ptr, ptr2 - ptr);
 	  if (err)
 	    {
-	      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+	      conn->dead = 1;
 	      grub_netbuff_free (nb);
 	      return err;
 	    }
@@ -268,183 +1161,140 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
       err = grub_netbuff_pull (nb, ptr - (char *) nb->data);
       if (err)
 	{
-	  grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+	  conn->dead = 1;
 	  grub_netbuff_free (nb);
 	  return err;
 	}
-      if (!(data->chunked && (grub_ssize_t) data->chunk_rem
-	    < nb->tail - nb->data))
-	{
-	  grub_net_put_packet (&file->device->net->packs, nb);
-	  if (file->device->net->packs.count >= 20)
-	    file->device->net->stall = 1;
+      if (!data->nreqs || conn->dead || !data->headers_recv)
+	continue;
 
-	  if (file->device->net->packs.count >= 100)
-	    grub_net_tcp_stall (data->sock);
-
-	  if (data->chunked)
-	    data->chunk_rem -= nb->tail - nb->data;
-	  return GRUB_ERR_NONE;
-	}
-      if (data->chunk_rem)
+      if (data->chunked)
 	{
-	  struct grub_net_buff *nb2;
-	  nb2 = grub_netbuff_alloc (data->chunk_rem);
-	  if (!nb2)
-	    return grub_errno;
-	  err = grub_netbuff_put (nb2, data->chunk_rem);
-	  if (err)
-	    return grub_errno;
-	  grub_memcpy (nb2->data, nb->data, data->chunk_rem);
-	  if (file->device->net->packs.count >= 20)
+	  if ((grub_ssize_t) data->chunk_rem >= nb->tail - nb->data)
 	    {
-	      file->device->net->stall = 1;
-	      grub_net_tcp_stall (data->sock);
+	      data->chunk_rem -= nb->tail - nb->data;
+	      http_deliver (file, data, nb);
+	      return GRUB_ERR_NONE;
 	    }
-
-	  grub_net_put_packet (&file->device->net->packs, nb2);
-	  grub_netbuff_pull (nb, data->chunk_rem);
 	}
-      data->in_chunk_len = 1;
+      else if (!data->size_recv
+	       || data->body_rem >= (grub_uint64_t) (nb->tail - nb->data))
+	{
+	  if (data->size_recv)
+	    data->body_rem -= nb->tail - nb->data;
+	  http_deliver (file, data, nb);
+	  if (data->size_recv && !data->body_rem)
+	    http_response_done (file, data);
+	  return GRUB_ERR_NONE;
+	}
+
+      /* The packet holds more than the rest of the chunk or body.  */
+      {
+	grub_size_t rem = data->chunked ? data->chunk_rem : data->body_rem;
+
+	if (rem)
+	  {
+	    struct grub_net_buff *nb2;
+	    nb2 = grub_netbuff_alloc (rem);
+	    if (!nb2)
+	      {
+		grub_netbuff_free (nb);
+		conn->dead = 1;
+		return grub_errno;
+	      }
+	    grub_netbuff_put (nb2, rem);
+	    grub_memcpy (nb2->data, nb->data, rem);
+	    http_deliver (file, data, nb2);
+	    grub_netbuff_pull (nb, rem);
+	  }
+	if (data->chunked)
+	  data->in_chunk_len = 1;
+	else
+	  {
+	    data->body_rem = 0;
+	    http_response_done (file, data);
+	  }
+      }
     }
 }
 
+/* Reconnect and ask for the data the reader wants next.  */
 static grub_err_t
-http_establish (struct grub_file *file, grub_off_t offset, int initial)
+http_restart (grub_file_t file)
 {
   http_data_t data = file->data;
-  grub_uint8_t *ptr;
-  int i;
-  struct grub_net_buff *nb;
-  grub_err_t err;
-  char* server = file->device->net->server;
-  int port = file->device->net->port;
-
-  nb = grub_netbuff_alloc (GRUB_NET_TCP_RESERVE_SIZE
-			   + sizeof ("GET ") - 1
-			   + grub_strlen (data->filename)
-			   + sizeof (" HTTP/1.1\r\nHost: ") - 1
-			   + grub_strlen (server) + sizeof (":XXXXXXXXXX")
-			   + sizeof ("\r\nUser-Agent: " PACKAGE_STRING
-				     "\r\n") - 1
-			   + sizeof ("Range: bytes=XXXXXXXXXXXXXXXXXXXX"
-				     "-\r\n\r\n"));
-  if (!nb)
-    return grub_errno;
+  int reused;
 
-  grub_netbuff_reserve (nb, GRUB_NET_TCP_RESERVE_SIZE);
-  ptr = nb->tail;
-  err = grub_netbuff_put (nb, sizeof ("GET ") - 1);
-  if (err)
+  if (data->conn)
     {
-      grub_netbuff_free (nb);
-      return err;
+      http_conn_free (data->conn);
+      data->conn = 0;
     }
-  grub_memcpy (ptr, "GET ", sizeof ("GET ") - 1);
-
-  ptr = nb->tail;
+  data->nreqs = 0;
+  http_reset_response (data);
+  data->req_end = data->want_off;
 
-  err = grub_netbuff_put (nb, grub_strlen (data->filename));
-  if (err)
+  if (file->size != GRUB_FILE_SIZE_UNKNOWN && data->want_off >= file->size)
     {
-      grub_netbuff_free (nb);
-      return err;
-    }
-  grub_memcpy (ptr, data->filename, grub_strlen (data->filename));
-
-  ptr = nb->tail;
-  err = grub_netbuff_put (nb, sizeof (" HTTP/1.1\r\nHost: ") - 1);
-  if (err)
-    {
-      grub_netbuff_free (nb);
-      return err;
+      http_set_eof (file);
+      return GRUB_ERR_NONE;
     }
-  grub_memcpy (ptr, " HTTP/1.1\r\nHost: ",
-	       sizeof (" HTTP/1.1\r\nHost: ") - 1);
 
-  ptr = nb->tail;
-  err = grub_netbuff_put (nb, grub_strlen (server));
-  if (err)
-    {
-      grub_netbuff_free (nb);
-      return err;
-    }
-  grub_memcpy (ptr, file->device->net->server,
-	       grub_strlen (file->device->net->server));
+  data->conn = http_conn_get (data, &reused);
+  if (!data->conn)
+    return grub_errno;
+  return http_send_request (data, data->want_off);
+}
 
-  if (port)
-    {
-      ptr = nb->tail;
-      grub_snprintf ((char *) ptr,
-	  sizeof (":XXXXXXXXXX"),
-	  ":%d",
-	  port);
-    }
+static grub_err_t
+http_establish (struct grub_file *file)
+{
+  http_data_t data = file->data;
+  grub_err_t err = GRUB_ERR_NONE;
+  int try, i, reused = 0, dead;
 
-  ptr = nb->tail;
-  err = grub_netbuff_put (nb, 
-			  sizeof ("\r\nUser-Agent: " PACKAGE_STRING "\r\n")
-			  - 1);
-  if (err)
+  for (try = 0; try < 2; try++)
     {
-      grub_netbuff_free (nb);
-      return err;
-    }
-  grub_memcpy (ptr, "\r\nUser-Agent: " PACKAGE_STRING "\r\n",
-	       sizeof ("\r\nUser-Agent: " PACKAGE_STRING "\r\n") - 1);
-  if (!initial)
-    {
-      ptr = nb->tail;
-      grub_snprintf ((char *) ptr,
-		     sizeof ("Range: bytes=XXXXXXXXXXXXXXXXXXXX-"
-			     "\r\n"),
-		     "Range: bytes=%" PRIuGRUB_UINT64_T "-\r\n",
-		     offset);
-      grub_netbuff_put (nb, grub_strlen ((char *) ptr));
-    }
-  ptr = nb->tail;
-  grub_netbuff_put (nb, 2);
-  grub_memcpy (ptr, "\r\n", 2);
-
-  grub_dprintf ("http", "opening path %s on host %s TCP port %d\n",
-		data->filename, server, port ? port : HTTP_PORT);
-  data->sock = grub_net_tcp_open (server,
-				  port ? port : HTTP_PORT, http_receive,
-				  http_err, NULL,
-				  file);
-  if (!data->sock)
-    {
-      grub_netbuff_free (nb);
-      return grub_errno;
-    }
+      data->conn = http_conn_get (data, &reused);
+      if (!data->conn)
+	return grub_errno;
 
-  //  grub_net_poll_cards (5000);
+      err = http_send_request (data, 0);
+      for (i = 0; !err && !data->opened && !data->conn->dead && i < 100; i++)
+	{
+	  grub_net_tcp_retransmit ();
+	  grub_net_poll_cards (300, &data->opened);
+	}
+      if (data->opened)
+	break;
 
-  err = grub_net_send_tcp_packet (data->sock, nb, 1);
-  if (err)
-    {
-      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
-      return err;
+      /* An idle connection may have been closed by the server meanwhile;
+	 try once more with a new one.  */
+      dead = data->conn->dead;
+      http_conn_free (data->conn);
+      data->conn = 0;
+      data->nreqs = 0;
+      http_reset_response (data);
+      if (!reused || !dead)
+	break;
+      grub_errno = GRUB_ERR_NONE;
+      err = GRUB_ERR_NONE;
     }
 
-  for (i = 0; !data->headers_recv && i < 100; i++)
+  if (!data->opened)
     {
-      grub_net_tcp_retransmit ();
-      grub_net_poll_cards (300, &data->headers_recv);
+      if (err)
+	return err;
+      return grub_error (GRUB_ERR_TIMEOUT, N_("time out opening `%s'"), data->filename);
     }
 
-  if (!data->headers_recv)
+  if (data->err)
     {
-      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
-      if (data->err)
-	{
-	  char *str = data->errmsg;
-	  err = grub_error (data->err, "%s", str);
-	  grub_free (str);
-	  data->errmsg = 0;
-	  return data->err;
-	}
-      return grub_error (GRUB_ERR_TIMEOUT, N_("time out opening `%s'"), data->filename);
+      err = grub_error (data->err, "%s", data->errmsg);
+      http_conn_free (data->conn);
+      data->conn = 0;
+      http_reset_response (data);
+      return err;
     }
   return GRUB_ERR_NONE;
 }
@@ -452,48 +1302,67 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
 static grub_err_t
 http_seek (struct grub_file *file, grub_off_t off)
 {
-  struct http_data *old_data, *data;
-  grub_err_t err;
-  old_data = file->data;
-  /* FIXME: Reuse socket?  */
-  if (old_data->sock)
-    grub_net_tcp_close (old_data->sock, GRUB_NET_TCP_ABORT);
-  old_data->sock = 0;
+  http_data_t data = file->data;
+  grub_net_t net = file->device->net;
+  grub_off_t live_start, pending = 0;
+  unsigned i;
 
-  while (file->device->net->packs.first)
+  while (net->packs.first)
     {
-      grub_netbuff_free (file->device->net->packs.first->nb);
-      grub_net_remove_packet (file->device->net->packs.first);
+      grub_netbuff_free (net->packs.first->nb);
+      grub_net_remove_packet (net->packs.first);
     }
 
-  file->device->net->stall = 0;
-  file->device->net->eof = 0;
-  file->device->net->offset = off;
+  net->stall = 0;
+  net->eof = 0;
+  net->offset = off;
 
-  data = grub_zalloc (sizeof (*data));
-  if (!data)
-    return grub_errno;
-
-  data->size_recv = 1;
-  data->filename = old_data->filename;
-  if (!data->filename)
+  if (data->conn && !data->conn->dead)
     {
-      grub_free (data);
-      file->data = 0;
-      return grub_errno;
-    }
-  grub_free (old_data);
+      /* Where the data still wanted starts arriving.  */
+      live_start = data->req_end;
+      for (i = 0; i < data->nreqs; i++)
+	if (!data->reqs[i].discard)
+	  {
+	    live_start = (i == 0 && data->headers_recv) ? data->recv_off
+	      : data->reqs[i].start;
+	    break;
+	  }
 
-  file->data = data;
-  err = http_establish (file, off, 0);
-  if (err)
-    {
-      grub_free (data->filename);
-      grub_free (data);
-      file->data = 0;
-      return err;
+      /* OFF is on its way already.  */
+      if (live_start <= off && off < data->req_end
+	  && off - live_start <= HTTP_DRAIN_MAX)
+	{
+	  data->want_off = off;
+	  return GRUB_ERR_NONE;
+	}
+
+      for (i = 0; i < data->nreqs; i++)
+	pending += data->reqs[i].end - data->reqs[i].start;
+      if (data->nreqs && data->headers_recv && data->size_recv
+	  && !data->chunked)
+	pending -= (data->reqs[0].end - data->reqs[0].start) - data->body_rem;
+
+      /* Drain the responses in flight and ask for OFF behind them.  */
+      if (data->ranges_ok && !data->close && pending <= HTTP_DRAIN_MAX
+	  && data->nreqs < HTTP_MAX_REQS)
+	{
+	  for (i = 0; i < data->nreqs; i++)
+	    data->reqs[i].discard = 1;
+	  data->want_off = off;
+	  data->range_size = HTTP_MIN_RANGE;
+	  if (file->size != GRUB_FILE_SIZE_UNKNOWN && off >= file->size)
+	    {
+	      http_set_eof (file);
+	      return GRUB_ERR_NONE;
+	    }
+	  return http_send_request (data, off);
+	}
     }
-  return GRUB_ERR_NONE;
+
+  data->want_off = off;
+  data->range_size = HTTP_MIN_RANGE;
+  return http_restart (file);
 }
 
 static grub_err_t
@@ -513,15 +1382,18 @@ http_open (struct grub_file *file, const char *filename)
       grub_free (data);
       return grub_errno;
     }
+  data->range_size = HTTP_MIN_RANGE;
+  data->file = file;
 
   file->not_easily_seekable = 0;
   file->data = data;
 
-  err = http_establish (file, 0, 1);
+  err = http_establish (file);
   if (err)
     {
       grub_free (data->filename);
       grub_free (data);
+      file->data = 0;
       return err;
     }
 
@@ -536,10 +1408,10 @@ http_close (struct grub_file *file)
   if (!data)
     return GRUB_ERR_NONE;
 
-  if (data->sock)
-    grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
-  if (data->current_line)
-    grub_free (data->current_line);
+  if (data->cache)
+    http_cache_free (data);
+  http_conn_release (data);
+  http_reset_response (data);
   grub_free (data->filename);
   grub_free (data);
   return GRUB_ERR_NONE;
@@ -549,32 +1421,182 @@ static grub_err_t
 http_packets_pulled (struct grub_file *file)
 {
   http_data_t data = file->data;
+  grub_err_t err;
 
-  if (file->device->net->packs.count >= 20)
+  if (data && http_update_unread (file, data))
     return 0;
 
   if (!file->device->net->eof)
     file->device->net->stall = 0;
-  if (data && data->sock)
-    grub_net_tcp_unstall (data->sock);
+  if (!data)
+    return 0;
+
+  if (data->conn && !data->conn->dead)
+    {
+      http_pipeline (file);
+      return 0;
+    }
+
+  /* The connection went away before the data the reader wants.  */
+  if (!file->device->net->eof)
+    {
+      err = http_restart (file);
+      if (err)
+	{
+	  grub_dprintf ("http", "reconnecting failed: %s\n", grub_errmsg);
+	  grub_errno = GRUB_ERR_NONE;
+	}
+    }
   return 0;
 }
 
+/* Track sequential reading like grub_disk_read does and return the
+   number of blocks to read ahead of a read of LEN bytes at OFF.  The
+   window doubles on every read that continues where the last one ended
+   and is dropped on a seek, so random reads, such as the metadata reads
+   of a loopback-mounted image, fetch only the blocks they need.  */
+static unsigned
+http_cache_readahead (struct http_cache *cache, grub_off_t off,
+		      grub_size_t len)
+{
+  if (off != cache->ra_next)
+    {
+      /* Small reads outside of the stream are mostly filesystem
+	 metadata; let the stream continue after them.  */
+      if (cache->ra_window && len <= HTTP_BLOCK_SIZE)
+	return 0;
+      cache->ra_next = off + len;
+      cache->ra_window = 0;
+      return 0;
+    }
+
+  cache->ra_next = off + len;
+  if (cache->ra_window)
+    cache->ra_window *= 2;
+  else
+    cache->ra_window = HTTP_READAHEAD_MIN;
+  if (cache->ra_window > HTTP_READAHEAD)
+    cache->ra_window = HTTP_READAHEAD;
+  return cache->ra_window;
+}
+
+/* Read through the block cache.  */
+static grub_ssize_t
+http_read (struct grub_file *file, char *buf, grub_size_t len)
+{
+  http_data_t data = file->data;
+  grub_net_t net = file->device->net;
+  grub_off_t off = file->offset;
+  grub_size_t total = 0;
+  unsigned i, ahead;
+
+  if (off >= file->size)
+    return 0;
+  if (len > file->size - off)
+    len = file->size - off;
+  ahead = http_cache_readahead (data->cache, off, len);
+
+  while (len)
+    {
+      struct http_block *block;
+      grub_off_t start = off & ~(grub_off_t) (HTTP_BLOCK_SIZE - 1);
+      grub_size_t amount, filled;
+      int try = 0;
+
+      block = http_cache_get (data, start, 1);
+      if (!block)
+	return -1;
+      http_cache_schedule (data, 1);
+      while (!block->done)
+	{
+	  if (try > GRUB_NET_TRIES)
+	    {
+	      grub_error (GRUB_ERR_TIMEOUT, N_("timeout reading `%s'"),
+			  net->name);
+	      return -1;
+	    }
+	  filled = block->filled;
+	  grub_net_poll_cards (GRUB_NET_INTERVAL
+			       + (try * GRUB_NET_INTERVAL_ADDITION),
+			       &block->done);
+	  http_cache_schedule (data, 1);
+	  if (block->filled == filled)
+	    try++;
+	  else
+	    try = 0;
+	}
+      if (block->failed)
+	{
+	  grub_error (GRUB_ERR_FILE_READ_ERROR,
+		      N_("premature end of file %s"), net->name);
+	  return -1;
+	}
+
+      amount = block->len - (off - start);
+      if (amount > len)
+	amount = len;
+      if (buf)
+	{
+	  grub_memcpy (buf, block->buf + (off - start), amount);
+	  buf += amount;
+	}
+      if (grub_file_progress_hook)
+	grub_file_progress_hook (0, 0, amount, file);
+      off += amount;
+      total += amount;
+      len -= amount;
+      net->offset = off;
+
+      for (i = 1; i <= ahead; i++)
+	if (!http_cache_get (data, start + ((grub_off_t) i << HTTP_BLOCK_SHIFT),
+			     0))
+	  break;
+      grub_errno = GRUB_ERR_NONE;
+    }
+  http_cache_schedule (data, 1);
+  return total;
+}
+
+static char *
+http_cache_size_write (struct grub_env_var *var __attribute__ ((unused)),
+		       const char *val)
+{
+  grub_size_t size;
+
+  if (grub_env_parse_size (val, &size))
+    return NULL;
+
+  cache_size = size;
+  return grub_strdup (val);
+}
+
 static struct grub_net_app_protocol grub_http_protocol = 
   {
     .name = "http",
     .open = http_open,
     .close = http_close,
     .seek = http_seek,
+    .read = http_read,
     .packets_pulled = http_packets_pulled
   };
 
 GRUB_MOD_INIT (http)
 {
+  grub_register_variable_hook ("net_http_cache_size", 0,
+			       http_cache_size_write);
   grub_net_app_level_register (&grub_http_protocol);
 }
 
 GRUB_MOD_FINI (http)
 {
+  struct http_conn *conn;
+
   grub_net_app_level_unregister (&grub_http_protocol);
+  grub_register_variable_hook ("net_http_cache_size", 0, 0);
+  while (idle_conns)
+    {
+      conn = idle_conns;
+      idle_conns = conn->next;
+      http_conn_free (conn);
+    }
 }
@@ -29,6 +29,7 @@
 #include <grub/net/ethernet.h>
 #include <grub/net/arp.h>
 #include <grub/net/ip.h>
+#include <grub/net/tcp.h>
 #include <grub/loader.h>
 #include <grub/bufio.h>
 #include <grub/kernel.h>
@@ -38,6 +39,12 @@
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
+/* Frames taken from a card before handing them up the stack.  */
+#define GRUB_NET_RECV_BATCH 16
+/* Receive buffers each card allocates up front and keeps at most.  */
+#define GRUB_NET_RX_POOL_PREALLOC 32
+#define GRUB_NET_RX_POOL_MAX 256
+
 char *grub_net_default_server;
 
 struct grub_net_route *grub_net_routes = NULL;
@@ -197,9 +204,33 @@ grub_net_card_unregister (struct grub_net_card *card)
 	card->driver->close (card);
       card->opened = 0;
     }
+  grub_netbuff_pool_destroy (card->rx_pool);
+  card->rx_pool = 0;
   grub_list_remove (GRUB_AS_LIST (card));
 }
 
+/* Get a buffer of at least LEN bytes for a frame received by CARD.
+   Frames up to the MTU get a buffer from the card's pool, which is set
+   up on first use.  */
+struct grub_net_buff *
+grub_net_card_alloc_rx (struct grub_net_card *card, grub_size_t len)
+{
+  struct grub_net_buff *nb;
+
+  if (!card->rx_pool)
+    card->rx_pool = grub_netbuff_pool_new (ALIGN_UP (card->mtu, 64)
+					   + GRUB_NET_MAX_LINK_HEADER_SIZE + 2,
+					   GRUB_NET_RX_POOL_PREALLOC,
+					   GRUB_NET_RX_POOL_MAX);
+  if (card->rx_pool && len <= card->rx_pool->len)
+    nb = grub_netbuff_pool_alloc (card->rx_pool);
+  else
+    nb = grub_netbuff_alloc (len);
+  if (!nb)
+    card->stats.rx_nobuf++;
+  return nb;
+}
+
 static struct grub_net_slaac_mac_list *
 grub_net_ipv6_get_slaac (struct grub_net_card *card,
 			 const grub_net_link_level_address_t *hwaddr)
@@ -1327,6 +1358,31 @@ grub_cmd_listcards (struct grub_command *cmd __attribute__ ((unused)),
   return GRUB_ERR_NONE;
 }
 
+static grub_err_t
+grub_cmd_stats (struct grub_command *cmd __attribute__ ((unused)),
+		int argc __attribute__ ((unused)),
+		char **args __attribute__ ((unused)))
+{
+  struct grub_net_card *card;
+  FOR_NET_CARDS(card)
+  {
+    grub_printf ("%s: %llu packets, %llu bytes, %llu errors,"
+		 " %llu dropped for lack of buffers\n", card->name,
+		 (unsigned long long) card->stats.rx_packets,
+		 (unsigned long long) card->stats.rx_bytes,
+		 (unsigned long long) card->stats.rx_errors,
+		 (unsigned long long) card->stats.rx_nobuf);
+    if (card->rx_pool)
+      grub_printf ("  %u receive buffers of %llu bytes,"
+		   " %llu reused, %llu allocated\n",
+		   card->rx_pool->count,
+		   (unsigned long long) card->rx_pool->len,
+		   (unsigned long long) card->rx_pool->reused,
+		   (unsigned long long) card->rx_pool->allocated);
+  }
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_cmd_listaddrs (struct grub_command *cmd __attribute__ ((unused)),
 		    int argc __attribute__ ((unused)),
@@ -1576,6 +1632,7 @@ grub_net_fs_open (struct grub_file *file_out, const char *name)
   grub_memcpy (file, file_out, sizeof (struct grub_file));
   file->device->net->packs.first = NULL;
   file->device->net->packs.last = NULL;
+  file->device->net->direct_read = 0;
   file->device->net->name = grub_strdup (name);
   if (!file->device->net->name)
     {
@@ -1630,6 +1687,8 @@ grub_net_fs_close (grub_file_t file)
 static void
 receive_packets (struct grub_net_card *card, int *stop_condition)
 {
+  struct grub_net_buff *batch[GRUB_NET_RECV_BATCH];
+  unsigned n, i;
   int received = 0;
   if (card->num_ifaces == 0)
     return;
@@ -1645,28 +1704,41 @@ receive_packets (struct grub_net_card *card, int *stop_condition)
 	}
       card->opened = 1;
     }
+  /* Take frames from the card a batch at a time, then hand them up the
+     stack together so that TCP acknowledges each batch once.  */
   while (received < 100)
     {
-      /* Maybe should be better have a fixed number of packets for each card
-	 and just mark them as used and not used.  */ 
-      struct grub_net_buff *nb;
-
       if (received > 10 && stop_condition && *stop_condition)
 	break;
 
-      nb = card->driver->recv (card);
-      if (!nb)
+      for (n = 0; n < GRUB_NET_RECV_BATCH; n++)
 	{
-	  card->last_poll = grub_get_time_ms ();
-	  break;
+	  batch[n] = card->driver->recv (card);
+	  if (!batch[n])
+	    break;
 	}
-      received++;
-      grub_net_recv_ethernet_packet (nb, card);
-      if (grub_errno)
+      received += n;
+
+      grub_net_tcp_batch_begin ();
+      for (i = 0; i < n; i++)
 	{
-	  grub_dprintf ("net", "error receiving: %d: %s\n", grub_errno,
-			grub_errmsg);
-	  grub_errno = GRUB_ERR_NONE;
+	  card->stats.rx_packets++;
+	  card->stats.rx_bytes += batch[i]->tail - batch[i]->data;
+	  grub_net_recv_ethernet_packet (batch[i], card);
+	  if (grub_errno)
+	    {
+	      card->stats.rx_errors++;
+	      grub_dprintf ("net", "error receiving: %d: %s\n", grub_errno,
+			    grub_errmsg);
+	      grub_errno = GRUB_ERR_NONE;
+	    }
+	}
+      grub_net_tcp_batch_end ();
+
+      if (n < GRUB_NET_RECV_BATCH)
+	{
+	  card->last_poll = grub_get_time_ms ();
+	  break;
 	}
     }
   grub_print_error ();
@@ -1853,6 +1925,8 @@ grub_net_seek_real (struct grub_file *file, grub_off_t offset)
 static grub_ssize_t
 grub_net_fs_read (grub_file_t file, char *buf, grub_size_t len)
 {
+  if (file->device->net->direct_read)
+    return file->device->net->protocol->read (file, buf, len);
   if (file->offset != file->device->net->offset)
     {
       grub_err_t err;
@@ -2032,7 +2106,7 @@ static struct grub_preboot *fini_hnd;
 
 static grub_command_t cmd_addaddr, cmd_deladdr, cmd_addroute, cmd_delroute;
 static grub_command_t cmd_lsroutes, cmd_lscards;
-static grub_command_t cmd_lsaddr, cmd_slaac;
+static grub_command_t cmd_lsaddr, cmd_slaac, cmd_stats;
 
 #ifdef GRUB_MACHINE_EFI
 
@@ -2116,8 +2190,11 @@ GRUB_MOD_INIT(net)
 				       "", N_("list network cards"));
   cmd_lsaddr = grub_register_command ("net_ls_addr", grub_cmd_listaddrs,
 				       "", N_("list network addresses"));
+  cmd_stats = grub_register_command ("net_stats", grub_cmd_stats,
+				     "", N_("show receive statistics"));
   grub_bootp_init ();
   grub_dns_init ();
+  grub_net_tcp_init ();
 
   grub_net_open = grub_net_open_real;
   fini_hnd = grub_loader_register_preboot_hook (grub_net_fini_hw,
@@ -2160,6 +2237,7 @@ GRUB_MOD_FINI(net)
 
   grub_bootp_fini ();
   grub_dns_fini ();
+  grub_net_tcp_fini ();
   grub_unregister_command (cmd_addaddr);
   grub_unregister_command (cmd_deladdr);
   grub_unregister_command (cmd_addroute);
@@ -2168,6 +2246,7 @@ GRUB_MOD_FINI(net)
   grub_unregister_command (cmd_lscards);
   grub_unregister_command (cmd_lsaddr);
   grub_unregister_command (cmd_slaac);
+  grub_unregister_command (cmd_stats);
   grub_fs_unregister (&grub_net_fs);
   grub_net_open = NULL;
   grub_net_fini_hw (0);
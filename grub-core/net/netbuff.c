@@ -94,6 +94,8 @@ grub_netbuff_alloc (grub_size_t len)
 				 + len / sizeof (grub_properly_aligned_t));
   nb->head = nb->data = nb->tail = data;
   nb->end = (grub_uint8_t *) nb;
+  nb->pool = 0;
+  nb->pool_next = 0;
   return nb;
 }
 
@@ -120,11 +122,99 @@ grub_netbuff_make_pkt (grub_size_t len)
 void
 grub_netbuff_free (struct grub_net_buff *nb)
 {
+  struct grub_net_buff_pool *pool;
+
   if (!nb)
     return;
+  pool = nb->pool;
+  if (pool && !pool->dead)
+    {
+      nb->pool_next = pool->free;
+      pool->free = nb;
+      return;
+    }
+  if (pool && --pool->count == 0)
+    grub_free (pool);
   grub_free (nb->head);
 }
 
+/* Take a buffer from POOL, allocating one if none is free.  Allocated
+   buffers join the pool as long as it has fewer than its maximum.  */
+struct grub_net_buff *
+grub_netbuff_pool_alloc (struct grub_net_buff_pool *pool)
+{
+  struct grub_net_buff *nb = pool->free;
+
+  if (nb)
+    {
+      pool->free = nb->pool_next;
+      pool->reused++;
+      grub_netbuff_clear (nb);
+      return nb;
+    }
+
+  nb = grub_netbuff_alloc (pool->len);
+  if (!nb)
+    return NULL;
+  pool->allocated++;
+  if (pool->count < pool->max)
+    {
+      nb->pool = pool;
+      pool->count++;
+    }
+  return nb;
+}
+
+struct grub_net_buff_pool *
+grub_netbuff_pool_new (grub_size_t len, unsigned prealloc, unsigned max)
+{
+  struct grub_net_buff_pool *pool;
+  struct grub_net_buff *nb;
+  unsigned i;
+
+  pool = grub_zalloc (sizeof (*pool));
+  if (!pool)
+    return NULL;
+  if (len < NETBUFFMINLEN)
+    len = NETBUFFMINLEN;
+  pool->len = ALIGN_UP (len, NETBUFF_ALIGN);
+  pool->max = max;
+
+  for (i = 0; i < prealloc && i < max; i++)
+    {
+      nb = grub_netbuff_alloc (pool->len);
+      if (!nb)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  break;
+	}
+      nb->pool = pool;
+      nb->pool_next = pool->free;
+      pool->free = nb;
+      pool->count++;
+    }
+  return pool;
+}
+
+void
+grub_netbuff_pool_destroy (struct grub_net_buff_pool *pool)
+{
+  struct grub_net_buff *nb;
+
+  if (!pool)
+    return;
+  pool->dead = 1;
+  while (pool->free)
+    {
+      nb = pool->free;
+      pool->free = nb->pool_next;
+      pool->count--;
+      grub_free (nb->head);
+    }
+  if (!pool->count)
+    grub_free (pool);
+}
+
 grub_err_t
 grub_netbuff_clear (struct grub_net_buff *nb)
 {
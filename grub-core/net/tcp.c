@@ -22,12 +22,20 @@
 #include <grub/net/netbuff.h>
 #include <grub/time.h>
 #include <grub/priority_queue.h>
+#include <grub/env.h>
+#include <grub/i18n.h>
 
 #define TCP_SYN_RETRANSMISSION_TIMEOUT GRUB_NET_INTERVAL
 #define TCP_SYN_RETRANSMISSION_COUNT GRUB_NET_TRIES
 #define TCP_RETRANSMISSION_TIMEOUT GRUB_NET_INTERVAL
 #define TCP_RETRANSMISSION_COUNT GRUB_NET_TRIES
 
+/* Default receive buffer budget in KiB, overridden by the
+   net_tcp_window_size variable.  */
+#define TCP_DEFAULT_WINDOW_SIZE 4096
+#define TCP_MAX_WINDOW_SCALE 14
+#define TCP_MAX_SACK_BLOCKS 4
+
 struct unacked
 {
   struct unacked *next;
@@ -47,6 +55,22 @@ enum
     TCP_URG = 0x20,
   };
 
+enum
+  {
+    TCP_OPT_EOL = 0,
+    TCP_OPT_NOP = 1,
+    TCP_OPT_WINDOW_SCALE = 3,
+    TCP_OPT_SACK_PERMITTED = 4,
+    TCP_OPT_SACK = 5,
+  };
+
+/* A block of out-of-order data held in the priority queue.  */
+struct tcp_sack_block
+{
+  grub_uint32_t start;
+  grub_uint32_t end;
+};
+
 struct grub_net_tcp_socket
 {
   struct grub_net_tcp_socket *next;
@@ -65,7 +89,22 @@ struct grub_net_tcp_socket
   grub_uint32_t my_cur_seq;
   grub_uint32_t their_start_seq;
   grub_uint32_t their_cur_seq;
-  grub_uint16_t my_window;
+  /* Shift applied to the windows we advertise, 0 unless both sides sent
+     the window scale option.  */
+  int my_scale;
+  int sack_ok;
+  /* Right edge of the last window we advertised.  */
+  grub_uint32_t my_window_end;
+  /* Payload bytes waiting in PQ.  */
+  grub_size_t pq_bytes;
+  /* Bytes handed to the application that it hasn't consumed yet, as
+     reported by grub_net_tcp_set_unread.  */
+  grub_size_t unread;
+  /* An acknowledgement is due at the end of the receive batch.  */
+  int ack_pending;
+  /* Most recently changed block first, as RFC 2018 asks.  */
+  struct tcp_sack_block sack[TCP_MAX_SACK_BLOCKS];
+  unsigned nsack;
   struct unacked *unack_first;
   struct unacked *unack_last;
   grub_err_t (*recv_hook) (grub_net_tcp_socket_t sock, struct grub_net_buff *nb,
@@ -112,11 +151,25 @@ struct tcp_scale_opt {
   grub_uint8_t scale;
 } GRUB_PACKED;
 
+struct tcp_sack_permitted_opt {
+  grub_uint8_t kind;
+  grub_uint8_t length;
+} GRUB_PACKED;
+
 struct tcp_synhdr {
   struct tcphdr tcphdr;
+  grub_uint8_t nop[2];
+  struct tcp_sack_permitted_opt sack_permitted_opt;
+  grub_uint8_t nop2;
   struct tcp_scale_opt scale_opt;
-  grub_uint8_t padding;
-};
+} GRUB_PACKED;
+
+struct tcp_sack_opt {
+  grub_uint8_t nop[2];
+  grub_uint8_t kind;
+  grub_uint8_t length;
+  grub_uint32_t blocks[2 * TCP_MAX_SACK_BLOCKS];
+} GRUB_PACKED;
 
 struct tcp_pseudohdr
 {
@@ -138,6 +191,8 @@ struct tcp6_pseudohdr
 
 static struct grub_net_tcp_socket *tcp_sockets;
 static struct grub_net_tcp_listen *tcp_listens;
+static grub_size_t tcp_window_size = TCP_DEFAULT_WINDOW_SIZE << 10;
+static int tcp_batch;
 
 #define FOR_TCP_SOCKETS(var) FOR_LIST_ELEMENTS (var, tcp_sockets)
 #define FOR_TCP_LISTENS(var) FOR_LIST_ELEMENTS (var, tcp_listens)
@@ -175,6 +230,169 @@ tcp_socket_register (grub_net_tcp_socket_t sock)
 		  GRUB_AS_LIST (sock));
 }
 
+static inline int
+seq_lt (grub_uint32_t a, grub_uint32_t b)
+{
+  return (grub_int32_t) (a - b) < 0;
+}
+
+static inline int
+seq_le (grub_uint32_t a, grub_uint32_t b)
+{
+  return (grub_int32_t) (a - b) <= 0;
+}
+
+/* Shift needed to advertise the whole receive buffer.  */
+static int
+tcp_window_scale (void)
+{
+  int scale = 0;
+
+  while ((tcp_window_size >> scale) > 0xffff
+	 && scale < TCP_MAX_WINDOW_SCALE)
+    scale++;
+  return scale;
+}
+
+/* Window for SYN segments, which is never scaled.  */
+static grub_uint16_t
+tcp_syn_window (void)
+{
+  return tcp_window_size > 0xffff ? 0xffff : tcp_window_size;
+}
+
+/* Room left in the receive buffer of SOCK once the out-of-order data
+   and the data the application hasn't read yet are accounted for.  */
+static grub_size_t
+tcp_room (grub_net_tcp_socket_t sock)
+{
+  grub_size_t used = sock->pq_bytes + sock->unread;
+
+  return tcp_window_size > used ? tcp_window_size - used : 0;
+}
+
+/* Window to advertise: the room in the receive buffer, without moving
+   the right edge of an earlier window back.  */
+static grub_uint16_t
+tcp_window (grub_net_tcp_socket_t sock)
+{
+  grub_size_t room;
+  grub_uint32_t win;
+
+  if (sock->i_stall)
+    return 0;
+
+  room = tcp_room (sock);
+  if (room > 0x7fffffff)
+    room = 0x7fffffff;
+  if (seq_lt (sock->their_cur_seq + room, sock->my_window_end))
+    room = sock->my_window_end - sock->their_cur_seq;
+
+  win = room >> sock->my_scale;
+  if (win > 0xffff)
+    win = 0xffff;
+  sock->my_window_end = sock->their_cur_seq + (win << sock->my_scale);
+  return win;
+}
+
+/* Fill in the options of a SYN segment.  Options the peer did not offer
+   are replaced with no-ops.  */
+static void
+tcp_syn_options (struct tcp_synhdr *tcph, int scale, int sack_permitted)
+{
+  grub_memset (tcph->nop, TCP_OPT_NOP, sizeof (*tcph) - sizeof (tcph->tcphdr));
+  if (sack_permitted)
+    {
+      tcph->sack_permitted_opt.kind = TCP_OPT_SACK_PERMITTED;
+      tcph->sack_permitted_opt.length = sizeof (tcph->sack_permitted_opt);
+    }
+  if (scale >= 0)
+    {
+      tcph->scale_opt.kind = TCP_OPT_WINDOW_SCALE;
+      tcph->scale_opt.length = sizeof (tcph->scale_opt);
+      tcph->scale_opt.scale = scale;
+    }
+  tcph->tcphdr.flags |= grub_cpu_to_be16_compile_time ((sizeof (*tcph) / 4)
+						       << 12);
+}
+
+/* Find the window scale and SACK permitted options of a SYN segment.
+   SCALE is set to -1 if the peer does not scale windows.  */
+static void
+tcp_parse_syn_options (struct tcphdr *tcph, int *scale, int *sack_permitted)
+{
+  grub_uint8_t *ptr = (grub_uint8_t *) (tcph + 1);
+  grub_uint8_t *end = (grub_uint8_t *) tcph
+    + (grub_be_to_cpu16 (tcph->flags) >> 12) * sizeof (grub_uint32_t);
+
+  *scale = -1;
+  *sack_permitted = 0;
+  while (ptr < end && *ptr != TCP_OPT_EOL)
+    {
+      if (*ptr == TCP_OPT_NOP)
+	{
+	  ptr++;
+	  continue;
+	}
+      if (end - ptr < 2 || ptr[1] < 2 || ptr[1] > end - ptr)
+	break;
+      if (ptr[0] == TCP_OPT_WINDOW_SCALE && ptr[1] == 3)
+	*scale = ptr[2];
+      if (ptr[0] == TCP_OPT_SACK_PERMITTED && ptr[1] == 2)
+	*sack_permitted = 1;
+      ptr += ptr[1];
+    }
+}
+
+/* Record that [START, END) was received out of order.  */
+static void
+tcp_sack_add (grub_net_tcp_socket_t sock, grub_uint32_t start,
+	      grub_uint32_t end)
+{
+  unsigned i, j;
+
+  /* Merge with the blocks it touches.  */
+  for (i = 0; i < sock->nsack; )
+    if (seq_le (start, sock->sack[i].end) && seq_le (sock->sack[i].start, end))
+      {
+	if (seq_lt (sock->sack[i].start, start))
+	  start = sock->sack[i].start;
+	if (seq_lt (end, sock->sack[i].end))
+	  end = sock->sack[i].end;
+	for (j = i + 1; j < sock->nsack; j++)
+	  sock->sack[j - 1] = sock->sack[j];
+	sock->nsack--;
+      }
+    else
+      i++;
+
+  if (sock->nsack == TCP_MAX_SACK_BLOCKS)
+    sock->nsack--;
+  for (j = sock->nsack; j > 0; j--)
+    sock->sack[j] = sock->sack[j - 1];
+  sock->sack[0].start = start;
+  sock->sack[0].end = end;
+  sock->nsack++;
+}
+
+/* Drop the parts of the SACK blocks that are now acknowledged.  */
+static void
+tcp_sack_update (grub_net_tcp_socket_t sock)
+{
+  unsigned i, j;
+
+  for (i = 0, j = 0; i < sock->nsack; i++)
+    {
+      if (seq_le (sock->sack[i].end, sock->their_cur_seq))
+	continue;
+      sock->sack[j] = sock->sack[i];
+      if (seq_lt (sock->sack[j].start, sock->their_cur_seq))
+	sock->sack[j].start = sock->their_cur_seq;
+      j++;
+    }
+  sock->nsack = j;
+}
+
 static void
 error (grub_net_tcp_socket_t sock)
 {
@@ -311,9 +529,15 @@ ack_real (grub_net_tcp_socket_t sock, int res)
 {
   struct grub_net_buff *nb_ack;
   struct tcphdr *tcph_ack;
+  struct tcp_sack_opt *sack_opt;
+  grub_size_t optlen = 0;
   grub_err_t err;
+  unsigned i;
+
+  if (!res && sock->sack_ok && sock->nsack)
+    optlen = 4 + 8 * sock->nsack;
 
-  nb_ack = grub_netbuff_alloc (sizeof (*tcph_ack) + 128);
+  nb_ack = grub_netbuff_alloc (sizeof (*tcph_ack) + sizeof (*sack_opt) + 128);
   if (!nb_ack)
     return;
   err = grub_netbuff_reserve (nb_ack, 128);
@@ -325,7 +549,7 @@ ack_real (grub_net_tcp_socket_t sock, int res)
       return;
     }
 
-  err = grub_netbuff_put (nb_ack, sizeof (*tcph_ack));
+  err = grub_netbuff_put (nb_ack, sizeof (*tcph_ack) + optlen);
   if (err)
     {
       grub_netbuff_free (nb_ack);
@@ -334,6 +558,19 @@ ack_real (grub_net_tcp_socket_t sock, int res)
       return;
     }
   tcph_ack = (void *) nb_ack->data;
+  if (optlen)
+    {
+      sack_opt = (struct tcp_sack_opt *) (tcph_ack + 1);
+      sack_opt->nop[0] = TCP_OPT_NOP;
+      sack_opt->nop[1] = TCP_OPT_NOP;
+      sack_opt->kind = TCP_OPT_SACK;
+      sack_opt->length = optlen - 2;
+      for (i = 0; i < sock->nsack; i++)
+	{
+	  sack_opt->blocks[2 * i] = grub_cpu_to_be32 (sock->sack[i].start);
+	  sack_opt->blocks[2 * i + 1] = grub_cpu_to_be32 (sock->sack[i].end);
+	}
+    }
   if (res)
     {
       tcph_ack->ack = grub_cpu_to_be32_compile_time (0);
@@ -343,9 +580,8 @@ ack_real (grub_net_tcp_socket_t sock, int res)
   else
     {
       tcph_ack->ack = grub_cpu_to_be32 (sock->their_cur_seq);
-      tcph_ack->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_ACK);
-      tcph_ack->window = !sock->i_stall ? grub_cpu_to_be16 (sock->my_window)
-	: 0;
+      tcph_ack->flags = grub_cpu_to_be16 (((5 + optlen / 4) << 12) | TCP_ACK);
+      tcph_ack->window = grub_cpu_to_be16 (tcp_window (sock));
     }
   tcph_ack->urgent = 0;
   tcph_ack->src = grub_cpu_to_be16 (sock->in_port);
@@ -361,6 +597,7 @@ ack_real (grub_net_tcp_socket_t sock, int res)
 static void
 ack (grub_net_tcp_socket_t sock)
 {
+  sock->ack_pending = 0;
   ack_real (sock, 0);
 }
 
@@ -483,6 +720,18 @@ cmp (const void *a__, const void *b__)
   return 0;
 }
 
+/* Payload length of the segment in NB, whose data starts at the TCP
+   header.  Used for every change to pq_bytes so that the count returns
+   to 0 exactly when the queue empties.  */
+static grub_size_t
+tcp_payload_len (struct grub_net_buff *nb)
+{
+  struct tcphdr *tcph = (struct tcphdr *) nb->data;
+
+  return nb->tail - nb->data
+    - (grub_be_to_cpu16 (tcph->flags) >> 12) * sizeof (grub_uint32_t);
+}
+
 static void
 destroy_pq (grub_net_tcp_socket_t sock)
 {
@@ -508,7 +757,7 @@ grub_net_tcp_accept (grub_net_tcp_socket_t sock,
 		     void *hook_data)
 {
   struct grub_net_buff *nb_ack;
-  struct tcphdr *tcph;
+  struct tcp_synhdr *tcph;
   grub_err_t err;
   grub_net_network_level_address_t gateway;
   struct grub_net_network_level_interface *inf;
@@ -546,10 +795,12 @@ grub_net_tcp_accept (grub_net_tcp_socket_t sock,
       return err;
     }
   tcph = (void *) nb_ack->data;
-  tcph->ack = grub_cpu_to_be32 (sock->their_cur_seq);
-  tcph->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_SYN | TCP_ACK);
-  tcph->window = grub_cpu_to_be16 (sock->my_window);
-  tcph->urgent = 0;
+  tcph->tcphdr.ack = grub_cpu_to_be32 (sock->their_cur_seq);
+  tcph->tcphdr.flags = grub_cpu_to_be16_compile_time (TCP_SYN | TCP_ACK);
+  tcph->tcphdr.window = grub_cpu_to_be16 (tcp_syn_window ());
+  tcph->tcphdr.urgent = 0;
+  tcp_syn_options (tcph, sock->my_scale ? sock->my_scale : -1, sock->sack_ok);
+  sock->my_window_end = sock->their_cur_seq + tcp_syn_window ();
   sock->established = 1;
   tcp_socket_register (sock);
   err = tcp_send (nb_ack, sock);
@@ -650,18 +901,17 @@ grub_net_tcp_open (char *server,
   grub_memset(tcph, 0, sizeof (*tcph));
   socket->my_start_seq = grub_get_time_ms ();
   socket->my_cur_seq = socket->my_start_seq + 1;
-  socket->my_window = 32768;
+  socket->my_scale = tcp_window_scale ();
+  socket->sack_ok = 1;
   tcph->tcphdr.seqnr = grub_cpu_to_be32 (socket->my_start_seq);
   tcph->tcphdr.ack = grub_cpu_to_be32_compile_time (0);
-  tcph->tcphdr.flags = grub_cpu_to_be16_compile_time ((6 << 12) | TCP_SYN);
-  tcph->tcphdr.window = grub_cpu_to_be16 (socket->my_window);
+  tcph->tcphdr.flags = grub_cpu_to_be16_compile_time (TCP_SYN);
+  tcph->tcphdr.window = grub_cpu_to_be16 (tcp_syn_window ());
   tcph->tcphdr.urgent = 0;
   tcph->tcphdr.src = grub_cpu_to_be16 (socket->in_port);
   tcph->tcphdr.dst = grub_cpu_to_be16 (socket->out_port);
   tcph->tcphdr.checksum = 0;
-  tcph->scale_opt.kind = 3;
-  tcph->scale_opt.length = 3;
-  tcph->scale_opt.scale = 5;
+  tcp_syn_options (tcph, socket->my_scale, 1);
   tcph->tcphdr.checksum = grub_net_ip_transport_checksum (nb, GRUB_NET_IP_TCP,
 							  &socket->inf->address,
 							  &socket->out_nla);
@@ -743,8 +993,7 @@ grub_net_send_tcp_packet (const grub_net_tcp_socket_t socket,
       tcph = (struct tcphdr *) nb2->data;
       tcph->ack = grub_cpu_to_be32 (socket->their_cur_seq);
       tcph->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_ACK);
-      tcph->window = !socket->i_stall ? grub_cpu_to_be16 (socket->my_window)
-	: 0;
+      tcph->window = grub_cpu_to_be16 (tcp_window (socket));
       tcph->urgent = 0;
       err = grub_netbuff_put (nb2, fraglen);
       if (err)
@@ -767,7 +1016,7 @@ grub_net_send_tcp_packet (const grub_net_tcp_socket_t socket,
   tcph->ack = grub_cpu_to_be32 (socket->their_cur_seq);
   tcph->flags = (grub_cpu_to_be16_compile_time ((5 << 12) | TCP_ACK)
 		 | (push ? grub_cpu_to_be16_compile_time (TCP_PUSH) : 0));
-  tcph->window = !socket->i_stall ? grub_cpu_to_be16 (socket->my_window) : 0;
+  tcph->window = grub_cpu_to_be16 (tcp_window (socket));
   tcph->urgent = 0;
   return tcp_send (nb, socket);
 }
@@ -836,8 +1085,15 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	&& (grub_be_to_cpu16 (tcph->flags) & TCP_ACK)
 	&& !sock->established)
       {
+	int scale, sack_permitted;
+
+	tcp_parse_syn_options (tcph, &scale, &sack_permitted);
+	if (scale < 0)
+	  sock->my_scale = 0;
+	sock->sack_ok = sack_permitted;
 	sock->their_start_seq = grub_be_to_cpu32 (tcph->seqnr);
 	sock->their_cur_seq = sock->their_start_seq + 1;
+	sock->my_window_end = sock->their_cur_seq + tcp_syn_window ();
 	sock->established = 1;
       }
 
@@ -885,19 +1141,33 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	grub_netbuff_free (nb);
 	return GRUB_ERR_NONE;
       }
-    if (sock->i_reseted && (nb->tail - nb->data
-			    - (grub_be_to_cpu16 (tcph->flags)
-			       >> 12) * sizeof (grub_uint32_t)) > 0)
+    if (sock->i_reseted && tcp_payload_len (nb) > 0)
       {
 	reset (sock);
       }
 
-    err = grub_priority_queue_push (sock->pq, &nb);
-    if (err)
-      {
-	grub_netbuff_free (nb);
-	return err;
-      }
+    {
+      grub_size_t len = tcp_payload_len (nb);
+      grub_uint32_t seqnr = grub_be_to_cpu32 (tcph->seqnr);
+
+      /* Don't let bursts beyond the window grow the queue.  */
+      if (len && !seq_lt (seqnr, sock->my_window_end))
+	{
+	  ack (sock);
+	  grub_netbuff_free (nb);
+	  return GRUB_ERR_NONE;
+	}
+
+      err = grub_priority_queue_push (sock->pq, &nb);
+      if (err)
+	{
+	  grub_netbuff_free (nb);
+	  return err;
+	}
+      sock->pq_bytes += len;
+      if (len && seqnr != sock->their_cur_seq)
+	tcp_sack_add (sock, seqnr, seqnr + len);
+    }
 
     {
       struct grub_net_buff **nb_top_p, *nb_top;
@@ -912,11 +1182,13 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	  tcph = (struct tcphdr *) nb_top->data;
 	  if (grub_be_to_cpu32 (tcph->seqnr) >= sock->their_cur_seq)
 	    break;
+	  sock->pq_bytes -= tcp_payload_len (nb_top);
 	  grub_netbuff_free (nb_top);
 	  grub_priority_queue_pop (sock->pq);
 	}
       if (grub_be_to_cpu32 (tcph->seqnr) != sock->their_cur_seq)
 	{
+	  tcp_sack_update (sock);
 	  ack (sock);
 	  return GRUB_ERR_NONE;
 	}
@@ -932,6 +1204,7 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	    break;
 	  grub_priority_queue_pop (sock->pq);
 
+	  sock->pq_bytes -= tcp_payload_len (nb_top);
 	  err = grub_netbuff_pull (nb_top, (grub_be_to_cpu16 (tcph->flags)
 					    >> 12) * sizeof (grub_uint32_t));
 	  if (err)
@@ -957,7 +1230,10 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	  else
 	    grub_netbuff_free (nb_top);
 	}
-      if (do_ack)
+      tcp_sack_update (sock);
+      if (do_ack && tcp_batch)
+	sock->ack_pending = 1;
+      else if (do_ack)
 	ack (sock);
       while (sock->packs.first)
 	{
@@ -995,7 +1271,13 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	sock->their_start_seq = grub_be_to_cpu32 (tcph->seqnr);
 	sock->their_cur_seq = sock->their_start_seq + 1;
 	sock->my_cur_seq = sock->my_start_seq = grub_get_time_ms ();
-	sock->my_window = 8192;
+	{
+	  int scale, sack_permitted;
+
+	  tcp_parse_syn_options (tcph, &scale, &sack_permitted);
+	  sock->my_scale = scale >= 0 ? tcp_window_scale () : 0;
+	  sock->sack_ok = sack_permitted;
+	}
 
 	sock->pq = grub_priority_queue_new (sizeof (struct grub_net_buff *),
 					    cmp);
@@ -1034,3 +1316,76 @@ grub_net_tcp_unstall (grub_net_tcp_socket_t sock)
   sock->i_stall = 0;
   ack (sock);
 }
+
+/* Size of the receive buffer of each connection.  */
+grub_size_t
+grub_net_tcp_buffer_size (void)
+{
+  return tcp_window_size;
+}
+
+/* Record that the application holds UNREAD bytes of SOCK's data.  When
+   reading them opens the window by two segments or half the buffer,
+   whichever is less, tell the server (RFC 1122, 4.2.3.3).  */
+void
+grub_net_tcp_set_unread (grub_net_tcp_socket_t sock, grub_size_t unread)
+{
+  grub_size_t room, advertised, threshold;
+
+  sock->unread = unread;
+  if (sock->i_stall || sock->they_closed
+      || seq_lt (sock->my_window_end, sock->their_cur_seq))
+    return;
+
+  advertised = sock->my_window_end - sock->their_cur_seq;
+  room = tcp_room (sock);
+  threshold = 2 * (sock->inf->card->mtu - GRUB_NET_OUR_IPV4_HEADER_SIZE
+		   - sizeof (struct tcphdr));
+  if (threshold > tcp_window_size / 2)
+    threshold = tcp_window_size / 2;
+  if (room >= advertised + threshold)
+    ack (sock);
+}
+
+void
+grub_net_tcp_batch_begin (void)
+{
+  tcp_batch = 1;
+}
+
+void
+grub_net_tcp_batch_end (void)
+{
+  grub_net_tcp_socket_t sock;
+
+  tcp_batch = 0;
+  FOR_TCP_SOCKETS (sock)
+    if (sock->ack_pending)
+      ack (sock);
+}
+
+static char *
+tcp_window_size_write (struct grub_env_var *var __attribute__ ((unused)),
+		       const char *val)
+{
+  grub_size_t size;
+
+  if (grub_env_parse_size (val, &size))
+    return NULL;
+
+  tcp_window_size = size;
+  return grub_strdup (val);
+}
+
+void
+grub_net_tcp_init (void)
+{
+  grub_register_variable_hook ("net_tcp_window_size", 0,
+			       tcp_window_size_write);
+}
+
+void
+grub_net_tcp_fini (void)
+{
+  grub_register_variable_hook ("net_tcp_window_size", 0, 0);
+}
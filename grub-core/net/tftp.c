@@ -26,6 +26,8 @@
 #include <grub/dl.h>
 #include <grub/file.h>
 #include <grub/i18n.h>
+#include <grub/time.h>
+#include <grub/env.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -41,8 +43,19 @@ enum
 enum
   {
     TFTP_DEFAULTSIZE_PACKET = 512,
+    /* Limits of the blksize option (RFC 2348).  */
+    TFTP_MIN_BLKSIZE = 8,
+    TFTP_MAX_BLKSIZE = 65464,
+    /* Largest windowsize (RFC 7440) asked for.  */
+    TFTP_MAX_WINDOWSIZE = 64,
+    /* Acknowledge what has come in when nothing arrived for this long,
+       in case the rest of the window was lost.  */
+    TFTP_WINDOW_TIMEOUT = GRUB_NET_INTERVAL / 2
   };
 
+/* Default windowsize, overridden by the net_tftp_windowsize variable.  */
+#define TFTP_DEFAULT_WINDOWSIZE 8
+
 enum
   {
     TFTP_CODE_EOF = 1,
@@ -71,7 +84,8 @@ enum
     TFTP_EBADOP = 4,                   /* illegal TFTP operation */
     TFTP_EBADID = 5,                   /* unknown transfer ID */
     TFTP_EEXISTS = 6,                  /* file already exists */
-    TFTP_ENOUSER = 7                  /* no such user */
+    TFTP_ENOUSER = 7,                 /* no such user */
+    TFTP_EOPTNEG = 8                   /* option negotiation refused */
   };
 
 struct tftphdr {
@@ -99,14 +113,34 @@ struct tftphdr {
 typedef struct tftp_data
 {
   grub_uint64_t file_size;
+  int have_tsize;
   grub_uint64_t block;
   grub_uint32_t block_size;
   grub_uint64_t ack_sent;
   int have_oack;
+  /* Send options in the request; cleared if the server refuses them.  */
+  int options;
+  int options_refused;
+  grub_uint32_t req_block_size;
+  unsigned windowsize;
+  unsigned req_windowsize;
+  /* Blocks that arrived ahead of the next one expected; HELD[i] is block
+     BLOCK + 2 + i.  */
+  struct grub_net_buff *held[TFTP_MAX_WINDOWSIZE - 1];
+  /* An acknowledgement is due but was held back while the reader is
+     behind.  */
+  int ack_held;
+  grub_uint64_t last_recv;
+  /* When a retransmitted window was last acknowledged again.  */
+  grub_uint64_t dup_ack_time;
   struct grub_error_saved save_err;
   grub_net_udp_socket_t sock;
 } *tftp_data_t;
 
+/* 0 means as large as fits the MTU of the route to the server.  */
+static unsigned long tftp_blksize;
+static unsigned long tftp_windowsize = TFTP_DEFAULT_WINDOWSIZE;
+
 static grub_err_t
 ack (tftp_data_t data, grub_uint64_t block)
 {
@@ -132,6 +166,59 @@ ack (tftp_data_t data, grub_uint64_t block)
   if (err)
     return err;
   data->ack_sent = block;
+  data->ack_held = 0;
+  return GRUB_ERR_NONE;
+}
+
+static void
+tftp_free_held (tftp_data_t data)
+{
+  unsigned i;
+
+  for (i = 0; i < ARRAY_SIZE (data->held); i++)
+    if (data->held[i])
+      {
+	grub_netbuff_free (data->held[i]);
+	data->held[i] = 0;
+      }
+}
+
+/* Take the next block of the file, with the TFTP header already
+   pulled.  */
+static grub_err_t
+tftp_accept (grub_file_t file, tftp_data_t data, struct grub_net_buff *nb)
+{
+  unsigned size = nb->tail - nb->data;
+  grub_err_t err;
+
+  data->block++;
+  if (size < data->block_size)
+    {
+      if (data->ack_sent < data->block)
+	ack (data, data->block);
+      file->device->net->eof = 1;
+      file->device->net->stall = 1;
+      grub_net_udp_close (data->sock);
+      data->sock = NULL;
+    }
+  /*
+   * Prevent garbage in broken cards. Is it still necessary
+   * given that IP implementation has been fixed?
+   */
+  if (size > data->block_size)
+    {
+      err = grub_netbuff_unput (nb, size - data->block_size);
+      if (err)
+	{
+	  grub_netbuff_free (nb);
+	  return err;
+	}
+    }
+  /* If there is data, puts packet in socket list. */
+  if ((nb->tail - nb->data) > 0)
+    grub_net_put_packet (&file->device->net->packs, nb);
+  else
+    grub_netbuff_free (nb);
   return GRUB_ERR_NONE;
 }
 
@@ -145,6 +232,8 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
   tftp_data_t data = file->data;
   grub_err_t err;
   grub_uint8_t *ptr;
+  grub_uint16_t blk, delta;
+  unsigned i;
 
   if (nb->tail - nb->data < (grub_ssize_t) sizeof (tftph->opcode))
     {
@@ -156,20 +245,44 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
   switch (grub_be_to_cpu16 (tftph->opcode))
     {
     case TFTP_OACK:
+      /* Our request was retransmitted; the transfer is already on.  */
+      if (data->have_oack)
+	{
+	  grub_netbuff_free (nb);
+	  if (data->block == 0)
+	    ack (data, 0);
+	  return GRUB_ERR_NONE;
+	}
       data->block_size = TFTP_DEFAULTSIZE_PACKET;
+      data->windowsize = 1;
       data->have_oack = 1; 
       for (ptr = nb->data + sizeof (tftph->opcode); ptr < nb->tail;)
 	{
 	  if (grub_memcmp (ptr, "tsize\0", sizeof ("tsize\0") - 1) == 0)
-	    data->file_size = grub_strtoul ((char *) ptr + sizeof ("tsize\0")
-					    - 1, 0, 0);
+	    {
+	      data->file_size = grub_strtoul ((char *) ptr + sizeof ("tsize\0")
+					      - 1, 0, 0);
+	      data->have_tsize = 1;
+	    }
 	  if (grub_memcmp (ptr, "blksize\0", sizeof ("blksize\0") - 1) == 0)
 	    data->block_size = grub_strtoul ((char *) ptr + sizeof ("blksize\0")
 					     - 1, 0, 0);
+	  if (grub_memcmp (ptr, "windowsize\0", sizeof ("windowsize\0") - 1) == 0)
+	    data->windowsize = grub_strtoul ((char *) ptr
+					     + sizeof ("windowsize\0") - 1, 0, 0);
 	  while (ptr < nb->tail && *ptr)
 	    ptr++;
 	  ptr++;
 	}
+      grub_errno = GRUB_ERR_NONE;
+      /* The server may only lower what we asked for.  */
+      if (data->block_size < TFTP_MIN_BLKSIZE
+	  || data->block_size > data->req_block_size)
+	data->block_size = data->req_block_size;
+      if (data->windowsize < 1 || data->windowsize > data->req_windowsize)
+	data->windowsize = data->req_windowsize;
+      grub_dprintf ("tftp", "blksize %u, windowsize %u\n",
+		    data->block_size, data->windowsize);
       data->block = 0;
       grub_netbuff_free (nb);
       err = ack (data, 0);
@@ -183,9 +296,17 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	  return GRUB_ERR_NONE;
 	}
 
+      /* A server that ignores options goes straight to the data, in
+	 lockstep with the default block size.  */
+      if (!data->have_oack)
+	{
+	  data->have_oack = 1;
+	  data->block_size = TFTP_DEFAULTSIZE_PACKET;
+	  data->windowsize = 1;
+	}
+      data->last_recv = grub_get_time_ms ();
+
       /*
-       * Ack old/retransmitted block.
-       *
        * The block number is a 16-bit counter, thus the maximum file size that
        * could be transfered is 65535 * block size. Most TFTP hosts support to
        * roll-over the block counter to allow unlimited transfer file size.
@@ -195,62 +316,90 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
        *
        * [0]: https://tools.ietf.org/html/rfc1350
        */
-      if (grub_be_to_cpu16 (tftph->u.data.block) < ((grub_uint16_t) (data->block + 1)))
-	ack (data, grub_be_to_cpu16 (tftph->u.data.block));
-      /* Ignore unexpected block. */
-      else if (grub_be_to_cpu16 (tftph->u.data.block) > ((grub_uint16_t) (data->block + 1)))
-	grub_dprintf ("tftp", "TFTP unexpected block # %d\n", tftph->u.data.block);
-      else
-	{
-	  unsigned size;
+      blk = grub_be_to_cpu16 (tftph->u.data.block);
+      delta = blk - (grub_uint16_t) (data->block + 1);
 
-	  if (file->device->net->packs.count < 50)
+      if (delta >= data->windowsize)
+	{
+	  /*
+	   * A block from a window we acknowledged means the acknowledgement
+	   * was lost; repeat it once for the retransmitted window.  Blocks
+	   * resent after a gap in the current window are already held.
+	   */
+	  if ((grub_uint16_t) (data->ack_sent - blk) < 0x8000 && data->sock
+	      && data->last_recv - data->dup_ack_time >= TFTP_WINDOW_TIMEOUT)
 	    {
-	      err = ack (data, data->block + 1);
-	      if (err)
-		return err;
+	      ack (data, data->block);
+	      data->dup_ack_time = data->last_recv;
 	    }
 	  else
-	    file->device->net->stall = 1;
+	    grub_dprintf ("tftp", "TFTP unexpected block # %d\n", blk);
+	  grub_netbuff_free (nb);
+	  return GRUB_ERR_NONE;
+	}
+
+      err = grub_netbuff_pull (nb, sizeof (tftph->opcode) +
+			       sizeof (tftph->u.data.block));
+      if (err)
+	{
+	  grub_netbuff_free (nb);
+	  return err;
+	}
 
-	  err = grub_netbuff_pull (nb, sizeof (tftph->opcode) +
-				   sizeof (tftph->u.data.block));
+      /* Hold blocks that overtook one still missing.  */
+      if (delta)
+	{
+	  if (data->held[delta - 1])
+	    grub_netbuff_free (nb);
+	  else
+	    data->held[delta - 1] = nb;
+	  /* The window is over without the missing block; ask for the rest
+	     again.  */
+	  if ((grub_uint16_t) (blk - data->ack_sent) == data->windowsize)
+	    ack (data, data->block);
+	  return GRUB_ERR_NONE;
+	}
+
+      err = tftp_accept (file, data, nb);
+      while (!err && data->sock && data->held[0])
+	{
+	  nb = data->held[0];
+	  for (i = 1; i < ARRAY_SIZE (data->held); i++)
+	    data->held[i - 1] = data->held[i];
+	  data->held[ARRAY_SIZE (data->held) - 1] = 0;
+	  err = tftp_accept (file, data, nb);
+	}
+      if (!data->sock)
+	tftp_free_held (data);
+      if (err)
+	return err;
+      if (!data->sock)
+	return GRUB_ERR_NONE;
+
+      if (file->device->net->packs.count >= 50)
+	{
+	  data->ack_held = 1;
+	  file->device->net->stall = 1;
+	}
+      else if (data->block - data->ack_sent >= data->windowsize)
+	{
+	  err = ack (data, data->block);
 	  if (err)
 	    return err;
-	  size = nb->tail - nb->data;
-
-	  data->block++;
-	  if (size < data->block_size)
-	    {
-	      if (data->ack_sent < data->block)
-		ack (data, data->block);
-	      file->device->net->eof = 1;
-	      file->device->net->stall = 1;
-	      grub_net_udp_close (data->sock);
-	      data->sock = NULL;
-	    }
-	  /*
-	   * Prevent garbage in broken cards. Is it still necessary
-	   * given that IP implementation has been fixed?
-	   */
-	  if (size > data->block_size)
-	    {
-	      err = grub_netbuff_unput (nb, size - data->block_size);
-	      if (err)
-		return err;
-	    }
-	  /* If there is data, puts packet in socket list. */
-	  if ((nb->tail - nb->data) > 0)
-	    {
-	      grub_net_put_packet (&file->device->net->packs, nb);
-	      /* Do not free nb. */
-	      return GRUB_ERR_NONE;
-	    }
 	}
-      grub_netbuff_free (nb);
       return GRUB_ERR_NONE;
     case TFTP_ERROR:
       data->have_oack = 1;
+      /* Asking again without options may still work.  */
+      if (data->options && data->block == 0
+	  && nb->tail - nb->data >= (grub_ssize_t) (sizeof (tftph->opcode)
+						    + sizeof (tftph->u.err.errcode))
+	  && grub_be_to_cpu16 (tftph->u.err.errcode) == TFTP_EOPTNEG)
+	{
+	  data->options_refused = 1;
+	  grub_netbuff_free (nb);
+	  return GRUB_ERR_NONE;
+	}
       grub_netbuff_free (nb);
       grub_error (GRUB_ERR_IO, (char *) tftph->u.err.errmsg);
       grub_error_save (&data->save_err);
@@ -280,39 +429,34 @@ grub_normalize_filename (char *normalized, const char *filename)
   *dest = '\0';
 }
 
+static char *
+put_string (char *rrq, int *rrqlen, const char *str)
+{
+  grub_strcpy (rrq, str);
+  *rrqlen += grub_strlen (str) + 1;
+  return rrq + grub_strlen (str) + 1;
+}
+
+/* Build the read request in NB, with options unless the server refused
+   them.  */
 static grub_err_t
-tftp_open (struct grub_file *file, const char *filename)
+tftp_make_rrq (struct grub_net_buff *nb, tftp_data_t data,
+	       const char *filename)
 {
   struct tftphdr *tftph;
   char *rrq;
-  int i;
   int rrqlen;
   int hdrlen;
-  grub_uint8_t open_data[1500];
-  struct grub_net_buff nb;
-  tftp_data_t data;
+  char buf[sizeof ("XXXXXXXXXX")];
   grub_err_t err;
-  grub_uint8_t *nbd;
-  grub_net_network_level_address_t addr;
-  int port = file->device->net->port;
-
-  data = grub_zalloc (sizeof (*data));
-  if (!data)
-    return grub_errno;
 
-  nb.head = open_data;
-  nb.end = open_data + sizeof (open_data);
-  grub_netbuff_clear (&nb);
-
-  grub_netbuff_reserve (&nb, 1500);
-  err = grub_netbuff_push (&nb, sizeof (*tftph));
+  grub_netbuff_clear (nb);
+  grub_netbuff_reserve (nb, 1500);
+  err = grub_netbuff_push (nb, sizeof (*tftph));
   if (err)
-    {
-      grub_free (data);
-      return err;
-    }
+    return err;
 
-  tftph = (struct tftphdr *) nb.data;
+  tftph = (struct tftphdr *) nb->data;
 
   rrq = (char *) tftph->u.rrq;
   rrqlen = 0;
@@ -325,33 +469,71 @@ tftp_open (struct grub_file *file, const char *filename)
   rrqlen += grub_strlen (rrq) + 1;
   rrq += grub_strlen (rrq) + 1;
 
-  grub_strcpy (rrq, "octet");
-  rrqlen += grub_strlen ("octet") + 1;
-  rrq += grub_strlen ("octet") + 1;
+  rrq = put_string (rrq, &rrqlen, "octet");
 
-  grub_strcpy (rrq, "blksize");
-  rrqlen += grub_strlen ("blksize") + 1;
-  rrq += grub_strlen ("blksize") + 1;
-
-  grub_strcpy (rrq, "1024");
-  rrqlen += grub_strlen ("1024") + 1;
-  rrq += grub_strlen ("1024") + 1;
+  if (data->options)
+    {
+      rrq = put_string (rrq, &rrqlen, "blksize");
+      grub_snprintf (buf, sizeof (buf), "%u", data->req_block_size);
+      rrq = put_string (rrq, &rrqlen, buf);
 
-  grub_strcpy (rrq, "tsize");
-  rrqlen += grub_strlen ("tsize") + 1;
-  rrq += grub_strlen ("tsize") + 1;
+      if (data->req_windowsize > 1)
+	{
+	  rrq = put_string (rrq, &rrqlen, "windowsize");
+	  grub_snprintf (buf, sizeof (buf), "%u", data->req_windowsize);
+	  rrq = put_string (rrq, &rrqlen, buf);
+	}
 
-  grub_strcpy (rrq, "0");
-  rrqlen += grub_strlen ("0") + 1;
-  rrq += grub_strlen ("0") + 1;
+      rrq = put_string (rrq, &rrqlen, "tsize");
+      rrq = put_string (rrq, &rrqlen, "0");
+    }
   hdrlen = sizeof (tftph->opcode) + rrqlen;
 
-  err = grub_netbuff_unput (&nb, nb.tail - (nb.data + hdrlen));
-  if (err)
-    {
-      grub_free (data);
-      return err;
-    }
+  return grub_netbuff_unput (nb, nb->tail - (nb->data + hdrlen));
+}
+
+/* Pick the block size to ask for: the configured one, limited to what
+   fits in one frame on the way to ADDR.  */
+static grub_uint32_t
+tftp_block_size (grub_net_network_level_address_t addr)
+{
+  struct grub_net_network_level_interface *inf;
+  grub_net_network_level_address_t gateway;
+  grub_size_t max = 1024;
+
+  if (grub_net_route_address (addr, &gateway, &inf) == GRUB_ERR_NONE
+      && inf->card->mtu > GRUB_NET_OUR_MAX_IP_HEADER_SIZE
+      + GRUB_NET_UDP_HEADER_SIZE + 4 + TFTP_MIN_BLKSIZE)
+    max = inf->card->mtu - GRUB_NET_UDP_HEADER_SIZE - 4
+      - (addr.type == GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV6
+	 ? GRUB_NET_OUR_IPV6_HEADER_SIZE : GRUB_NET_OUR_IPV4_HEADER_SIZE);
+  grub_errno = GRUB_ERR_NONE;
+
+  if (max > TFTP_MAX_BLKSIZE)
+    max = TFTP_MAX_BLKSIZE;
+  if (tftp_blksize && tftp_blksize < max)
+    max = tftp_blksize < TFTP_MIN_BLKSIZE ? TFTP_MIN_BLKSIZE : tftp_blksize;
+  return max;
+}
+
+static grub_err_t
+tftp_open (struct grub_file *file, const char *filename)
+{
+  int i;
+  grub_uint8_t open_data[1500];
+  struct grub_net_buff nb;
+  tftp_data_t data;
+  grub_err_t err;
+  grub_uint8_t *nbd;
+  grub_net_network_level_address_t addr;
+  int port = file->device->net->port;
+
+  data = grub_zalloc (sizeof (*data));
+  if (!data)
+    return grub_errno;
+
+  nb.head = open_data;
+  nb.end = open_data + sizeof (open_data);
 
   file->not_easily_seekable = 1;
   file->data = data;
@@ -368,6 +550,19 @@ tftp_open (struct grub_file *file, const char *filename)
       return err;
     }
 
+  data->options = 1;
+  data->req_block_size = tftp_block_size (addr);
+  data->req_windowsize = tftp_windowsize;
+  if (data->req_windowsize < 1)
+    data->req_windowsize = 1;
+
+  err = tftp_make_rrq (&nb, data, filename);
+  if (err)
+    {
+      grub_free (data);
+      return err;
+    }
+
   grub_dprintf("tftp", "opening connection\n");
   data->sock = grub_net_udp_open (addr,
 				  port ? port : TFTP_SERVER_PORT, tftp_receive,
@@ -393,6 +588,32 @@ tftp_open (struct grub_file *file, const char *filename)
 	}
       grub_net_poll_cards (GRUB_NET_INTERVAL + (i * GRUB_NET_INTERVAL_ADDITION),
                            &data->have_oack);
+      if (data->options_refused)
+	{
+	  /* Fall back to a plain request, from a new port as the server
+	     answered the first one already.  */
+	  grub_dprintf ("tftp", "options refused, retrying without\n");
+	  grub_net_udp_close (data->sock);
+	  data->options = 0;
+	  data->options_refused = 0;
+	  data->have_oack = 0;
+	  err = tftp_make_rrq (&nb, data, filename);
+	  if (err)
+	    {
+	      grub_free (data);
+	      return err;
+	    }
+	  nbd = nb.data;
+	  data->sock = grub_net_udp_open (addr,
+					  port ? port : TFTP_SERVER_PORT,
+					  tftp_receive, file);
+	  if (!data->sock)
+	    {
+	      grub_free (data);
+	      return grub_errno;
+	    }
+	  continue;
+	}
       if (data->have_oack)
 	break;
     }
@@ -403,12 +624,14 @@ tftp_open (struct grub_file *file, const char *filename)
     grub_error_load (&data->save_err);
   if (grub_errno)
     {
-      grub_net_udp_close (data->sock);
+      if (data->sock)
+	grub_net_udp_close (data->sock);
+      tftp_free_held (data);
       grub_free (data);
       return grub_errno;
     }
 
-  file->size = data->file_size;
+  file->size = data->have_tsize ? data->file_size : GRUB_FILE_SIZE_UNKNOWN;
 
   return GRUB_ERR_NONE;
 }
@@ -446,6 +669,7 @@ tftp_close (struct grub_file *file)
 	grub_print_error ();
       grub_net_udp_close (data->sock);
     }
+  tftp_free_held (data);
   grub_free (data);
   return GRUB_ERR_NONE;
 }
@@ -459,11 +683,38 @@ tftp_packets_pulled (struct grub_file *file)
 
   if (!file->device->net->eof)
     file->device->net->stall = 0;
-  if (data->ack_sent >= data->block)
+  if (data->ack_sent >= data->block || !data->sock)
+    return 0;
+  /* Acknowledge a window whose acknowledgement was held back, or what
+     came in when the rest of the window seems lost.  */
+  if (!data->ack_held && data->block - data->ack_sent < data->windowsize
+      && grub_get_time_ms () - data->last_recv < TFTP_WINDOW_TIMEOUT)
     return 0;
   return ack (data, data->block);
 }
 
+static char *
+tftp_env_write (const char *val, unsigned long max, unsigned long *out)
+{
+  if (grub_env_parse_number (val, max, out))
+    return NULL;
+  return grub_strdup (val);
+}
+
+static char *
+tftp_blksize_write (struct grub_env_var *var __attribute__ ((unused)),
+		    const char *val)
+{
+  return tftp_env_write (val, TFTP_MAX_BLKSIZE, &tftp_blksize);
+}
+
+static char *
+tftp_windowsize_write (struct grub_env_var *var __attribute__ ((unused)),
+		       const char *val)
+{
+  return tftp_env_write (val, TFTP_MAX_WINDOWSIZE, &tftp_windowsize);
+}
+
 static struct grub_net_app_protocol grub_tftp_protocol = 
   {
     .name = "tftp",
@@ -474,10 +725,15 @@ static struct grub_net_app_protocol grub_tftp_protocol =
 
 GRUB_MOD_INIT (tftp)
 {
+  grub_register_variable_hook ("net_tftp_blksize", 0, tftp_blksize_write);
+  grub_register_variable_hook ("net_tftp_windowsize", 0,
+			       tftp_windowsize_write);
   grub_net_app_level_register (&grub_tftp_protocol);
 }
 
 GRUB_MOD_FINI (tftp)
 {
   grub_net_app_level_unregister (&grub_tftp_protocol);
+  grub_register_variable_hook ("net_tftp_blksize", 0, 0);
+  grub_register_variable_hook ("net_tftp_windowsize", 0, 0);
 }
@@ -870,6 +870,121 @@ grub_script_function_call (grub_script_function_t func, int argc, char **args)
   return ret;
 }
 
+/* Sources are parsed into one script per top-level command.  Sources
+   that parse cleanly and define no functions keep their scripts here,
+   so that executing them again skips the lexer and the parser.  */
+#define SCRIPT_CACHE_HASH	64
+#define SCRIPT_CACHE_MAX	256
+#define SCRIPT_CACHE_MAX_SOURCE	0x10000
+
+struct grub_script_cache_ent
+{
+  struct grub_script_cache_ent *next;
+  grub_uint32_t hash;
+  unsigned long stamp;
+  /* Executions in progress; such entries are not evicted.  */
+  unsigned busy;
+  unsigned nscripts;
+  struct grub_script **scripts;
+  char source[0];
+};
+
+static struct grub_script_cache_ent *script_cache[SCRIPT_CACHE_HASH];
+static unsigned script_cache_count;
+static unsigned long script_cache_stamp;
+
+static grub_uint32_t
+script_cache_hash (const char *source)
+{
+  grub_uint32_t h = 2166136261U;
+
+  for (; *source; source++)
+    h = (h ^ (grub_uint8_t) *source) * 16777619U;
+  return h;
+}
+
+static void
+script_cache_free (struct grub_script_cache_ent *ent)
+{
+  unsigned i;
+
+  for (i = 0; i < ent->nscripts; i++)
+    grub_script_free (ent->scripts[i]);
+  grub_free (ent->scripts);
+  grub_free (ent);
+}
+
+static struct grub_script_cache_ent *
+script_cache_find (const char *source, grub_uint32_t hash)
+{
+  struct grub_script_cache_ent *ent;
+
+  for (ent = script_cache[hash % SCRIPT_CACHE_HASH]; ent; ent = ent->next)
+    if (ent->hash == hash && grub_strcmp (ent->source, source) == 0)
+      return ent;
+  return NULL;
+}
+
+/* Make room for one more entry by dropping the least recently used idle
+   one.  Return 0 if every entry is busy.  */
+static int
+script_cache_evict (void)
+{
+  struct grub_script_cache_ent **p, **victim = NULL, *ent;
+  unsigned i;
+
+  for (i = 0; i < SCRIPT_CACHE_HASH; i++)
+    for (p = &script_cache[i]; *p; p = &(*p)->next)
+      if (!(*p)->busy && (!victim || (*p)->stamp < (*victim)->stamp))
+	victim = p;
+  if (!victim)
+    return 0;
+
+  ent = *victim;
+  *victim = ent->next;
+  script_cache_free (ent);
+  script_cache_count--;
+  return 1;
+}
+
+/* Drop all cached scripts.  */
+void
+grub_script_execute_cache_flush (void)
+{
+  struct grub_script_cache_ent **p, *ent;
+  unsigned i;
+
+  for (i = 0; i < SCRIPT_CACHE_HASH; i++)
+    for (p = &script_cache[i]; *p; )
+      {
+	ent = *p;
+	if (ent->busy)
+	  {
+	    p = &ent->next;
+	    continue;
+	  }
+	*p = ent->next;
+	script_cache_free (ent);
+	script_cache_count--;
+      }
+}
+
+/* Execute the scripts of a cached source.  */
+static grub_err_t
+script_cache_execute (struct grub_script_cache_ent *ent)
+{
+  grub_err_t ret = 0;
+  unsigned i;
+
+  ent->stamp = ++script_cache_stamp;
+  ent->busy++;
+  for (i = 0; i < ent->nscripts; i++)
+    ret = grub_script_execute (ent->scripts[i]);
+  ent->busy--;
+
+  return ret;
+}
+
 /* Helper for grub_script_execute_sourcecode.  */
 static grub_err_t
 grub_script_execute_sourcecode_getline (char **line,
@@ -901,14 +1016,30 @@ grub_script_execute_sourcecode (const char *source)
 {
   grub_err_t ret = 0;
   struct grub_script *parsed_script;
+  struct grub_script_cache_ent *ent;
+  struct grub_script **scripts = NULL;
+  unsigned nscripts = 0, nalloc = 0;
+  const char *orig = source;
+  grub_uint32_t hash = 0;
+  int cacheable;
 
 #ifdef GRUB_MACHINE_IEEE1275
   grub_ieee1275_set_boot_last_label (source);
 #endif
 
+  cacheable = source && grub_strlen (source) < SCRIPT_CACHE_MAX_SOURCE;
+  if (cacheable)
+    {
+      hash = script_cache_hash (source);
+      ent = script_cache_find (source, hash);
+      if (ent)
+	return script_cache_execute (ent);
+    }
+
   while (source)
     {
       char *line;
+      unsigned long defs = grub_script_function_defs;
 
       grub_script_execute_sourcecode_getline (&line, 0, &source);
       parsed_script = grub_script_parse
@@ -917,14 +1048,63 @@ grub_script_execute_sourcecode (const char *source)
 	{
 	  ret = grub_errno;
 	  grub_free (line);
+	  cacheable = 0;
 	  break;
 	}
 
+      /* Function definitions happen at parse time, so such sources must
+	 go through the parser every time.  */
+      if (defs != grub_script_function_defs)
+	cacheable = 0;
+
+      if (cacheable && nscripts == nalloc)
+	{
+	  struct grub_script **t;
+
+	  nalloc = nalloc ? nalloc * 2 : 4;
+	  t = grub_realloc (scripts, nalloc * sizeof (scripts[0]));
+	  if (!t)
+	    {
+	      grub_errno = GRUB_ERR_NONE;
+	      cacheable = 0;
+	    }
+	  else
+	    scripts = t;
+	}
+
       ret = grub_script_execute (parsed_script);
-      grub_script_free (parsed_script);
+      if (cacheable)
+	scripts[nscripts++] = parsed_script;
+      else
+	grub_script_free (parsed_script);
       grub_free (line);
     }
 
+  /* A nested execution may have cached the same source already.  */
+  if (cacheable && !script_cache_find (orig, hash)
+      && (script_cache_count < SCRIPT_CACHE_MAX || script_cache_evict ()))
+    {
+      grub_size_t len = grub_strlen (orig);
+
+      ent = grub_zalloc (sizeof (*ent) + len + 1);
+      if (ent)
+	{
+	  grub_memcpy (ent->source, orig, len + 1);
+	  ent->hash = hash;
+	  ent->stamp = ++script_cache_stamp;
+	  ent->nscripts = nscripts;
+	  ent->scripts = scripts;
+	  ent->next = script_cache[hash % SCRIPT_CACHE_HASH];
+	  script_cache[hash % SCRIPT_CACHE_HASH] = ent;
+	  script_cache_count++;
+	  return ret;
+	}
+    }
+
+  while (nscripts)
+    grub_script_free (scripts[--nscripts]);
+  grub_free (scripts);
+
   return ret;
 }
 
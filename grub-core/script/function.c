@@ -24,6 +24,9 @@
 
 grub_script_function_t grub_script_function_list;
 
+/* Counts function definitions seen by the parser.  */
+unsigned long grub_script_function_defs;
+
 grub_script_function_t
 grub_script_function_create (struct grub_script_arg *functionname_arg,
 			     struct grub_script *cmd)
@@ -31,6 +34,8 @@ grub_script_function_create (struct grub_script_arg *functionname_arg,
   grub_script_function_t func;
   grub_script_function_t *p;
 
+  grub_script_function_defs++;
+
   func = (grub_script_function_t) grub_malloc (sizeof (*func));
   if (! func)
     return 0;
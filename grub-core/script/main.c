@@ -76,6 +76,8 @@ grub_script_init (void)
 void
 grub_script_fini (void)
 {
+  grub_script_execute_cache_flush ();
+
   if (cmd_break)
     grub_unregister_command (cmd_break);
   cmd_break = 0;
@@ -0,0 +1,174 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/test.h>
+#include <grub/dl.h>
+#include <grub/env.h>
+#include <grub/env_private.h>
+#include <grub/misc.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define ENV_TEST_VARS	2000
+#define ENV_TEST_PREFIX	"env_test_"
+
+static void
+env_test_name (char *buf, grub_size_t size, unsigned i)
+{
+  grub_snprintf (buf, size, ENV_TEST_PREFIX "%u", i);
+}
+
+/* Check that the variables from FIRST on are set, and only them.  */
+static void
+env_test_check (unsigned first)
+{
+  struct grub_env_var *var;
+  char name[32], val[32];
+  const char *got;
+  unsigned i, n = 0;
+
+  for (i = 0; i < ENV_TEST_VARS; i++)
+    {
+      env_test_name (name, sizeof (name), i);
+      got = grub_env_get (name);
+      if (i < first)
+	{
+	  grub_test_assert (!got, "%s is still set", name);
+	  continue;
+	}
+      grub_snprintf (val, sizeof (val), "%u", i * 3);
+      grub_test_assert (got && grub_strcmp (got, val) == 0,
+			"%s is `%s' instead of `%s'", name,
+			got ? : "(unset)", val);
+    }
+
+  FOR_SORTED_ENV (var)
+    if (grub_strncmp (var->name, ENV_TEST_PREFIX,
+		      sizeof (ENV_TEST_PREFIX) - 1) == 0)
+      n++;
+  grub_test_assert (n == ENV_TEST_VARS - first,
+		    "%u variables listed instead of %u",
+		    n, ENV_TEST_VARS - first);
+}
+
+static void
+env_test_size (const char *val, grub_size_t expected, grub_err_t error)
+{
+  grub_size_t size = 0;
+  grub_err_t err;
+
+  grub_errno = GRUB_ERR_NONE;
+  err = grub_env_parse_size (val, &size);
+  grub_test_assert (err == error, "`%s' gave error %d instead of %d",
+		    val, err, error);
+  if (!err)
+    grub_test_assert (size == expected,
+		      "`%s' is %" PRIuGRUB_SIZE " bytes instead of %"
+		      PRIuGRUB_SIZE, val, size, expected);
+  grub_errno = GRUB_ERR_NONE;
+}
+
+static void
+env_test_number (const char *val, unsigned long max, unsigned long expected,
+		 grub_err_t error)
+{
+  unsigned long num = 0;
+  grub_err_t err;
+
+  grub_errno = GRUB_ERR_NONE;
+  err = grub_env_parse_number (val, max, &num);
+  grub_test_assert (err == error, "`%s' gave error %d instead of %d",
+		    val, err, error);
+  if (!err)
+    grub_test_assert (num == expected, "`%s' is %lu instead of %lu",
+		      val, num, expected);
+  grub_errno = GRUB_ERR_NONE;
+}
+
+static void
+env_test_parse (void)
+{
+  env_test_size ("0", 0, GRUB_ERR_NONE);
+  env_test_size ("16", 16 << 10, GRUB_ERR_NONE);
+  env_test_size ("16K", 16 << 10, GRUB_ERR_NONE);
+  env_test_size ("0x10k", 16 << 10, GRUB_ERR_NONE);
+  env_test_size ("32M", 32 << 20, GRUB_ERR_NONE);
+  env_test_size ("1g", 1 << 30, GRUB_ERR_NONE);
+  env_test_size ("", 0, GRUB_ERR_BAD_NUMBER);
+  env_test_size ("16x", 0, GRUB_ERR_BAD_NUMBER);
+  env_test_size ("16MB", 0, GRUB_ERR_BAD_NUMBER);
+#if GRUB_CPU_SIZEOF_VOID_P == 8
+  env_test_size ("17179869184G", 0, GRUB_ERR_OUT_OF_RANGE);
+  env_test_size ("18014398509481984", 0, GRUB_ERR_OUT_OF_RANGE);
+#else
+  env_test_size ("4G", 0, GRUB_ERR_OUT_OF_RANGE);
+  env_test_size ("4194304", 0, GRUB_ERR_OUT_OF_RANGE);
+#endif
+
+  env_test_number ("8", 64, 8, GRUB_ERR_NONE);
+  env_test_number ("64", 64, 64, GRUB_ERR_NONE);
+  env_test_number ("65", 64, 0, GRUB_ERR_OUT_OF_RANGE);
+  env_test_number ("8 ", 64, 0, GRUB_ERR_BAD_NUMBER);
+  /* Must not wrap around to 8.  */
+  env_test_number ("4294967304", 64, 0, GRUB_ERR_OUT_OF_RANGE);
+}
+
+static void
+env_test (void)
+{
+  char name[32], val[32];
+  unsigned i;
+
+  for (i = 0; i < ENV_TEST_VARS; i++)
+    {
+      env_test_name (name, sizeof (name), i);
+      /* Overwriting a variable must not add a second one.  */
+      grub_env_set (name, "stale");
+      grub_snprintf (val, sizeof (val), "%u", i * 3);
+      grub_env_set (name, val);
+    }
+
+  /* The table grows to keep no more variables than buckets.  */
+  grub_test_assert (grub_current_context->hashsz >= ENV_TEST_VARS,
+		    "%u variables in %u buckets", ENV_TEST_VARS,
+		    grub_current_context->hashsz);
+  grub_test_assert (grub_current_context->count
+		    <= grub_current_context->hashsz,
+		    "%u variables in %u buckets",
+		    grub_current_context->count,
+		    grub_current_context->hashsz);
+  env_test_check (0);
+
+  for (i = 0; i < ENV_TEST_VARS / 2; i++)
+    {
+      env_test_name (name, sizeof (name), i);
+      grub_env_unset (name);
+    }
+  env_test_check (ENV_TEST_VARS / 2);
+
+  for (; i < ENV_TEST_VARS; i++)
+    {
+      env_test_name (name, sizeof (name), i);
+      grub_env_unset (name);
+    }
+  env_test_check (ENV_TEST_VARS);
+
+  env_test_parse ();
+}
+
+GRUB_FUNCTIONAL_TEST (env_test, env_test);
@@ -0,0 +1,178 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/test.h>
+#include <grub/dl.h>
+#include <grub/mm.h>
+#include <grub/mm_private.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define MM_TEST_SLOTS	512
+#define MM_TEST_ROUNDS	50000
+
+static struct
+{
+  grub_uint8_t *ptr;
+  grub_size_t size;
+} slots[MM_TEST_SLOTS];
+
+static grub_uint32_t seed;
+
+static grub_uint32_t
+mm_test_random (void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+static void
+mm_test_fill (unsigned i)
+{
+  grub_size_t j;
+
+  for (j = 0; j < slots[i].size; j++)
+    slots[i].ptr[j] = (grub_uint8_t) (i + j * 7);
+}
+
+static int
+mm_test_intact (unsigned i)
+{
+  grub_size_t j;
+
+  for (j = 0; j < slots[i].size; j++)
+    if (slots[i].ptr[j] != (grub_uint8_t) (i + j * 7))
+      return 0;
+  return 1;
+}
+
+/* Pick a size, most of them small enough for the bins.  */
+static grub_size_t
+mm_test_size (void)
+{
+  grub_uint32_t r = mm_test_random ();
+
+  switch (r % 16)
+    {
+    case 0:
+      /* Large enough to be carved from the top of the heap.  */
+      return (GRUB_MM_LARGE << GRUB_MM_ALIGN_LOG2) + (r >> 4) % 0x10000;
+    case 1:
+    case 2:
+      return 1 + (r >> 4) % 0x4000;
+    default:
+      return 1 + (r >> 4) % (GRUB_MM_BINS << GRUB_MM_ALIGN_LOG2);
+    }
+}
+
+static void
+mm_test (void)
+{
+  unsigned i, round;
+#ifndef GRUB_MACHINE_EMU
+  struct grub_mm_stats before, after;
+
+  grub_mm_flush_bins ();
+  grub_mm_get_stats (&before);
+#endif
+
+  seed = 42;
+  for (round = 0; round < MM_TEST_ROUNDS; round++)
+    {
+      i = mm_test_random () % MM_TEST_SLOTS;
+      if (slots[i].ptr)
+	{
+	  grub_test_assert (mm_test_intact (i),
+			    "block of %" PRIuGRUB_SIZE " bytes at %p overwritten",
+			    slots[i].size, slots[i].ptr);
+	  if (mm_test_random () % 4 == 0)
+	    {
+	      grub_uint8_t *ptr;
+	      grub_size_t size = mm_test_size ();
+
+	      /* Growing or shrinking keeps the common part.  */
+	      ptr = grub_realloc (slots[i].ptr, size);
+	      if (!ptr)
+		{
+		  grub_errno = GRUB_ERR_NONE;
+		  continue;
+		}
+	      slots[i].ptr = ptr;
+	      if (size < slots[i].size)
+		slots[i].size = size;
+	      grub_test_assert (mm_test_intact (i),
+				"realloc to %" PRIuGRUB_SIZE " bytes lost data",
+				size);
+	      slots[i].size = size;
+	      mm_test_fill (i);
+	      continue;
+	    }
+	  grub_free (slots[i].ptr);
+	  slots[i].ptr = NULL;
+	  continue;
+	}
+
+      slots[i].size = mm_test_size ();
+#ifndef GRUB_MACHINE_EMU
+      if (mm_test_random () % 8 == 0)
+	{
+	  grub_size_t align = GRUB_MM_ALIGN << (mm_test_random () % 8);
+
+	  slots[i].ptr = grub_memalign (align, slots[i].size);
+	  grub_test_assert (((grub_addr_t) slots[i].ptr & (align - 1)) == 0,
+			    "%p is not aligned to %" PRIuGRUB_SIZE,
+			    slots[i].ptr, align);
+	}
+      else
+#endif
+	slots[i].ptr = grub_malloc (slots[i].size);
+      if (!slots[i].ptr)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  continue;
+	}
+      mm_test_fill (i);
+    }
+
+  for (i = 0; i < MM_TEST_SLOTS; i++)
+    if (slots[i].ptr)
+      {
+	grub_test_assert (mm_test_intact (i),
+			  "block of %" PRIuGRUB_SIZE " bytes at %p overwritten",
+			  slots[i].size, slots[i].ptr);
+	grub_free (slots[i].ptr);
+	slots[i].ptr = NULL;
+      }
+
+#ifndef GRUB_MACHINE_EMU
+  grub_mm_get_stats (&after);
+  grub_test_assert (after.binned <= GRUB_MM_BIN_LIMIT,
+		    "%" PRIuGRUB_SIZE " bytes held in bins",
+		    after.binned);
+
+  /* Once the bins are emptied, everything must be back in the free lists,
+     whether or not the heap grew meanwhile.  */
+  grub_mm_flush_bins ();
+  grub_mm_get_stats (&after);
+  grub_test_assert (after.total - after.free == before.total - before.free,
+		    "%" PRIuGRUB_SIZE " bytes in use instead of %" PRIuGRUB_SIZE,
+		    after.total - after.free, before.total - before.free);
+#endif
+}
+
+GRUB_FUNCTIONAL_TEST (mm_test, mm_test);
@@ -152,6 +152,21 @@ struct grub_disk
 
   /* Device-specific data.  */
   void *data;
+
+  /* Set to turn off sequential readahead for random-access users.  */
+  int readahead_disabled;
+
+  /* Byte position where the current sequential stream continues.  */
+  grub_uint64_t ra_next;
+
+  /* Readahead window in units of GRUB_DISK_CACHE_SIZE.  */
+  unsigned int ra_window;
+
+  /* End of the region already prefetched into the cache.  */
+  grub_disk_addr_t ra_end;
+
+  /* Buffer for readahead, allocated on first use.  */
+  char *ra_buf;
 };
 typedef struct grub_disk *grub_disk_t;
 
@@ -168,8 +183,11 @@ typedef struct grub_disk_memberlist *grub_disk_memberlist_t;
 #define GRUB_DISK_SECTOR_SIZE	0x200
 #define GRUB_DISK_SECTOR_BITS	9
 
-/* The maximum number of disk caches.  */
-#define GRUB_DISK_CACHE_NUM	1021
+/* The default total size of the disk cache in bytes.  */
+#define GRUB_DISK_CACHE_DEFAULT_SIZE	(32 << 20)
+
+/* The number of cache blocks in each set of the disk cache.  */
+#define GRUB_DISK_CACHE_WAYS	8
 
 /* The size of a disk cache in 512B units. Must be at least as big as the
    largest supported sector size, currently 16K.  */
@@ -188,9 +206,24 @@ grub_disk_from_native_sector (grub_disk_t disk, grub_disk_addr_t sector)
   return sector << (disk->log_sector_size - GRUB_DISK_SECTOR_BITS);
 }
 
+/* Readahead window limits, in units of GRUB_DISK_CACHE_SIZE. The
+   window is further limited by max_agglomerate of the disk.  */
+#define GRUB_DISK_READAHEAD_MIN	2
+#define GRUB_DISK_READAHEAD_MAX	64
+
+static inline void
+grub_disk_set_readahead (grub_disk_t disk, int enable)
+{
+  disk->readahead_disabled = ! enable;
+  disk->ra_window = 0;
+}
+
 /* This is called from the memory manager.  */
 void grub_disk_cache_invalidate_all (void);
 
+/* Register the disk_cache_size variable.  */
+void grub_disk_cache_init (void);
+
 void EXPORT_FUNC(grub_disk_dev_register) (grub_disk_dev_t dev);
 void EXPORT_FUNC(grub_disk_dev_unregister) (grub_disk_dev_t dev);
 static inline int
@@ -233,10 +266,28 @@ extern grub_err_t (*EXPORT_VAR(grub_disk_write_weak)) (grub_disk_t disk,
 
 grub_uint64_t EXPORT_FUNC(grub_disk_get_size) (grub_disk_t disk);
 
-#if DISK_CACHE_STATS
+/* Disk cache statistics.  */
+struct grub_disk_cache_stats
+{
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+  /* Blocks prefetched by sequential readahead.  */
+  unsigned long readahead;
+  /* Configured total size in bytes.  */
+  grub_size_t size;
+  unsigned sets;
+  unsigned ways;
+};
+
 void
-EXPORT_FUNC(grub_disk_cache_get_performance) (unsigned long *hits, unsigned long *misses);
-#endif
+EXPORT_FUNC(grub_disk_cache_get_performance) (struct grub_disk_cache_stats *stats);
+grub_err_t EXPORT_FUNC(grub_disk_cache_set_size) (grub_size_t size);
+void EXPORT_FUNC(grub_disk_cache_invalidate) (unsigned long dev_id,
+					      unsigned long disk_id,
+					      grub_disk_addr_t sector);
+
+extern grub_uint32_t EXPORT_VAR(grub_disk_cache_generation);
 
 extern void (* EXPORT_VAR(grub_disk_firmware_fini)) (void);
 extern int EXPORT_VAR(grub_disk_firmware_is_tainted);
@@ -253,17 +304,26 @@ grub_stop_disk_firmware (void)
     }
 }
 
-/* Disk cache.  */
+/* Disk cache block.  */
 struct grub_disk_cache
 {
   enum grub_disk_dev_id dev_id;
   unsigned long disk_id;
   grub_disk_addr_t sector;
+  /* Slot in the slab of the owning set, NULL if the slab isn't allocated.  */
   char *data;
+  int valid;
   int lock;
+  /* Last access time, used for LRU replacement.  */
+  grub_uint32_t stamp;
 };
 
-extern struct grub_disk_cache EXPORT_VAR(grub_disk_cache_table)[GRUB_DISK_CACHE_NUM];
+/* Disk cache set. All blocks of a set share one slab buffer.  */
+struct grub_disk_cache_set
+{
+  struct grub_disk_cache ways[GRUB_DISK_CACHE_WAYS];
+  char *slab;
+};
 
 #if defined (GRUB_UTIL)
 void grub_lvm_init (void);
@@ -62,6 +62,8 @@ struct block_io_protocol
 };
 typedef struct block_io_protocol block_io_protocol_t;
 
+struct grub_efivdisk_cache;
+
 typedef struct
 {
   /* efi data */
@@ -73,6 +75,7 @@ typedef struct
   grub_efi_block_io_media_t media;
   /* grub data */
   grub_file_t file;
+  struct grub_efivdisk_cache *cache;
 } grub_efivdisk_t;
 
 enum grub_efivdisk_type
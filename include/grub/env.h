@@ -54,6 +54,12 @@ grub_err_t EXPORT_FUNC(grub_register_variable_hook) (const char *name,
 						     grub_env_read_hook_t read_hook,
 						     grub_env_write_hook_t write_hook);
 
+grub_err_t EXPORT_FUNC(grub_env_parse_number) (const char *val,
+					      unsigned long max,
+					      unsigned long *value);
+grub_err_t EXPORT_FUNC(grub_env_parse_size) (const char *val,
+					    grub_size_t *size);
+
 grub_err_t grub_env_context_open (void);
 grub_err_t grub_env_context_close (void);
 grub_err_t EXPORT_FUNC(grub_env_export) (const char *name);
@@ -21,14 +21,20 @@
 
 #include <grub/env.h>
 
-/* The size of the hash table.  */
-#define	HASHSZ	13
+/* The initial size of the hash table, a power of two.  The table doubles
+   whenever it holds more variables than buckets.  */
+#define	HASHSZ	16
 
 /* A hashtable for quick lookup of variables.  */
 struct grub_env_context
 {
-  /* A hash table for variables.  */
-  struct grub_env_var *vars[HASHSZ];
+  /* A hash table for variables with HASHSZ buckets, holding COUNT
+     variables.  It is NULL until the first variable is added, then
+     points to INITIAL_VARS until the table has to grow.  */
+  struct grub_env_var **vars;
+  unsigned hashsz;
+  unsigned count;
+  struct grub_env_var *initial_vars[HASHSZ];
 
   /* One level deeper on the stack.  */
   struct grub_env_context *prev;
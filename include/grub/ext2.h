@@ -112,9 +112,25 @@
 #define EXT3_JOURNAL_FLAG_DELETED	4
 #define EXT3_JOURNAL_FLAG_LAST_TAG	8
 
+#define EXT2_INDEX_FLAG		0x1000
 #define EXT4_ENCRYPT_FLAG              0x800
 #define EXT4_EXTENTS_FLAG		0x80000
 
+/* Superblock flags.  */
+#define EXT2_FLAGS_SIGNED_HASH		0x0001
+#define EXT2_FLAGS_UNSIGNED_HASH	0x0002
+
+/* Directory index hash versions.  */
+#define EXT2_DX_HASH_LEGACY		0
+#define EXT2_DX_HASH_HALF_MD4		1
+#define EXT2_DX_HASH_TEA		2
+#define EXT2_DX_HASH_LEGACY_UNSIGNED	3
+#define EXT2_DX_HASH_HALF_MD4_UNSIGNED	4
+#define EXT2_DX_HASH_TEA_UNSIGNED	5
+
+/* Maximum depth of a directory index tree (with large_dir).  */
+#define EXT2_DX_MAX_LEVELS		3
+
 /* The ext2 superblock.  */
 struct grub_ext2_sblock
 {
@@ -168,6 +184,12 @@ struct grub_ext2_sblock
   grub_uint32_t first_meta_bg;
   grub_uint32_t mkfs_time;
   grub_uint32_t jnl_blocks[17];
+  grub_uint32_t total_blocks_high;
+  grub_uint32_t reserved_blocks_high;
+  grub_uint32_t free_blocks_high;
+  grub_uint16_t min_extra_inode_size;
+  grub_uint16_t want_extra_inode_size;
+  grub_uint32_t flags;
 };
 
 /* The ext2 blockgroup.  */
@@ -233,6 +255,31 @@ struct ext2_dirent
   grub_uint8_t filetype;
 };
 
+/* The information following the "." and ".." entries in the first
+   block of an indexed directory.  */
+struct grub_ext2_dx_root_info
+{
+  grub_uint32_t reserved_zero;
+  grub_uint8_t hash_version;
+  grub_uint8_t info_length;
+  grub_uint8_t indirect_levels;
+  grub_uint8_t unused_flags;
+};
+
+/* An index entry.  The first entry of a node holds the limit and count
+   of the node in place of the hash.  */
+struct grub_ext2_dx_entry
+{
+  grub_uint32_t hash;
+  grub_uint32_t block;
+};
+
+struct grub_ext2_dx_countlimit
+{
+  grub_uint16_t limit;
+  grub_uint16_t count;
+};
+
 struct grub_ext3_journal_header
 {
   grub_uint32_t magic;
@@ -132,7 +132,9 @@ enum grub_file_type
 
     /* --skip-sig is specified.  */
     GRUB_FILE_TYPE_SKIP_SIGNATURE = 0x10000,
-    GRUB_FILE_TYPE_NO_DECOMPRESS = 0x20000
+    GRUB_FILE_TYPE_NO_DECOMPRESS = 0x20000,
+    /* File is accessed randomly, don't prefetch.  */
+    GRUB_FILE_TYPE_NO_READAHEAD = 0x40000
   };
 
 /* File description.  */
@@ -172,6 +174,10 @@ struct grub_file
   void *read_hook_data;
 
   int blocklist;
+
+  /* Number of extents in a block list and the extent last accessed.  */
+  grub_size_t blocklist_num;
+  grub_size_t blocklist_cur;
 };
 typedef struct grub_file *grub_file_t;
 
@@ -107,6 +107,9 @@ struct grub_fs_block
 {
   grub_disk_addr_t offset;
   grub_off_t length;
+  /* Offset of this extent in the file. Block lists are terminated by an
+     entry with zero length whose file_offset is the file size.  */
+  grub_off_t file_offset;
 };
 
 /* This hook is used to automatically load filesystem modules.
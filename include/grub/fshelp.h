@@ -73,6 +73,43 @@ EXPORT_FUNC(grub_fshelp_find_file_lookup) (const char *path,
 					   char *(*read_symlink) (grub_fshelp_node_t node),
 					   enum grub_fshelp_filetype expect);
 
+/* Description of the nodes of a filesystem for the lookup cache.  Nodes
+   are cached by value, so they must not own other allocations.  NODE_KEY
+   identifies a directory across mounts of the same disk, and BIND_NODE
+   attaches a node copied from the cache to the mount that DIR belongs
+   to.  */
+struct grub_fshelp_cache_desc
+{
+  grub_size_t node_size;
+  grub_uint64_t (*node_key) (grub_fshelp_node_t node);
+  void (*bind_node) (grub_fshelp_node_t node, grub_fshelp_node_t dir);
+};
+
+/* Like grub_fshelp_find_file or, if ITERATE_DIR is NULL,
+   grub_fshelp_find_file_lookup, but remember the results of directory
+   lookups on DISK, including misses.  The cache follows the disk cache:
+   it is dropped on writes and once devices have been closed for a
+   while.  */
+grub_err_t
+EXPORT_FUNC(grub_fshelp_find_file_cached) (const char *path,
+					   grub_fshelp_node_t rootnode,
+					   grub_fshelp_node_t *foundnode,
+					   int (*iterate_dir) (grub_fshelp_node_t dir,
+							       grub_fshelp_iterate_dir_hook_t hook,
+							       void *hook_data),
+					   grub_err_t (*lookup_file) (grub_fshelp_node_t dir,
+								      const char *name,
+								      grub_fshelp_node_t *foundnode,
+								      enum grub_fshelp_filetype *foundtype),
+					   char *(*read_symlink) (grub_fshelp_node_t node),
+					   enum grub_fshelp_filetype expect,
+					   grub_disk_t disk,
+					   const struct grub_fshelp_cache_desc *cache);
+
+/* Forget everything cached for CACHE, e.g. when its module goes away.  */
+void
+EXPORT_FUNC(grub_fshelp_cache_forget) (const struct grub_fshelp_cache_desc *cache);
+
 /* Read LEN bytes from the file NODE on disk DISK into the buffer BUF,
    beginning with the block POS.  READ_HOOK should be set before
    reading a block from the file.  GET_BLOCK is used to translate file
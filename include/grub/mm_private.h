@@ -24,6 +24,7 @@
 /* Magic words.  */
 #define GRUB_MM_FREE_MAGIC	0x2d3c2808
 #define GRUB_MM_ALLOC_MAGIC	0x6db08fa4
+#define GRUB_MM_BIN_MAGIC	0x4b1e5e0d
 
 typedef struct grub_mm_header
 {
@@ -57,8 +58,34 @@ typedef struct grub_mm_region
 }
 *grub_mm_region_t;
 
+/* Freed blocks of up to GRUB_MM_BINS cells, header included, are kept
+   on per-size lists instead of being merged back into their region, as
+   long as the lists hold less than GRUB_MM_BIN_LIMIT bytes.  */
+#define GRUB_MM_BINS		32
+#define GRUB_MM_BIN_LIMIT	0x40000
+
+/* Allocations of at least this many cells, like those aligned to more
+   than GRUB_MM_ALIGN, are carved from the top of the heap.  */
+#define GRUB_MM_LARGE		(0x8000 >> GRUB_MM_ALIGN_LOG2)
+
+struct grub_mm_stats
+{
+  grub_size_t total;
+  grub_size_t free;
+  grub_size_t binned;
+  unsigned long allocs;
+  unsigned long frees;
+  unsigned long bin_hits;
+  unsigned long large_allocs;
+  unsigned long failures;
+  unsigned bin_count[GRUB_MM_BINS + 1];
+};
+
 #ifndef GRUB_MACHINE_EMU
 extern grub_mm_region_t EXPORT_VAR (grub_mm_base);
+
+void EXPORT_FUNC(grub_mm_get_stats) (struct grub_mm_stats *stats);
+void EXPORT_FUNC(grub_mm_flush_bins) (void);
 #endif
 
 #endif
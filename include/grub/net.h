@@ -114,6 +114,16 @@ struct grub_net_slaac_mac_list
 
 struct grub_net_link_layer_entry;
 
+struct grub_net_card_stats
+{
+  grub_uint64_t rx_packets;
+  grub_uint64_t rx_bytes;
+  /* Frames the stack failed to handle.  */
+  grub_uint64_t rx_errors;
+  /* Frames lost for lack of a receive buffer.  */
+  grub_uint64_t rx_nobuf;
+};
+
 struct grub_net_card
 {
   struct grub_net_card *next;
@@ -135,6 +145,9 @@ struct grub_net_card
   grub_size_t rcvbufsize;
   grub_size_t txbufsize;
   int txbusy;
+  /* Receive buffers, see grub_net_card_alloc_rx.  */
+  struct grub_net_buff_pool *rx_pool;
+  struct grub_net_card_stats stats;
   union
   {
 #ifdef GRUB_MACHINE_EFI
@@ -267,6 +280,9 @@ struct grub_net_app_protocol
   grub_err_t (*seek) (struct grub_file *file, grub_off_t off);
   grub_err_t (*close) (struct grub_file *file);
   grub_err_t (*packets_pulled) (struct grub_file *file);
+  /* Read directly instead of from the packet list, on files for which
+     the protocol set direct_read.  */
+  grub_ssize_t (*read) (struct grub_file *file, char *buf, grub_size_t len);
 };
 
 typedef struct grub_net
@@ -280,6 +296,7 @@ typedef struct grub_net
   grub_fs_t fs;
   int eof;
   int stall;
+  int direct_read;
 } *grub_net_t;
 
 extern grub_net_t (*EXPORT_VAR (grub_net_open)) (const char *name);
@@ -385,6 +402,9 @@ grub_net_card_register (struct grub_net_card *card)
 void
 grub_net_card_unregister (struct grub_net_card *card);
 
+struct grub_net_buff *
+grub_net_card_alloc_rx (struct grub_net_card *card, grub_size_t len);
+
 #define FOR_NET_CARDS(var) for (var = grub_net_cards; var; var = var->next)
 #define FOR_NET_CARDS_SAFE(var, next) for (var = grub_net_cards, next = (var ? var->next : 0); var; var = next, next = (var ? var->next : 0))
 
@@ -624,6 +644,9 @@ void grub_bootp_fini (void);
 void grub_dns_init (void);
 void grub_dns_fini (void);
 
+void grub_net_tcp_init (void);
+void grub_net_tcp_fini (void);
+
 static inline void
 grub_net_network_level_interface_unregister (struct grub_net_network_level_interface *inter)
 {
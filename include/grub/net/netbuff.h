@@ -16,6 +16,26 @@ struct grub_net_buff
   grub_uint8_t *tail;
   /* Pointer to the end of the buffer.  */
   grub_uint8_t *end;
+  /* Pool the buffer goes back to when freed, if any.  */
+  struct grub_net_buff_pool *pool;
+  struct grub_net_buff *pool_next;
+};
+
+/* Buffers of one size kept for reuse rather than freed.  */
+struct grub_net_buff_pool
+{
+  struct grub_net_buff *free;
+  /* Usable length of each buffer.  */
+  grub_size_t len;
+  /* Buffers belonging to the pool, free or in use, and the most it
+     keeps.  */
+  unsigned count;
+  unsigned max;
+  /* Set once destroyed; buffers still in use are freed as they come
+     back.  */
+  int dead;
+  grub_uint64_t reused;
+  grub_uint64_t allocated;
 };
 
 grub_err_t grub_netbuff_put (struct grub_net_buff *net_buff, grub_size_t len);
@@ -27,5 +47,11 @@ grub_err_t grub_netbuff_clear (struct grub_net_buff *net_buff);
 struct grub_net_buff * grub_netbuff_alloc (grub_size_t len);
 struct grub_net_buff * grub_netbuff_make_pkt (grub_size_t len);
 void grub_netbuff_free (struct grub_net_buff *net_buff);
+struct grub_net_buff_pool *grub_netbuff_pool_new (grub_size_t len,
+						  unsigned prealloc,
+						  unsigned max);
+struct grub_net_buff *
+grub_netbuff_pool_alloc (struct grub_net_buff_pool *pool);
+void grub_netbuff_pool_destroy (struct grub_net_buff_pool *pool);
 
 #endif
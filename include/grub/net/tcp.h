@@ -82,4 +82,20 @@ grub_net_tcp_stall (grub_net_tcp_socket_t sock);
 void
 grub_net_tcp_unstall (grub_net_tcp_socket_t sock);
 
+grub_size_t
+grub_net_tcp_buffer_size (void);
+
+/* Tell TCP how many received bytes the application still holds, so that
+   they count against the receive window.  */
+void
+grub_net_tcp_set_unread (grub_net_tcp_socket_t sock, grub_size_t unread);
+
+/* Acknowledgements for data received between these calls are sent once,
+   at the end.  */
+void
+grub_net_tcp_batch_begin (void);
+
+void
+grub_net_tcp_batch_end (void);
+
 #endif
@@ -127,6 +127,17 @@ struct grub_ntfs_bpb
   grub_uint32_t checksum;
 } GRUB_PACKED;
 
+/* Maximum number of decoded runs kept per attribute.  */
+#define GRUB_NTFS_MAX_RUNS		16384
+
+/* A decoded data run: clusters from VCN up to the next run's VCN start at
+   LCN, or are sparse if LCN is 0.  */
+struct grub_ntfs_run
+{
+  grub_disk_addr_t vcn;
+  grub_disk_addr_t lcn;
+};
+
 struct grub_ntfs_attr
 {
   int flags;
@@ -135,6 +146,12 @@ struct grub_ntfs_attr
   grub_uint32_t save_pos;
   grub_uint8_t *sbuf;
   struct grub_ntfs_file *mft;
+  /* Run list of the attribute of type RUNS_TYPE, decoded on first read.
+     RUNS is NULL if that attribute can't be mapped.  */
+  grub_uint8_t runs_type;
+  grub_size_t num_runs;
+  grub_disk_addr_t runs_end;
+  struct grub_ntfs_run *runs;
 };
 
 struct grub_ntfs_file
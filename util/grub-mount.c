@@ -40,6 +40,8 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <pthread.h>
 
 #pragma GCC diagnostic ignored "-Wmissing-prototypes"
 #pragma GCC diagnostic ignored "-Wmissing-declarations"
@@ -58,6 +60,16 @@ static char **fuse_args = NULL;
 static int fuse_argc = 0;
 static int num_disks = 0;
 static int mount_crypt = 0;
+static int multithreaded = 0;
+
+/* GRUB itself is not reentrant: the disk cache, the filesystem drivers
+   and grub_errno are all global.  Every call into GRUB is made with this
+   lock held.  */
+static pthread_mutex_t grub_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Host image that file extents are read from directly, or -1 if the
+   mounted device is not a plain loopback image.  */
+static int image_fd = -1;
 
 static grub_err_t
 execute_command (const char *name, int n, char **args)
@@ -147,7 +159,7 @@ fuse_getattr_find_file (const char *cur_filename,
 }
 
 static int
-fuse_getattr (const char *path, struct stat *st)
+fuse_getattr_unlocked (const char *path, struct stat *st)
 {
   struct fuse_getattr_ctx ctx;
   char *pathname, *path2;
@@ -230,27 +242,223 @@ fuse_getattr (const char *path, struct stat *st)
   return 0;
 }
 
+static int
+fuse_getattr (const char *path, struct stat *st)
+{
+  int ret;
+
+  pthread_mutex_lock (&grub_lock);
+  ret = fuse_getattr_unlocked (path, st);
+  pthread_mutex_unlock (&grub_lock);
+  return ret;
+}
+
 static int
 fuse_opendir (const char *path, struct fuse_file_info *fi) 
 {
   return 0;
 }
 
-/* FIXME */
-static grub_file_t files[65536];
-static int first_fd = 1;
+/* A range of a file whose contents are stored verbatim in the image.  */
+struct fuse_file_extent
+{
+  grub_off_t file_offset;
+  grub_off_t image_offset;
+  grub_size_t length;
+};
+
+struct fuse_file
+{
+  grub_file_t file;
+  /* Protects the extent map, which is read without GRUB_LOCK.  */
+  pthread_mutex_t lock;
+  struct fuse_file_extent *extents;
+  grub_size_t num_extents;
+  grub_size_t alloc_extents;
+};
+
+/* Context for fuse_read_hook.  */
+struct fuse_read_hook_ctx
+{
+  struct fuse_file_extent *extents;
+  grub_size_t num_extents;
+  grub_size_t alloc_extents;
+  grub_off_t file_offset;
+};
+
+/* Helper for fuse_read: record where each piece of the file came from.  */
+static void
+fuse_read_hook (grub_disk_addr_t sector, unsigned offset, unsigned length,
+		void *data)
+{
+  struct fuse_read_hook_ctx *ctx = data;
+  struct fuse_file_extent *last;
+  grub_off_t image_offset;
+
+  image_offset = (sector << GRUB_DISK_SECTOR_BITS) + offset;
+  last = ctx->num_extents ? &ctx->extents[ctx->num_extents - 1] : NULL;
+  if (last && last->image_offset + last->length == image_offset)
+    last->length += length;
+  else
+    {
+      if (ctx->num_extents == ctx->alloc_extents)
+	{
+	  ctx->alloc_extents = ctx->alloc_extents * 2 + 8;
+	  ctx->extents = xrealloc (ctx->extents, ctx->alloc_extents
+				   * sizeof (ctx->extents[0]));
+	}
+      last = &ctx->extents[ctx->num_extents++];
+      last->file_offset = ctx->file_offset;
+      last->image_offset = image_offset;
+      last->length = length;
+    }
+  ctx->file_offset += length;
+}
+
+/* Find the extent covering OFF, or the first one after it.  Called with
+   FH->lock held.  */
+static grub_size_t
+fuse_find_extent (struct fuse_file *fh, grub_off_t off)
+{
+  grub_size_t lo = 0, hi = fh->num_extents, mid;
+
+  while (lo < hi)
+    {
+      mid = (lo + hi) / 2;
+      if (fh->extents[mid].file_offset + fh->extents[mid].length <= off)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+static void
+fuse_add_extent (struct fuse_file *fh, const struct fuse_file_extent *ext)
+{
+  struct fuse_file_extent *e;
+  grub_size_t i;
+
+  pthread_mutex_lock (&fh->lock);
+  i = fuse_find_extent (fh, ext->file_offset);
+  /* Ranges that are already mapped are left alone.  */
+  if (i < fh->num_extents
+      && fh->extents[i].file_offset < ext->file_offset + ext->length)
+    {
+      pthread_mutex_unlock (&fh->lock);
+      return;
+    }
+  /* Extend the previous extent if both sides are contiguous.  */
+  if (i > 0)
+    {
+      e = &fh->extents[i - 1];
+      if (e->file_offset + e->length == ext->file_offset
+	  && e->image_offset + e->length == ext->image_offset)
+	{
+	  e->length += ext->length;
+	  pthread_mutex_unlock (&fh->lock);
+	  return;
+	}
+    }
+  if (fh->num_extents == fh->alloc_extents)
+    {
+      fh->alloc_extents = fh->alloc_extents * 2 + 8;
+      fh->extents = xrealloc (fh->extents, fh->alloc_extents
+			      * sizeof (fh->extents[0]));
+    }
+  memmove (&fh->extents[i + 1], &fh->extents[i],
+	   (fh->num_extents - i) * sizeof (fh->extents[0]));
+  fh->extents[i] = *ext;
+  fh->num_extents++;
+  pthread_mutex_unlock (&fh->lock);
+}
+
+/* Serve a read entirely from known extents, without entering GRUB.
+   Return the number of bytes read, or -1 if some part is not mapped.  */
+static grub_ssize_t
+fuse_read_extents (struct fuse_file *fh, char *buf, grub_size_t sz,
+		   grub_off_t off)
+{
+  struct fuse_file_extent ext;
+  grub_size_t done = 0, len, i;
+  ssize_t actual;
+
+  while (done < sz)
+    {
+      pthread_mutex_lock (&fh->lock);
+      i = fuse_find_extent (fh, off + done);
+      if (i == fh->num_extents || fh->extents[i].file_offset > off + done)
+	{
+	  pthread_mutex_unlock (&fh->lock);
+	  return -1;
+	}
+      ext = fh->extents[i];
+      pthread_mutex_unlock (&fh->lock);
+
+      len = ext.file_offset + ext.length - (off + done);
+      if (len > sz - done)
+	len = sz - done;
+      actual = pread (image_fd, buf + done, len,
+		      ext.image_offset + (off + done - ext.file_offset));
+      if (actual != (ssize_t) len)
+	return -1;
+      done += len;
+    }
+  return done;
+}
+
+/* Remember the extents seen while reading BUF, after checking that the
+   image really holds those bytes there (compressed or encrypted data
+   also shows up in the hook, but does not match).  */
+static void
+fuse_learn_extents (struct fuse_file *fh, struct fuse_read_hook_ctx *ctx,
+		    const char *buf, grub_off_t off, grub_size_t size)
+{
+  char *tmp;
+  grub_size_t i;
+
+  if (ctx->file_offset != off + size)
+    return;
+  tmp = xmalloc (size);
+  for (i = 0; i < ctx->num_extents; i++)
+    {
+      struct fuse_file_extent *e = &ctx->extents[i];
+      if (pread (image_fd, tmp, e->length, e->image_offset)
+	  != (ssize_t) e->length
+	  || memcmp (tmp, buf + (e->file_offset - off), e->length) != 0)
+	break;
+    }
+  if (i == ctx->num_extents)
+    for (i = 0; i < ctx->num_extents; i++)
+      fuse_add_extent (fh, &ctx->extents[i]);
+  free (tmp);
+}
 
 static int 
 fuse_open (const char *path, struct fuse_file_info *fi __attribute__ ((unused)))
 {
+  struct fuse_file *fh;
   grub_file_t file;
-  file = grub_file_open (path, GRUB_FILE_TYPE_MOUNT);
+  int ret;
+
+  pthread_mutex_lock (&grub_lock);
+  /* The kernel already reads ahead on FUSE files.  */
+  file = grub_file_open (path, GRUB_FILE_TYPE_MOUNT
+			 | GRUB_FILE_TYPE_NO_READAHEAD);
   if (! file)
-    return translate_error ();
-  files[first_fd++] = file;
-  fi->fh = first_fd;
-  files[first_fd++] = file;
+    {
+      ret = translate_error ();
+      pthread_mutex_unlock (&grub_lock);
+      return ret;
+    }
   grub_errno = GRUB_ERR_NONE;
+  pthread_mutex_unlock (&grub_lock);
+
+  fh = xmalloc (sizeof (*fh));
+  memset (fh, 0, sizeof (*fh));
+  fh->file = file;
+  pthread_mutex_init (&fh->lock, NULL);
+  fi->fh = (uintptr_t) fh;
   return 0;
 } 
 
@@ -258,30 +466,69 @@ static int
 fuse_read (const char *path, char *buf, size_t sz, off_t off,
 	   struct fuse_file_info *fi)
 {
-  grub_file_t file = files[fi->fh];
+  struct fuse_file *fh = (struct fuse_file *) (uintptr_t) fi->fh;
+  grub_file_t file = fh->file;
+  struct fuse_read_hook_ctx ctx;
   grub_ssize_t size;
+  int ret;
 
   if (off > file->size)
     return -EINVAL;
 
+  if (sz > file->size - off)
+    sz = file->size - off;
+  if (sz == 0)
+    return 0;
+
+  if (image_fd >= 0)
+    {
+      size = fuse_read_extents (fh, buf, sz, off);
+      if (size >= 0)
+	return size;
+    }
+
+  memset (&ctx, 0, sizeof (ctx));
+  ctx.file_offset = off;
+
+  pthread_mutex_lock (&grub_lock);
   file->offset = off;
-  
+  if (image_fd >= 0)
+    {
+      file->read_hook = fuse_read_hook;
+      file->read_hook_data = &ctx;
+    }
   size = grub_file_read (file, buf, sz);
+  file->read_hook = NULL;
+  file->read_hook_data = NULL;
   if (size < 0)
-    return translate_error ();
-  else
     {
-      grub_errno = GRUB_ERR_NONE;
-      return size;
+      ret = translate_error ();
+      pthread_mutex_unlock (&grub_lock);
+      free (ctx.extents);
+      return ret;
     }
+  grub_errno = GRUB_ERR_NONE;
+  pthread_mutex_unlock (&grub_lock);
+
+  if (image_fd >= 0 && size > 0)
+    fuse_learn_extents (fh, &ctx, buf, off, size);
+  free (ctx.extents);
+  return size;
 } 
 
 static int 
 fuse_release (const char *path, struct fuse_file_info *fi)
 {
-  grub_file_close (files[fi->fh]);
-  files[fi->fh] = NULL;
+  struct fuse_file *fh = (struct fuse_file *) (uintptr_t) fi->fh;
+
+  pthread_mutex_lock (&grub_lock);
+  grub_file_close (fh->file);
   grub_errno = GRUB_ERR_NONE;
+  pthread_mutex_unlock (&grub_lock);
+
+  pthread_mutex_destroy (&fh->lock);
+  free (fh->extents);
+  free (fh);
   return 0;
 }
 
@@ -352,9 +599,11 @@ fuse_readdir (const char *path, void *buf,
 	 && pathname[grub_strlen (pathname) - 1] == '/')
     pathname[grub_strlen (pathname) - 1] = 0;
 
+  pthread_mutex_lock (&grub_lock);
   (fs->fs_dir) (dev, pathname, fuse_readdir_call_fill, &ctx);
-  free (pathname);
   grub_errno = GRUB_ERR_NONE;
+  pthread_mutex_unlock (&grub_lock);
+  free (pathname);
   return 0;
 }
 
@@ -424,9 +673,21 @@ fuse_init (void)
       return grub_errno;
     }
 
+  /* Sectors reported while reading files from a single unencrypted image
+     are offsets into that image, so they can be read back directly.  */
+  if (multithreaded && num_disks == 1 && !mount_crypt && dev->disk
+      && dev->disk->dev->id == GRUB_DISK_DEVICE_LOOPBACK_ID)
+    image_fd = open (images[0], O_RDONLY);
+
   if (fuse_main (fuse_argc, fuse_args, &grub_opers, NULL))
     grub_error (GRUB_ERR_IO, "fuse_main failed");
 
+  if (image_fd >= 0)
+    {
+      close (image_fd);
+      image_fd = -1;
+    }
+
   for (i = 0; i < num_disks; i++)
     {
       char *argv[2];
@@ -456,6 +717,7 @@ static struct argp_option options[] = {
    /* TRANSLATORS: "prompt" is a keyword.  */
    N_("FILE|prompt"), 0, N_("Load zfs crypto key."),                 2},
   {"verbose",   'v', NULL, 0, N_("print verbose messages."), 2},
+  {"threads",   'T', NULL, 0, N_("Serve requests from multiple threads."), 2},
   {0, 0, 0, 0, 0, 0}
 };
 
@@ -526,6 +788,10 @@ argp_parser (int key, char *arg, struct argp_state *state)
       verbosity++;
       return 0;
 
+    case 'T':
+      multithreaded = 1;
+      return 0;
+
     case ARGP_KEY_ARG:
       if (arg[0] != '-')
 	break;
@@ -562,18 +828,21 @@ main (int argc, char *argv[])
 
   grub_util_host_init (&argc, &argv);
 
-  fuse_args = xrealloc (fuse_args, (fuse_argc + 2) * sizeof (fuse_args[0]));
+  fuse_args = xrealloc (fuse_args, (fuse_argc + 1) * sizeof (fuse_args[0]));
   fuse_args[fuse_argc] = xstrdup (argv[0]);
   fuse_argc++;
-  /* Run single-threaded.  */
-  fuse_args[fuse_argc] = xstrdup ("-s");
-  fuse_argc++;
 
   argp_parse (&argp, argc, argv, 0, 0, 0);
   
   if (num_disks < 2)
     grub_util_error ("%s", _("need an image and mountpoint"));
-  fuse_args = xrealloc (fuse_args, (fuse_argc + 2) * sizeof (fuse_args[0]));
+  fuse_args = xrealloc (fuse_args, (fuse_argc + 3) * sizeof (fuse_args[0]));
+  /* Run single-threaded unless asked otherwise.  */
+  if (!multithreaded)
+    {
+      fuse_args[fuse_argc] = xstrdup ("-s");
+      fuse_argc++;
+    }
   fuse_args[fuse_argc] = images[num_disks - 1];
   fuse_argc++;
   num_disks--;